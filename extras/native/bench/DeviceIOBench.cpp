@@ -0,0 +1,1825 @@
+// DeviceIOBench.cpp
+// Host microbenchmarks for the DeviceIO check-in path
+//
+// Every case prints one line with real CPU time per operation,
+// heap allocations per operation, application bytes on the wire
+// per operation, TLS handshakes per operation and the virtual
+// time per operation that delay() and the network model charged.
+// The output is stable enough to diff between library builds.
+//
+// usage: deviceio_bench [filter]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Arduino.h>
+#include <DeviceIO.h>
+#include "DeviceIONative.h"
+#include "DeviceIOStandIn.h"
+
+// friend of DeviceIO, see DeviceIO.h
+class DeviceIONativeBench
+{
+public:
+	// drain the upload encoder through a fixed buffer, returns the body length
+	static size_t encodeSensorPayload(DeviceIO &device)
+	{
+		DeviceIOSampleEncoder<DeviceIO::SampleBuffer> encoder(device._DeviceIO_sensorsamples, device._DeviceIO_sensorsamples.size());
+		char buf[256];
+		size_t total = 0, n;
+		while ((n = encoder.readBytes(buf, sizeof(buf))) > 0) total += n;
+		return total;
+	}
+	// same for the binary encoder, the body is kept in out
+	static size_t encodeBinaryPayload(DeviceIO &device, std::string *out = nullptr)
+	{
+		DeviceIOBinaryEncoder<DeviceIO::SampleBuffer> encoder(device._DeviceIO_sensorsamples, device._DeviceIO_sensorsamples.size(),
+															  device._DeviceIO_sensorpolicies);
+		char buf[256];
+		size_t total = 0, n;
+		while ((n = encoder.readBytes(buf, sizeof(buf))) > 0)
+		{
+			if (out) out->append(buf, n);
+			total += n;
+		}
+		return total;
+	}
+	static long 	getRemoteVersionNumber(DeviceIO &device) { return device.getRemoteVersionNumber(); }
+	static DeviceIOSpool &spool(DeviceIO &device) { return device._DeviceIO_spool; }
+	static DeviceIOFirmware &firmware(DeviceIO &device) { return device._DeviceIO_firmware; }
+	static DeviceIOAggregator &aggregator(DeviceIO &device) { return device._DeviceIO_aggregator; }
+	static DeviceIOScheduler &scheduler(DeviceIO &device) { return device._DeviceIO_scheduler; }
+	static size_t 	bufferedSamples(DeviceIO &device) { return device._DeviceIO_sensorsamples.size(); }
+	static uint32_t logDropped(DeviceIO &device) { return device._DeviceIO_log.dropped(); }
+	static DeviceIODirectives &directives(DeviceIO &device) { return device._DeviceIO_directives; }
+	static long 	checkInInterval(DeviceIO &device) { return device.checkInInterval(); }
+	static DeviceIOCheckInSchedule &schedule(DeviceIO &device) { return device._DeviceIO_schedule; }
+	static DeviceIOPush &push(DeviceIO &device) { return device._DeviceIO_push; }
+};
+
+struct BenchResult
+{
+	double 			nsPerOp;
+	double 			allocsPerOp;
+	double 			wireBytesPerOp;
+	double 			handshakesPerOp;
+	double 			resumedPerOp;
+	double 			virtualMsPerOp;
+	long 			peakHeapBytes;		// peak live heap above the starting point
+};
+
+static BenchResult runBench(unsigned long iterations, std::function<void(unsigned long)> op)
+{
+	DeviceIONative::HeapCounters heapBefore = DeviceIONative::heap();
+	DeviceIONative::NetCounters netBefore = DeviceIONative::net();
+	unsigned long long blockedBefore = DeviceIONative::blockedMicros();
+	DeviceIONative::resetHeapPeak();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned long i = 0; i < iterations; i++)
+		op(i);
+	std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+	const DeviceIONative::HeapCounters &heapAfter = DeviceIONative::heap();
+	const DeviceIONative::NetCounters &netAfter = DeviceIONative::net();
+
+	BenchResult r;
+	r.nsPerOp = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / (double)iterations;
+	r.allocsPerOp = (heapAfter.allocs - heapBefore.allocs) / (double)iterations;
+	r.wireBytesPerOp = ((netAfter.bytesSent - netBefore.bytesSent) + (netAfter.bytesReceived - netBefore.bytesReceived)) / (double)iterations;
+	r.handshakesPerOp = (netAfter.tlsHandshakes - netBefore.tlsHandshakes) / (double)iterations;
+	r.resumedPerOp = (netAfter.tlsResumed - netBefore.tlsResumed) / (double)iterations;
+	r.virtualMsPerOp = (DeviceIONative::blockedMicros() - blockedBefore) / 1000.0 / iterations;
+	r.peakHeapBytes = (long)(heapAfter.peakLiveBytes - heapBefore.liveBytes);
+	return r;
+}
+
+static void printHeader(void)
+{
+	printf("DeviceIO host benchmark, library build %d\n", DEVICE_IO_BUILD_NUMBER);
+	printf("%-28s %8s %12s %10s %10s %8s %8s %12s %8s\n", "case", "iters", "ns/op", "allocs/op", "wireB/op", "tls/op", "resum/op", "virt ms/op", "peakB");
+}
+
+static void printResult(const char *name, unsigned long iterations, const BenchResult &r)
+{
+	printf("%-28s %8lu %12.1f %10.2f %10.1f %8.2f %8.2f %12.2f %8ld\n", name, iterations, r.nsPerOp, r.allocsPerOp,
+		   r.wireBytesPerOp, r.handshakesPerOp, r.resumedPerOp, r.virtualMsPerOp, r.peakHeapBytes);
+}
+
+// failed checks, main() returns 1 when there are any
+static unsigned long checksFailed = 0;
+
+// the word a check prints, counting the failures
+static const char *verdict(bool passed, const char *good = "ok", const char *bad = "MISMATCH")
+{
+	if (!passed)
+		checksFailed++;
+	return passed ? good : bad;
+}
+
+static bool selected(const char *filter, const char *name)
+{
+	return filter == nullptr || strstr(name, filter) != nullptr;
+}
+
+// a provisioned device talking to the stand-in, the flash starts
+// empty unless the device is rebooting
+static void setupDevice(DeviceIO &device, DeviceIOStandIn &server, bool reboot = false, bool keepLastCheckIn = false)
+{
+	eSPIFFS fileSystem;
+	DeviceIOStore store;
+	if (!reboot)
+		SPIFFS.format();
+	store.begin(fileSystem);
+	store.setInt("provisioned", 1);
+	store.setString("token", server.token.c_str());
+	// a restarted device checks in at once, not an interval after its last check-in
+	if (!keepLastCheckIn)
+		store.remove("checkin");
+	store.commit();
+
+	device.debugSerial = 0;
+	// the cases check in when they want to, not after the start jitter
+	device.checkinJitterMS = 0;
+	device.initialize();
+	device.buildNumber = server.latestBuild;
+	device.productIDname = server.productID.c_str();
+	device.productIDpassword = server.productPassword.c_str();
+}
+
+// the OTA partition holds image and would boot it
+static bool otaImageIs(const std::vector<uint8_t> &image)
+{
+	const DeviceIONative::FlashPartition &flash = DeviceIONative::otaPartition();
+	return flash.bootable && flash.bytes.size() >= image.size() && std::equal(image.begin(), image.end(), flash.bytes.begin());
+}
+
+// code-like bytes: 3 byte instructions from a skewed vocabulary, every
+// 16th one a 4 byte pointer into the image
+static std::vector<uint8_t> makeFirmware(size_t size, uint32_t seed)
+{
+	uint32_t x = seed | 1;
+	uint8_t vocabulary[256][3];
+	for (int i = 0; i < 256; i++)
+		for (int k = 0; k < 3; k++)
+		{
+			x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+			vocabulary[i][k] = (uint8_t)x;
+		}
+
+	std::vector<uint8_t> image;
+	image.push_back(DEVICEIO_IMAGE_MAGIC);
+	for (unsigned long n = 0; image.size() < size; n++)
+	{
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		if ((n & 15) == 15)
+		{
+			uint32_t pointer = 0x400D0000 + (x % size);
+			for (int k = 0; k < 4; k++) image.push_back((uint8_t)(pointer >> (8 * k)));
+		} else
+		{
+			const uint8_t *op = vocabulary[((x & 0xFF) * ((x >> 8) & 0xFF)) >> 8];
+			image.insert(image.end(), op, op + 3);
+		}
+	}
+	image.resize(size);
+	return image;
+}
+
+// the next release: new code in the middle, some removed further on,
+// and every pointer behind the change moved
+static std::vector<uint8_t> nextRelease(const std::vector<uint8_t> &old)
+{
+	size_t insertAt = old.size() * 2 / 5, removeAt = old.size() * 7 / 10;
+	std::vector<uint8_t> added = makeFirmware(6000, 77);
+	std::vector<uint8_t> image(old.begin(), old.begin() + insertAt);
+	image.insert(image.end(), added.begin() + 1, added.end());
+	image.insert(image.end(), old.begin() + insertAt, old.begin() + removeAt);
+	image.insert(image.end(), old.begin() + removeAt + 2000, old.end());
+	for (size_t i = 0; i + 4 <= image.size(); i++)
+	{
+		if (image[i + 3] != 0x40 || image[i + 2] != 0x0D) continue;
+		uint32_t pointer = image[i] | (image[i + 1] << 8);
+		if (pointer >= insertAt)
+		{
+			pointer += added.size() - 1 - (pointer >= removeAt ? 2000 : 0);
+			image[i] = (uint8_t)pointer;
+			image[i + 1] = (uint8_t)(pointer >> 8);
+			image[i + 2] = (uint8_t)(0x0D + (pointer >> 16));
+		}
+	}
+	return image;
+}
+
+static void fillSamples(DeviceIO &device, int count)
+{
+	for (int i = 0; i < count; i++)
+		device.addSensorValue(i % 8, 20.0f + i * 0.25f);
+}
+
+static const char *phaseName(uint8_t phase)
+{
+	static const char *names[] = {"idle", "ntp", "token", "sensors", "checkin", "version", "telemetry",
+								  "ota-begin", "ota-write", "ota-end", "finish", "reboot", "replay"};
+	return phase < sizeof(names) / sizeof(names[0]) ? names[phase] : "?";
+}
+
+// a poll()-driven check-in, as a control loop with a 1ms period would run it
+struct PollStats
+{
+	unsigned long 	calls;
+	double 			worstMs;			// longest call, CPU plus virtual time
+	uint8_t 		worstPhase;			// phase the longest call started in
+	double 			worstLocalMs;		// longest call that made no HTTPS request
+	bool 			restarted;
+};
+
+static uint8_t pollCheckIn(DeviceIO &device, unsigned long budgetUs, PollStats &stats)
+{
+	uint8_t state = DEVICEIO_POLL_BUSY;
+	while (state == DEVICEIO_POLL_BUSY)
+	{
+		uint8_t phase = device.getCheckInPhase();
+		uint64_t connects = DeviceIONative::net().connects;
+		unsigned long long blocked = DeviceIONative::blockedMicros();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		try
+		{
+			state = device.poll(budgetUs);
+		} catch (DeviceIONative::Restart &)
+		{
+			stats.restarted = true;
+			state = DEVICEIO_POLL_DONE;
+		}
+		double ms = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 1e6 +
+					(DeviceIONative::blockedMicros() - blocked) / 1000.0;
+		if (ms > stats.worstMs)
+		{
+			stats.worstMs = ms;
+			stats.worstPhase = phase;
+		}
+		if (ms > stats.worstLocalMs && DeviceIONative::net().connects == connects && device.getCheckInPhase() != DEVICEIO_PHASE_IDLE)
+			stats.worstLocalMs = ms;
+		stats.calls++;
+		DeviceIONative::advanceMillis(1);
+	}
+	return state;
+}
+
+static void printPollStats(const PollStats &stats, unsigned long checkIns)
+{
+	printf("%-28s %8s %12.1f\n", "  poll calls/check-in", "", stats.calls / (double)checkIns);
+	printf("%-28s %8s %12.2f  (%s)\n", "  worst poll call ms", "", stats.worstMs, phaseName(stats.worstPhase));
+	printf("%-28s %8s %12.2f\n", "  worst call w/o HTTPS ms", "", stats.worstLocalMs);
+}
+
+// virtual time, the network model against the flash model
+static void printStages(const DeviceIOFirmware &firmware)
+{
+	printf("%-28s %8s %12lu\n", "  network KB/s", "", (unsigned long)firmware.receiveBytesPerSecond() / 1024);
+	printf("%-28s %8s %12lu\n", "  flash KB/s", "", (unsigned long)firmware.flashBytesPerSecond() / 1024);
+	printf("%-28s %8s %12lu\n", "  waited for flash ms", "", (unsigned long)firmware.stallMillis());
+}
+
+// the statistics of closed windows in output order
+static void collectAggregate(void *values, uint16_t, float value, unsigned long)
+{
+	((std::vector<float> *)values)->push_back(value);
+}
+
+// a sensor channel that counts its reads
+static bool countRead(void *reads, float &value)
+{
+	value = (float)++*(uint32_t *)reads;
+	return true;
+}
+
+static void dropReadings(void *batches, const DeviceIOReading *, uint8_t)
+{
+	++*(uint32_t *)batches;
+}
+
+// a 100 Hz vibration-like signal
+static void keepArguments(void *kept, char *args)
+{
+	*(std::string *)kept = args;
+}
+
+static void countCalls(void *count, char *)
+{
+	(*(int *)count)++;
+}
+
+static float vibration(unsigned long i)
+{
+	return 2.0f + sinf(i * 0.37f) + 0.25f * (float)((i * 2654435761UL >> 16) & 0xFF) / 255.0f;
+}
+
+int main(int argc, char **argv)
+{
+	const char *filter = argc > 1 ? argv[1] : nullptr;
+
+	DeviceIOStandIn server;
+	DeviceIONative::setServer(&server);
+	SPIFFS.begin(true);
+
+	printHeader();
+
+	if (selected(filter, "addSensorValue"))
+	{
+		DeviceIO device;
+		setupDevice(device, server);
+		fillSamples(device, DEVICEIO_SAMPLE_CAPACITY);
+		const unsigned long n = 200000;
+		// steady state, every DEVICEIO_SAMPLE_CAPACITY pushes spool one record
+		BenchResult r = runBench(n, [&](unsigned long i) { device.addSensorValue(i & 7, (float)i); });
+		printResult("addSensorValue", n, r);
+		printf("%-28s %8s %12lu\n", "  sample buffer bytes", "", (unsigned long)(sizeof(sensordata) * DEVICEIO_SAMPLE_CAPACITY));
+	}
+
+	if (selected(filter, "sensorPayload"))
+	{
+		DeviceIO device;
+		setupDevice(device, server);
+		fillSamples(device, DEVICEIO_SAMPLE_CAPACITY);
+		const unsigned long n = 20000;
+		size_t payloadBytes = 0;
+		BenchResult r = runBench(n, [&](unsigned long) { payloadBytes = DeviceIONativeBench::encodeSensorPayload(device); });
+		printResult("sensorPayload", n, r);
+		printf("%-28s %8s %12lu\n", "  payload bytes", "", (unsigned long)payloadBytes);
+	}
+
+	if (selected(filter, "sensorPayload/binary"))
+	{
+		DeviceIO device;
+		setupDevice(device, server);
+		fillSamples(device, DEVICEIO_SAMPLE_CAPACITY);
+		const unsigned long n = 20000;
+		size_t payloadBytes = 0;
+		BenchResult r = runBench(n, [&](unsigned long) { payloadBytes = DeviceIONativeBench::encodeBinaryPayload(device); });
+		printResult("sensorPayload/binary", n, r);
+		size_t formBytes = DeviceIONativeBench::encodeSensorPayload(device);
+		printf("%-28s %8s %12lu  (%.1fx smaller than form)\n", "  payload bytes", "", (unsigned long)payloadBytes, formBytes / (double)payloadBytes);
+
+		// the reference decoder must read back what the form upload would have sent
+		std::string body;
+		std::vector<DeviceIOStandIn::Sample> decoded;
+		DeviceIONativeBench::encodeBinaryPayload(device, &body);
+		bool ok = DeviceIOStandIn::decodeBinary(body, decoded) && decoded.size() == DEVICEIO_SAMPLE_CAPACITY;
+		for (size_t i = 0; ok && i < decoded.size(); i++)
+			ok = fabsf(decoded[i].sensorval - (20.0f + i * 0.25f)) < 0.005f && decoded[i].sensornum == (long)(i % 8);
+		body[body.size() / 2] ^= 0x40;
+		ok = ok && !DeviceIOStandIn::decodeBinary(body, decoded);
+		printf("%-28s %8s %12s\n", "  decode and crc check", "", verdict(ok, "ok", "FAILED"));
+	}
+
+	if (selected(filter, "getRemoteVersionNumber"))
+	{
+		DeviceIO device;
+		setupDevice(device, server);
+		const unsigned long n = 2000;
+		BenchResult r = runBench(n, [&](unsigned long) { DeviceIONativeBench::getRemoteVersionNumber(device); });
+		printResult("getRemoteVersionNumber", n, r);
+	}
+
+	if (selected(filter, "doCheckIn"))
+	{
+		DeviceIO device;
+		setupDevice(device, server);
+		const unsigned long n = 500;
+		server.reset();
+		BenchResult r = runBench(n, [&](unsigned long) {
+			fillSamples(device, DEVICEIO_SAMPLE_CAPACITY - 3);
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+		});
+		printResult("doCheckIn", n, r);
+		printf("%-28s %8s %12.2f\n", "  requests/check-in", "", server.counters.requests / (double)n);
+		printf("%-28s %8s %12.2f\n", "  samples/check-in", "", server.samples.size() / (double)n);
+	}
+
+	if (selected(filter, "doCheckIn/form"))
+	{
+		// a server without binary uploads, the device falls back to the form encoding
+		DeviceIO device;
+		setupDevice(device, server);
+		const unsigned long n = 500;
+		server.reset();
+		server.binaryFormat = false;
+		BenchResult r = runBench(n, [&](unsigned long) {
+			fillSamples(device, DEVICEIO_SAMPLE_CAPACITY - 3);
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+		});
+		server.binaryFormat = true;
+		printResult("doCheckIn/form", n, r);
+		printf("%-28s %8s %12.2f\n", "  requests/check-in", "", server.counters.requests / (double)n);
+		printf("%-28s %8s %12.2f\n", "  samples/check-in", "", server.samples.size() / (double)n);
+	}
+
+	if (selected(filter, "doCheckIn/refused"))
+	{
+		// a reply with nothing new stored keeps the binary upload, one that says
+		// UNSUPPORTED falls back without running its directives
+		DeviceIO device;
+		setupDevice(device, server);
+		server.reset();
+		int led = 0;
+		device.addDirective("LED", countCalls, &led);
+		server.reportNone = true;
+		fillSamples(device, 4);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		server.reportNone = false;
+		fillSamples(device, 4);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		printf("%-28s %8s %12s\n", "  0 updated, binary kept", "", verdict(server.counters.binaryUploads == 2, "ok", "NOT"));
+
+		server.reset();
+		server.binaryFormat = false;
+		server.refuseInBody = true;
+		server.directives.push_back("LED on");
+		fillSamples(device, 4);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		server.binaryFormat = true;
+		server.refuseInBody = false;
+		printf("%-28s %8s %12s\n", "  UNSUPPORTED, form sent", "", verdict((server.samples.size() == 4) && (server.counters.requests == 2)));
+		printf("%-28s %8s %12d\n", "  directive runs", "", led);
+		verdict(led == 1);
+		fillSamples(device, 4);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		printf("%-28s %8s %12s\n", "  form for the boot", "", verdict((server.counters.binaryUploads == 0) && (server.samples.size() == 8)));
+	}
+
+	if (selected(filter, "doCheckIn/legacy"))
+	{
+		// a server without cmd=checkin, the device falls back to getversion + sensor
+		DeviceIO device;
+		setupDevice(device, server);
+		const unsigned long n = 500;
+		server.reset();
+		server.checkinCommand = false;
+		BenchResult r = runBench(n, [&](unsigned long) {
+			fillSamples(device, DEVICEIO_SAMPLE_CAPACITY - 3);
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+		});
+		server.checkinCommand = true;
+		printResult("doCheckIn/legacy", n, r);
+		printf("%-28s %8s %12.2f\n", "  requests/check-in", "", server.counters.requests / (double)n);
+		printf("%-28s %8s %12.2f\n", "  samples/check-in", "", server.samples.size() / (double)n);
+	}
+
+	if (selected(filter, "doCheckIn/sensor reply"))
+	{
+		// a server that takes cmd=checkin for cmd=sensor has the samples, they
+		// aren't sent again, and the next check-in uses getversion + sensor
+		DeviceIO device;
+		setupDevice(device, server);
+		server.reset();
+		server.checkinAsSensor = true;
+		fillSamples(device, 4);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		// the built-in channels add theirs
+		size_t stored = 0;
+		for (size_t i = 0; i < server.samples.size(); i++)
+			if (server.samples[i].sensornum < 8) stored++;
+		printf("%-28s %8s %12lu\n", "  samples stored", "", (unsigned long)stored);
+		verdict((stored == 4) && (server.commands["getversion"] == 1));
+		fillSamples(device, 4);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		server.checkinAsSensor = false;
+		printf("%-28s %8s %12s\n", "  checkin dropped", "", verdict((server.commands["checkin"] == 1) && (server.commands["sensor"] >= 1)));
+
+		// the directives of that reply run once, and its REBOOT goes after the sensor request
+		DeviceIO rebooting;
+		setupDevice(rebooting, server);
+		server.reset();
+		server.checkinAsSensor = true;
+		int led = 0;
+		rebooting.addDirective("LED", countCalls, &led);
+		server.directives.push_back("LED on");
+		server.directives.push_back("REBOOT");
+		fillSamples(rebooting, 4);
+		rebooting.lastCheckInTimeMS = 0;
+		PollStats stats = {};
+		pollCheckIn(rebooting, 1000, stats);
+		server.checkinAsSensor = false;
+		printf("%-28s %8s %12d  (%s)\n", "  directive runs", "", led, verdict((led == 1) && stats.restarted, "rebooted", "MISMATCH"));
+	}
+
+	if (selected(filter, "poll/checkin"))
+	{
+		// the first check-in waits 2 s for the SNTP sync, the loop keeps running
+		DeviceIONative::setNtpSyncDelay(2000);
+		DeviceIO device;
+		setupDevice(device, server);
+		const unsigned long n = 50;
+		PollStats stats = {};
+		BenchResult r = runBench(n, [&](unsigned long) {
+			fillSamples(device, DEVICEIO_SAMPLE_CAPACITY - 3);
+			device.lastCheckInTimeMS = 0;
+			pollCheckIn(device, 1000, stats);
+		});
+		printResult("poll/checkin", n, r);
+		printPollStats(stats, n);
+	}
+
+	if (selected(filter, "poll/ota"))
+	{
+		// a 256 KB firmware download, one chunk to flash per step
+		DeviceIO device;
+		setupDevice(device, server);
+		server.latestBuild = device.buildNumber + 1;
+		server.firmware.resize(256 * 1024);
+		for (size_t i = 0; i < server.firmware.size(); i++) server.firmware[i] = (uint8_t)(i * 31);
+		server.firmware[0] = DEVICEIO_IMAGE_MAGIC;
+		DeviceIONative::eraseOtaPartition();
+		PollStats stats = {};
+		BenchResult r = runBench(1, [&](unsigned long) {
+			device.lastCheckInTimeMS = 0;
+			pollCheckIn(device, 1000, stats);
+		});
+		printResult("poll/ota", 1, r);
+		printPollStats(stats, 1);
+		printf("%-28s %8s %12s\n", "  image", "", verdict((stats.restarted && otaImageIs(server.firmware))));
+		printStages(DeviceIONativeBench::firmware(device));
+		server.latestBuild = device.buildNumber;
+		server.firmware.clear();
+	}
+
+	if (selected(filter, "ota/resume"))
+	{
+		// a 1 MB download whose connection drops every 150000 bytes, the device
+		// resets after the first check-in gives up and continues from its checkpoint
+		DeviceIO device;
+		setupDevice(device, server);
+		server.reset();
+		server.latestBuild = device.buildNumber + 1;
+		server.firmware.resize(1024 * 1024);
+		for (size_t i = 0; i < server.firmware.size(); i++) server.firmware[i] = (uint8_t)(i * 131 + (i >> 12));
+		server.firmware[0] = DEVICEIO_IMAGE_MAGIC;
+		server.firmwareCutAfter = 150000;
+		DeviceIONative::eraseOtaPartition();
+		PollStats stats = {};
+		BenchResult r = runBench(1, [&](unsigned long) {
+			device.lastCheckInTimeMS = 0;
+			pollCheckIn(device, 1000, stats);
+			server.firmwareCutAfter = -1;
+			DeviceIO rebooted;
+			setupDevice(rebooted, server, true);
+			rebooted.buildNumber = device.buildNumber;
+			rebooted.lastCheckInTimeMS = 0;
+			pollCheckIn(rebooted, 1000, stats);
+		});
+		printResult("ota/resume", 1, r);
+		printf("%-28s %8s %12lu\n", "  firmware requests", "", server.commands["getfirmware"]);
+		printf("%-28s %8s %12lu\n", "  range requests", "", server.counters.rangeRequests);
+		printf("%-28s %8s %12ld\n", "  bytes sent twice", "", (long)(server.counters.firmwareBytes - server.firmware.size()));
+		printf("%-28s %8s %12s\n", "  image", "", verdict((stats.restarted && otaImageIs(server.firmware))));
+		server.latestBuild = device.buildNumber;
+		server.firmware.clear();
+		server.reset();
+	}
+
+	if (selected(filter, "decode/") || selected(filter, "ota/encoded"))
+	{
+		std::vector<uint8_t> running = makeFirmware(1000000, 5);
+		std::vector<uint8_t> release = nextRelease(running);
+		DeviceIONative::runningPartition().bytes.assign(running.begin(), running.end());
+		DeviceIONative::runningPartition().bytes.resize(DeviceIONative::otaPartition().bytes.size(), 0xFF);
+
+		// the decoder into the RAM partition, one TCP segment at a time
+		const char *decodeNames[] = {"decode/raw", "decode/heatshrink", "decode/patch", "decode/patch+heatshrink"};
+		for (int mode = 0; mode < 4; mode++)
+		{
+			if (!selected(filter, decodeNames[mode])) continue;
+			std::vector<uint8_t> body = (mode >= 2) ? DeviceIOStandIn::makePatch(running, release) : release;
+			if (mode & 1) body = DeviceIOStandIn::heatshrinkEncode(body, DEVICEIO_HEATSHRINK_WINDOW, DEVICEIO_HEATSHRINK_LOOKAHEAD);
+			DeviceIOFirmware firmware;
+			DeviceIOImageDecoder decoder;
+			bool ok = true;
+			const unsigned long n = 5;
+			DeviceIONative::eraseOtaPartition();
+			BenchResult r = runBench(n, [&](unsigned long) {
+				firmware.open(release.size(), 2);
+				decoder.begin(firmware, mode & 1, true);
+				for (size_t at = 0; at < body.size(); at += 1460)
+					decoder.write(body.data() + at, std::min((size_t)1460, body.size() - at));
+				decoder.end();
+				ok = ok && firmware.finish() && otaImageIs(release);
+			});
+			printResult(decodeNames[mode], n, r);
+			printf("%-28s %8s %12lu  (%.1f%% of the image)\n", "  body bytes", "", (unsigned long)body.size(), 100.0 * body.size() / release.size());
+			printf("%-28s %8s %12.1f\n", "  image MB/s (host CPU)", "", release.size() / (r.nsPerOp / 1e9) / 1e6);
+			printf("%-28s %8s %12s\n", "  image", "", verdict(ok));
+		}
+
+		if (selected(filter, "decode/patch"))
+		{
+			// another build of the same size, the patch is refused before a byte is written
+			std::vector<uint8_t> body = DeviceIOStandIn::makePatch(running, release);
+			DeviceIONative::runningPartition().bytes[running.size() / 2] ^= 0x5A;
+			DeviceIOFirmware firmware;
+			DeviceIOImageDecoder decoder;
+			firmware.open(release.size(), 2);
+			decoder.begin(firmware, false, true);
+			bool written = decoder.write(body.data(), std::min((size_t)1460, body.size()));
+			printf("%-28s %8s %12s\n", "  other source, refused", "", verdict(!written && (decoder.getError() == DEVICEIO_DECODER_SOURCE) && (firmware.progress() == 0)));
+			decoder.end();
+			firmware.abort();
+			DeviceIONative::runningPartition().bytes[running.size() / 2] ^= 0x5A;
+		}
+
+		// the whole update over the network, a patch alone is as big as the image
+		const char *otaNames[] = {"ota/encoded/raw", "ota/encoded/heatshrink", nullptr, "ota/encoded/patch+hs"};
+		for (int mode = 0; mode < 4; mode++)
+		{
+			if (otaNames[mode] == nullptr || !selected(filter, otaNames[mode])) continue;
+			DeviceIO device;
+			setupDevice(device, server);
+			server.reset();
+			server.latestBuild = device.buildNumber + 1;
+			server.firmware = release;
+			server.previousBuild = device.buildNumber;
+			server.previousFirmware = running;
+			server.compressFirmware = (mode & 1) != 0;
+			server.patchFirmware = mode >= 2;
+			DeviceIONative::eraseOtaPartition();
+			PollStats stats = {};
+			BenchResult r = runBench(1, [&](unsigned long) {
+				device.lastCheckInTimeMS = 0;
+				pollCheckIn(device, 1000, stats);
+			});
+			printResult(otaNames[mode], 1, r);
+			printf("%-28s %8s %12lu  (%.1f%% of the image)\n", "  firmware bytes sent", "", server.counters.firmwareBytes,
+				   100.0 * server.counters.firmwareBytes / release.size());
+			printf("%-28s %8s %12s\n", "  image", "", verdict((stats.restarted && otaImageIs(release))));
+			printStages(DeviceIONativeBench::firmware(device));
+			server.latestBuild = device.buildNumber;
+			server.firmware.clear();
+			server.previousFirmware.clear();
+			server.compressFirmware = false;
+			server.patchFirmware = false;
+			server.reset();
+		}
+	}
+
+	if (selected(filter, "contention"))
+	{
+		// producer threads record as fast as they can while the worker
+		// drains the queue and checks in every 5 virtual minutes. far above
+		// any sensor rate, nearly every push finds the queue full: this is
+		// the cost of a push under contention, contention/paced the capacity
+		printf("%-28s %8s %12s %10s %10s %12s %10s\n", "", "threads", "pushes", "ns/push", "p99 ns", "max ns", "accepted");
+		for (int producers = 1; producers <= 4; producers *= 2)
+		{
+			DeviceIO device;
+			setupDevice(device, server);
+			// the clock thread jumps 5 minutes at a time, past any NTP round
+			// trip: sync in the foreground first, later syncs may fail
+			device.checkinInterval = DEVICEIO_MIN_CHECKIN_INTERVAL;
+			device.doCheckIn();
+			server.reset();
+			device.startBackgroundCheckIn();
+
+			const unsigned long perThread = 200000;
+			std::atomic<int> ready(0);
+			std::atomic<bool> done(false);
+			std::vector<std::vector<uint32_t> > latencies(producers);
+			std::vector<std::thread> threads;
+			for (int p = 0; p < producers; p++)
+			{
+				threads.push_back(std::thread([&, p]() {
+					std::vector<uint32_t> &lat = latencies[p];
+					lat.reserve(perThread);
+					ready++;
+					while (ready.load() < producers) std::this_thread::yield();
+					for (unsigned long i = 0; i < perThread; i++)
+					{
+						std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+						device.addSensorValue(p, (float)i);
+						lat.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+					}
+				}));
+			}
+			std::thread clock([&]() {
+				while (!done.load())
+				{
+					DeviceIONative::advanceMillis(5 * 60 * 1000UL + 1);
+					std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				}
+			});
+			for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+			done.store(true);
+			clock.join();
+			device.stopBackgroundCheckIn();
+
+			std::vector<uint32_t> all;
+			for (size_t t = 0; t < latencies.size(); t++) all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+			double sum = 0;
+			for (size_t i = 0; i < all.size(); i++) sum += all[i];
+			std::sort(all.begin(), all.end());
+			unsigned long pushes = (unsigned long)all.size();
+			unsigned long accepted = pushes - device.getDroppedPushCount();
+			char name[32];
+			snprintf(name, sizeof(name), "contention/%d", producers);
+			printf("%-28s %8d %12lu %10.1f %10u %12u %10lu\n", name, producers, pushes, sum / pushes,
+				   all[(size_t)(pushes * 0.99)], all.back(), accepted);
+			printf("%-28s %8s %12lu  (%s)\n", "  worker requests", "", server.counters.requests, verdict(server.counters.requests > 0));
+		}
+
+		// a producer at DEVICEIO_QUEUE_RATE_HZ against a server that answers
+		// just before DEVICEIO_HTTPS_TIMEOUT, in real time. both run 10 times
+		// faster, the queue fills the same: no sample may be dropped
+		DeviceIO device;
+		setupDevice(device, server);
+		device.checkinInterval = DEVICEIO_MIN_CHECKIN_INTERVAL;
+		device.doCheckIn();
+		server.reset();
+		server.stallMs = DEVICEIO_HTTPS_TIMEOUT / 10 * 9 / 10;
+		device.startBackgroundCheckIn();
+		DeviceIONative::advanceMillis(2 * DEVICEIO_MIN_CHECKIN_INTERVAL);
+		const unsigned long pushes = DEVICEIO_QUEUE_RATE_HZ * 10 * 3;
+		std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+		for (unsigned long i = 0; i < pushes; i++)
+		{
+			device.addSensorValue(0, (float)i);
+			next += std::chrono::microseconds(100000 / DEVICEIO_QUEUE_RATE_HZ);
+			std::this_thread::sleep_until(next);
+		}
+		device.stopBackgroundCheckIn();
+		server.stallMs = 0;
+		printf("%-28s %8d %12lu %10s %10s %12s %10lu\n", "contention/paced", 1, pushes, "", "", "",
+			   pushes - (unsigned long)device.getDroppedPushCount());
+		printf("%-28s %8s %12lu  (%s, %lu requests, queue %u)\n", "  dropped pushes", "", (unsigned long)device.getDroppedPushCount(),
+			   verdict((device.getDroppedPushCount() == 0) && (server.counters.requests > 0)), server.counters.requests,
+			   (unsigned)DEVICEIO_QUEUE_CAPACITY);
+	}
+
+	if (selected(filter, "tlsResumption"))
+	{
+		// every check-in after the first resumes the session, until the
+		// server forgets it and the next one falls back to a full handshake.
+		// only with DEVICEIO_TLS_SESSIONS=1, the ESP8266's BearSSL, the
+		// ESP32 model does a full handshake per check-in
+		DeviceIO device;
+		setupDevice(device, server);
+		const unsigned long n = 100;
+		BenchResult r = runBench(n, [&](unsigned long i) {
+			if (i == n / 2) DeviceIONative::flushTlsSessions();
+			fillSamples(device, 4);
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+		});
+		printResult("tlsResumption", n, r);
+		printf("%-28s %8s %12lu\n", "  device handshakes", "", (unsigned long)device.getTLSHandshakeCount());
+		printf("%-28s %8s %12lu  (%s)\n", "  device resumptions", "", (unsigned long)device.getTLSResumeCount(),
+			   DEVICEIO_TLS_SESSIONS ? "ESP8266 BearSSL model" : "ESP32, full handshakes");
+	}
+
+	if (selected(filter, "spool"))
+	{
+		// offline, every full sample buffer is appended to the spool as one record
+		DeviceIONative::setWiFiConnected(false);
+		DeviceIO device;
+		setupDevice(device, server);
+		DeviceIOSpool &spool = DeviceIONativeBench::spool(device);
+		const unsigned long records = 200;
+		const unsigned long n = records * DEVICEIO_SAMPLE_CAPACITY;
+		fs::FS::Counters fsStart = SPIFFS.counters;
+		fs::FS::Counters fsTenth = fsStart;
+		uint32_t appendsTenth = 0;
+		BenchResult r = runBench(n, [&](unsigned long i) {
+			if (i == n / 10)
+			{
+				fsTenth = SPIFFS.counters;
+				appendsTenth = spool.appends;
+			}
+			device.addSensorValue(i & 7, (float)i);
+		});
+		printResult("spool/append", n, r);
+		// the same cost for the first and the last records, nothing is rewritten
+		double firstBytes = (fsTenth.bytesWritten - fsStart.bytesWritten) / (double)appendsTenth;
+		double lastBytes = (SPIFFS.counters.bytesWritten - fsTenth.bytesWritten) / (double)(spool.appends - appendsTenth);
+		printf("%-28s %8s %12.1f  (first 10%%: %.1f)\n", "  flash bytes/append", "", lastBytes, firstBytes);
+		printf("%-28s %8s %12.2f\n", "  file opens/append", "", (SPIFFS.counters.opens - fsTenth.opens) / (double)(spool.appends - appendsTenth));
+		printf("%-28s %8s %12lu\n", "  segments evicted", "", (unsigned long)spool.evictions);
+		printf("%-28s %8s %12lu\n", "  flash bytes used", "", (unsigned long)SPIFFS.usedBytes());
+
+		// back online, the newest samples arrive in order after the fresh ones
+		DeviceIONative::setWiFiConnected(true);
+		server.reset();
+		device.lastCheckInTimeMS = 0;
+		r = runBench(1, [&](unsigned long) { device.doCheckIn(); });
+		printResult("spool/replay", 1, r);
+		std::vector<float> values;
+		for (size_t i = 0; i < server.samples.size(); i++)
+			if (server.samples[i].sensornum < 8) values.push_back(server.samples[i].sensorval);
+		std::sort(values.begin(), values.end());
+		bool ordered = !values.empty() && values.back() == (float)(n - 1);
+		for (size_t i = 1; ordered && i < values.size(); i++)
+			ordered = values[i] == values[i - 1] + 1.0f;
+		printf("%-28s %8s %12.2f\n", "  requests", "", (double)server.counters.requests);
+		printf("%-28s %8s %12lu  (%s)\n", "  samples replayed", "", (unsigned long)values.size(), verdict(ordered, "newest, complete", "GAPS"));
+		// only the store is left, it holds the index
+		File kv = SPIFFS.open("/deviceio.kv", "r");
+		size_t kvBytes = kv.size();
+		kv.close();
+		printf("%-28s %8s %12s\n", "  spool empty", "", verdict(spool.empty() && SPIFFS.usedBytes() - kvBytes < 128, "yes", "NO"));
+
+		// a reset tears the last record, the records before it survive
+		DeviceIONative::setWiFiConnected(false);
+		for (unsigned long i = 0; i < 3 * DEVICEIO_SAMPLE_CAPACITY + 1; i++)
+			device.addSensorValue(i & 7, (float)i);
+		char name[24];
+		for (unsigned long segment = 0; segment < 1000; segment++)
+		{
+			char candidate[24];
+			snprintf(candidate, sizeof(candidate), "/spool%lu.seg", segment);
+			if (SPIFFS.exists(candidate)) strcpy(name, candidate);
+		}
+		File torn = SPIFFS.open(name, "a");
+		torn.write((const uint8_t *)"\x3c\x00\x12", 3);
+		torn.close();
+		// and the index is in the file an older build wrote, it moves to the store
+		eSPIFFS legacy;
+		DeviceIOStore store;
+		uint32_t index[3];
+		store.begin(legacy);
+		bool stored = store.getBytes("spool", index, sizeof(index)) && !SPIFFS.exists("/spool.idx");
+		printf("%-28s %8s %12s\n", "  index in the store", "", verdict(stored));
+		char saved[40];
+		snprintf(saved, sizeof(saved), "%lu %lu %lu", (unsigned long)index[0], (unsigned long)index[1], (unsigned long)index[2]);
+		legacy.saveToFile("/spool.idx", (const char *)saved);
+		store.remove("spool");
+		store.commit();
+		DeviceIONative::setWiFiConnected(true);
+		server.reset();
+		DeviceIO rebooted;
+		setupDevice(rebooted, server, true);
+		rebooted.doCheckIn();
+		size_t recovered = 0;
+		for (size_t i = 0; i < server.samples.size(); i++)
+			if (server.samples[i].sensornum < 8) recovered++;
+		printf("%-28s %8s %12lu  (%s)\n", "  torn record recovery", "", (unsigned long)recovered,
+			   verdict((recovered == 3 * DEVICEIO_SAMPLE_CAPACITY && DeviceIONativeBench::spool(rebooted).corrupt > 0), "ok", "FAILED"));
+		store.begin(legacy);
+		printf("%-28s %8s %12s\n", "  index file moved", "", verdict(store.getBytes("spool", index, sizeof(index)) && !SPIFFS.exists("/spool.idx")));
+	}
+
+	if (selected(filter, "fs"))
+	{
+		// the provisioning files as initialize() reads them and unprovisionDevice()
+		// writes them, through a plain eSPIFFS and a mounted one
+		SPIFFS.format();
+		eSPIFFS seed;
+		seed.saveToFile("/deviceProvisioned.txt", "1");
+		seed.saveToFile("/deviceToken.txt", server.token.c_str());
+		const unsigned long n = 20000;
+		for (int mountedMode = 0; mountedMode < 2; mountedMode++)
+		{
+			eSPIFFS fileSystem;
+			if (mountedMode) fileSystem.mount();
+			const char *mode = mountedMode ? "mounted" : "unmounted";
+			for (int op = 0; op < 3; op++)
+			{
+				static const char *const opNames[] = { "openFromFile", "getFileSize", "saveToFile" };
+				char name[40];
+				snprintf(name, sizeof(name), "fs/%s/%s", mode, opNames[op]);
+				bool ok = true;
+				fs::FS::Counters before = SPIFFS.counters;
+				BenchResult r = runBench(n, [&](unsigned long) {
+					int provisioned = 0;
+					String token;
+					if (op == 0)
+					{
+						fileSystem.openFromFile("/deviceProvisioned.txt", provisioned);
+						fileSystem.openFromFile("/deviceToken.txt", token);
+						ok = ok && provisioned == 1 && token == server.token.c_str();
+					}
+					else if (op == 1)
+						ok = ok && fileSystem.getFileSize("/deviceToken.txt") == (int)server.token.size();
+					else
+						ok = fileSystem.saveToFile("/deviceProvisioned.txt", "1") && ok;
+				});
+				printResult(name, n, r);
+				unsigned long calls = (SPIFFS.counters.begins - before.begins) + (SPIFFS.counters.opens - before.opens) +
+									  (SPIFFS.counters.exists - before.exists);
+				printf("%-28s %8s %12.0f  (%s)\n", "  ops/s", "", 1e9 / r.nsPerOp, verdict(ok, "contents ok", "MISMATCH"));
+				printf("%-28s %8s %12.2f\n", "  fs calls/op", "", calls / (double)n);
+			}
+			printf("%-28s %8s %12lu\n", "  cache hits", "", fileSystem.getCacheHits());
+		}
+
+		// the cache follows this instance's writes
+		eSPIFFS fileSystem;
+		fileSystem.mount();
+		int provisioned = 0;
+		String token;
+		fileSystem.openFromFile("/deviceProvisioned.txt", provisioned);
+		fileSystem.saveToFile("/deviceProvisioned.txt", "0");
+		fileSystem.saveToFile("/deviceToken.txt", "");
+		fileSystem.openFromFile("/deviceProvisioned.txt", provisioned);
+		bool coherent = provisioned == 0 && !fileSystem.openFromFile("/deviceToken.txt", token) && token.length() == 0;
+		fileSystem.removeFile("/deviceToken.txt");
+		coherent = coherent && fileSystem.getFileSize("/deviceToken.txt") == 0 && !SPIFFS.exists("/deviceToken.txt");
+		printf("%-28s %8s %12s\n", "  write-through", "", verdict(coherent));
+	}
+
+	if (selected(filter, "store"))
+	{
+		// a device provisioned by an older build boots, its files move to the store
+		SPIFFS.format();
+		eSPIFFS legacy;
+		legacy.saveToFile("/deviceProvisioned.txt", "1");
+		legacy.saveToFile("/deviceToken.txt", server.token.c_str());
+		DeviceIO migrated;
+		migrated.debugSerial = 0;
+		migrated.initialize();
+		DeviceIOStore check;
+		check.begin(legacy);
+		int32_t provisioned = 0;
+		String token;
+		bool moved = check.getInt("provisioned", provisioned) && provisioned == 1 && check.getString("token", token) &&
+					 token == server.token.c_str() && !SPIFFS.exists("/deviceProvisioned.txt") && !SPIFFS.exists("/deviceToken.txt");
+		printf("%-28s %8s %12s\n", "  migration", "", verdict(moved, "ok", "FAILED"));
+
+		// provisioning saves both values, one file per value before
+		eSPIFFS fileSystem;
+		fileSystem.mount();
+		const unsigned long n = 2000;
+		fs::FS::Counters before = SPIFFS.counters;
+		BenchResult r = runBench(n, [&](unsigned long i) {
+			legacy.saveToFile("/deviceProvisioned.txt", (i & 1) ? "1" : "0");
+			legacy.saveToFile("/deviceToken.txt", (i & 1) ? server.token.c_str() : "");
+		});
+		printResult("store/provision/files", n, r);
+		printf("%-28s %8s %12.2f\n", "  file opens/save", "", (SPIFFS.counters.opens - before.opens) / (double)n);
+		printf("%-28s %8s %12.1f\n", "  flash bytes/save", "", (SPIFFS.counters.bytesWritten - before.bytesWritten) / (double)n);
+		SPIFFS.remove("/deviceProvisioned.txt");
+		SPIFFS.remove("/deviceToken.txt");
+
+		DeviceIOStore store;
+		store.begin(fileSystem);
+		before = SPIFFS.counters;
+		r = runBench(n, [&](unsigned long i) {
+			store.setInt("provisioned", (i & 1) ? 1 : 0);
+			if (i & 1)
+				store.setString("token", server.token.c_str());
+			else
+				store.remove("token");
+			store.commit();
+		});
+		printResult("store/provision/commit", n, r);
+		printf("%-28s %8s %12.2f\n", "  file opens/save", "", (SPIFFS.counters.opens - before.opens) / (double)n);
+		printf("%-28s %8s %12.1f\n", "  flash bytes/save", "", (SPIFFS.counters.bytesWritten - before.bytesWritten) / (double)n);
+		printf("%-28s %8s %12lu\n", "  compactions", "", (unsigned long)store.compactions);
+
+		// boot, one read whatever the log holds
+		before = SPIFFS.counters;
+		r = runBench(n, [&](unsigned long) { check.begin(fileSystem); });
+		printResult("store/begin", n, r);
+		printf("%-28s %8s %12.2f\n", "  file opens/begin", "", (SPIFFS.counters.opens - before.opens) / (double)n);
+
+		// a reset tears the last commit, the one before it holds
+		fileSystem.removeFile("/deviceio.kv");
+		store.begin(fileSystem);
+		store.setInt("provisioned", 0);
+		store.remove("token");
+		store.commit();
+		store.setInt("provisioned", 1);
+		store.setString("token", server.token.c_str());
+		store.commit();
+		std::vector<uint8_t> log(2048);
+		File file = SPIFFS.open("/deviceio.kv", "r");
+		log.resize(file.read(log.data(), log.size()));
+		file.close();
+		file = SPIFFS.open("/deviceio.kv", "w");
+		file.write(log.data(), log.size() - 3);
+		file.close();
+		fileSystem.clearCache();
+		DeviceIOStore torn;
+		torn.begin(fileSystem);
+		bool atomic = torn.getInt("provisioned", provisioned) && provisioned == 0 && !torn.getString("token", token) && torn.corrupt == 1;
+		torn.setString("token", "after");
+		torn.commit();
+		DeviceIOStore rebooted;
+		rebooted.begin(fileSystem);
+		atomic = atomic && rebooted.getString("token", token) && token == "after" && rebooted.corrupt == 0;
+		printf("%-28s %8s %12s\n", "  torn commit", "", verdict(atomic, "previous state", "FAILED"));
+	}
+
+	if (selected(filter, "aggregate"))
+	{
+		// 4 hours of one 100 Hz sensor, 10 minute windows
+		const unsigned long n = 4UL * 3600 * 100;
+		for (int sliding = 0; sliding < 2; sliding++)
+		{
+			DeviceIOAggregator aggregator;
+			std::vector<float> values;
+			aggregator.begin(collectAggregate, &values);
+			aggregator.configure(1, 600000, sliding ? 150000 : 600000, DEVICEIO_AGGREGATE_ALL, 1);
+			BenchResult r = runBench(n, [&](unsigned long i) { aggregator.add(1, vibration(i), i * 10); });
+			printResult(sliding ? "aggregate/sliding" : "aggregate/tumbling", n, r);
+			aggregator.flush(n * 10);
+
+			// the last window against doubles
+			unsigned long from = n - 60000;
+			double sum = 0, squares = 0, lo = 1e9, hi = -1e9;
+			for (unsigned long i = from; i < n; i++)
+			{
+				double v = vibration(i);
+				sum += v;
+				lo = std::min(lo, v);
+				hi = std::max(hi, v);
+			}
+			double mean = sum / 60000;
+			for (unsigned long i = from; i < n; i++)
+				squares += (vibration(i) - mean) * (vibration(i) - mean);
+			const float *last = values.data() + values.size() - 6;
+			bool ok = fabs(last[0] - mean) < 1e-3 && last[1] == (float)lo && last[2] == (float)hi && last[3] == 60000.0f &&
+					  last[4] == vibration(n - 1) && fabs(last[5] - squares / 60000) < 1e-3 * (squares / 60000);
+			printf("%-28s %8s %12lu  (%s)\n", "  windows", "", (unsigned long)aggregator.windows, verdict(ok, "stats ok", "MISMATCH"));
+			printf("%-28s %8s %12lu  (raw: %lu)\n", "  rows to upload", "", (unsigned long)values.size(), n);
+		}
+
+		// through addSensorValue, the windows end up in the sample buffer and the spool
+		DeviceIONative::setWiFiConnected(false);
+		DeviceIO device;
+		setupDevice(device, server);
+		device.setSensorAggregation(1, 600, 600, DEVICEIO_AGGREGATE_MEAN | DEVICEIO_AGGREGATE_MIN | DEVICEIO_AGGREGATE_MAX, 100);
+		DeviceIOSpool &spool = DeviceIONativeBench::spool(device);
+		const unsigned long m = 3600UL * 100;
+		BenchResult r = runBench(m, [&](unsigned long i) {
+			DeviceIONative::advanceMillis(10);
+			device.addSensorValue(1, vibration(i));
+		});
+		printResult("aggregate/addSensorValue", m, r);
+		printf("%-28s %8s %12lu  (%lu spool records)\n", "  rows stored", "",
+			   (unsigned long)(DeviceIONativeBench::bufferedSamples(device) + spool.appends * DEVICEIO_SAMPLE_CAPACITY),
+			   (unsigned long)spool.appends);
+		DeviceIONative::setWiFiConnected(true);
+
+		// a gap closes several sliding windows at once, each keeps its own end time
+		DeviceIO stamped;
+		setupDevice(stamped, server);
+		server.reset();
+		stamped.lastCheckInTimeMS = 0;
+		stamped.doCheckIn();
+		stamped.setSensorAggregation(2, 600, 150, DEVICEIO_AGGREGATE_MEAN, 200);
+		for (int k = 0; k < 4; k++)
+		{
+			stamped.addSensorValue(2, (float)k);
+			DeviceIONative::advanceMillis(150 * 1000UL);
+		}
+		DeviceIONative::advanceMillis(3600 * 1000UL);
+		stamped.addSensorValue(2, 4.0f);
+		server.reset();
+		stamped.lastCheckInTimeMS = 0;
+		stamped.doCheckIn();
+		std::vector<std::string> times;
+		for (size_t i = 0; i < server.samples.size(); i++)
+			if (server.samples[i].sensornum == 200) times.push_back(server.samples[i].datetime);
+		bool increasing = times.size() >= 4;
+		for (size_t i = 1; increasing && i < times.size(); i++)
+			increasing = times[i - 1] < times[i];
+		printf("%-28s %8s %12lu  (%s)\n", "  window end times", "", (unsigned long)times.size(), verdict(increasing, "distinct", "MISMATCH"));
+	}
+
+	if (selected(filter, "deadband"))
+	{
+		// a room temperature read every minute, noise below 0.1 and a step every 40 minutes,
+		// checked in every 4 hours, without and with a 0.1 deadband and an hourly heartbeat
+		for (int deadband = 0; deadband < 2; deadband++)
+		{
+			DeviceIO device;
+			setupDevice(device, server);
+			if (deadband) device.setSensorDeadband(3, 0.1f, 0, 3600);
+			const unsigned long checkIns = 6;
+			server.reset();
+			BenchResult r = runBench(checkIns, [&](unsigned long c) {
+				for (unsigned long i = 0; i < 240; i++)
+				{
+					unsigned long minute = c * 240 + i;
+					DeviceIONative::advanceMillis(60000);
+					device.addSensorValue(3, 21.0f + (minute / 40) * 0.5f + ((minute * 7) % 5) * 0.02f);
+				}
+				device.lastCheckInTimeMS = 0;
+				device.doCheckIn();
+			});
+			printResult(deadband ? "deadband/on" : "deadband/off", checkIns, r);
+			size_t uploaded = 0;
+			for (size_t i = 0; i < server.samples.size(); i++)
+				if (server.samples[i].sensornum == 3) uploaded++;
+			printf("%-28s %8s %12.1f  (of 240)\n", "  sensor rows/check-in", "", uploaded / (double)checkIns);
+			printf("%-28s %8s %12.1f\n", "  built-in rows/check-in", "", (server.samples.size() - uploaded) / (double)checkIns);
+			printf("%-28s %8s %12lu  (built-in %lu)\n", "  suppressed", "", (unsigned long)device.getSuppressedSampleCount(),
+				   (unsigned long)(device.getSuppressedSampleCount(DEVICEIO_SENSOR_WIFI) + device.getSuppressedSampleCount(DEVICEIO_SENSOR_TEMPERATURE)));
+		}
+	}
+
+	if (selected(filter, "clock"))
+	{
+		// a week against an oscillator that runs fast or slow, a check-in every
+		// 5 minutes polls like stepNTP(). the error is the device's wall clock
+		// against the NTP server's
+		const long skews[] = { 40, -80 };
+		for (size_t k = 0; k < sizeof(skews) / sizeof(skews[0]); k++)
+		{
+			DeviceIONative::setClockSkewPpm(skews[k]);
+			DeviceIONative::resetNet();
+			DeviceIOClock clock;
+			clock.begin(nullptr);
+			double worstMs = 0, sumMs = 0;
+			unsigned long measured = 0;
+			const unsigned long steps = 7 * 24 * 12;
+			BenchResult r = runBench(steps, [&](unsigned long) {
+				unsigned long start = millis();
+				clock.poll(true);
+				while (clock.busy())
+				{
+					DeviceIONative::advanceMillis(10);
+					clock.poll(true);
+				}
+				DeviceIONative::advanceMillis(5 * 60000 - (millis() - start));
+				if (!clock.synced())
+					return;
+				double error = fabs((double)(long long)(clock.epochMs() - DeviceIONative::trueEpochMicros(micros()) / 1000));
+				worstMs = std::max(worstMs, error);
+				sumMs += error;
+				measured++;
+			});
+			char name[32];
+			snprintf(name, sizeof(name), "clock/skew%+ldppm", skews[k]);
+			printResult(name, steps, r);
+			printf("%-28s %8s %12lu  (%lu requests)\n", "  syncs/week", "", (unsigned long)clock.syncs, (unsigned long)DeviceIONative::net().ntpRequests);
+			printf("%-28s %8s %12.1f  (mean %.1f)\n", "  worst error ms", "", worstMs, sumMs / measured);
+			printf("%-28s %8s %12.1f\n", "  drift estimate ppm", "", clock.driftPpm());
+			printf("%-28s %8s %12.1f\n", "  error/day undisciplined ms", "", fabs(skews[k] * 1e-6 * DEVICEIO_CLOCK_MAX_AGE_S * 1000));
+		}
+		DeviceIONative::setClockSkewPpm(0);
+
+		{
+			// a bogus future epoch saved by an earlier boot: the second reply
+			// in a row outvotes it, and only a confirmed sync is saved
+			SPIFFS.format();
+			eSPIFFS fileSystem;
+			DeviceIOStore store;
+			store.begin(fileSystem);
+			uint32_t now = (uint32_t)(DeviceIONative::trueEpochMicros(micros()) / 1000000);
+			store.setInt("epoch", (int32_t)(now + 30 * 86400));
+			store.commit();
+			DeviceIOClock clock;
+			clock.begin(&store);
+			unsigned long polls = 0;
+			while (!clock.synced() && (polls++ < 10000))
+			{
+				clock.poll(true);
+				DeviceIONative::advanceMillis(10);
+			}
+			int32_t saved = 0;
+			store.getInt("epoch", saved);
+			uint32_t nowAfter = (uint32_t)(DeviceIONative::trueEpochMicros(micros()) / 1000000);
+			printf("%-28s %8s %12lu  (%s)\n", "  bad saved epoch, rejected", "", (unsigned long)clock.rejected,
+				   verdict(clock.synced() && (clock.epoch() + 1 >= nowAfter) && (clock.epoch() <= nowAfter + 1) && ((uint32_t)saved <= nowAfter)));
+		}
+
+		// the first check-in syncs, getTime() and the sample timestamps never wait for it
+		DeviceIO device;
+		setupDevice(device, server);
+		struct tm t;
+		BenchResult r = runBench(100000, [&](unsigned long) { device.getTime(t); });
+		printResult("getTime/unsynced", 100000, r);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		r = runBench(100000, [&](unsigned long) { device.getTime(t); });
+		printResult("getTime", 100000, r);
+		printf("%-28s %8s %12s\n", "  year", "", verdict(device.getTime(t) && t.tm_year >= 2021, "ok", "NOT SET"));
+	}
+
+	if (selected(filter, "sensors"))
+	{
+		// 32 channels, 8 each every 10 ms, 100 ms, 1 s and 10 s, a minute of loop()
+		// passes of 1 ms with every 7th taking 3 ms. the wheel against a millis()
+		// check per channel that restarts the period when it reads
+		const uint32_t periods[] = { 10, 100, 1000, 10000 };
+		const unsigned long passes = 60000 / (6 + 3) * 7;
+		uint32_t expected = 0;
+		for (int i = 0; i < 32; i++) expected += 60000 / periods[i / 8];
+		for (int wheel = 1; wheel >= 0; wheel--)
+		{
+			DeviceIOScheduler scheduler;
+			uint32_t reads = 0, batches = 0;
+			unsigned long last[32];
+			scheduler.begin(dropReadings, &batches);
+			for (int i = 0; i < 32; i++)
+			{
+				scheduler.add(i, periods[i / 8], countRead, &reads, millis());
+				last[i] = millis();
+			}
+			unsigned long start = millis();
+			BenchResult r = runBench(passes, [&](unsigned long pass) {
+				DeviceIONative::advanceMillis((pass % 7) == 6 ? 3 : 1);
+				if (wheel)
+				{
+					scheduler.run(millis());
+					return;
+				}
+				float value;
+				for (int i = 0; i < 32; i++)
+				{
+					if (millis() - last[i] >= periods[i / 8])
+					{
+						last[i] = millis();
+						countRead(&reads, value);
+					}
+				}
+			});
+			// the first reads come at once on the wheel
+			if (wheel) reads -= 32;
+			printResult(wheel ? "sensors/wheel" : "sensors/millis-checks", passes, r);
+			printf("%-28s %8s %12lu  (%lu on the period grid, %lu ms)\n", "  reads", "", (unsigned long)reads, (unsigned long)expected,
+				   millis() - start);
+			if (wheel)
+				printf("%-28s %8s %12.1f  (latest %lu ms)\n", "  readings/batch", "", scheduler.reads / (double)batches, scheduler.maxLateMs);
+		}
+
+		// through DeviceIO the readings are samples, the built-in ones included
+		DeviceIO device;
+		setupDevice(device, server);
+		uint32_t reads = 0;
+		device.addSensor(1, 1000, countRead, &reads);
+		device.runSensors();
+		size_t before = DeviceIONativeBench::bufferedSamples(device);
+		for (int i = 0; i < 1000; i++)
+		{
+			DeviceIONative::advanceMillis(10);
+			device.runSensors();
+		}
+		printf("%-28s %8s %12lu  (%lu buffered)\n", "  device reads in 10 s", "", (unsigned long)reads,
+			   (unsigned long)(DeviceIONativeBench::bufferedSamples(device) - before));
+		printf("%-28s %8s %12lu\n", "  built-in channels", "", (unsigned long)(DeviceIONativeBench::scheduler(device).reads - reads));
+	}
+
+	if (selected(filter, "stats"))
+	{
+		// check-ins with the stats reported as sensors, the last one against a
+		// server without cmd=checkin so it answers 400 and the device falls back
+		DeviceIONative::flushTlsSessions();
+		DeviceIO device;
+		setupDevice(device, server);
+		device.reportStats = 1;
+		server.reset();
+		const unsigned long n = 10;
+		BenchResult r = runBench(n, [&](unsigned long i) {
+			if (i == n - 1) server.checkinCommand = false;
+			fillSamples(device, 4);
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+		});
+		server.checkinCommand = true;
+		printResult("stats/checkIn", n, r);
+		DeviceIOStats stats = device.getStats();
+		unsigned long reported = 0;
+		for (size_t i = 0; i < server.samples.size(); i++)
+			if ((server.samples[i].sensornum >= DEVICEIO_SENSOR_CHECKIN_MS) && (server.samples[i].sensornum <= DEVICEIO_SENSOR_DROPPED))
+				reported++;
+		printf("%-28s %8s %12lu  (%lu failed)\n", "  check-ins", "", (unsigned long)stats.checkins, (unsigned long)stats.failures);
+		printf("%-28s %8s %12lu  (ntp %lu, dns %lu, tls %lu)\n", "  last check-in ms", "", (unsigned long)stats.last.durationMs,
+			   (unsigned long)stats.last.ntpMs, (unsigned long)stats.last.dnsMs, (unsigned long)stats.last.tlsMs);
+		printf("%-28s %8s %12lu  (get %lu, post %lu)\n", "  last requests", "", (unsigned long)stats.last.requests,
+			   (unsigned long)stats.last.getMs, (unsigned long)stats.last.postMs);
+		printf("%-28s %8s %12lu  (2xx %lu, 4xx %lu, errors %lu)\n", "  requests", "", (unsigned long)stats.requests,
+			   (unsigned long)stats.httpStatus[2], (unsigned long)stats.httpStatus[4], (unsigned long)stats.httpErrors[1]);
+		printf("%-28s %8s %12lu  (%lu received)\n", "  body bytes sent", "", (unsigned long)stats.bytesSent, (unsigned long)stats.bytesReceived);
+		printf("%-28s %8s %12ld\n", "  heap kept by the check-in", "", (long)stats.last.freeHeapBefore - (long)stats.last.freeHeapAfter);
+		printf("%-28s %8s %12lu  (%lu resumed, %s)\n", "  tls handshakes", "", (unsigned long)stats.tlsHandshakes, (unsigned long)stats.tlsResumptions,
+			   DEVICEIO_TLS_SESSIONS ? "ESP8266 BearSSL model" : "ESP32, full handshakes");
+		printf("%-28s %8s %12lu\n", "  stat samples uploaded", "", reported);
+		r = runBench(100000, [&](unsigned long) { stats = device.getStats(); });
+		printResult("stats/getStats", 100000, r);
+	}
+
+	if (selected(filter, "log"))
+	{
+		// a deferred record against the String message and println it replaces,
+		// both with the UART at 115200 and nothing echoed
+		DeviceIOLog log;
+		char line[DEVICEIO_LOG_LINE];
+		const unsigned long n = 100000;
+		Serial.echo = false;
+		BenchResult r = runBench(n, [&](unsigned long i) {
+			DEVICEIO_LOG_I(log, "Downloaded bytes = %lu", (unsigned long)i);
+			if ((i & 15) == 15)
+				while (log.read(line, sizeof(line))) {}
+		});
+		printResult("log/record", n, r);
+		unsigned long serialBefore = Serial.bytesWritten;
+		r = runBench(2000, [&](unsigned long i) {
+			Serial.println(String(F("(DeviceIO b")) + String(DEVICE_IO_BUILD_NUMBER) + String(F(") ")) + String(F("Downloaded bytes = ")) + String(i));
+		});
+		printResult("log/String+println", 2000, r);
+		printf("%-28s %8s %12.1f\n", "  serial bytes/line", "", (Serial.bytesWritten - serialBefore) / 2000.0);
+		delay(1000);
+
+		// the check-in with its log drained to Serial, a drain sends what fits the
+		// FIFO so the sketch's loop() calling doCheckIn() prints the rest
+		DeviceIO device;
+		setupDevice(device, server);
+		device.debugSerial = 1;
+		server.reset();
+		serialBefore = Serial.bytesWritten;
+		const unsigned long checkIns = 200;
+		r = runBench(checkIns, [&](unsigned long) {
+			fillSamples(device, DEVICEIO_SAMPLE_CAPACITY - 3);
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+			for (int k = 0; k < 20; k++)
+			{
+				delay(10);
+				device.doCheckIn();
+			}
+		});
+		printResult("log/doCheckIn", checkIns, r);
+		printf("%-28s %8s %12.1f\n", "  serial bytes/check-in", "", (Serial.bytesWritten - serialBefore) / (double)checkIns);
+		printf("%-28s %8s %12lu\n", "  records dropped", "", (unsigned long)DeviceIONativeBench::logDropped(device));
+		Serial.echo = true;
+	}
+
+	if (selected(filter, "directives"))
+	{
+		// an app directive in a check-in reply, then the check-in with no
+		// directives against one with forty lines of them
+		DeviceIO device;
+		setupDevice(device, server);
+		server.reset();
+		std::string led;
+		device.addDirective("LED", keepArguments, &led);
+		server.directives.push_back("LED on");
+		fillSamples(device, 4);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		printf("%-28s %8s %12s\n", "  app directive", "", verdict((led == "on"), "ok", "MISSING"));
+		printf("%-28s %8s %12s\n", "  REBOOT reserved", "", verdict(!(device.addDirective("REBOOT", keepArguments, &led)), "ok", "NOT"));
+		// the library's own don't take the sketch's slots
+		static char names[DEVICEIO_DIRECTIVES_USER][8];
+		int added = 1;
+		for (int k = 1; k < DEVICEIO_DIRECTIVES_USER; k++)
+		{
+			snprintf(names[k], sizeof(names[k]), "APP%d", k);
+			added += device.addDirective(names[k], keepArguments, &led) ? 1 : 0;
+		}
+		printf("%-28s %8s %12d\n", "  sketch directives", "", added);
+		verdict((added == DEVICEIO_DIRECTIVES_USER) && !device.addDirective("FULL", keepArguments, &led));
+		for (int k = 1; k < DEVICEIO_DIRECTIVES_USER; k++)
+			device.removeDirective(names[k]);
+
+		const unsigned long n = 20;
+		BenchResult r = runBench(n, [&](unsigned long) {
+			fillSamples(device, 4);
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+		});
+		printResult("directives/none", n, r);
+		// the stand-in's 40 strings and the reply body count here too, the
+		// device's own allocations don't grow with the reply
+		std::string note = "NOTE " + std::string(100, 'x');
+		r = runBench(n, [&](unsigned long) {
+			for (int k = 0; k < 40; k++)
+				server.directives.push_back(note);
+			fillSamples(device, 4);
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+		});
+		printResult("directives/40 lines", n, r);
+		printf("%-28s %8s %12lu  (%lu dispatched)\n", "  unknown directives", "", (unsigned long)DeviceIONativeBench::directives(device).unknown,
+			   (unsigned long)DeviceIONativeBench::directives(device).dispatched);
+
+		// the parser alone, one reply of three directives per op
+		DeviceIODirectives table;
+		std::string kept;
+		table.add("LED", keepArguments, &kept);
+		table.add("SETCMD", keepArguments, &kept);
+		const char reply[] = "deviceio OK\r2 sensors updated\rLED on\rSETCMD enable(123),disable(1)\rREBOOT\r";
+		r = runBench(200000, [&](unsigned long) {
+			DeviceIODirectiveParser parser(table);
+			parser.begin(200);
+			parser.write((const uint8_t *)reply, sizeof(reply) - 1);
+			parser.end();
+		});
+		printResult("directives/parse reply", 200000, r);
+
+		char args[] = "enable(123),ssid(a,b),reset";
+		char *cursor = args, *name, *value;
+		std::string pairs;
+		while (DeviceIODirectives::nextArgument(cursor, name, value))
+			pairs += std::string(name) + "=" + value + ";";
+		printf("%-28s %8s %12s\n", "  nextArgument", "", verdict((pairs == "enable=123;ssid=a,b;reset=;")));
+	}
+
+	if (selected(filter, "tuning"))
+	{
+		// a SETCMD that throttles the device: a longer interval, small batches,
+		// a deadband on sensor 0, sensor 7 off, and a setting for the sketch
+		DeviceIO device;
+		setupDevice(device, server);
+		server.reset();
+		std::string ssid;
+		device.addDirective("ssid", keepArguments, &ssid);
+		long before = DeviceIONativeBench::checkInInterval(device);
+		server.directives.push_back("SETCMD id(7),interval(28800),batch(10),deadband(0,5),disable(7),ssid(home),volume(11)");
+		fillSamples(device, 8);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		printf("%-28s %8s %12ld  (was %ld)\n", "  check-in interval ms", "", DeviceIONativeBench::checkInInterval(device), before);
+		printf("%-28s %8s %12s\n", "  sketch setting", "", verdict((ssid == "home"), "ok", "MISSING"));
+
+		// acknowledged with the next upload, which goes up in batches of 10
+		server.reset();
+		fillSamples(device, 48);
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		unsigned long sensor7 = 0;
+		for (size_t i = 0; i < server.samples.size(); i++)
+			if (server.samples[i].sensornum == 7)
+				sensor7++;
+		printf("%-28s %8s %12s  (%s)\n", "  acknowledgement", "", verdict((server.settingsAck == "7,5,1")), server.settingsAck.c_str());
+		printf("%-28s %8s %12lu  (%lu samples, %lu suppressed, %lu of sensor 7)\n", "  upload requests", "",
+			   server.commands["checkin"] + server.commands["sensor"], (unsigned long)server.samples.size(),
+			   (unsigned long)device.getSuppressedSampleCount(0), sensor7);
+
+		// the settings outlive a restart, the acknowledgement isn't sent again
+		DeviceIO restarted;
+		setupDevice(restarted, server, true);
+		server.reset();
+		fillSamples(restarted, 8);
+		restarted.lastCheckInTimeMS = 0;
+		restarted.doCheckIn();
+		sensor7 = 0;
+		for (size_t i = 0; i < server.samples.size(); i++)
+			if (server.samples[i].sensornum == 7)
+				sensor7++;
+		printf("%-28s %8s %12s\n", "  kept after restart", "", verdict(((DeviceIONativeBench::checkInInterval(restarted) == 28800000) && (sensor7 == 0) && \
+			   server.settingsAck.empty()), "ok", "NOT"));
+
+		server.directives.push_back("SETCMD reset");
+		restarted.lastCheckInTimeMS = 0;
+		restarted.doCheckIn();
+		printf("%-28s %8s %12s\n", "  reset", "", verdict((DeviceIONativeBench::checkInInterval(restarted) == before), "ok", "NOT"));
+
+		// deadbands that aren't finite numbers are rejected
+		server.directives.push_back("SETCMD id(9),deadband(0,nan),deadband(1,5,inf)");
+		restarted.lastCheckInTimeMS = 0;
+		restarted.doCheckIn();
+		server.reset();
+		fillSamples(restarted, 8);
+		restarted.lastCheckInTimeMS = 0;
+		restarted.doCheckIn();
+		printf("%-28s %8s %12s  (%s)\n", "  nan and inf deadbands", "", verdict((server.settingsAck == "9,0,2"), "rejected", "MISMATCH"), server.settingsAck.c_str());
+
+		// three records of 4 samples spooled offline replay in batches of at most 10
+		DeviceIONative::setWiFiConnected(false);
+		for (int record = 0; record < 3; record++)
+		{
+			for (int i = 1; i <= 4; i++)
+				device.addSensorValue(i, (float)(record * 10 + i));
+			device.lastCheckInTimeMS = 0;
+			device.doCheckIn();
+		}
+		DeviceIONative::setWiFiConnected(true);
+		server.reset();
+		device.lastCheckInTimeMS = 0;
+		device.doCheckIn();
+		printf("%-28s %8s %12lu  (%s, %lu samples)\n", "  replay requests", "", server.commands["sensor"],
+			   verdict(server.commands["sensor"] == 2), (unsigned long)server.samples.size());
+
+		// a reply with a SETCMD of five settings, flash write included
+		const char reply[] = "deviceio OK\r2 sensors updated\rSETCMD id(8),interval(1800),batch(20),period(300,60000),deadband(301,0.5,0,3600)\r";
+		BenchResult r = runBench(200, [&](unsigned long) {
+			DeviceIODirectiveParser parser(DeviceIONativeBench::directives(restarted));
+			parser.begin(200);
+			parser.write((const uint8_t *)reply, sizeof(reply) - 1);
+			parser.end();
+		});
+		printResult("tuning/SETCMD", 200, r);
+	}
+
+	if (selected(filter, "schedule"))
+	{
+		// a fleet restarts together after a power cut and checks in with a
+		// server that answers 20 requests a second, the others get a 503.
+		// the old schedule checks in at once and retries 7/8 of the interval
+		// later, the new one spreads the first check-ins over the start
+		// jitter and backs off. the model counts each device's first check-in
+		const unsigned long fleet = 5000, capacity = 20, horizonS = 24 * 3600UL;
+		const uint32_t interval = FOUR_HOURS;
+		for (int policy = 0; policy < 2; policy++)
+		{
+			std::vector<DeviceIOCheckInSchedule> schedules(fleet);
+			std::vector<std::vector<unsigned long> > due(horizonS + 1);
+			unsigned long peak = 0, failed = 0, in = 0, allInS = 0;
+			for (unsigned long d = 0; d < fleet; d++)
+			{
+				schedules[d].begin(0, (policy == 0) ? 0 : DEVICEIO_STARTUP_JITTER_MS);
+				due[schedules[d].dueMs() / 1000].push_back(d);
+			}
+			for (unsigned long t = 0; (t <= horizonS) && (in < fleet); t++)
+			{
+				peak = std::max(peak, (unsigned long)due[t].size());
+				for (size_t i = 0; i < due[t].size(); i++)
+				{
+					unsigned long d = due[t][i];
+					if (i < capacity)
+					{
+						in++;
+						allInS = t;
+						continue;
+					}
+					failed++;
+					if (policy == 0)
+						schedules[d].at(t * 1000 + interval - interval / 8);
+					else
+						schedules[d].failed(t * 1000, interval, 0);
+					if (schedules[d].dueMs() / 1000 <= horizonS)
+						due[schedules[d].dueMs() / 1000].push_back(d);
+				}
+			}
+			char allIn[32];
+			if (in == fleet)
+				snprintf(allIn, sizeof(allIn), "%lus", allInS);
+			else
+				snprintf(allIn, sizeof(allIn), ">24h, %lu left", fleet - in);
+			printf("%-28s %8s %12lu  (%lu failed requests, all in after %s)\n", policy == 0 ? "  fixed, peak req/s" : "  jittered, peak req/s", "",
+				   peak, failed, allIn);
+		}
+
+		// the same on a device: the start jitter, back-off, the server's hints
+		// and the first check-in after a restart
+		DeviceIO device;
+		setupDevice(device, server);
+		server.reset();
+		DeviceIOCheckInSchedule &schedule = DeviceIONativeBench::schedule(device);
+		device.checkinJitterMS = DEVICEIO_STARTUP_JITTER_MS;
+		unsigned long start = millis();
+		uint8_t first = device.poll(1000);
+		unsigned long jitterMs = schedule.dueMs() - start;
+		DeviceIONative::advanceMillis(jitterMs);
+		uint8_t checkedIn = device.doCheckIn();
+		printf("%-28s %8s %12lu  (%s)\n", "  start jitter ms", "", jitterMs,
+			   verdict(((first == DEVICEIO_POLL_IDLE) && (checkedIn == 1) && (server.commands["checkin"] == 1))));
+
+		// the busy server's Retry-After is longer than the first back-off
+		server.busyCode = 503;
+		server.retryAfter = 7200;
+		DeviceIONative::advanceMillis(schedule.dueMs() - millis());
+		device.doCheckIn();
+		unsigned long waitS = (schedule.dueMs() - millis()) / 1000;
+		printf("%-28s %8s %12lu  (%s)\n", "  Retry-After 7200 s, wait s", "", waitS, verdict(((waitS >= 7199) && (waitS <= 7200))));
+
+		// without one each failure waits between half and all of twice the last
+		server.retryAfter = -1;
+		bool backoff = true;
+		char waits[96] = "";
+		for (uint8_t failure = 2; failure <= 5; failure++)
+		{
+			DeviceIONative::advanceMillis(schedule.dueMs() - millis());
+			device.doCheckIn();
+			unsigned long longest = std::min((unsigned long)(interval / 8) << (failure - 1), (unsigned long)interval);
+			unsigned long wait = schedule.dueMs() - millis();
+			backoff = backoff && (schedule.failures() == failure) && (wait >= longest / 2 - 1000) && (wait <= longest);
+			snprintf(waits + strlen(waits), sizeof(waits) - strlen(waits), "%s%lu", (failure > 2) ? "," : "", wait / 1000);
+		}
+		printf("%-28s %8s %12s  (%s s)\n", "  back-off", "", verdict(backoff), waits);
+
+		// NEXT with a good check-in
+		server.busyCode = 0;
+		server.directives.push_back("NEXT 36000");
+		DeviceIONative::advanceMillis(schedule.dueMs() - millis());
+		device.doCheckIn();
+		waitS = (schedule.dueMs() - millis()) / 1000;
+		printf("%-28s %8s %12lu  (%s)\n", "  NEXT 36000, wait s", "", waitS,
+			   verdict(((schedule.failures() == 0) && (waitS >= 35999) && (waitS <= 36000))));
+
+		// a NEXT that wraps when it is taken times 1000 in 32 bits
+		server.directives.push_back("NEXT 4294968");
+		DeviceIONative::advanceMillis(schedule.dueMs() - millis());
+		device.doCheckIn();
+		waitS = (schedule.dueMs() - millis()) / 1000;
+		printf("%-28s %8s %12lu  (%s)\n", "  NEXT 4294968, wait s", "", waitS,
+			   verdict((waitS >= DEVICEIO_HINT_MAX_S - 1) && (waitS <= DEVICEIO_HINT_MAX_S)));
+
+		// a restart an hour on, the next check-in stays where it was
+		DeviceIONative::advanceMillis(3600 * 1000UL);
+		DeviceIO restarted;
+		setupDevice(restarted, server, true, true);
+		server.reset();
+		uint8_t state = restarted.doCheckIn();
+		unsigned long restartWaitS = (DeviceIONativeBench::schedule(restarted).dueMs() - millis()) / 1000;
+		bool skipped = (state == 0) && (server.commands["checkin"] == 0) && (restartWaitS >= interval / 1000 - 3600 - 2) && (restartWaitS <= interval / 1000 - 3600);
+		DeviceIONative::advanceMillis(DeviceIONativeBench::schedule(restarted).dueMs() - millis());
+		restarted.doCheckIn();
+		printf("%-28s %8s %12lu  (%s)\n", "  after restart, wait s", "", restartWaitS,
+			   verdict((skipped && (server.commands["checkin"] == 1))));
+
+		// a firmware download the server turns away during a rollout
+		DeviceIO updating;
+		setupDevice(updating, server);
+		server.reset();
+		server.latestBuild = updating.buildNumber + 1;
+		server.firmware.assign(64 * 1024, 0x5A);
+		server.firmware[0] = DEVICEIO_IMAGE_MAGIC;
+		server.busyCode = 503;
+		server.retryAfter = 7200;
+		server.busyCommand = "getfirmware";
+		DeviceIONative::eraseOtaPartition();
+		updating.doCheckIn();
+		waitS = (DeviceIONativeBench::schedule(updating).dueMs() - millis()) / 1000;
+		printf("%-28s %8s %12lu  (%s)\n", "  OTA Retry-After 7200, wait s", "", waitS,
+			   verdict((server.commands["getfirmware"] == 1) && (waitS >= 7199) && (waitS <= 7200)));
+		server.busyCode = 0;
+		server.retryAfter = -1;
+		server.busyCommand.clear();
+		server.latestBuild = updating.buildNumber;
+		server.firmware.clear();
+
+		// a REBOOT for the whole fleet: the restarted devices don't all check in again at once
+		DeviceIO rebooting;
+		setupDevice(rebooting, server);
+		server.reset();
+		server.directives.push_back("REBOOT");
+		PollStats rebootStats = {};
+		pollCheckIn(rebooting, 1000, rebootStats);
+		DeviceIONative::advanceMillis(60 * 1000UL);
+		DeviceIO rebooted;
+		setupDevice(rebooted, server, true, true);
+		server.reset();
+		state = rebooted.doCheckIn();
+		restartWaitS = (DeviceIONativeBench::schedule(rebooted).dueMs() - millis()) / 1000;
+		printf("%-28s %8s %12lu  (%s)\n", "  after REBOOT, wait s", "", restartWaitS,
+			   verdict(rebootStats.restarted && (state == 0) && (server.commands["checkin"] == 0) && (restartWaitS >= interval / 1000 - 60 - 10)));
+		server.reset();
+	}
+
+	if (selected(filter, "push"))
+	{
+		// directives between check-ins over the long-poll channel: how soon
+		// they arrive, what an idle hour costs, and the fallback to check-ins
+		DeviceIO device;
+		setupDevice(device, server);
+		server.reset();
+		std::string led;
+		device.addDirective("LED", keepArguments, &led);
+		device.pushChannel = 1;
+		DeviceIOPush &push = DeviceIONativeBench::push(device);
+		device.doCheckIn();
+		unsigned long start = millis();
+		while (!device.isPushListening() && (millis() - start < 10000))
+		{
+			device.poll(1000);
+			DeviceIONative::advanceMillis(10);
+		}
+		printf("%-28s %8s %12lu  (%s)\n", "  listening after ms", "", millis() - start, verdict(device.isPushListening(), "ok", "NOT"));
+
+		// polled every 10 ms, as a sketch's loop() would
+		server.directives.push_back("LED on");
+		start = millis();
+		while (led.empty() && (millis() - start < 10000))
+		{
+			device.poll(1000);
+			DeviceIONative::advanceMillis(10);
+		}
+		printf("%-28s %8s %12lu  (%s, %ld s by check-in)\n", "  directive latency ms", "", millis() - start,
+			   verdict((led == "on"), "ok", "MISSING"), DeviceIONativeBench::checkInInterval(device) / 2000);
+
+		// an idle hour, polled once a second
+		DeviceIONative::NetCounters before = DeviceIONative::net();
+		unsigned long listens = server.commands["listen"];
+		uint32_t handshakes = push.connection().handshakes;
+		for (int i = 0; i < 3600; i++)
+		{
+			device.poll(1000);
+			DeviceIONative::advanceMillis(1000);
+		}
+		DeviceIONative::NetCounters after = DeviceIONative::net();
+		printf("%-28s %8s %12lu  (hold %u s, %lu handshakes)\n", "  idle hour, requests", "", server.commands["listen"] - listens,
+			   (unsigned int)device.pushHoldS, (unsigned long)(push.connection().handshakes - handshakes));
+		printf("%-28s %8s %12lu\n", "  idle hour, wire bytes", "",
+			   (unsigned long)(after.bytesSent + after.bytesReceived + after.handshakeBytes - before.bytesSent - before.bytesReceived - before.handshakeBytes));
+
+		// a busy server's Retry-After holds the reconnect back
+		server.busyCode = 503;
+		server.retryAfter = 300;
+		server.directives.push_back("LED off");
+		start = millis();
+		listens = server.commands["listen"];
+		unsigned long failedAt = 0, back = 0;
+		while ((back == 0) && (millis() - start < 600 * 1000UL))
+		{
+			device.poll(1000);
+			if ((failedAt == 0) && (push.failures > 0))
+			{
+				failedAt = millis();
+				server.busyCode = 0;
+				server.retryAfter = -1;
+			}
+			if ((failedAt != 0) && device.isPushListening())
+				back = millis() - failedAt;
+			DeviceIONative::advanceMillis(100);
+		}
+		printf("%-28s %8s %12lu  (%s)\n", "  Retry-After 300, back s", "", back / 1000,
+			   verdict(((back >= 300 * 1000UL) && (back < 310 * 1000UL) && (server.commands["listen"] - listens == 2))));
+
+		// a pushed REBOOT checks in first, then restarts
+		PollStats stats = {};
+		unsigned long checkins = server.commands["checkin"];
+		server.directives.push_back("REBOOT");
+		start = millis();
+		while (!stats.restarted && (millis() - start < 60000))
+		{
+			try
+			{
+				device.poll(1000);
+			} catch (DeviceIONative::Restart &)
+			{
+				stats.restarted = true;
+			}
+			DeviceIONative::advanceMillis(10);
+		}
+		printf("%-28s %8s %12lu  (%s)\n", "  pushed reboot after ms", "", millis() - start,
+			   verdict((stats.restarted && (server.commands["checkin"] == checkins + 1))));
+
+		// a new build goes out to a listening device at once
+		DeviceIO updated;
+		setupDevice(updated, server, true);
+		updated.pushChannel = 1;
+		updated.doCheckIn();
+		for (int i = 0; (i < 1000) && !updated.isPushListening(); i++)
+		{
+			updated.poll(1000);
+			DeviceIONative::advanceMillis(10);
+		}
+		server.firmware.resize(64 * 1024);
+		for (size_t i = 0; i < server.firmware.size(); i++) server.firmware[i] = (uint8_t)(i * 7 + (i >> 9));
+		server.firmware[0] = DEVICEIO_IMAGE_MAGIC;
+		DeviceIONative::eraseOtaPartition();
+		server.latestBuild = updated.buildNumber + 1;
+		stats.restarted = false;
+		start = millis();
+		while (!stats.restarted && (millis() - start < 120000))
+		{
+			try
+			{
+				updated.poll(1000);
+			} catch (DeviceIONative::Restart &)
+			{
+				stats.restarted = true;
+			}
+			DeviceIONative::advanceMillis(10);
+		}
+		printf("%-28s %8s %12lu  (%s)\n", "  pushed build, updated ms", "", millis() - start,
+			   verdict((stats.restarted && otaImageIs(server.firmware))));
+		server.latestBuild = updated.buildNumber;
+		server.firmware.clear();
+
+		// a server without cmd=listen, the device goes on with check-ins
+		server.listenCommand = false;
+		DeviceIO fallback;
+		setupDevice(fallback, server, true);
+		server.reset();
+		fallback.pushChannel = 1;
+		fallback.doCheckIn();
+		for (int i = 0; i < 100; i++)
+		{
+			fallback.poll(1000);
+			DeviceIONative::advanceMillis(1000);
+		}
+		fallback.lastCheckInTimeMS = 0;
+		uint8_t checkedIn = fallback.doCheckIn();
+		printf("%-28s %8s %12s  (%lu listen, %lu checkin)\n", "  no listen, fallback", "",
+			   verdict((!DeviceIONativeBench::push(fallback).supported() && (checkedIn == 1) && (server.commands["listen"] == 1))),
+			   server.commands["listen"], server.commands["checkin"]);
+		server.listenCommand = true;
+		server.reset();
+	}
+
+	DeviceIONative::setServer(nullptr);
+	if (checksFailed > 0)
+	{
+		printf("%lu checks failed\n", checksFailed);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,60 @@
+// Arduino.h
+// Host build shim for the Arduino core
+//
+// See DeviceIONative.h for the harness that drives these shims.
+
+#ifndef DeviceIO_native_Arduino_h
+#define DeviceIO_native_Arduino_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include <ctime>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "Esp.h"
+#include "HardwareSerial.h"
+
+// flash strings live in normal memory on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strncmp_P strncmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+typedef const char *PGM_P;
+
+#define ADC_MODE(mode)
+
+unsigned long 	millis(void);
+unsigned long 	micros(void);
+void 			delay(unsigned long ms);
+void 			delayMicroseconds(unsigned int us);
+void 			yield(void);
+
+long 			random(long max);
+long 			random(long min, long max);
+void 			randomSeed(unsigned long seed);
+
+char *			dtostrf(double val, signed char width, unsigned char prec, char *sout);
+
+// time() runs on the virtual clock and reports seconds since boot until
+// settimeofday() sets it. <time.h> and <sys/time.h> are included above so
+// the macros do not reach their declarations
+time_t 			nativeTime(time_t *t);
+int 			nativeSetTimeOfDay(const struct timeval *tv, const struct timezone *tz);
+#define settimeofday(tv, tz) 	nativeSetTimeOfDay(tv, tz)
+#define time(t) 	nativeTime(t)
+
+#endif
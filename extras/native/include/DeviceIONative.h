@@ -0,0 +1,155 @@
+// DeviceIONative.h
+// Host build harness for DeviceIO
+//
+// The host build impersonates the ESP32 Arduino core (ESP32 and
+// DEVICEIO_NATIVE are both defined) so the ESP32 code paths of
+// DeviceIO compile unmodified on Linux. This header exposes the
+// knobs and counters of the shims: a virtual clock that delay()
+// advances instead of sleeping, heap allocation counters, an
+// in-process loopback network with a simple latency model, and
+// the exception that ESP.restart() throws.
+
+#ifndef DeviceIONative_h
+#define DeviceIONative_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DeviceIONative
+{
+	// thrown by ESP.restart(), the harness catches it to simulate a reboot
+	struct Restart
+	{
+	};
+
+	// virtual clock ///////////////
+
+	// millis()/micros() run on the host monotonic clock plus a virtual
+	// offset. delay() only advances the offset so blocking paths can be
+	// measured without actually sleeping.
+	void 				advanceMillis(unsigned long ms);
+	unsigned long long 	blockedMicros(void);	// total time spent in delay() and the network model
+	void 				resetBlocked(void);
+	// the calling thread stands for the other ESP32 core: its delays run
+	// its own timeline instead of the shared clock, so they overlap with
+	// the device's. syncOtherCore() makes the device wait for the other
+	// core to reach the end of its timeline
+	void 				enterOtherCore(void);
+	void 				syncOtherCore(void);
+	// drops the clock sync: time() reports seconds since boot until the
+	// next settimeofday() and the NTP server doesn't answer for ms. the
+	// default is 0, it answers at once
+	void 				setNtpSyncDelay(unsigned long ms);
+	bool 				ntpAnswers(void);
+	// from now on the device clock runs ppm fast (negative: slow) against
+	// the time the NTP server reports
+	void 				setClockSkewPpm(long ppm);
+	// the time the NTP server reports at a micros() reading
+	unsigned long long 	trueEpochMicros(unsigned long long deviceMicros);
+
+	// heap ////////////////////////
+
+	struct HeapCounters
+	{
+		uint64_t 		allocs;
+		uint64_t 		frees;
+		uint64_t 		allocBytes;
+		int64_t 		liveBytes;
+		int64_t 		peakLiveBytes;
+	};
+
+	const HeapCounters &heap(void);
+	void 				resetHeapPeak(void);
+	// allocations made while paused are not counted, used by the stand-in server
+	void 				pauseHeapTracking(void);
+	void 				resumeHeapTracking(void);
+
+	// loopback network ////////////
+
+	struct NetCounters
+	{
+		uint64_t 		connects;
+		uint64_t 		tlsHandshakes;		// full handshakes
+		uint64_t 		tlsResumed;			// abbreviated handshakes
+		uint64_t 		bytesSent;			// application bytes device -> server
+		uint64_t 		bytesReceived;		// application bytes server -> device
+		uint64_t 		handshakeBytes;		// modelled TLS handshake bytes, both directions
+		uint64_t 		ntpRequests;		// UDP packets to port 123
+	};
+
+	// latency model applied to the virtual clock
+	struct NetModel
+	{
+		unsigned long 	rttMs 				= 40;
+		unsigned long 	tlsFullHandshakeMs 	= 1200;		// ESP8266 BearSSL ballpark
+		unsigned long 	tlsFullHandshakeBytes = 3500;
+		unsigned long 	tlsResumedHandshakeMs = 150;
+		unsigned long 	tlsResumedHandshakeBytes = 350;
+		bool 			tlsSessionCache 	= true;		// server side session ID cache
+		unsigned long 	tlsSessionLifetimeMs = 24UL * 3600 * 1000;
+		unsigned long 	bytesPerMs 			= 100;		// ~1 Mbit/s effective
+	};
+
+	const NetCounters &net(void);
+	void 				resetNet(void);
+	NetModel &			netModel(void);
+	// forget every TLS session the server side has issued
+	void 				flushTlsSessions(void);
+
+	// one client connection as seen by the server
+	struct LoopbackConnection
+	{
+		std::string 	rx;					// device -> server, not yet consumed
+		std::string 	tx;					// server -> device, not yet read
+		bool 			open 		= true;
+		bool 			secure 		= false;
+		std::string 	host;
+		uint16_t 		port 		= 0;
+		void *			user 		= nullptr;
+	};
+
+	class LoopbackServer
+	{
+	public:
+		virtual ~LoopbackServer() {}
+		// return false to refuse the connection
+		virtual bool 	onAccept(LoopbackConnection &) { return true; }
+		// new bytes are available in rx
+		virtual void 	onData(LoopbackConnection &) = 0;
+		// the device is waiting for bytes, used for long-held responses
+		virtual void 	onPoll(LoopbackConnection &) {}
+		virtual void 	onClose(LoopbackConnection &) {}
+	};
+
+	// at most one server, any host name resolves to it
+	void 				setServer(LoopbackServer *server);
+	LoopbackServer *	server(void);
+
+	// flash ///////////////////////
+
+	// the OTA app partition behind esp_partition_* and esp_ota_*
+	struct FlashPartition
+	{
+		std::vector<uint8_t> bytes;				// 0xFF when erased
+		unsigned long 	erases;					// sectors
+		unsigned long 	bytesWritten;
+		bool 			bootable;				// esp_ota_set_boot_partition() accepted it
+		unsigned long 	sectorEraseMicros 	= 30000;
+		unsigned long 	programMicrosPerKB 	= 1000;
+	};
+
+	FlashPartition &	otaPartition(void);
+	// the image the device runs, only read
+	FlashPartition &	runningPartition(void);
+	// a blank partition, as after a factory flash
+	void 				eraseOtaPartition(void);
+
+	// wifi ////////////////////////
+
+	void 				setWiFiConnected(bool connected);
+	void 				setRSSI(long dBm);
+}
+
+#endif
@@ -0,0 +1,160 @@
+// DeviceIOStandIn.h
+// Local stand-in for deviceio-devices.goodprototyping.com
+//
+// Speaks HTTP/1.1 over the host loopback network and implements
+// the /manage-device commands DeviceIO uses, so a complete
+// check-in can run on the host. Everything the device uploads is
+// recorded for inspection.
+
+#ifndef DeviceIOStandIn_h
+#define DeviceIOStandIn_h
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "DeviceIONative.h"
+
+class DeviceIOStandIn : public DeviceIONative::LoopbackServer
+{
+public:
+	struct Request
+	{
+		std::string 	method;
+		std::string 	path;
+		std::map<std::string, std::string> query;
+		std::map<std::string, std::string> headers;		// lower case keys
+		std::string 	body;
+	};
+
+	struct Response
+	{
+		int 			code 		= 200;
+		std::string 	body;
+		std::vector<std::pair<std::string, std::string> > headers;
+		bool 			close 		= false;
+		// drops the connection after this many body bytes, -1 sends all
+		long 			cutAfter 	= -1;
+		// a listen request that waits for directives, up to this many ms, -1 answers now
+		long 			holdMs 		= -1;
+	};
+
+	struct Sample
+	{
+		std::string 	datetime;
+		long 			sensornum;
+		float 			sensorval;
+	};
+
+	struct Counters
+	{
+		unsigned long 	connections;
+		unsigned long 	requests;
+		unsigned long 	rejected;		// bad credentials or malformed
+		unsigned long 	requestBytes;
+		unsigned long 	responseBytes;
+		unsigned long 	binaryUploads;	// sample batches in the binary format
+		unsigned long 	firmwareBytes;	// image bytes actually sent
+		unsigned long 	rangeRequests;	// firmware requests that continued a download
+		unsigned long 	encodedImages;	// firmware sent compressed or as a patch
+	};
+
+	DeviceIOStandIn();
+	~DeviceIOStandIn();
+
+	// product and device state
+	std::string 		productID 		= "basic";
+	std::string 		productPassword = "password";
+	std::string 		token 			= "standin-token";
+	long 				latestBuild 	= 1;
+	std::vector<uint8_t> firmware;
+
+	// false impersonates a server without cmd=checkin, it answers 400
+	bool 				checkinCommand 	= true;
+	// true impersonates a server that takes cmd=checkin for cmd=sensor, it
+	// stores the samples and answers without a BUILD line
+	bool 				checkinAsSensor = false;
+	// false impersonates a server without cmd=listen, it answers 400
+	bool 				listenCommand 	= true;
+	// false impersonates a server that only reads form uploads, binary ones get 415
+	bool 				binaryFormat 	= true;
+	// with binaryFormat false, refuse binary uploads with a 200 that says
+	// UNSUPPORTED and carries the queued directives, instead of a 415
+	bool 				refuseInBody 	= false;
+	// replies "0 sensors updated" to every upload, as when all of it was stored before
+	bool 				reportNone 		= false;
+	// false impersonates a server that ignores Range and always sends the whole image
+	bool 				rangeRequests 	= true;
+	// every firmware response drops the connection after this many body bytes, -1 never
+	long 				firmwareCutAfter = -1;
+	// answer heatshrink= with a compressed image, and patchfrom=previousBuild with
+	// a patch from previousFirmware, both are off by default
+	bool 				compressFirmware = false;
+	bool 				patchFirmware 	= false;
+	long 				previousBuild 	= -1;
+	std::vector<uint8_t> previousFirmware;
+	// build number the device reported with its last checkin
+	long 				reportedBuild 	= -1;
+
+	// non-zero impersonates an overloaded server, every request is answered with this
+	// code (e.g. 503) and a Retry-After header of retryAfter seconds when that is >= 0
+	int 				busyCode 		= 0;
+	long 				retryAfter 		= -1;
+	// only requests with this cmd= are busy, empty for all of them
+	std::string 		busyCommand;
+	// every request holds the device this many real ms before it is answered, the
+	// latency model only moves the virtual clock and blocks nobody else
+	unsigned long 		stallMs 		= 0;
+
+	// directive lines delivered with the next sensor upload, e.g. "REBOOT",
+	// or at once to a device with a listen request waiting
+	std::vector<std::string> directives;
+	// setack= of the last sensor or checkin upload that had one
+	std::string 		settingsAck;
+
+	// what the devices sent
+	std::vector<Sample> samples;
+	Counters 			counters = {};
+	std::map<std::string, unsigned long> commands;	// requests per cmd=
+
+	void 				reset(void);
+
+	// LoopbackServer
+	bool 				onAccept(DeviceIONative::LoopbackConnection &conn) override;
+	void 				onData(DeviceIONative::LoopbackConnection &conn) override;
+	// answers a waiting listen request when there is something to say, or its hold is over
+	void 				onPoll(DeviceIONative::LoopbackConnection &conn) override;
+	void 				onClose(DeviceIONative::LoopbackConnection &conn) override;
+
+	static std::string 	urlDecode(const std::string &s);
+	static std::map<std::string, std::string> parseForm(const std::string &s);
+	// reference decoder for DEVICEIO_BINARY_CONTENT_TYPE bodies, false when malformed
+	static bool 		decodeBinary(const std::string &body, std::vector<Sample> &out);
+	// reference encoders for the formats DeviceIOImageDecoder reads
+	static std::vector<uint8_t> heatshrinkEncode(const std::vector<uint8_t> &in, int window, int lookahead);
+	static std::vector<uint8_t> makePatch(const std::vector<uint8_t> &source, const std::vector<uint8_t> &target);
+
+protected:
+	virtual Response 	handle(const Request &req);
+	Response 			handleManageDevice(const Request &req);
+	bool 				authorized(const Request &req, bool needToken);
+	// records the samples of a sensor or checkin body, returns how many or -1
+	// with resp set when the body can't be used
+	long 				storeSamples(const Request &req, Response &resp);
+	void 				sendResponse(DeviceIONative::LoopbackConnection &conn, const Response &resp);
+	// the directives for a device running build, a newer build first
+	std::string 		listenReply(long build);
+
+	struct Listener
+	{
+		long 			build;
+		unsigned long 	untilMs;
+	};
+	// listen requests waiting for directives
+	std::map<DeviceIONative::LoopbackConnection *, Listener> listeners;
+
+	// returns bytes consumed from buf, 0 when the request is incomplete, -1 when malformed
+	static long 		parseRequest(const std::string &buf, Request &req);
+};
+
+#endif
@@ -0,0 +1,30 @@
+// Esp.h
+// Host build shim for the ESP class
+
+#ifndef DeviceIO_native_Esp_h
+#define DeviceIO_native_Esp_h
+
+#include <stdint.h>
+
+class EspClass
+{
+public:
+	// throws DeviceIONative::Restart
+	[[noreturn]] void restart(void);
+
+	uint32_t 		getFreeHeap(void);
+	uint32_t 		getMaxAllocHeap(void);
+	uint32_t 		getMaxFreeBlockSize(void) { return getMaxAllocHeap(); }
+	uint32_t 		getHeapSize(void) { return heapSize; }
+	uint16_t 		getVcc(void) { return 3300; }
+	uint32_t 		getFlashChipSize(void) { return 4 * 1024 * 1024; }
+	uint32_t 		getFlashChipRealSize(void) { return 4 * 1024 * 1024; }
+	uint32_t 		getCpuFreqMHz(void) { return 240; }
+
+	// modelled heap size, ESP32 ballpark
+	uint32_t 		heapSize = 320 * 1024;
+};
+
+extern EspClass ESP;
+
+#endif
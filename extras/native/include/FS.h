@@ -0,0 +1,102 @@
+// FS.h
+// Host build shim for the ESP32 filesystem API, backed by RAM
+//
+// Every call into the filesystem is counted so the cost of the
+// eSPIFFS access patterns can be compared between builds.
+
+#ifndef DeviceIO_native_FS_h
+#define DeviceIO_native_FS_h
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+
+namespace fs
+{
+	enum SeekMode
+	{
+		SeekSet = 0,
+		SeekCur = 1,
+		SeekEnd = 2
+	};
+
+	struct FileData
+	{
+		std::vector<uint8_t> bytes;
+	};
+
+	class File : public Stream
+	{
+	public:
+		File() {}
+		File(std::shared_ptr<FileData> data, const char *name, bool writable, size_t pos);
+
+		size_t 		write(uint8_t c) override { return write(&c, 1); }
+		size_t 		write(const uint8_t *buf, size_t size) override;
+		using Print::write;
+		int 		available(void) override;
+		int 		read(void) override;
+		size_t 		read(uint8_t *buf, size_t size);
+		size_t 		readBytes(char *buffer, size_t length) override { return read((uint8_t *)buffer, length); }
+		int 		peek(void) override;
+		void 		flush(void) override {}
+		bool 		seek(uint32_t pos, SeekMode mode = SeekSet);
+		size_t 		position(void) const { return _pos; }
+		size_t 		size(void) const;
+		void 		close(void) { _data.reset(); }
+		const char *name(void) const { return _name.c_str(); }
+		operator bool() const { return (bool)_data; }
+
+	private:
+		std::shared_ptr<FileData> _data;
+		std::string _name;
+		bool 		_writable = false;
+		size_t 		_pos = 0;
+	};
+
+	class FS
+	{
+	public:
+		bool 		begin(bool formatOnFail = false);
+		void 		end(void) { _mounted = false; }
+		bool 		format(void);
+		File 		open(const char *path, const char *mode = "r");
+		File 		open(const String &path, const char *mode = "r") { return open(path.c_str(), mode); }
+		bool 		exists(const char *path);
+		bool 		exists(const String &path) { return exists(path.c_str()); }
+		bool 		remove(const char *path);
+		bool 		remove(const String &path) { return remove(path.c_str()); }
+		bool 		rename(const char *pathFrom, const char *pathTo);
+		size_t 		totalBytes(void) { return _totalBytes; }
+		size_t 		usedBytes(void);
+
+		// host only: call counters and fault injection
+		struct Counters
+		{
+			unsigned long begins;
+			unsigned long opens;
+			unsigned long exists;
+			unsigned long removes;
+			unsigned long renames;
+			unsigned long bytesRead;
+			unsigned long bytesWritten;
+		};
+		Counters 	counters = {};
+		size_t 		_totalBytes = 1024 * 1024;
+		bool 		failMount = false;
+
+	private:
+		std::map<std::string, std::shared_ptr<FileData> > _files;
+		bool 		_mounted = false;
+	};
+}
+
+using fs::File;
+using fs::FS;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
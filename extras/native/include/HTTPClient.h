@@ -0,0 +1,108 @@
+// HTTPClient.h
+// Host build shim for the ESP32 HTTPClient
+//
+// A small HTTP/1.1 client that speaks real HTTP over the loopback
+// WiFiClient, so bytes on the wire and keep-alive behave like they
+// do on the device.
+
+#ifndef DeviceIO_native_HTTPClient_h
+#define DeviceIO_native_HTTPClient_h
+
+#include <memory>
+#include <vector>
+#include "Arduino.h"
+#include "WiFiClient.h"
+#include "WiFiClientSecure.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED  (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED  (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED       (-4)
+#define HTTPC_ERROR_CONNECTION_LOST     (-5)
+#define HTTPC_ERROR_NO_STREAM           (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER      (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM        (-8)
+#define HTTPC_ERROR_ENCODING            (-9)
+#define HTTPC_ERROR_STREAM_WRITE        (-10)
+#define HTTPC_ERROR_READ_TIMEOUT        (-11)
+
+#define HTTP_TCP_BUFFER_SIZE 			(1460)
+
+typedef enum
+{
+	HTTP_CODE_OK 				= 200,
+	HTTP_CODE_PARTIAL_CONTENT 	= 206,
+	HTTP_CODE_NOT_FOUND 		= 404
+} t_http_codes;
+
+class HTTPClient
+{
+public:
+	HTTPClient() {}
+	// like the cores, destroying the client closes the connection
+	~HTTPClient() { if (_client) _client->stop(); }
+
+	bool 			begin(WiFiClient &client, String url);
+	bool 			begin(String url, const char *CAcert);
+	bool 			begin(String url);
+	void 			end(void);
+	bool 			connected(void);
+
+	void 			setReuse(bool reuse) { _reuse = reuse; }
+	void 			setTimeout(uint16_t timeout) { _tcpTimeout = timeout; }
+	void 			setConnectTimeout(int32_t) {}
+	void 			setUserAgent(const String &userAgent) { _userAgent = userAgent; }
+
+	void 			addHeader(const String &name, const String &value);
+	void 			collectHeaders(const char *headerKeys[], const size_t headerKeysCount);
+	String 			header(const char *name);
+	bool 			hasHeader(const char *name);
+
+	int 			GET(void);
+	int 			POST(uint8_t *payload, size_t size);
+	int 			POST(String payload);
+	int 			sendRequest(const char *type, String payload);
+	int 			sendRequest(const char *type, uint8_t *payload = nullptr, size_t size = 0);
+	int 			sendRequest(const char *type, Stream *stream, size_t size = 0);
+
+	int 			getSize(void) { return _size; }
+	WiFiClient &	getStream(void) { return *_client; }
+	WiFiClient *	getStreamPtr(void) { return connected() ? _client : nullptr; }
+	String 			getString(void);
+	int 			writeToStream(Stream *stream);
+
+	static String 	errorToString(int error);
+
+private:
+	struct RequestArgument
+	{
+		String key;
+		String value;
+	};
+
+	bool 			connect(void);
+	bool 			sendHeader(const char *type, size_t size);
+	int 			handleHeaderResponse(void);
+	int 			returnError(int error);
+	bool 			readLine(String &line);
+
+	WiFiClient *	_client = nullptr;
+	std::unique_ptr<WiFiClientSecure> _ownedClient;
+
+	String 			_host;
+	uint16_t 		_port = 0;
+	String 			_uri;
+	bool 			_secure = false;
+	bool 			_reuse = true;
+	bool 			_canReuse = false;
+	uint16_t 		_tcpTimeout = 5000;
+	String 			_userAgent = "ESP32HTTPClient";
+	String 			_headers;
+
+	std::vector<RequestArgument> _currentHeaders;
+	int 			_returnCode = 0;
+	int 			_size = -1;
+	bool 			_chunked = false;
+};
+
+#endif
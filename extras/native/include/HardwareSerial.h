@@ -0,0 +1,40 @@
+// HardwareSerial.h
+// Host build shim, Serial writes to stdout. The UART is modelled: bytes
+// leave at the baud rate through a 128 byte FIFO and a write that finds
+// it full waits on the virtual clock, as the cores do
+
+#ifndef DeviceIO_native_HardwareSerial_h
+#define DeviceIO_native_HardwareSerial_h
+
+#include "Stream.h"
+
+class HardwareSerial : public Stream
+{
+public:
+	void 			begin(unsigned long baud) { started = true; _baud = baud; }
+	void 			end(void) { started = false; }
+	operator bool() const { return started; }
+
+	int 			available(void) override { return 0; }
+	int 			read(void) override { return -1; }
+	int 			peek(void) override { return -1; }
+	size_t 			write(uint8_t c) override;
+	size_t 			write(const uint8_t *buffer, size_t size) override;
+	using Print::write;
+	// free FIFO bytes, a write of this many doesn't wait
+	int 			availableForWrite(void);
+
+	// count of bytes printed, useful to measure debug output cost
+	unsigned long 	bytesWritten = 0;
+	// set to false to count without printing
+	bool 			echo = true;
+
+private:
+	bool 			started = false;
+	unsigned long 	_baud 	= 115200;
+	unsigned long long _idleMicros = 0;		// the FIFO is empty from then on
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,27 @@
+// IPAddress.h
+// Host build shim
+
+#ifndef DeviceIO_native_IPAddress_h
+#define DeviceIO_native_IPAddress_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include "WString.h"
+
+class IPAddress
+{
+public:
+	IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : addr{a, b, c, d} {}
+	uint8_t operator[](int i) const { return addr[i]; }
+	String toString(void) const
+	{
+		char buf[16];
+		snprintf(buf, sizeof(buf), "%u.%u.%u.%u", addr[0], addr[1], addr[2], addr[3]);
+		return String(buf);
+	}
+
+private:
+	uint8_t addr[4];
+};
+
+#endif
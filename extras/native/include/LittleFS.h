@@ -0,0 +1,11 @@
+// LittleFS.h
+// Host build shim, LittleFS and SPIFFS share the RAM backed filesystem
+
+#ifndef DeviceIO_native_LittleFS_h
+#define DeviceIO_native_LittleFS_h
+
+#include "SPIFFS.h"
+
+#define LittleFS SPIFFS
+
+#endif
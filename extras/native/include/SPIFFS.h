@@ -0,0 +1,11 @@
+// SPIFFS.h
+// Host build shim, SPIFFS is the RAM backed filesystem from FS.h
+
+#ifndef DeviceIO_native_SPIFFS_h
+#define DeviceIO_native_SPIFFS_h
+
+#include "FS.h"
+
+extern fs::FS SPIFFS;
+
+#endif
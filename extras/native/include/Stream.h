@@ -0,0 +1,27 @@
+// Stream.h
+// Host build shim for the Arduino Stream class
+
+#ifndef DeviceIO_native_Stream_h
+#define DeviceIO_native_Stream_h
+
+#include "Print.h"
+
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+
+	void setTimeout(unsigned long timeout) { _timeout = timeout; }
+	unsigned long getTimeout(void) { return _timeout; }
+
+	virtual size_t readBytes(char *buffer, size_t length);
+	virtual size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+	String readString();
+
+protected:
+	unsigned long _timeout = 1000;
+};
+
+#endif
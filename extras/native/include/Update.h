@@ -0,0 +1,58 @@
+// Update.h
+// Host build shim for the ESP32 Update class
+//
+// The image is kept in RAM so the harness can compare it with what
+// the stand-in server served. Flash timing is modelled on the
+// virtual clock: a sector erase each time a new 4 KB sector is
+// touched plus a per-byte program cost.
+
+#ifndef DeviceIO_native_Update_h
+#define DeviceIO_native_Update_h
+
+#include <vector>
+#include "Arduino.h"
+
+#define UPDATE_ERROR_OK 		(0)
+#define UPDATE_ERROR_WRITE 		(1)
+#define UPDATE_ERROR_SPACE 		(4)
+#define UPDATE_ERROR_SIZE 		(5)
+#define UPDATE_ERROR_STREAM 	(6)
+#define UPDATE_ERROR_ABORT 		(8)
+
+#define UPDATE_SIZE_UNKNOWN 	0xFFFFFFFF
+#define U_FLASH 				0
+
+class UpdateClass
+{
+public:
+	bool 			begin(size_t size = UPDATE_SIZE_UNKNOWN, int command = U_FLASH);
+	size_t 			write(uint8_t *data, size_t len);
+	size_t 			writeStream(Stream &data);
+	bool 			end(bool evenIfRemaining = false);
+	void 			abort(void);
+
+	bool 			isRunning(void) { return _running; }
+	bool 			isFinished(void) { return _running == false && _size > 0 && _progress == _size; }
+	bool 			hasError(void) { return _error != UPDATE_ERROR_OK; }
+	uint8_t 		getError(void) { return _error; }
+	size_t 			size(void) { return _size; }
+	size_t 			progress(void) { return _progress; }
+	size_t 			remaining(void) { return _size - _progress; }
+
+	// host only
+	std::vector<uint8_t> image;						// bytes written by the last update
+	size_t 			partitionSize 		= 1310720;
+	unsigned long 	sectorEraseMicros 	= 30000;	// per 4 KB sector
+	unsigned long 	programMicrosPerKB 	= 1000;
+	unsigned long 	completed 			= 0;		// successful end() calls
+
+private:
+	bool 			_running = false;
+	size_t 			_size = 0;
+	size_t 			_progress = 0;
+	uint8_t 		_error = UPDATE_ERROR_OK;
+};
+
+extern UpdateClass Update;
+
+#endif
@@ -0,0 +1,109 @@
+// WString.h
+// Host build shim for the Arduino String class
+//
+// Only the subset of the Arduino API that DeviceIO and its
+// examples use is provided. Storage comes from operator new[]
+// so the native heap counters see every String allocation,
+// exactly like they would on the device.
+
+#ifndef DeviceIO_native_WString_h
+#define DeviceIO_native_WString_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class String
+{
+public:
+	String(const char *cstr = "");
+	String(const String &str);
+	String(String &&str);
+	String(const __FlashStringHelper *str);
+	explicit String(char c);
+	explicit String(unsigned char value, unsigned char base = 10);
+	explicit String(int value, unsigned char base = 10);
+	explicit String(unsigned int value, unsigned char base = 10);
+	explicit String(long value, unsigned char base = 10);
+	explicit String(unsigned long value, unsigned char base = 10);
+	explicit String(float value, unsigned char decimalPlaces = 2);
+	explicit String(double value, unsigned char decimalPlaces = 2);
+	~String(void);
+
+	unsigned char reserve(unsigned int size);
+	unsigned int length(void) const { return len; }
+	const char *c_str(void) const { return buffer ? buffer : ""; }
+
+	String &operator=(const String &rhs);
+	String &operator=(String &&rhs);
+	String &operator=(const char *cstr);
+	String &operator=(const __FlashStringHelper *str);
+
+	unsigned char concat(const String &str);
+	unsigned char concat(const char *cstr);
+	unsigned char concat(const char *cstr, unsigned int length);
+	unsigned char concat(char c);
+	unsigned char concat(int num);
+	unsigned char concat(unsigned int num);
+	unsigned char concat(long num);
+	unsigned char concat(unsigned long num);
+	unsigned char concat(float num);
+	unsigned char concat(double num);
+
+	String &operator+=(const String &rhs) { concat(rhs); return *this; }
+	String &operator+=(const char *cstr) { concat(cstr); return *this; }
+	String &operator+=(char c) { concat(c); return *this; }
+	String &operator+=(int num) { concat(num); return *this; }
+	String &operator+=(unsigned int num) { concat(num); return *this; }
+	String &operator+=(long num) { concat(num); return *this; }
+	String &operator+=(unsigned long num) { concat(num); return *this; }
+
+	int compareTo(const String &s) const;
+	unsigned char equals(const String &s) const;
+	unsigned char equals(const char *cstr) const;
+	unsigned char operator==(const String &rhs) const { return equals(rhs); }
+	unsigned char operator==(const char *cstr) const { return equals(cstr); }
+	unsigned char operator!=(const String &rhs) const { return !equals(rhs); }
+	unsigned char operator!=(const char *cstr) const { return !equals(cstr); }
+	unsigned char startsWith(const String &prefix) const;
+	unsigned char endsWith(const String &suffix) const;
+
+	char charAt(unsigned int index) const;
+	char operator[](unsigned int index) const { return charAt(index); }
+	char &operator[](unsigned int index);
+
+	int indexOf(char ch, unsigned int fromIndex = 0) const;
+	int indexOf(const String &str, unsigned int fromIndex = 0) const;
+	int lastIndexOf(char ch) const;
+	String substring(unsigned int beginIndex) const { return substring(beginIndex, len); }
+	String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+	void trim(void);
+	void toLowerCase(void);
+	void toUpperCase(void);
+	long toInt(void) const;
+	float toFloat(void) const;
+
+protected:
+	char *buffer;
+	unsigned int capacity;
+	unsigned int len;
+
+	void init(void);
+	void invalidate(void);
+	unsigned char changeBuffer(unsigned int maxStrLen);
+	String &copy(const char *cstr, unsigned int length);
+	void move(String &rhs);
+};
+
+String operator+(const String &lhs, const String &rhs);
+String operator+(const String &lhs, const char *rhs);
+String operator+(const char *lhs, const String &rhs);
+String operator+(const String &lhs, char rhs);
+String operator+(String &&lhs, const String &rhs);
+String operator+(String &&lhs, const char *rhs);
+String operator+(String &&lhs, char rhs);
+
+#endif
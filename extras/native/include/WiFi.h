@@ -0,0 +1,33 @@
+// WiFi.h
+// Host build shim, see DeviceIONative::setWiFiConnected()
+
+#ifndef DeviceIO_native_WiFi_h
+#define DeviceIO_native_WiFi_h
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "WiFiClient.h"
+
+typedef enum
+{
+	WL_IDLE_STATUS 		= 0,
+	WL_NO_SSID_AVAIL 	= 1,
+	WL_CONNECTED 		= 3,
+	WL_CONNECT_FAILED 	= 4,
+	WL_CONNECTION_LOST 	= 5,
+	WL_DISCONNECTED 	= 6
+} wl_status_t;
+
+class WiFiClass
+{
+public:
+	wl_status_t 	begin(const char *, const char * = nullptr) { return status(); }
+	wl_status_t 	status(void);
+	long 			RSSI(void);
+	IPAddress 		localIP(void) { return IPAddress(127, 0, 0, 1); }
+	int 			hostByName(const char *host, IPAddress &result);
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,43 @@
+// WiFiClient.h
+// Host build shim, TCP client over the in-process loopback network
+
+#ifndef DeviceIO_native_WiFiClient_h
+#define DeviceIO_native_WiFiClient_h
+
+#include <memory>
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "DeviceIONative.h"
+
+class WiFiClient : public Stream
+{
+public:
+	WiFiClient() {}
+	virtual ~WiFiClient() {}
+
+	virtual int 	connect(const char *host, uint16_t port);
+	virtual int 	connect(IPAddress ip, uint16_t port) { return connect(ip.toString().c_str(), port); }
+	virtual uint8_t connected(void);
+	virtual void 	stop(void);
+	operator bool() { return connected(); }
+
+	int 			available(void) override;
+	int 			read(void) override;
+	int 			read(uint8_t *buf, size_t size);
+	int 			peek(void) override;
+	size_t 			write(uint8_t c) override { return write(&c, 1); }
+	size_t 			write(const uint8_t *buf, size_t size) override;
+	using Print::write;
+	void 			flush(void) override {}
+
+	void 			setNoDelay(bool) {}
+
+protected:
+	// called once the TCP connection is up, secure clients model the handshake here
+	virtual bool 	onConnected(DeviceIONative::LoopbackConnection &) { return true; }
+	void 			pump(void);
+
+	std::shared_ptr<DeviceIONative::LoopbackConnection> _conn;
+};
+
+#endif
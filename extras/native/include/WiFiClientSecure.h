@@ -0,0 +1,44 @@
+// WiFiClientSecure.h
+// Host build shim, the TLS handshake is modelled rather than performed
+
+#ifndef DeviceIO_native_WiFiClientSecure_h
+#define DeviceIO_native_WiFiClientSecure_h
+
+#include <string.h>
+#include "WiFiClient.h"
+
+class WiFiClientSecure;
+
+// TLS session cache entry, shaped like the ESP8266 BearSSL one so
+// session resumption can be exercised on the host
+namespace BearSSL
+{
+	class Session
+	{
+		friend class ::WiFiClientSecure;
+
+	public:
+		Session() { memset(_id, 0, sizeof(_id)); }
+
+	private:
+		uint8_t 	_id[32];
+	};
+}
+
+class WiFiClientSecure : public WiFiClient
+{
+public:
+	void 			setCACert(const char *rootCA) { _CA_cert = rootCA; }
+	void 			setInsecure(void) { _CA_cert = nullptr; }
+	void 			setHandshakeTimeout(unsigned long) {}
+	// the session is offered for resumption and updated after each handshake
+	void 			setSession(BearSSL::Session *session) { _session = session; }
+
+protected:
+	bool 			onConnected(DeviceIONative::LoopbackConnection &conn) override;
+
+	const char *	_CA_cert = nullptr;
+	BearSSL::Session *_session = nullptr;
+};
+
+#endif
@@ -0,0 +1,36 @@
+// WiFiUdp.h
+// Host build shim, UDP to the modelled NTP server, see
+// DeviceIONative::setNtpSyncDelay() and setClockSkewPpm()
+
+#ifndef DeviceIO_native_WiFiUdp_h
+#define DeviceIO_native_WiFiUdp_h
+
+#include <string>
+#include "Arduino.h"
+
+class WiFiUDP
+{
+public:
+	uint8_t 		begin(uint16_t port);
+	void 			stop(void);
+
+	// only port 123 answers, one reply per request after the modelled RTT
+	int 			beginPacket(const char *host, uint16_t port);
+	size_t 			write(const uint8_t *buffer, size_t size);
+	int 			endPacket(void);
+
+	int 			parsePacket(void);
+	int 			available(void) { return (int)(_rx.size() - _rxPos); }
+	int 			read(uint8_t *buffer, size_t len);
+
+private:
+	bool 			_open 			= false;
+	uint16_t 		_port 			= 0;
+	std::string 	_tx;
+	std::string 	_rx;				// the packet parsePacket() returned
+	size_t 			_rxPos 			= 0;
+	std::string 	_reply;				// in flight
+	unsigned long 	_replyMicros 	= 0;
+};
+
+#endif
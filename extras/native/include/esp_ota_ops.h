@@ -0,0 +1,15 @@
+// esp_ota_ops.h
+// Host build shim for the ESP-IDF OTA API, see esp_partition.h
+
+#ifndef DeviceIO_native_esp_ota_ops_h
+#define DeviceIO_native_esp_ota_ops_h
+
+#include "esp_partition.h"
+
+// holds DeviceIONative::runningPartition(), the image a patch applies to
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+// accepts the partition when it holds an image, its first byte is 0xE9
+esp_err_t 	esp_ota_set_boot_partition(const esp_partition_t *partition);
+
+#endif
@@ -0,0 +1,50 @@
+// esp_partition.h
+// Host build shim for the ESP-IDF partition API
+//
+// Two app partitions backed by RAM, the running one and the OTA target,
+// see DeviceIONative::runningPartition() and otaPartition().
+// It behaves like NOR flash: an erase sets a sector to 0xFF and a write
+// can only clear bits. Erase and program time is charged to the
+// virtual clock like the Update shim does.
+
+#ifndef DeviceIO_native_esp_partition_h
+#define DeviceIO_native_esp_partition_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 							0
+#define ESP_FAIL 						-1
+#define ESP_ERR_INVALID_ARG 			0x102
+#define ESP_ERR_INVALID_SIZE 			0x104
+#define ESP_ERR_OTA_VALIDATE_FAILED 	0x1503
+
+typedef enum
+{
+	ESP_PARTITION_TYPE_APP 			= 0x00,
+	ESP_PARTITION_TYPE_DATA 		= 0x01
+} esp_partition_type_t;
+
+typedef enum
+{
+	ESP_PARTITION_SUBTYPE_APP_OTA_0 = 0x10,
+	ESP_PARTITION_SUBTYPE_APP_OTA_1 = 0x11
+} esp_partition_subtype_t;
+
+typedef struct
+{
+	esp_partition_type_t 	type;
+	esp_partition_subtype_t subtype;
+	uint32_t 				address;
+	uint32_t 				size;
+	char 					label[17];
+	bool 					encrypted;
+} esp_partition_t;
+
+esp_err_t 	esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t 	esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+esp_err_t 	esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size);
+
+#endif
@@ -0,0 +1,2 @@
+// ssl_client.h
+// Host build shim, intentionally empty
@@ -0,0 +1,428 @@
+// Arduino.cpp
+// Host build shim for the Arduino core: Print, Stream, Serial, ESP,
+// WiFi, the virtual clock and heap accounting
+
+#include <stdarg.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <random>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "DeviceIONative.h"
+
+// virtual clock ///////////////
+
+static std::chrono::steady_clock::time_point nativeStart = std::chrono::steady_clock::now();
+// atomic, background check-ins run the clock from a second thread
+static std::atomic<unsigned long long> nativeOffsetMicros(0);
+static std::atomic<unsigned long long> nativeBlockedMicros(0);
+// the other core's timeline, see DeviceIONative::enterOtherCore()
+static thread_local bool nativeOnOtherCore = false;
+static std::atomic<unsigned long long> nativeOtherCoreMicros(0);
+
+static unsigned long long nativeNowMicros(void)
+{
+	unsigned long long real = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - nativeStart).count();
+	unsigned long long now = real + nativeOffsetMicros;
+	if (nativeOnOtherCore && nativeOtherCoreMicros > now)
+		return nativeOtherCoreMicros;
+	return now;
+}
+
+unsigned long millis(void)
+{
+	return (unsigned long)(nativeNowMicros() / 1000);
+}
+
+unsigned long micros(void)
+{
+	return (unsigned long)nativeNowMicros();
+}
+
+void delay(unsigned long ms)
+{
+	DeviceIONative::advanceMillis(ms);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	if (nativeOnOtherCore)
+	{
+		nativeOtherCoreMicros = nativeNowMicros() + us;
+		return;
+	}
+	nativeOffsetMicros += us;
+	nativeBlockedMicros += us;
+}
+
+void yield(void)
+{
+}
+
+void DeviceIONative::advanceMillis(unsigned long ms)
+{
+	nativeOffsetMicros += (unsigned long long)ms * 1000;
+	nativeBlockedMicros += (unsigned long long)ms * 1000;
+}
+
+void DeviceIONative::enterOtherCore(void)
+{
+	nativeOnOtherCore = true;
+}
+
+void DeviceIONative::syncOtherCore(void)
+{
+	unsigned long long now = nativeNowMicros();
+	if (nativeOtherCoreMicros > now)
+		delayMicroseconds((unsigned int)(nativeOtherCoreMicros - now));
+}
+
+unsigned long long DeviceIONative::blockedMicros(void)
+{
+	return nativeBlockedMicros;
+}
+
+void DeviceIONative::resetBlocked(void)
+{
+	nativeBlockedMicros = 0;
+}
+
+// heap accounting /////////////
+
+// every block carries its size in front so frees can be accounted
+static DeviceIONative::HeapCounters nativeHeap = {};
+static int nativeHeapPaused = 0;
+
+static const size_t NATIVE_HEAP_HEADER = 16;
+
+static void *nativeAlloc(size_t size)
+{
+	unsigned char *p = (unsigned char *)malloc(size + NATIVE_HEAP_HEADER);
+	if (p == nullptr) throw std::bad_alloc();
+	*(size_t *)p = nativeHeapPaused ? (size_t)-1 : size;
+	if (!nativeHeapPaused)
+	{
+		nativeHeap.allocs++;
+		nativeHeap.allocBytes += size;
+		nativeHeap.liveBytes += size;
+		if (nativeHeap.liveBytes > nativeHeap.peakLiveBytes)
+			nativeHeap.peakLiveBytes = nativeHeap.liveBytes;
+	}
+	return p + NATIVE_HEAP_HEADER;
+}
+
+static void nativeFree(void *ptr)
+{
+	if (ptr == nullptr) return;
+	unsigned char *p = (unsigned char *)ptr - NATIVE_HEAP_HEADER;
+	size_t size = *(size_t *)p;
+	if (size != (size_t)-1)
+	{
+		nativeHeap.frees++;
+		nativeHeap.liveBytes -= size;
+	}
+	free(p);
+}
+
+void *operator new(size_t size) { return nativeAlloc(size); }
+void *operator new[](size_t size) { return nativeAlloc(size); }
+void operator delete(void *ptr) noexcept { nativeFree(ptr); }
+void operator delete[](void *ptr) noexcept { nativeFree(ptr); }
+void operator delete(void *ptr, size_t) noexcept { nativeFree(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { nativeFree(ptr); }
+
+const DeviceIONative::HeapCounters &DeviceIONative::heap(void)
+{
+	return nativeHeap;
+}
+
+void DeviceIONative::resetHeapPeak(void)
+{
+	nativeHeap.peakLiveBytes = nativeHeap.liveBytes;
+}
+
+void DeviceIONative::pauseHeapTracking(void)
+{
+	nativeHeapPaused++;
+}
+
+void DeviceIONative::resumeHeapTracking(void)
+{
+	if (nativeHeapPaused > 0) nativeHeapPaused--;
+}
+
+// ESP /////////////////////////
+
+EspClass ESP;
+
+void EspClass::restart(void)
+{
+	throw DeviceIONative::Restart();
+}
+
+uint32_t EspClass::getFreeHeap(void)
+{
+	int64_t used = nativeHeap.liveBytes;
+	return used >= (int64_t)heapSize ? 0 : heapSize - (uint32_t)used;
+}
+
+uint32_t EspClass::getMaxAllocHeap(void)
+{
+	// no fragmentation model, the largest block is the free heap
+	return getFreeHeap();
+}
+
+// ESP32 internal temperature sensor, raw value is in Fahrenheit
+extern "C" uint8_t temprature_sens_read()
+{
+	return 113;
+}
+
+// misc ////////////////////////
+
+static std::mt19937 nativeRandom(1);
+
+long random(long max)
+{
+	if (max <= 0) return 0;
+	return (long)(nativeRandom() % (unsigned long)max);
+}
+
+long random(long min, long max)
+{
+	if (min >= max) return min;
+	return min + random(max - min);
+}
+
+void randomSeed(unsigned long seed)
+{
+	nativeRandom.seed(seed);
+}
+
+char *dtostrf(double val, signed char width, unsigned char prec, char *sout)
+{
+	sprintf(sout, "%*.*f", width, prec, val);
+	return sout;
+}
+
+// sntp model //////////////////
+
+static const unsigned long long NATIVE_NOT_SET = ~0ULL;
+// the NTP server in Network.cpp answers from here on
+static unsigned long long nativeNtpAnswerMicros = 0;
+// (time) skips the macro in Arduino.h and reaches the C library
+static time_t nativeEpochAtStart = (time)(nullptr);
+// true time runs 1e6 / (1e6 + skew) as fast as the device clock from the base on
+static long nativeClockSkewPpm = 0;
+static unsigned long long nativeSkewBaseMicros = 0;
+static unsigned long long nativeSkewBaseEpochMicros = (unsigned long long)nativeEpochAtStart * 1000000;
+// the last settimeofday(), time() counts from boot until there is one
+static unsigned long long nativeTimeSetMicros = NATIVE_NOT_SET;
+static unsigned long long nativeTimeSetEpochMicros = 0;
+
+void DeviceIONative::setNtpSyncDelay(unsigned long ms)
+{
+	nativeNtpAnswerMicros = nativeNowMicros() + (unsigned long long)ms * 1000;
+	nativeTimeSetMicros = NATIVE_NOT_SET;
+}
+
+bool DeviceIONative::ntpAnswers(void)
+{
+	return nativeNowMicros() >= nativeNtpAnswerMicros;
+}
+
+void DeviceIONative::setClockSkewPpm(long ppm)
+{
+	unsigned long long now = nativeNowMicros();
+	nativeSkewBaseEpochMicros = trueEpochMicros(now);
+	nativeSkewBaseMicros = now;
+	nativeClockSkewPpm = ppm;
+}
+
+unsigned long long DeviceIONative::trueEpochMicros(unsigned long long deviceMicros)
+{
+	long long elapsed = (long long)(deviceMicros - nativeSkewBaseMicros);
+	return nativeSkewBaseEpochMicros + elapsed - elapsed * nativeClockSkewPpm / (1000000 + nativeClockSkewPpm);
+}
+
+int nativeSetTimeOfDay(const struct timeval *tv, const struct timezone *)
+{
+	nativeTimeSetMicros = nativeNowMicros();
+	nativeTimeSetEpochMicros = (unsigned long long)tv->tv_sec * 1000000 + tv->tv_usec;
+	return 0;
+}
+
+time_t nativeTime(time_t *t)
+{
+	unsigned long long now = nativeNowMicros();
+	time_t result;
+	// the system time runs on the device clock, skew included
+	if (nativeTimeSetMicros != NATIVE_NOT_SET)
+		result = (time_t)((nativeTimeSetEpochMicros + (now - nativeTimeSetMicros)) / 1000000);
+	else
+		result = (time_t)(now / 1000000);
+	if (t) *t = result;
+	return result;
+}
+
+// Print ///////////////////////
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t n = 0;
+	while (size--)
+	{
+		if (write(*buffer++)) n++;
+		else break;
+	}
+	return n;
+}
+
+size_t Print::write(const char *str)
+{
+	if (str == nullptr) return 0;
+	return write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::printf(const char *format, ...)
+{
+	char buf[256];
+	va_list arg;
+	va_start(arg, format);
+	int len = vsnprintf(buf, sizeof(buf), format, arg);
+	va_end(arg);
+	if (len < 0) return 0;
+	return write((const uint8_t *)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+size_t Print::print(const __FlashStringHelper *ifsh) { return write(reinterpret_cast<const char *>(ifsh)); }
+size_t Print::print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+size_t Print::print(const char str[]) { return write(str); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(unsigned char b, int base) { return print(String(b, (unsigned char)base)); }
+size_t Print::print(int n, int base) { return print(String(n, (unsigned char)base)); }
+size_t Print::print(unsigned int n, int base) { return print(String(n, (unsigned char)base)); }
+size_t Print::print(long n, int base) { return print(String(n, (unsigned char)base)); }
+size_t Print::print(unsigned long n, int base) { return print(String(n, (unsigned char)base)); }
+size_t Print::print(double n, int digits) { return print(String(n, (unsigned char)digits)); }
+
+size_t Print::println(void) { return write("\r\n"); }
+size_t Print::println(const __FlashStringHelper *ifsh) { size_t n = print(ifsh); return n + println(); }
+size_t Print::println(const String &s) { size_t n = print(s); return n + println(); }
+size_t Print::println(const char c[]) { size_t n = print(c); return n + println(); }
+size_t Print::println(char c) { size_t n = print(c); return n + println(); }
+size_t Print::println(unsigned char b, int base) { size_t n = print(b, base); return n + println(); }
+size_t Print::println(int num, int base) { size_t n = print(num, base); return n + println(); }
+size_t Print::println(unsigned int num, int base) { size_t n = print(num, base); return n + println(); }
+size_t Print::println(long num, int base) { size_t n = print(num, base); return n + println(); }
+size_t Print::println(unsigned long num, int base) { size_t n = print(num, base); return n + println(); }
+size_t Print::println(double num, int digits) { size_t n = print(num, digits); return n + println(); }
+
+// Stream //////////////////////
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+	size_t count = 0;
+	unsigned long start = millis();
+	while (count < length)
+	{
+		int c = read();
+		if (c < 0)
+		{
+			if (millis() - start >= _timeout) break;
+			delay(1);
+			continue;
+		}
+		*buffer++ = (char)c;
+		count++;
+	}
+	return count;
+}
+
+String Stream::readString()
+{
+	String ret;
+	int c;
+	while ((c = read()) >= 0) ret += (char)c;
+	return ret;
+}
+
+// Serial //////////////////////
+
+HardwareSerial Serial;
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	return write(&c, 1);
+}
+
+#define NATIVE_UART_FIFO 	128
+
+// 10 bits a byte
+static unsigned long long uartByteMicros(unsigned long baud)
+{
+	return 10000000ULL / (baud ? baud : 115200);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+	unsigned long long byteMicros = uartByteMicros(_baud);
+	unsigned long long now = micros();
+	unsigned long long full;
+
+	bytesWritten += size;
+	if (echo) fwrite(buffer, 1, size, stdout);
+
+	// the bytes that don't fit wait for the FIFO
+	if (_idleMicros < now) _idleMicros = now;
+	_idleMicros += size * byteMicros;
+	full = now + NATIVE_UART_FIFO * byteMicros;
+	if (_idleMicros > full) delayMicroseconds((unsigned int)(_idleMicros - full));
+	return size;
+}
+
+int HardwareSerial::availableForWrite(void)
+{
+	unsigned long long byteMicros = uartByteMicros(_baud);
+	unsigned long long now = micros();
+	unsigned long long queued = (_idleMicros > now) ? (_idleMicros - now + byteMicros - 1) / byteMicros : 0;
+
+	return (queued >= NATIVE_UART_FIFO) ? 0 : (int)(NATIVE_UART_FIFO - queued);
+}
+
+// WiFi ////////////////////////
+
+WiFiClass WiFi;
+static bool nativeWiFiConnected = true;
+static long nativeRSSI = -60;
+
+void DeviceIONative::setWiFiConnected(bool connected)
+{
+	nativeWiFiConnected = connected;
+}
+
+void DeviceIONative::setRSSI(long dBm)
+{
+	nativeRSSI = dBm;
+}
+
+wl_status_t WiFiClass::status(void)
+{
+	return nativeWiFiConnected ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+long WiFiClass::RSSI(void)
+{
+	return nativeWiFiConnected ? nativeRSSI : 0;
+}
+
+int WiFiClass::hostByName(const char *, IPAddress &result)
+{
+	if (!nativeWiFiConnected) return 0;
+	// one round trip to the resolver, no cache
+	DeviceIONative::advanceMillis(DeviceIONative::netModel().rttMs);
+	result = IPAddress(127, 0, 0, 1);
+	return 1;
+}
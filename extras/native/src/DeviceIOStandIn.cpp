@@ -0,0 +1,801 @@
+// DeviceIOStandIn.cpp
+// Local stand-in for deviceio-devices.goodprototyping.com
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include "DeviceIOStandIn.h"
+#include "DeviceIOBinaryEncoder.h"
+#include "DeviceIOImageDecoder.h"
+#include "DeviceIOCRC32.h"
+
+DeviceIOStandIn::DeviceIOStandIn()
+{
+}
+
+DeviceIOStandIn::~DeviceIOStandIn()
+{
+	if (DeviceIONative::server() == this)
+		DeviceIONative::setServer(nullptr);
+}
+
+void DeviceIOStandIn::reset(void)
+{
+	directives.clear();
+	samples.clear();
+	counters = Counters();
+	commands.clear();
+	reportedBuild = -1;
+	settingsAck.clear();
+}
+
+// parsing /////////////////////
+
+static std::string lowerCase(std::string s)
+{
+	for (size_t i = 0; i < s.size(); i++)
+		if (s[i] >= 'A' && s[i] <= 'Z') s[i] = s[i] - 'A' + 'a';
+	return s;
+}
+
+std::string DeviceIOStandIn::urlDecode(const std::string &s)
+{
+	std::string out;
+	out.reserve(s.size());
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		if (s[i] == '+') out += ' ';
+		else if (s[i] == '%' && i + 2 < s.size())
+		{
+			char hex[3] = {s[i + 1], s[i + 2], 0};
+			out += (char)strtol(hex, nullptr, 16);
+			i += 2;
+		} else
+			out += s[i];
+	}
+	return out;
+}
+
+std::map<std::string, std::string> DeviceIOStandIn::parseForm(const std::string &s)
+{
+	std::map<std::string, std::string> out;
+	size_t pos = 0;
+	while (pos <= s.size())
+	{
+		size_t amp = s.find('&', pos);
+		if (amp == std::string::npos) amp = s.size();
+		std::string pair = s.substr(pos, amp - pos);
+		if (!pair.empty())
+		{
+			size_t eq = pair.find('=');
+			if (eq == std::string::npos) out[urlDecode(pair)] = "";
+			else out[urlDecode(pair.substr(0, eq))] = urlDecode(pair.substr(eq + 1));
+		}
+		pos = amp + 1;
+	}
+	return out;
+}
+
+long DeviceIOStandIn::parseRequest(const std::string &buf, Request &req)
+{
+	size_t headerEnd = buf.find("\r\n\r\n");
+	if (headerEnd == std::string::npos) return 0;
+
+	size_t lineEnd = buf.find("\r\n");
+	std::string line = buf.substr(0, lineEnd);
+	size_t sp1 = line.find(' ');
+	size_t sp2 = line.find(' ', sp1 + 1);
+	if (sp1 == std::string::npos || sp2 == std::string::npos) return -1;
+	req.method = line.substr(0, sp1);
+	std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+	size_t q = target.find('?');
+	req.path = target.substr(0, q);
+	req.query.clear();
+	if (q != std::string::npos) req.query = parseForm(target.substr(q + 1));
+
+	req.headers.clear();
+	size_t pos = lineEnd + 2;
+	while (pos < headerEnd)
+	{
+		size_t end = buf.find("\r\n", pos);
+		std::string h = buf.substr(pos, end - pos);
+		size_t colon = h.find(':');
+		if (colon != std::string::npos)
+		{
+			size_t v = colon + 1;
+			while (v < h.size() && h[v] == ' ') v++;
+			req.headers[lowerCase(h.substr(0, colon))] = h.substr(v);
+		}
+		pos = end + 2;
+	}
+
+	size_t bodyStart = headerEnd + 4;
+	req.body.clear();
+	std::map<std::string, std::string>::const_iterator te = req.headers.find("transfer-encoding");
+	if (te != req.headers.end() && te->second == "chunked")
+	{
+		size_t p = bodyStart;
+		while (true)
+		{
+			size_t crlf = buf.find("\r\n", p);
+			if (crlf == std::string::npos) return 0;
+			unsigned long chunk = strtoul(buf.substr(p, crlf - p).c_str(), nullptr, 16);
+			p = crlf + 2;
+			if (chunk == 0)
+			{
+				if (buf.size() < p + 2) return 0;
+				return (long)(p + 2);
+			}
+			if (buf.size() < p + chunk + 2) return 0;
+			req.body.append(buf, p, chunk);
+			p += chunk + 2;
+		}
+	}
+
+	size_t length = 0;
+	std::map<std::string, std::string>::const_iterator cl = req.headers.find("content-length");
+	if (cl != req.headers.end()) length = strtoul(cl->second.c_str(), nullptr, 10);
+	if (buf.size() < bodyStart + length) return 0;
+	req.body = buf.substr(bodyStart, length);
+	return (long)(bodyStart + length);
+}
+
+// connection //////////////////
+
+bool DeviceIOStandIn::onAccept(DeviceIONative::LoopbackConnection &)
+{
+	counters.connections++;
+	return true;
+}
+
+void DeviceIOStandIn::onData(DeviceIONative::LoopbackConnection &conn)
+{
+	while (conn.open && !conn.rx.empty())
+	{
+		Request req;
+		long used = parseRequest(conn.rx, req);
+		if (used == 0) return;
+		if (used < 0)
+		{
+			counters.rejected++;
+			Response bad;
+			bad.code = 400;
+			bad.close = true;
+			conn.rx.clear();
+			sendResponse(conn, bad);
+			return;
+		}
+		counters.requests++;
+		counters.requestBytes += used;
+		conn.rx.erase(0, used);
+
+		Response resp = handle(req);
+		if (resp.holdMs >= 0)
+		{
+			std::map<std::string, std::string>::const_iterator build = req.query.find("build");
+			Listener &listener = listeners[&conn];
+			listener.build = build == req.query.end() ? -1 : strtol(build->second.c_str(), nullptr, 10);
+			listener.untilMs = millis() + resp.holdMs;
+			continue;
+		}
+		std::map<std::string, std::string>::const_iterator c = req.headers.find("connection");
+		if (c != req.headers.end() && c->second == "close") resp.close = true;
+		sendResponse(conn, resp);
+	}
+}
+
+void DeviceIOStandIn::onPoll(DeviceIONative::LoopbackConnection &conn)
+{
+	std::map<DeviceIONative::LoopbackConnection *, Listener>::iterator it = listeners.find(&conn);
+	if (it == listeners.end()) return;
+	if (directives.empty() && latestBuild <= it->second.build && (long)(millis() - it->second.untilMs) < 0) return;
+	Response resp;
+	resp.body = listenReply(it->second.build);
+	listeners.erase(it);
+	sendResponse(conn, resp);
+}
+
+void DeviceIOStandIn::onClose(DeviceIONative::LoopbackConnection &conn)
+{
+	listeners.erase(&conn);
+}
+
+// RFC 1321, for the X-Image-MD5 header
+static std::string md5Hex(const std::vector<uint8_t> &in)
+{
+	static const uint32_t k[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+	static const uint8_t r[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+	uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+	std::vector<uint8_t> msg(in);
+	uint64_t bits = (uint64_t)in.size() * 8;
+	msg.push_back(0x80);
+	while (msg.size() % 64 != 56) msg.push_back(0);
+	for (int i = 0; i < 8; i++) msg.push_back((uint8_t)(bits >> (8 * i)));
+
+	for (size_t block = 0; block < msg.size(); block += 64)
+	{
+		uint32_t w[16];
+		for (int i = 0; i < 16; i++)
+			w[i] = msg[block + 4 * i] | (msg[block + 4 * i + 1] << 8) | (msg[block + 4 * i + 2] << 16) | ((uint32_t)msg[block + 4 * i + 3] << 24);
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+		for (int i = 0; i < 64; i++)
+		{
+			uint32_t f;
+			int g;
+			if (i < 16) { f = (b & c) | (~b & d); g = i; }
+			else if (i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) % 16; }
+			else if (i < 48) { f = b ^ c ^ d; g = (3 * i + 5) % 16; }
+			else { f = c ^ (b | ~d); g = (7 * i) % 16; }
+			uint32_t rotated = a + f + k[i] + w[g];
+			int s = r[(i / 16) * 4 + i % 4];
+			a = d;
+			d = c;
+			c = b;
+			b += (rotated << s) | (rotated >> (32 - s));
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	}
+
+	char hex[33];
+	for (int i = 0; i < 16; i++)
+		snprintf(hex + 2 * i, 3, "%02x", (h[i / 4] >> (8 * (i % 4))) & 0xFF);
+	return std::string(hex, 32);
+}
+
+static const char *reasonPhrase(int code)
+{
+	switch (code)
+	{
+		case 200: return "OK";
+		case 206: return "Partial Content";
+		case 400: return "Bad Request";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 415: return "Unsupported Media Type";
+		case 416: return "Range Not Satisfiable";
+		case 503: return "Service Unavailable";
+		default: return "Unknown";
+	}
+}
+
+void DeviceIOStandIn::sendResponse(DeviceIONative::LoopbackConnection &conn, const Response &resp)
+{
+	char status[64];
+	snprintf(status, sizeof(status), "HTTP/1.1 %d %s\r\n", resp.code, reasonPhrase(resp.code));
+	std::string out = status;
+	out += "Content-Type: text/plain\r\n";
+	for (size_t i = 0; i < resp.headers.size(); i++)
+		out += resp.headers[i].first + ": " + resp.headers[i].second + "\r\n";
+	out += "Content-Length: " + std::to_string(resp.body.size()) + "\r\n";
+	out += resp.close ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+	out += "\r\n";
+	if (resp.cutAfter >= 0 && (size_t)resp.cutAfter < resp.body.size())
+	{
+		// the peer goes away in the middle of the body
+		out.append(resp.body, 0, resp.cutAfter);
+		counters.responseBytes += out.size();
+		conn.tx += out;
+		conn.open = false;
+		return;
+	}
+	out += resp.body;
+	counters.responseBytes += out.size();
+	conn.tx += out;
+	if (resp.close) conn.open = false;
+}
+
+// commands ////////////////////
+
+DeviceIOStandIn::Response DeviceIOStandIn::handle(const Request &req)
+{
+	if (stallMs > 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(stallMs));
+	if (req.path == "/manage-device")
+		return handleManageDevice(req);
+	Response resp;
+	resp.code = 404;
+	return resp;
+}
+
+bool DeviceIOStandIn::authorized(const Request &req, bool needToken)
+{
+	std::map<std::string, std::string>::const_iterator id = req.query.find("prodID");
+	std::map<std::string, std::string>::const_iterator pass = req.query.find("prodIDpass");
+	if (id == req.query.end() || pass == req.query.end()) return false;
+	if (id->second != productID || pass->second != productPassword) return false;
+	if (!needToken) return true;
+	std::map<std::string, std::string>::const_iterator tok = req.query.find("token");
+	return tok != req.query.end() && tok->second == token;
+}
+
+DeviceIOStandIn::Response DeviceIOStandIn::handleManageDevice(const Request &req)
+{
+	Response resp;
+	std::map<std::string, std::string>::const_iterator cmdIt = req.query.find("cmd");
+	std::string cmd = cmdIt == req.query.end() ? "" : cmdIt->second;
+	commands[cmd]++;
+
+	if ((busyCode != 0) && (busyCommand.empty() || (busyCommand == cmd)))
+	{
+		resp.code = busyCode;
+		if (retryAfter >= 0)
+			resp.headers.push_back(std::make_pair("Retry-After", std::to_string(retryAfter)));
+		return resp;
+	}
+
+	if (cmd == "gettoken")
+	{
+		if (!authorized(req, false))
+		{
+			counters.rejected++;
+			resp.code = 403;
+			return resp;
+		}
+		resp.body = token;
+		return resp;
+	}
+
+	if (!authorized(req, true))
+	{
+		counters.rejected++;
+		resp.code = 403;
+		return resp;
+	}
+
+	if (cmd == "getversion")
+	{
+		resp.body = std::to_string(latestBuild);
+		return resp;
+	}
+
+	if (cmd == "getfirmware")
+	{
+		// Range: bytes=65536-
+		size_t start = 0;
+		std::map<std::string, std::string>::const_iterator range = req.headers.find("range");
+		if (rangeRequests && range != req.headers.end() && range->second.compare(0, 6, "bytes=") == 0)
+		{
+			start = strtoul(range->second.c_str() + 6, nullptr, 10);
+			if (start >= firmware.size())
+			{
+				resp.code = 416;
+				resp.headers.push_back(std::make_pair("Content-Range", "bytes */" + std::to_string(firmware.size())));
+				return resp;
+			}
+			resp.code = 206;
+			resp.headers.push_back(std::make_pair("Content-Range", "bytes " + std::to_string(start) + "-" +
+									std::to_string(firmware.size() - 1) + "/" + std::to_string(firmware.size())));
+			counters.rangeRequests++;
+		}
+		resp.headers.push_back(std::make_pair("X-Image-MD5", md5Hex(firmware)));
+		if (start > 0)
+			resp.body.assign(firmware.begin() + start, firmware.end());
+		else
+		{
+			// &heatshrink=11.4&patchfrom=12
+			std::vector<uint8_t> image = firmware;
+			bool encoded = false;
+			std::map<std::string, std::string>::const_iterator from = req.query.find("patchfrom");
+			if (patchFirmware && from != req.query.end() && strtol(from->second.c_str(), nullptr, 10) == previousBuild)
+			{
+				image = makePatch(previousFirmware, firmware);
+				encoded = true;
+			}
+			std::map<std::string, std::string>::const_iterator hs = req.query.find("heatshrink");
+			if (compressFirmware && hs != req.query.end())
+			{
+				const char *dot = strchr(hs->second.c_str(), '.');
+				int window = atoi(hs->second.c_str());
+				int lookahead = dot != nullptr ? atoi(dot + 1) : 0;
+				if (window >= 4 && window <= 14 && lookahead >= 3 && lookahead < window)
+				{
+					image = heatshrinkEncode(image, window, lookahead);
+					resp.headers.push_back(std::make_pair("Content-Encoding", "heatshrink"));
+					encoded = true;
+				}
+			}
+			if (encoded)
+			{
+				resp.headers.push_back(std::make_pair("X-Image-Size", std::to_string(firmware.size())));
+				counters.encodedImages++;
+			}
+			resp.body.assign(image.begin(), image.end());
+		}
+		resp.cutAfter = firmwareCutAfter;
+		counters.firmwareBytes += (firmwareCutAfter >= 0 && (size_t)firmwareCutAfter < resp.body.size()) ? firmwareCutAfter : resp.body.size();
+		return resp;
+	}
+
+	if (cmd == "listen" && listenCommand)
+	{
+		std::map<std::string, std::string>::const_iterator build = req.query.find("build");
+		long running = build == req.query.end() ? -1 : strtol(build->second.c_str(), nullptr, 10);
+		std::map<std::string, std::string>::const_iterator hold = req.query.find("hold");
+		if (directives.empty() && latestBuild <= running && hold != req.query.end())
+		{
+			resp.holdMs = strtol(hold->second.c_str(), nullptr, 10) * 1000;
+			return resp;
+		}
+		resp.body = listenReply(running);
+		return resp;
+	}
+
+	std::map<std::string, std::string>::const_iterator ack = req.query.find("setack");
+	if ((cmd == "sensor" || cmd == "checkin") && ack != req.query.end()) settingsAck = ack->second;
+
+	if (cmd == "sensor" || (cmd == "checkin" && checkinAsSensor))
+	{
+		long added = storeSamples(req, resp);
+		if (added < 0) return resp;
+		if (reportNone) added = 0;
+		// deviceio OK[CR]2 sensors updated[CR]REBOOT[CR]
+		resp.body = "deviceio OK\r" + std::to_string(added) + " sensors updated\r";
+		for (size_t i = 0; i < directives.size(); i++)
+			resp.body += directives[i] + "\r";
+		directives.clear();
+		return resp;
+	}
+
+	if (cmd == "checkin" && checkinCommand)
+	{
+		std::map<std::string, std::string>::const_iterator build = req.query.find("build");
+		if (build != req.query.end()) reportedBuild = strtol(build->second.c_str(), nullptr, 10);
+		long added = storeSamples(req, resp);
+		if (added < 0) return resp;
+		if (reportNone) added = 0;
+		// deviceio OK[CR]2 sensors updated[CR]BUILD 13[CR]REBOOT[CR]
+		resp.body = "deviceio OK\r" + std::to_string(added) + " sensors updated\r";
+		resp.body += "BUILD " + std::to_string(latestBuild) + "\r";
+		for (size_t i = 0; i < directives.size(); i++)
+			resp.body += directives[i] + "\r";
+		directives.clear();
+		return resp;
+	}
+
+	counters.rejected++;
+	resp.code = 400;
+	return resp;
+}
+
+std::string DeviceIOStandIn::listenReply(long build)
+{
+	// deviceio OK[CR]0 sensors updated[CR]BUILD 13[CR]REBOOT[CR]
+	std::string body = "deviceio OK\r0 sensors updated\r";
+	if (latestBuild > build)
+		body += "BUILD " + std::to_string(latestBuild) + "\r";
+	for (size_t i = 0; i < directives.size(); i++)
+		body += directives[i] + "\r";
+	directives.clear();
+	return body;
+}
+
+// "2020-11-25 1:50:34" as the device renders it, all zero before the clock was set
+static std::string sampleDateTime(uint32_t epoch)
+{
+	struct tm t;
+	memset(&t, 0, sizeof(t));
+	if (epoch != 0)
+	{
+		time_t e = epoch;
+		localtime_r(&e, &t);
+	}
+	char buf[48];
+	snprintf(buf, sizeof(buf), "%d-%d-%d %d:%d:%d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+	return buf;
+}
+
+static bool readVarint(const std::string &s, size_t &pos, uint32_t &v)
+{
+	v = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (pos >= s.size()) return false;
+		uint8_t b = (uint8_t)s[pos++];
+		v |= (uint32_t)(b & 0x7f) << shift;
+		if ((b & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+static bool readUint32(const std::string &s, size_t &pos, uint32_t &v)
+{
+	if (pos + 4 > s.size()) return false;
+	v = (uint32_t)(uint8_t)s[pos] | ((uint32_t)(uint8_t)s[pos + 1] << 8) |
+		((uint32_t)(uint8_t)s[pos + 2] << 16) | ((uint32_t)(uint8_t)s[pos + 3] << 24);
+	pos += 4;
+	return true;
+}
+
+bool DeviceIOStandIn::decodeBinary(const std::string &body, std::vector<Sample> &out)
+{
+	static const double scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+	if (body.size() < 4 + 1 + 4 + 4) return false;
+	if (body.compare(0, 3, "DIO") != 0 || (uint8_t)body[3] != DEVICEIO_BINARY_VERSION) return false;
+
+	size_t crcPos = body.size() - 4, p = crcPos;
+	uint32_t crc;
+	readUint32(body, p, crc);
+	if (DeviceIOCRC32::update(0, body.data(), crcPos) != crc) return false;
+
+	std::string data = body.substr(0, crcPos);
+	size_t pos = 4;
+	uint32_t count, epoch;
+	if (!readVarint(data, pos, count) || !readUint32(data, pos, epoch)) return false;
+
+	std::vector<Sample> decoded;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t delta, key, raw;
+		if (!readVarint(data, pos, delta) || !readVarint(data, pos, key)) return false;
+		epoch += (uint32_t)((int32_t)(delta >> 1) ^ -(int32_t)(delta & 1));
+		uint8_t mode = key & 7;
+		Sample s;
+		s.datetime = sampleDateTime(epoch);
+		s.sensornum = key >> 3;
+		if (mode == DEVICEIO_PRECISION_RAW)
+		{
+			if (!readUint32(data, pos, raw)) return false;
+			memcpy(&s.sensorval, &raw, sizeof(raw));
+		} else
+		{
+			if (!readVarint(data, pos, raw)) return false;
+			int32_t q = (int32_t)(raw >> 1) ^ -(int32_t)(raw & 1);
+			s.sensorval = (float)(q / scales[mode]);
+		}
+		decoded.push_back(s);
+	}
+	if (pos != data.size()) return false;
+
+	out.insert(out.end(), decoded.begin(), decoded.end());
+	return true;
+}
+
+long DeviceIOStandIn::storeSamples(const Request &req, Response &resp)
+{
+	std::map<std::string, std::string>::const_iterator type = req.headers.find("content-type");
+	if (type != req.headers.end() && type->second == DEVICEIO_BINARY_CONTENT_TYPE)
+	{
+		if (!binaryFormat)
+		{
+			resp.code = 415;
+			if (refuseInBody)
+			{
+				// deviceio UNSUPPORTED binary[CR]0 sensors updated[CR]REBOOT[CR]
+				resp.code = 200;
+				resp.body = "deviceio UNSUPPORTED binary\r0 sensors updated\r";
+				for (size_t i = 0; i < directives.size(); i++)
+					resp.body += directives[i] + "\r";
+			}
+			return -1;
+		}
+		size_t before = samples.size();
+		if (!decodeBinary(req.body, samples))
+		{
+			counters.rejected++;
+			resp.code = 400;
+			return -1;
+		}
+		counters.binaryUploads++;
+		return (long)(samples.size() - before);
+	}
+
+	std::map<std::string, std::string> form = parseForm(req.body);
+	long added = 0;
+	for (int i = 0;; i++)
+	{
+		std::string prefix = "sensor[" + std::to_string(i) + "]";
+		std::map<std::string, std::string>::const_iterator num = form.find(prefix + "[sensornum]");
+		if (num == form.end()) break;
+		Sample s;
+		s.datetime = form[prefix + "[datetime]"];
+		s.sensornum = strtol(num->second.c_str(), nullptr, 10);
+		s.sensorval = strtof(form[prefix + "[sensorval]"].c_str(), nullptr);
+		samples.push_back(s);
+		added++;
+	}
+	return added;
+}
+
+// firmware encodings //////////
+
+struct BitWriter
+{
+	std::vector<uint8_t> &out;
+	uint32_t 		bits;
+	int 			count;
+
+	explicit BitWriter(std::vector<uint8_t> &o) : out(o), bits(0), count(0) {}
+
+	void put(uint32_t value, int n)
+	{
+		for (int i = n - 1; i >= 0; i--)
+		{
+			bits = (bits << 1) | ((value >> i) & 1);
+			if (++count == 8)
+			{
+				out.push_back((uint8_t)bits);
+				bits = 0;
+				count = 0;
+			}
+		}
+	}
+
+	void flush(void)
+	{
+		if (count > 0) out.push_back((uint8_t)(bits << (8 - count)));
+		bits = 0;
+		count = 0;
+	}
+};
+
+static uint32_t hash3(const std::vector<uint8_t> &in, size_t i)
+{
+	return ((in[i] * 2654435761u) ^ (in[i + 1] * 40503u) ^ in[i + 2]) & 0xFFFF;
+}
+
+// greedy LZSS with hash chains, the same bit stream as heatshrink -e
+std::vector<uint8_t> DeviceIOStandIn::heatshrinkEncode(const std::vector<uint8_t> &in, int window, int lookahead)
+{
+	std::vector<uint8_t> out;
+	BitWriter writer(out);
+	const size_t maxDistance = (size_t)1 << window;
+	const size_t maxCount = (size_t)1 << lookahead;
+	const size_t backref = 1 + window + lookahead;
+	std::vector<int32_t> head(0x10000, -1);
+	std::vector<int32_t> prev(in.size(), -1);
+
+	size_t i = 0;
+	while (i < in.size())
+	{
+		size_t bestLen = 0, bestDistance = 0;
+		if (i + 2 < in.size())
+		{
+			int chain = 64;
+			for (int32_t j = head[hash3(in, i)]; j >= 0 && i - j <= maxDistance && chain-- > 0; j = prev[j])
+			{
+				size_t len = 0;
+				while (len < maxCount && i + len < in.size() && in[j + len] == in[i + len]) len++;
+				if (len > bestLen)
+				{
+					bestLen = len;
+					bestDistance = i - j;
+					if (len == maxCount) break;
+				}
+			}
+		}
+
+		size_t step = 1;
+		if (bestLen * 9 > backref)
+		{
+			writer.put(0, 1);
+			writer.put((uint32_t)(bestDistance - 1), window);
+			writer.put((uint32_t)(bestLen - 1), lookahead);
+			step = bestLen;
+		} else
+		{
+			writer.put(1, 1);
+			writer.put(in[i], 8);
+		}
+		for (size_t k = 0; k < step; k++, i++)
+		{
+			if (i + 2 >= in.size()) continue;
+			uint32_t h = hash3(in, i);
+			prev[i] = head[h];
+			head[h] = (int32_t)i;
+		}
+	}
+	writer.flush();
+	return out;
+}
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+static uint64_t key8(const std::vector<uint8_t> &in, size_t i)
+{
+	uint64_t k;
+	memcpy(&k, in.data() + i, 8);
+	return k;
+}
+
+// bsdiff style: exact 8 byte seeds from an index of the source, grown
+// over changed bytes as long as most of the next 16 still match
+std::vector<uint8_t> DeviceIOStandIn::makePatch(const std::vector<uint8_t> &source, const std::vector<uint8_t> &target)
+{
+	std::vector<uint8_t> out(DEVICEIO_PATCH_MAGIC, DEVICEIO_PATCH_MAGIC + 4);
+	putVarint(out, source.size());
+	putVarint(out, target.size());
+	putVarint(out, DeviceIOCRC32::update(0, source.data(), source.size()));
+
+	std::unordered_map<uint64_t, uint32_t> index;
+	for (size_t o = 0; o + 8 <= source.size(); o++)
+		index.emplace(key8(source, o), (uint32_t)o);
+
+	size_t diffStart = 0, diffSource = 0, diffLen = 0;
+	std::vector<uint8_t> extra;
+	size_t n = 0;
+	while (n <= target.size())
+	{
+		size_t o = 0, len = 0;
+		bool found = false;
+		if (n + 8 <= target.size())
+		{
+			// the same place as before, else wherever the index has it
+			size_t aligned = diffSource + diffLen + extra.size();
+			if (aligned + 8 <= source.size() && memcmp(&source[aligned], &target[n], 8) == 0)
+			{
+				o = aligned;
+				found = true;
+			} else
+			{
+				std::unordered_map<uint64_t, uint32_t>::const_iterator it = index.find(key8(target, n));
+				if (it != index.end())
+				{
+					o = it->second;
+					found = true;
+				}
+			}
+		}
+		if (found)
+		{
+			size_t k = 0;
+			while (n + k < target.size() && o + k < source.size())
+			{
+				if (target[n + k] == source[o + k])
+				{
+					len = ++k;
+					continue;
+				}
+				int same = 0;
+				for (size_t m = k; m < k + 16 && n + m < target.size() && o + m < source.size(); m++)
+					if (target[n + m] == source[o + m]) same++;
+				if (same < 8) break;
+				k++;
+			}
+		}
+		if (!found && n < target.size())
+		{
+			extra.push_back(target[n++]);
+			continue;
+		}
+
+		// the pending control, then a new one from o
+		size_t next = found ? o : diffSource + diffLen;
+		int64_t seek = (int64_t)next - (int64_t)(diffSource + diffLen);
+		putVarint(out, diffLen);
+		putVarint(out, extra.size());
+		putVarint(out, (uint64_t)((seek << 1) ^ (seek >> 63)));
+		for (size_t k = 0; k < diffLen; k++)
+			out.push_back((uint8_t)(target[diffStart + k] - source[diffSource + k]));
+		out.insert(out.end(), extra.begin(), extra.end());
+		extra.clear();
+		if (!found) break;
+
+		diffStart = n;
+		diffSource = o;
+		diffLen = len;
+		n += len;
+	}
+	return out;
+}
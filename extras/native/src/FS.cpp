@@ -0,0 +1,325 @@
+// FS.cpp
+// Host build shim for the RAM backed filesystem, Update and the OTA partition
+
+#include "Arduino.h"
+#include "FS.h"
+#include "SPIFFS.h"
+#include "Update.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "DeviceIONative.h"
+
+fs::FS SPIFFS;
+UpdateClass Update;
+
+// File ////////////////////////
+
+fs::File::File(std::shared_ptr<FileData> data, const char *name, bool writable, size_t pos)
+	: _data(data), _name(name), _writable(writable), _pos(pos)
+{
+}
+
+size_t fs::File::write(const uint8_t *buf, size_t size)
+{
+	if (!_data || !_writable) return 0;
+	if (_pos + size > _data->bytes.size()) _data->bytes.resize(_pos + size);
+	memcpy(_data->bytes.data() + _pos, buf, size);
+	_pos += size;
+	SPIFFS.counters.bytesWritten += size;
+	return size;
+}
+
+int fs::File::available(void)
+{
+	if (!_data) return 0;
+	return (int)(_data->bytes.size() - _pos);
+}
+
+int fs::File::read(void)
+{
+	uint8_t c;
+	return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t fs::File::read(uint8_t *buf, size_t size)
+{
+	if (!_data || _pos >= _data->bytes.size()) return 0;
+	size_t n = _data->bytes.size() - _pos;
+	if (n > size) n = size;
+	memcpy(buf, _data->bytes.data() + _pos, n);
+	_pos += n;
+	SPIFFS.counters.bytesRead += n;
+	return n;
+}
+
+int fs::File::peek(void)
+{
+	if (!_data || _pos >= _data->bytes.size()) return -1;
+	return _data->bytes[_pos];
+}
+
+bool fs::File::seek(uint32_t pos, SeekMode mode)
+{
+	if (!_data) return false;
+	size_t target = pos;
+	if (mode == SeekCur) target = _pos + pos;
+	if (mode == SeekEnd) target = _data->bytes.size() + pos;
+	if (target > _data->bytes.size()) return false;
+	_pos = target;
+	return true;
+}
+
+size_t fs::File::size(void) const
+{
+	return _data ? _data->bytes.size() : 0;
+}
+
+// FS //////////////////////////
+
+bool fs::FS::begin(bool)
+{
+	counters.begins++;
+	if (failMount) return false;
+	_mounted = true;
+	return true;
+}
+
+bool fs::FS::format(void)
+{
+	_files.clear();
+	failMount = false;
+	return true;
+}
+
+fs::File fs::FS::open(const char *path, const char *mode)
+{
+	counters.opens++;
+	if (!_mounted || path == nullptr || mode == nullptr) return File();
+
+	std::map<std::string, std::shared_ptr<FileData> >::iterator it = _files.find(path);
+	if (mode[0] == 'r')
+	{
+		if (it == _files.end()) return File();
+		return File(it->second, path, mode[1] == '+', 0);
+	}
+	if (mode[0] == 'w')
+	{
+		std::shared_ptr<FileData> data = std::make_shared<FileData>();
+		_files[path] = data;
+		return File(data, path, true, 0);
+	}
+	if (mode[0] == 'a')
+	{
+		if (it == _files.end())
+		{
+			std::shared_ptr<FileData> data = std::make_shared<FileData>();
+			_files[path] = data;
+			return File(data, path, true, 0);
+		}
+		return File(it->second, path, true, it->second->bytes.size());
+	}
+	return File();
+}
+
+bool fs::FS::exists(const char *path)
+{
+	counters.exists++;
+	return _mounted && path && _files.count(path) > 0;
+}
+
+bool fs::FS::remove(const char *path)
+{
+	counters.removes++;
+	return _mounted && path && _files.erase(path) > 0;
+}
+
+bool fs::FS::rename(const char *pathFrom, const char *pathTo)
+{
+	counters.renames++;
+	if (!_mounted || !exists(pathFrom)) return false;
+	_files[pathTo] = _files[pathFrom];
+	_files.erase(pathFrom);
+	return true;
+}
+
+size_t fs::FS::usedBytes(void)
+{
+	size_t used = 0;
+	for (std::map<std::string, std::shared_ptr<FileData> >::iterator it = _files.begin(); it != _files.end(); ++it)
+		used += it->second->bytes.size();
+	return used;
+}
+
+// Update //////////////////////
+
+bool UpdateClass::begin(size_t size, int)
+{
+	if (_running) abort();
+	_error = UPDATE_ERROR_OK;
+	_progress = 0;
+	image.clear();
+	if (size == 0 || (size != UPDATE_SIZE_UNKNOWN && size > partitionSize))
+	{
+		_error = UPDATE_ERROR_SIZE;
+		return false;
+	}
+	_size = size == UPDATE_SIZE_UNKNOWN ? partitionSize : size;
+	image.reserve(_size);
+	_running = true;
+	return true;
+}
+
+size_t UpdateClass::write(uint8_t *data, size_t len)
+{
+	if (!_running || hasError()) return 0;
+	if (len > remaining())
+	{
+		_error = UPDATE_ERROR_SPACE;
+		return 0;
+	}
+	// erase each sector the first time it is touched
+	size_t firstSector = (_progress + 4095) / 4096;
+	size_t lastSector = (_progress + len + 4095) / 4096;
+	unsigned long long cost = (unsigned long long)(lastSector - firstSector) * sectorEraseMicros;
+	cost += (unsigned long long)len * programMicrosPerKB / 1024;
+	DeviceIONative::advanceMillis((unsigned long)(cost / 1000));
+
+	image.insert(image.end(), data, data + len);
+	_progress += len;
+	return len;
+}
+
+size_t UpdateClass::writeStream(Stream &data)
+{
+	uint8_t buf[4096];
+	size_t written = 0;
+	while (remaining() > 0)
+	{
+		size_t want = remaining() < sizeof(buf) ? remaining() : sizeof(buf);
+		size_t got = data.readBytes(buf, want);
+		if (got == 0)
+		{
+			_error = UPDATE_ERROR_STREAM;
+			break;
+		}
+		if (write(buf, got) != got) break;
+		written += got;
+	}
+	return written;
+}
+
+bool UpdateClass::end(bool evenIfRemaining)
+{
+	if (!_running || hasError()) return false;
+	if (remaining() > 0 && !evenIfRemaining)
+	{
+		_error = UPDATE_ERROR_ABORT;
+		_running = false;
+		return false;
+	}
+	if (evenIfRemaining) _size = _progress;
+	_running = false;
+	completed++;
+	return true;
+}
+
+void UpdateClass::abort(void)
+{
+	_running = false;
+	_error = UPDATE_ERROR_ABORT;
+}
+
+// OTA partition ///////////////
+
+#define NATIVE_OTA_PARTITION_SIZE 	1310720
+#define NATIVE_FLASH_SECTOR 		4096
+
+static const esp_partition_t nativeRunningPartition = {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000,
+													   NATIVE_OTA_PARTITION_SIZE, "app0", false};
+static const esp_partition_t nativeOtaPartition = {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x150000,
+												   NATIVE_OTA_PARTITION_SIZE, "app1", false};
+
+DeviceIONative::FlashPartition &DeviceIONative::otaPartition(void)
+{
+	static FlashPartition partition;
+	if (partition.bytes.empty())
+		partition.bytes.assign(NATIVE_OTA_PARTITION_SIZE, 0xFF);
+	return partition;
+}
+
+DeviceIONative::FlashPartition &DeviceIONative::runningPartition(void)
+{
+	static FlashPartition partition;
+	if (partition.bytes.empty())
+		partition.bytes.assign(NATIVE_OTA_PARTITION_SIZE, 0xFF);
+	return partition;
+}
+
+static DeviceIONative::FlashPartition *nativeFlash(const esp_partition_t *partition)
+{
+	if (partition == &nativeOtaPartition) return &DeviceIONative::otaPartition();
+	if (partition == &nativeRunningPartition) return &DeviceIONative::runningPartition();
+	return nullptr;
+}
+
+void DeviceIONative::eraseOtaPartition(void)
+{
+	FlashPartition &partition = otaPartition();
+	partition.bytes.assign(NATIVE_OTA_PARTITION_SIZE, 0xFF);
+	partition.bootable = false;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+	// the running partition can be read, not written
+	DeviceIONative::FlashPartition *flash = nativeFlash(partition);
+	if (flash == nullptr) return ESP_ERR_INVALID_ARG;
+	if (src_offset + size > flash->bytes.size()) return ESP_ERR_INVALID_SIZE;
+	memcpy(dst, flash->bytes.data() + src_offset, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+	DeviceIONative::FlashPartition &flash = DeviceIONative::otaPartition();
+	if (partition != &nativeOtaPartition) return ESP_ERR_INVALID_ARG;
+	if (dst_offset + size > flash.bytes.size()) return ESP_ERR_INVALID_SIZE;
+	// programming only clears bits
+	const uint8_t *in = (const uint8_t *)src;
+	for (size_t i = 0; i < size; i++)
+		flash.bytes[dst_offset + i] &= in[i];
+	flash.bytesWritten += size;
+	delayMicroseconds((unsigned int)((unsigned long long)size * flash.programMicrosPerKB / 1024));
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t start_addr, size_t size)
+{
+	DeviceIONative::FlashPartition &flash = DeviceIONative::otaPartition();
+	if (partition != &nativeOtaPartition) return ESP_ERR_INVALID_ARG;
+	if ((start_addr % NATIVE_FLASH_SECTOR) != 0 || (size % NATIVE_FLASH_SECTOR) != 0) return ESP_ERR_INVALID_ARG;
+	if (start_addr + size > flash.bytes.size()) return ESP_ERR_INVALID_SIZE;
+	memset(flash.bytes.data() + start_addr, 0xFF, size);
+	flash.erases += size / NATIVE_FLASH_SECTOR;
+	delayMicroseconds((unsigned int)(size / NATIVE_FLASH_SECTOR * flash.sectorEraseMicros));
+	return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+	return &nativeRunningPartition;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *)
+{
+	return &nativeOtaPartition;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+	DeviceIONative::FlashPartition &flash = DeviceIONative::otaPartition();
+	if (partition != &nativeOtaPartition) return ESP_ERR_INVALID_ARG;
+	if (flash.bytes[0] != 0xE9) return ESP_ERR_OTA_VALIDATE_FAILED;
+	flash.bootable = true;
+	return ESP_OK;
+}
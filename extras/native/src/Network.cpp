@@ -0,0 +1,682 @@
+// Network.cpp
+// Host build shim for WiFiClient, WiFiClientSecure, HTTPClient and WiFiUDP
+// over the in-process loopback network
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "WiFiClient.h"
+#include "WiFiClientSecure.h"
+#include "HTTPClient.h"
+#include "WiFiUdp.h"
+#include "DeviceIONative.h"
+
+using DeviceIONative::LoopbackConnection;
+
+// loopback network ////////////
+
+static DeviceIONative::LoopbackServer *nativeServer = nullptr;
+static DeviceIONative::NetCounters nativeNet = {};
+static DeviceIONative::NetModel nativeModel;
+
+void DeviceIONative::setServer(LoopbackServer *server)
+{
+	nativeServer = server;
+}
+
+DeviceIONative::LoopbackServer *DeviceIONative::server(void)
+{
+	return nativeServer;
+}
+
+const DeviceIONative::NetCounters &DeviceIONative::net(void)
+{
+	return nativeNet;
+}
+
+void DeviceIONative::resetNet(void)
+{
+	nativeNet = DeviceIONative::NetCounters();
+}
+
+DeviceIONative::NetModel &DeviceIONative::netModel(void)
+{
+	return nativeModel;
+}
+
+// charge transfer time for bytes that crossed the link
+static void nativeChargeTransfer(size_t bytes)
+{
+	if (nativeModel.bytesPerMs > 0)
+		delayMicroseconds((unsigned int)((unsigned long long)bytes * 1000 / nativeModel.bytesPerMs));
+}
+
+// WiFiClient //////////////////
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+	stop();
+	if (WiFi.status() != WL_CONNECTED || nativeServer == nullptr)
+		return 0;
+
+	std::shared_ptr<LoopbackConnection> conn = std::make_shared<LoopbackConnection>();
+	conn->host = host;
+	conn->port = port;
+
+	// one round trip for the TCP handshake
+	DeviceIONative::advanceMillis(nativeModel.rttMs);
+	nativeNet.connects++;
+
+	DeviceIONative::pauseHeapTracking();
+	bool accepted = nativeServer->onAccept(*conn);
+	DeviceIONative::resumeHeapTracking();
+	if (!accepted)
+		return 0;
+
+	if (!onConnected(*conn))
+	{
+		DeviceIONative::pauseHeapTracking();
+		nativeServer->onClose(*conn);
+		DeviceIONative::resumeHeapTracking();
+		return 0;
+	}
+
+	_conn = conn;
+	return 1;
+}
+
+uint8_t WiFiClient::connected(void)
+{
+	if (!_conn) return 0;
+	pump();
+	return _conn->open || !_conn->tx.empty();
+}
+
+void WiFiClient::stop(void)
+{
+	if (!_conn) return;
+	if (nativeServer)
+	{
+		DeviceIONative::pauseHeapTracking();
+		nativeServer->onClose(*_conn);
+		DeviceIONative::resumeHeapTracking();
+	}
+	_conn->open = false;
+	_conn.reset();
+}
+
+void WiFiClient::pump(void)
+{
+	if (!_conn || !_conn->open || nativeServer == nullptr) return;
+	size_t before = _conn->tx.size();
+	DeviceIONative::pauseHeapTracking();
+	if (!_conn->rx.empty())
+		nativeServer->onData(*_conn);
+	nativeServer->onPoll(*_conn);
+	DeviceIONative::resumeHeapTracking();
+	if (_conn->tx.size() > before)
+	{
+		// a response started, charge a round trip. the transfer is
+		// charged as the device reads, like bytes trickling in
+		DeviceIONative::advanceMillis(nativeModel.rttMs);
+	}
+}
+
+int WiFiClient::available(void)
+{
+	if (!_conn) return 0;
+	if (_conn->tx.empty()) pump();
+	return (int)_conn->tx.size();
+}
+
+int WiFiClient::read(void)
+{
+	uint8_t c;
+	if (read(&c, 1) != 1) return -1;
+	return c;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size)
+{
+	if (!_conn) return -1;
+	if (_conn->tx.empty()) pump();
+	if (_conn->tx.empty()) return _conn->open ? 0 : -1;
+	size_t n = size < _conn->tx.size() ? size : _conn->tx.size();
+	memcpy(buf, _conn->tx.data(), n);
+	_conn->tx.erase(0, n);
+	nativeNet.bytesReceived += n;
+	nativeChargeTransfer(n);
+	return (int)n;
+}
+
+int WiFiClient::peek(void)
+{
+	if (!_conn) return -1;
+	if (_conn->tx.empty()) pump();
+	if (_conn->tx.empty()) return -1;
+	return (uint8_t)_conn->tx[0];
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size)
+{
+	if (!_conn || !_conn->open) return 0;
+	DeviceIONative::pauseHeapTracking();
+	_conn->rx.append((const char *)buf, size);
+	DeviceIONative::resumeHeapTracking();
+	nativeNet.bytesSent += size;
+	nativeChargeTransfer(size);
+	return size;
+}
+
+// WiFiClientSecure ////////////
+
+// server side TLS session cache, session id -> issue time
+static std::map<std::string, unsigned long> nativeTlsSessions;
+static uint32_t nativeTlsSessionSerial = 0;
+
+void DeviceIONative::flushTlsSessions(void)
+{
+	nativeTlsSessions.clear();
+}
+
+bool WiFiClientSecure::onConnected(LoopbackConnection &conn)
+{
+	conn.secure = true;
+
+	// abbreviated handshake when the server still knows the offered session
+	if (_session && nativeModel.tlsSessionCache)
+	{
+		std::string id((const char *)_session->_id, sizeof(_session->_id));
+		std::map<std::string, unsigned long>::iterator it = nativeTlsSessions.find(id);
+		if (it != nativeTlsSessions.end() && millis() - it->second < nativeModel.tlsSessionLifetimeMs)
+		{
+			nativeNet.tlsResumed++;
+			nativeNet.handshakeBytes += nativeModel.tlsResumedHandshakeBytes;
+			DeviceIONative::advanceMillis(nativeModel.rttMs + nativeModel.tlsResumedHandshakeMs);
+			return true;
+		}
+	}
+
+	nativeNet.tlsHandshakes++;
+	nativeNet.handshakeBytes += nativeModel.tlsFullHandshakeBytes;
+	DeviceIONative::advanceMillis(2 * nativeModel.rttMs + nativeModel.tlsFullHandshakeMs);
+
+	// the server issues a new session id
+	if (_session)
+	{
+		nativeTlsSessionSerial++;
+		memset(_session->_id, 0, sizeof(_session->_id));
+		memcpy(_session->_id, &nativeTlsSessionSerial, sizeof(nativeTlsSessionSerial));
+		_session->_id[31] = 0xd1;
+		if (nativeModel.tlsSessionCache)
+		{
+			DeviceIONative::pauseHeapTracking();
+			nativeTlsSessions[std::string((const char *)_session->_id, sizeof(_session->_id))] = millis();
+			DeviceIONative::resumeHeapTracking();
+		}
+	}
+	return true;
+}
+
+// HTTPClient //////////////////
+
+bool HTTPClient::begin(WiFiClient &client, String url)
+{
+	// keep an existing connection when it points at the same server
+	String oldHost = _host;
+	uint16_t oldPort = _port;
+	WiFiClient *oldClient = _client;
+
+	int index = url.indexOf("://");
+	if (index < 0) return false;
+	String protocol = url.substring(0, index);
+	String rest = url.substring(index + 3);
+	_secure = protocol.equals("https");
+	_port = _secure ? 443 : 80;
+
+	index = rest.indexOf('/');
+	String host = index < 0 ? rest : rest.substring(0, index);
+	_uri = index < 0 ? String("/") : rest.substring(index);
+	index = host.indexOf(':');
+	if (index >= 0)
+	{
+		_port = (uint16_t)host.substring(index + 1).toInt();
+		host = host.substring(0, index);
+	}
+	_host = host;
+	_client = &client;
+
+	if (oldClient && (oldClient != _client || !oldHost.equals(_host) || oldPort != _port))
+		oldClient->stop();
+	return true;
+}
+
+bool HTTPClient::begin(String url, const char *CAcert)
+{
+	if (!_ownedClient) _ownedClient.reset(new WiFiClientSecure);
+	_ownedClient->setCACert(CAcert);
+	return begin(*_ownedClient, url);
+}
+
+bool HTTPClient::begin(String url)
+{
+	return begin(url, nullptr);
+}
+
+void HTTPClient::end(void)
+{
+	if (_client)
+	{
+		if (_reuse && _canReuse && _client->connected())
+		{
+			// drop whatever is left of the response, keep the socket
+			while (_client->available() > 0)
+			{
+				uint8_t buf[128];
+				_client->read(buf, sizeof(buf));
+			}
+		} else
+		{
+			_client->stop();
+		}
+	}
+	_headers = "";
+	_size = -1;
+	_chunked = false;
+	_returnCode = 0;
+}
+
+bool HTTPClient::connected(void)
+{
+	return _client && _client->connected();
+}
+
+void HTTPClient::addHeader(const String &name, const String &value)
+{
+	if (name.equals("Connection") || name.equals("User-Agent") || name.equals("Host"))
+		return;
+	_headers += name;
+	_headers += ": ";
+	_headers += value;
+	_headers += "\r\n";
+}
+
+void HTTPClient::collectHeaders(const char *headerKeys[], const size_t headerKeysCount)
+{
+	_currentHeaders.clear();
+	for (size_t i = 0; i < headerKeysCount; i++)
+	{
+		RequestArgument arg;
+		arg.key = headerKeys[i];
+		_currentHeaders.push_back(arg);
+	}
+}
+
+String HTTPClient::header(const char *name)
+{
+	for (size_t i = 0; i < _currentHeaders.size(); i++)
+	{
+		String key = _currentHeaders[i].key;
+		String wanted = name;
+		key.toLowerCase();
+		wanted.toLowerCase();
+		if (key.equals(wanted)) return _currentHeaders[i].value;
+	}
+	return String();
+}
+
+bool HTTPClient::hasHeader(const char *name)
+{
+	return header(name).length() > 0;
+}
+
+bool HTTPClient::connect(void)
+{
+	if (_client == nullptr) return false;
+	if (_client->connected())
+	{
+		// reuse, flush leftovers of the previous response
+		while (_client->available() > 0) _client->read();
+		return true;
+	}
+	return _client->connect(_host.c_str(), _port) == 1;
+}
+
+bool HTTPClient::sendHeader(const char *type, size_t size)
+{
+	String header = String(type) + " " + _uri + " HTTP/1.1\r\nHost: " + _host;
+	if (_port != 80 && _port != 443)
+	{
+		header += ':';
+		header += String((unsigned int)_port);
+	}
+	header += "\r\nUser-Agent: ";
+	header += _userAgent;
+	header += "\r\nConnection: ";
+	header += _reuse ? "keep-alive" : "close";
+	header += "\r\nAccept-Encoding: identity;q=1,chunked;q=0.1,*;q=0\r\n";
+	if (size > 0 || strcmp(type, "POST") == 0)
+	{
+		header += "Content-Length: ";
+		header += String((unsigned long)size);
+		header += "\r\n";
+	}
+	header += _headers;
+	header += "\r\n";
+	return _client->write((const uint8_t *)header.c_str(), header.length()) == header.length();
+}
+
+int HTTPClient::returnError(int error)
+{
+	if (error < 0 && _client) _client->stop();
+	return error;
+}
+
+bool HTTPClient::readLine(String &line)
+{
+	line = "";
+	unsigned long start = millis();
+	while (true)
+	{
+		int c = _client->read();
+		if (c < 0)
+		{
+			if (!_client->connected() || millis() - start > _tcpTimeout) return false;
+			delay(1);
+			continue;
+		}
+		if (c == '\n') break;
+		if (c != '\r') line += (char)c;
+	}
+	return true;
+}
+
+int HTTPClient::handleHeaderResponse(void)
+{
+	String line;
+	_returnCode = 0;
+	_size = -1;
+	_chunked = false;
+	_canReuse = _reuse;
+	for (size_t i = 0; i < _currentHeaders.size(); i++) _currentHeaders[i].value = "";
+
+	if (!readLine(line)) return HTTPC_ERROR_READ_TIMEOUT;
+	if (!line.startsWith("HTTP/1.")) return HTTPC_ERROR_NO_HTTP_SERVER;
+	_returnCode = line.substring(9, 12).toInt();
+	if (line.startsWith("HTTP/1.0")) _canReuse = false;
+
+	while (readLine(line))
+	{
+		if (line.length() == 0)
+		{
+			if (_returnCode > 0) return _returnCode;
+			return HTTPC_ERROR_NO_HTTP_SERVER;
+		}
+		int colon = line.indexOf(':');
+		if (colon < 0) continue;
+		String key = line.substring(0, colon);
+		String value = line.substring(colon + 1);
+		value.trim();
+		String lowerKey = key;
+		lowerKey.toLowerCase();
+		if (lowerKey.equals("content-length")) _size = value.toInt();
+		if (lowerKey.equals("connection") && value.equals("close")) _canReuse = false;
+		if (lowerKey.equals("transfer-encoding") && value.equals("chunked")) _chunked = true;
+		for (size_t i = 0; i < _currentHeaders.size(); i++)
+		{
+			String wanted = _currentHeaders[i].key;
+			wanted.toLowerCase();
+			if (wanted.equals(lowerKey)) _currentHeaders[i].value = value;
+		}
+	}
+	return HTTPC_ERROR_CONNECTION_LOST;
+}
+
+int HTTPClient::GET(void)
+{
+	return sendRequest("GET");
+}
+
+int HTTPClient::POST(uint8_t *payload, size_t size)
+{
+	return sendRequest("POST", payload, size);
+}
+
+int HTTPClient::POST(String payload)
+{
+	return POST((uint8_t *)payload.c_str(), payload.length());
+}
+
+int HTTPClient::sendRequest(const char *type, String payload)
+{
+	return sendRequest(type, (uint8_t *)payload.c_str(), payload.length());
+}
+
+int HTTPClient::sendRequest(const char *type, uint8_t *payload, size_t size)
+{
+	if (!connect()) return returnError(HTTPC_ERROR_CONNECTION_REFUSED);
+	if (!sendHeader(type, size)) return returnError(HTTPC_ERROR_SEND_HEADER_FAILED);
+	if (payload && size > 0)
+	{
+		if (_client->write(payload, size) != size)
+			return returnError(HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+	}
+	return returnError(handleHeaderResponse());
+}
+
+int HTTPClient::sendRequest(const char *type, Stream *stream, size_t size)
+{
+	if (stream == nullptr) return returnError(HTTPC_ERROR_NO_STREAM);
+	if (!connect()) return returnError(HTTPC_ERROR_CONNECTION_REFUSED);
+	if (!sendHeader(type, size)) return returnError(HTTPC_ERROR_SEND_HEADER_FAILED);
+
+	// fixed transfer buffer like the ESP32 core
+	uint8_t *buff = new uint8_t[HTTP_TCP_BUFFER_SIZE];
+	size_t sent = 0;
+	while (sent < size)
+	{
+		size_t want = size - sent < HTTP_TCP_BUFFER_SIZE ? size - sent : HTTP_TCP_BUFFER_SIZE;
+		size_t got = stream->readBytes(buff, want);
+		if (got == 0) break;
+		if (_client->write(buff, got) != got)
+		{
+			delete[] buff;
+			return returnError(HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+		}
+		sent += got;
+	}
+	delete[] buff;
+	if (sent != size) return returnError(HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+	return returnError(handleHeaderResponse());
+}
+
+String HTTPClient::getString(void)
+{
+	String out;
+	if (_size > 0) out.reserve(_size);
+	// String is a Print in spirit, collect through a small adapter
+	class StringSink : public Stream
+	{
+	public:
+		StringSink(String &s) : str(s) {}
+		size_t write(uint8_t c) override { str += (char)c; return 1; }
+		size_t write(const uint8_t *b, size_t n) override { str.concat((const char *)b, n); return n; }
+		int available() override { return 0; }
+		int read() override { return -1; }
+		int peek() override { return -1; }
+		String &str;
+	} sink(out);
+	writeToStream(&sink);
+	return out;
+}
+
+int HTTPClient::writeToStream(Stream *stream)
+{
+	if (stream == nullptr) return returnError(HTTPC_ERROR_NO_STREAM);
+	if (!connected()) return returnError(HTTPC_ERROR_NOT_CONNECTED);
+
+	uint8_t buff[HTTP_TCP_BUFFER_SIZE];
+	int total = 0;
+	unsigned long start = millis();
+
+	if (!_chunked)
+	{
+		int len = _size;
+		while (connected() && (len > 0 || len == -1))
+		{
+			size_t want = len > 0 && (size_t)len < sizeof(buff) ? len : sizeof(buff);
+			int got = _client->read(buff, want);
+			if (got <= 0)
+			{
+				if (got < 0 || millis() - start > _tcpTimeout) break;
+				delay(1);
+				continue;
+			}
+			stream->write(buff, got);
+			total += got;
+			if (len > 0) len -= got;
+			start = millis();
+		}
+		if (_size > 0 && total != _size) return returnError(HTTPC_ERROR_CONNECTION_LOST);
+		return total;
+	}
+
+	// chunked transfer encoding
+	String line;
+	while (true)
+	{
+		if (!readLine(line)) return returnError(HTTPC_ERROR_READ_TIMEOUT);
+		long chunk = strtol(line.c_str(), nullptr, 16);
+		if (chunk == 0)
+		{
+			readLine(line);
+			break;
+		}
+		while (chunk > 0)
+		{
+			size_t want = (size_t)chunk < sizeof(buff) ? chunk : sizeof(buff);
+			int got = _client->read(buff, want);
+			if (got <= 0)
+			{
+				if (got < 0 || !_client->connected()) return returnError(HTTPC_ERROR_CONNECTION_LOST);
+				delay(1);
+				continue;
+			}
+			stream->write(buff, got);
+			total += got;
+			chunk -= got;
+		}
+		readLine(line);
+	}
+	return total;
+}
+
+String HTTPClient::errorToString(int error)
+{
+	switch (error)
+	{
+		case HTTPC_ERROR_CONNECTION_REFUSED: return F("connection refused");
+		case HTTPC_ERROR_SEND_HEADER_FAILED: return F("send header failed");
+		case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return F("send payload failed");
+		case HTTPC_ERROR_NOT_CONNECTED: return F("not connected");
+		case HTTPC_ERROR_CONNECTION_LOST: return F("connection lost");
+		case HTTPC_ERROR_NO_STREAM: return F("no stream");
+		case HTTPC_ERROR_NO_HTTP_SERVER: return F("no HTTP server");
+		case HTTPC_ERROR_TOO_LESS_RAM: return F("too less ram");
+		case HTTPC_ERROR_ENCODING: return F("Transfer-Encoding not supported");
+		case HTTPC_ERROR_STREAM_WRITE: return F("Stream write error");
+		case HTTPC_ERROR_READ_TIMEOUT: return F("read Timeout");
+		default: return String();
+	}
+}
+
+// WiFiUDP /////////////////////
+
+// NTP timestamps are seconds since 1900 and a 32-bit fraction, big endian
+static void nativeNtpTimestamp(std::string &packet, size_t offset, unsigned long long epochMicros)
+{
+	uint32_t seconds = (uint32_t)(epochMicros / 1000000 + 2208988800ULL);
+	uint32_t fraction = (uint32_t)(((epochMicros % 1000000) << 32) / 1000000);
+	for (int i = 0; i < 4; i++)
+	{
+		packet[offset + i] = (char)(seconds >> (24 - 8 * i));
+		packet[offset + 4 + i] = (char)(fraction >> (24 - 8 * i));
+	}
+}
+
+uint8_t WiFiUDP::begin(uint16_t)
+{
+	_open = true;
+	return 1;
+}
+
+void WiFiUDP::stop(void)
+{
+	_open = false;
+	_reply.clear();
+	_rx.clear();
+	_rxPos = 0;
+}
+
+int WiFiUDP::beginPacket(const char *, uint16_t port)
+{
+	if (!_open || WiFi.status() != WL_CONNECTED)
+		return 0;
+	_port = port;
+	_tx.clear();
+	return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+	_tx.append((const char *)buffer, size);
+	return size;
+}
+
+// the server stamps the request half an RTT after it left, the reply
+// arrives a full RTT after it left. datagrams to other ports are lost
+int WiFiUDP::endPacket(void)
+{
+	unsigned long sent = micros();
+	unsigned long long stamp;
+
+	nativeNet.bytesSent += _tx.size();
+	if (_port != 123)
+		return 1;
+	nativeNet.ntpRequests++;
+	if (_tx.size() < 48 || (_tx[0] & 0x07) != 3 || !DeviceIONative::ntpAnswers())
+		return 1;
+
+	stamp = DeviceIONative::trueEpochMicros(sent + nativeModel.rttMs * 500);
+	_reply.assign(48, 0);
+	_reply[0] = 0x24;			// no leap warning, version 4, server
+	_reply[1] = 2;				// stratum
+	_reply[3] = (char)-20;		// precision, about 1 us
+	nativeNtpTimestamp(_reply, 16, stamp);
+	_reply.replace(24, 8, _tx, 40, 8);
+	nativeNtpTimestamp(_reply, 32, stamp);
+	nativeNtpTimestamp(_reply, 40, stamp);
+	_replyMicros = sent + nativeModel.rttMs * 1000;
+	return 1;
+}
+
+int WiFiUDP::parsePacket(void)
+{
+	_rx.clear();
+	_rxPos = 0;
+	if (_reply.empty() || (long)(micros() - _replyMicros) < 0)
+		return 0;
+	_rx.swap(_reply);
+	nativeNet.bytesReceived += _rx.size();
+	return (int)_rx.size();
+}
+
+int WiFiUDP::read(uint8_t *buffer, size_t len)
+{
+	size_t n = std::min(len, _rx.size() - _rxPos);
+	memcpy(buffer, _rx.data() + _rxPos, n);
+	_rxPos += n;
+	return (int)n;
+}
@@ -0,0 +1,433 @@
+// WString.cpp
+// Host build shim for the Arduino String class
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "WString.h"
+
+// constructors ////////////////
+
+String::String(const char *cstr)
+{
+	init();
+	if (cstr) copy(cstr, strlen(cstr));
+}
+
+String::String(const String &value)
+{
+	init();
+	*this = value;
+}
+
+String::String(String &&rval)
+{
+	init();
+	move(rval);
+}
+
+String::String(const __FlashStringHelper *pstr)
+{
+	init();
+	*this = pstr;
+}
+
+String::String(char c)
+{
+	init();
+	char buf[2] = {c, 0};
+	*this = buf;
+}
+
+static void formatInteger(char *buf, size_t size, unsigned long long value, bool negative, unsigned char base)
+{
+	char tmp[72];
+	int i = 0;
+	if (base < 2) base = 10;
+	do
+	{
+		unsigned digit = value % base;
+		tmp[i++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+		value /= base;
+	} while (value);
+	size_t o = 0;
+	if (negative && o < size - 1) buf[o++] = '-';
+	while (i > 0 && o < size - 1) buf[o++] = tmp[--i];
+	buf[o] = 0;
+}
+
+String::String(unsigned char value, unsigned char base)
+{
+	init();
+	char buf[72];
+	formatInteger(buf, sizeof(buf), value, false, base);
+	*this = buf;
+}
+
+String::String(int value, unsigned char base)
+{
+	init();
+	char buf[72];
+	if (base == 10 && value < 0)
+		formatInteger(buf, sizeof(buf), -(long long)value, true, base);
+	else
+		formatInteger(buf, sizeof(buf), (unsigned int)value, false, base);
+	*this = buf;
+}
+
+String::String(unsigned int value, unsigned char base)
+{
+	init();
+	char buf[72];
+	formatInteger(buf, sizeof(buf), value, false, base);
+	*this = buf;
+}
+
+String::String(long value, unsigned char base)
+{
+	init();
+	char buf[72];
+	if (base == 10 && value < 0)
+		formatInteger(buf, sizeof(buf), -(long long)value, true, base);
+	else
+		formatInteger(buf, sizeof(buf), (unsigned long)value, false, base);
+	*this = buf;
+}
+
+String::String(unsigned long value, unsigned char base)
+{
+	init();
+	char buf[72];
+	formatInteger(buf, sizeof(buf), value, false, base);
+	*this = buf;
+}
+
+String::String(float value, unsigned char decimalPlaces)
+{
+	init();
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, (double)value);
+	*this = buf;
+}
+
+String::String(double value, unsigned char decimalPlaces)
+{
+	init();
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+	*this = buf;
+}
+
+String::~String()
+{
+	delete[] buffer;
+}
+
+// memory management ///////////
+
+void String::init(void)
+{
+	buffer = nullptr;
+	capacity = 0;
+	len = 0;
+}
+
+void String::invalidate(void)
+{
+	delete[] buffer;
+	buffer = nullptr;
+	capacity = len = 0;
+}
+
+unsigned char String::reserve(unsigned int size)
+{
+	if (buffer && capacity >= size) return 1;
+	if (changeBuffer(size))
+	{
+		if (len == 0) buffer[0] = 0;
+		return 1;
+	}
+	return 0;
+}
+
+unsigned char String::changeBuffer(unsigned int maxStrLen)
+{
+	char *newbuffer = new char[maxStrLen + 1];
+	if (buffer)
+	{
+		memcpy(newbuffer, buffer, len + 1);
+		delete[] buffer;
+	}
+	buffer = newbuffer;
+	capacity = maxStrLen;
+	return 1;
+}
+
+String &String::copy(const char *cstr, unsigned int length)
+{
+	if (!reserve(length))
+	{
+		invalidate();
+		return *this;
+	}
+	len = length;
+	memmove(buffer, cstr, length);
+	buffer[len] = 0;
+	return *this;
+}
+
+void String::move(String &rhs)
+{
+	delete[] buffer;
+	buffer = rhs.buffer;
+	capacity = rhs.capacity;
+	len = rhs.len;
+	rhs.buffer = nullptr;
+	rhs.capacity = 0;
+	rhs.len = 0;
+}
+
+String &String::operator=(const String &rhs)
+{
+	if (this == &rhs) return *this;
+	if (rhs.buffer) copy(rhs.buffer, rhs.len);
+	else invalidate();
+	return *this;
+}
+
+String &String::operator=(String &&rval)
+{
+	if (this != &rval) move(rval);
+	return *this;
+}
+
+String &String::operator=(const char *cstr)
+{
+	if (cstr) copy(cstr, strlen(cstr));
+	else invalidate();
+	return *this;
+}
+
+String &String::operator=(const __FlashStringHelper *pstr)
+{
+	return *this = reinterpret_cast<const char *>(pstr);
+}
+
+// concat //////////////////////
+
+unsigned char String::concat(const char *cstr, unsigned int length)
+{
+	unsigned int newlen = len + length;
+	if (!cstr) return 0;
+	if (length == 0) return 1;
+	if (capacity < newlen)
+	{
+		// grow geometrically like newer cores do, keeps += loops honest
+		unsigned int grow = capacity + (capacity >> 1);
+		if (!reserve(newlen > grow ? newlen : grow)) return 0;
+	}
+	memmove(buffer + len, cstr, length);
+	len = newlen;
+	buffer[len] = 0;
+	return 1;
+}
+
+unsigned char String::concat(const String &s)
+{
+	if (&s == this)
+	{
+		String tmp(s);
+		return concat(tmp.c_str(), tmp.len);
+	}
+	return concat(s.c_str(), s.len);
+}
+
+unsigned char String::concat(const char *cstr)
+{
+	if (!cstr) return 0;
+	return concat(cstr, strlen(cstr));
+}
+
+unsigned char String::concat(char c)
+{
+	return concat(&c, 1);
+}
+
+unsigned char String::concat(int num) { return concat(String(num)); }
+unsigned char String::concat(unsigned int num) { return concat(String(num)); }
+unsigned char String::concat(long num) { return concat(String(num)); }
+unsigned char String::concat(unsigned long num) { return concat(String(num)); }
+unsigned char String::concat(float num) { return concat(String(num)); }
+unsigned char String::concat(double num) { return concat(String(num)); }
+
+String operator+(const String &lhs, const String &rhs)
+{
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const String &lhs, const char *rhs)
+{
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const char *lhs, const String &rhs)
+{
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(const String &lhs, char rhs)
+{
+	String s(lhs);
+	s.concat(rhs);
+	return s;
+}
+
+String operator+(String &&lhs, const String &rhs)
+{
+	lhs.concat(rhs);
+	return static_cast<String &&>(lhs);
+}
+
+String operator+(String &&lhs, const char *rhs)
+{
+	lhs.concat(rhs);
+	return static_cast<String &&>(lhs);
+}
+
+String operator+(String &&lhs, char rhs)
+{
+	lhs.concat(rhs);
+	return static_cast<String &&>(lhs);
+}
+
+// comparison //////////////////
+
+int String::compareTo(const String &s) const
+{
+	return strcmp(c_str(), s.c_str());
+}
+
+unsigned char String::equals(const String &s) const
+{
+	return len == s.len && compareTo(s) == 0;
+}
+
+unsigned char String::equals(const char *cstr) const
+{
+	return strcmp(c_str(), cstr ? cstr : "") == 0;
+}
+
+unsigned char String::startsWith(const String &prefix) const
+{
+	if (len < prefix.len) return 0;
+	return strncmp(c_str(), prefix.c_str(), prefix.len) == 0;
+}
+
+unsigned char String::endsWith(const String &suffix) const
+{
+	if (len < suffix.len) return 0;
+	return strcmp(c_str() + len - suffix.len, suffix.c_str()) == 0;
+}
+
+// characters //////////////////
+
+char String::charAt(unsigned int index) const
+{
+	if (index >= len || !buffer) return 0;
+	return buffer[index];
+}
+
+char &String::operator[](unsigned int index)
+{
+	static char dummy_writable_char;
+	if (index >= len || !buffer)
+	{
+		dummy_writable_char = 0;
+		return dummy_writable_char;
+	}
+	return buffer[index];
+}
+
+// search //////////////////////
+
+int String::indexOf(char ch, unsigned int fromIndex) const
+{
+	if (fromIndex >= len) return -1;
+	const char *temp = strchr(buffer + fromIndex, ch);
+	if (temp == nullptr) return -1;
+	return temp - buffer;
+}
+
+int String::indexOf(const String &s2, unsigned int fromIndex) const
+{
+	if (fromIndex >= len) return -1;
+	const char *found = strstr(buffer + fromIndex, s2.c_str());
+	if (found == nullptr) return -1;
+	return found - buffer;
+}
+
+int String::lastIndexOf(char ch) const
+{
+	if (!buffer) return -1;
+	const char *temp = strrchr(buffer, ch);
+	if (temp == nullptr) return -1;
+	return temp - buffer;
+}
+
+String String::substring(unsigned int left, unsigned int right) const
+{
+	if (left > right)
+	{
+		unsigned int temp = right;
+		right = left;
+		left = temp;
+	}
+	String out;
+	if (left >= len) return out;
+	if (right > len) right = len;
+	out.copy(buffer + left, right - left);
+	return out;
+}
+
+// modification ////////////////
+
+void String::trim(void)
+{
+	if (!buffer || len == 0) return;
+	char *begin = buffer;
+	while (isspace((unsigned char)*begin)) begin++;
+	char *end = buffer + len - 1;
+	while (isspace((unsigned char)*end) && end >= begin) end--;
+	len = end + 1 - begin;
+	if (begin > buffer) memmove(buffer, begin, len);
+	buffer[len] = 0;
+}
+
+void String::toLowerCase(void)
+{
+	for (unsigned int i = 0; i < len; i++) buffer[i] = tolower((unsigned char)buffer[i]);
+}
+
+void String::toUpperCase(void)
+{
+	for (unsigned int i = 0; i < len; i++) buffer[i] = toupper((unsigned char)buffer[i]);
+}
+
+// parsing /////////////////////
+
+long String::toInt(void) const
+{
+	return buffer ? atol(buffer) : 0;
+}
+
+float String::toFloat(void) const
+{
+	return buffer ? (float)atof(buffer) : 0;
+}
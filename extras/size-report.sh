@@ -0,0 +1,19 @@
+#!/bin/sh
+# size-report.sh
+# Flash and RAM of the basic example per core, with every feature and
+# with the minimal set of platformio.ini, as PlatformIO reports them.
+# Run from the library root: sh extras/size-report.sh
+#
+# (c) GoodPrototyping 2020-21, All Rights Reserved
+
+mkdir -p .pio
+for env in ESP32 ESP32-minimal nodemcuv2 nodemcuv2-minimal; do
+	if ! pio run -e "$env" > ".pio/size-$env.log" 2>&1; then
+		echo "$env: build failed, see .pio/size-$env.log"
+		continue
+	fi
+	# "RAM:   [=         ]  13.6% (used 44588 bytes from 327680 bytes)"
+	ram=$(sed -n 's/^RAM:.*used \([0-9]*\) bytes.*/\1/p' ".pio/size-$env.log")
+	flash=$(sed -n 's/^Flash:.*used \([0-9]*\) bytes.*/\1/p' ".pio/size-$env.log")
+	printf "%-20s flash %8s  RAM %6s\n" "$env" "$flash" "$ram"
+done
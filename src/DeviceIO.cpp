@@ -71,15 +71,41 @@
 //          * Build 12 released for testing
 //  12.7.21 * Minor improvements
 //          * Build 13 released for testing
+// 10.16.26 * Host build with Arduino shims and check-in benchmarks (extras/native)
+//          * Sensor samples are 12-byte PODs in a ring buffer, capacity set by DEVICEIO_SAMPLE_CAPACITY
+//          * Sensor uploads are streamed, no String payload is built
+//          * One keep-alive HTTPS connection per check-in, TLS sessions are resumed on ESP8266
+//          * Combined checkin command uploads samples and returns the build number and directives in one request,
+//          * falls back to getversion + sensor when the server doesn't support it
+//          * poll(budgetUs) runs the check-in as a state machine without delay(), doCheckIn() wraps it
+//          * Optional background check-ins on their own task (ESP32), samples pass a lock-free queue
+//          * Samples are time stamped as soon as the SNTP clock is set
+//          * Binary sample batches (varint deltas, quantized values, CRC-32), form upload as fallback
+//          * Samples that can't be sent go to a CRC-framed segment log on flash and are replayed in batches
+//          * Firmware downloads resume with Range requests after a dropped connection, on ESP32 after a reset as well
+//          * Firmware can come heatshrink compressed and/or as a patch against the running build, decoded while downloading
+//          * ESP32 firmware sectors are flashed by a task on the other core while the next one downloads
+//          * The file system is mounted once, the provisioning files and other small ones are cached in RAM
+//          * Provisioning state lives in a CRC-checked key/value log (DeviceIOStore), committed atomically
+//          * setSensorAggregation() folds a sensor's samples into tumbling or sliding windows (mean, min, max, count, last, variance)
+//          * setSensorDeadband() drops values that didn't move, the built-in sensors only report changes or once a day
+//          * Own SNTP client (DeviceIOClock) replaces configTime(): the clock is anchored to millis() with a measured drift,
+//          * resynced when the drift estimate allows (usually daily), getTime() and sample time stamps never wait
+//          * addSensor() registers a read callback and period, the channels (and the built-in sensors) run on a timer wheel
+//          * getStats() returns per check-in timings, request and HTTP error counts and heap figures, reportStats uploads them
+//          * Logging goes to a ring of binary records with compile-time levels, formatted and printed later without blocking
+//          * NTP, OTA and the built-in sensors can be compiled out (DeviceIOFeatures.h), host strings are constants, not members
+//          * Server replies are parsed line by line as they arrive, sketches can register handlers for their own directives
+//          * SETCMD sets the check-in interval, upload batch size and per-sensor periods, deadbands and on/off, kept on flash
+//          * Check-ins are jittered at start and after each interval, failures back off, NEXT and Retry-After push them back
+//          * Optional long-poll push channel (pushChannel) delivers directives between check-ins within seconds
 
 #include <Arduino.h>
 #include "DeviceIO.h"
 #include <WiFiClientSecure.h>
-#include <WiFiUdp.h>
 #include <time.h>
 
 #ifdef ESP32
-	#include <Update.h> // esp32 firmware updater
 	#include <HTTPClient.h>
 	#include <ssl_client.h>
 	#include <WiFi.h>
@@ -89,7 +115,9 @@
 		#include <WiFiClientSecureBearSSL.h>
 		#include <ESP8266HTTPClient.h>
 		
-		ADC_MODE(ADC_VCC); // for ESP.getVcc() to report real values
+		#if DEVICEIO_BUILTIN_SENSORS
+			ADC_MODE(ADC_VCC); // for ESP.getVcc() to report real values
+		#endif
 	#endif
 #endif
 
@@ -105,14 +133,148 @@
 	uint8_t temprature_sens_read();
 #endif
 
+static constexpr char _DeviceIO_provisionedKey[] = "provisioned";
+static constexpr char _DeviceIO_tokenKey[] = "token";
+// epoch of the last check-in that went through, the first one after a restart waits for the interval
+static constexpr char _DeviceIO_checkinKey[] = "checkin";
+// one file each before DeviceIOStore, moved to the store on the first boot
+static constexpr char _DeviceIO_provisionKeyFilename[] = "/deviceProvisioned.txt";
+static constexpr char _DeviceIO_provisionTokenFilename[] = "/deviceToken.txt";
+
+// host connection strings, constants rather than members so no DeviceIO carries a pointer to each
+static constexpr char _DeviceIO_OTAhost[] = "deviceio-devices.goodprototyping.com";
+static constexpr char _DeviceIO_OTAHTTPSprefix[] = "https://";
+static constexpr char _DeviceIO_OTAprodIDpass[] = "&prodIDpass=";
+static constexpr char _DeviceIO_OTAqueryprefix[] = "/manage-device?cmd=";
+static constexpr char _DeviceIO_OTAgetversionprefix[] = "getversion&prodID=";
+static constexpr char _DeviceIO_OTAgetdevicetokenprefix[] = "gettoken&prodID=";
+static constexpr char _DeviceIO_OTAgetdfirmwareprefix[] = "getfirmware&prodID=";
+static constexpr char _DeviceIO_OTAsensorprefix[] = "sensor&prodID=";
+static constexpr char _DeviceIO_OTAcheckinprefix[] = "checkin&prodID=";
+static constexpr char _DeviceIO_OTAlistenprefix[] = "listen&prodID=";
+static constexpr char _DeviceIO_OTAbuildprefix[] = "&build=";
+static constexpr char _DeviceIO_OTAtokenprefix[] = "&token=";
+static constexpr char _DeviceIO_OTAheatshrinkprefix[] = "&heatshrink=";
+static constexpr char _DeviceIO_OTApatchprefix[] = "&patchfrom=";
+static constexpr char _DeviceIO_OTAsetackprefix[] = "&setack=";
+static constexpr char _DeviceIO_OTAholdprefix[] = "&hold=";
+
+static constexpr char DEVICEIO_SERVER_DIRECTIVE_REBOOT[] = "REBOOT";
+static constexpr char DEVICEIO_SERVER_DIRECTIVE_SET[] = "SETCMD";
+static constexpr char DEVICEIO_SERVER_DIRECTIVE_BUILD[] = "BUILD";
+static constexpr char DEVICEIO_SERVER_DIRECTIVE_NEXT[] = "NEXT";
+static constexpr char _DeviceIO_retryAfterHeader[] = "Retry-After";
+
+// the library's directives, sketches can't take them over
+static bool reservedDirective(const char *name)
+{
+	return (name == nullptr) || (strcmp(name, DEVICEIO_SERVER_DIRECTIVE_REBOOT) == 0) || \
+		   (strcmp(name, DEVICEIO_SERVER_DIRECTIVE_SET) == 0) || (strcmp(name, DEVICEIO_SERVER_DIRECTIVE_BUILD) == 0) || \
+		   (strcmp(name, DEVICEIO_SERVER_DIRECTIVE_NEXT) == 0);
+}
+
+// SSL/TLS for https://deviceio-devices.goodprototyping.com
+#ifdef ESP32
+	// cert for ESP32 HTTPClient
+	static constexpr char _DeviceIO_OTAserverCertificate[] = \
+"-----BEGIN CERTIFICATE-----\n" \
+"MIIDBzCCAnCgAwIBAgIJALaHl013FkeYMA0GCSqGSIb3DQEBCwUAMIGZMQswCQYD\n" \
+"VQQGEwJDQTEPMA0GA1UECAwGUXVlYmVjMREwDwYDVQQHDAhNb250cmVhbDEdMBsG\n" \
+"A1UECgwUR29vZFByb3RvdHlwaW5nIFtST10xGDAWBgNVBAsMD0dvb2RQcm90b3R5\n" \
+"cGluZzEtMCsGA1UEAwwkZGV2aWNlaW8tZGV2aWNlcy5nb29kcHJvdG90eXBpbmcu\n" \
+"Y29tMCAXDTIxMDEwOTIyMjcxOVoYDzIwODAxMjI1MjIyNzE5WjCBmTELMAkGA1UE\n" \
+"BhMCQ0ExDzANBgNVBAgMBlF1ZWJlYzERMA8GA1UEBwwITW9udHJlYWwxHTAbBgNV\n" \
+"BAoMFEdvb2RQcm90b3R5cGluZyBbUk9dMRgwFgYDVQQLDA9Hb29kUHJvdG90eXBp\n" \
+"bmcxLTArBgNVBAMMJGRldmljZWlvLWRldmljZXMuZ29vZHByb3RvdHlwaW5nLmNv\n" \
+"bTCBnzANBgkqhkiG9w0BAQEFAAOBjQAwgYkCgYEA4kAT5YbaRpPg/Tz7+gyeAVoH\n" \
+"hDA/Qtii/9FUE8LZszCapmdANNdLUDuTvWtCc8VgWymdA0OoF43RmWU+p2IuN20Y\n" \
+"XXf3CQMeBjgeCdG3jOVOUjYyFvrJPA5OK1eqx1WlorVf86rhlGGTDNTiWR+FArew\n" \
+"NL/vq9pUSbDjxp0MdFECAwEAAaNTMFEwHQYDVR0OBBYEFDQP7UEOfif5RGF8n2vr\n" \
+"hv5JYE4PMB8GA1UdIwQYMBaAFDQP7UEOfif5RGF8n2vrhv5JYE4PMA8GA1UdEwEB\n" \
+"/wQFMAMBAf8wDQYJKoZIhvcNAQELBQADgYEAPKvd34ZkD77B8E/37oS3K+Ju9uWh\n" \
+"fuODJTg+9OqgLwjaW8ueaq+kG5nPSIwCP2K69I1bXwwbaFXW2plL8VqPT/Pvv2S3\n" \
+"nctPTAfI5t8RFCWSSE4VzQyW5Dc76gb3OWUPc+1TCllC9cv5lgoVUjOMAeHG8ubr\n" \
+"/aHW8ixdgc1fRUs=\n" \
+"-----END CERTIFICATE-----\n";
+#else
+	#ifdef ESP8266
+		// SHA-1 fingerprint for BEARSSL
+		static constexpr uint8_t _DeviceIO_OTAserverFingerprint[20] = {0x93, 0x1C, 0x03, 0x1E, 0x5E, 0x3C, 0x34, 0x16, 0xE3, 0x1D, 0xD5, 0xD1, 0xE6, 0xA1, 0x60, 0xDB, 0x22, 0x48, 0xB3, 0x30};
+	#endif
+#endif
+
+// spool records hold up to DEVICEIO_SPOOL_BATCH samples of DEVICEIO_SPOOL_SAMPLE_SIZE
+// bytes: epoch uint32, sensor number uint16, value float, all little endian
+static void packSample(const struct sensordata &sample, uint8_t *out)
+{
+uint32_t bits;
+
+	memcpy(&bits, &sample.sensorvalue, sizeof(bits));
+	out[0] = (uint8_t)sample.epoch;
+	out[1] = (uint8_t)(sample.epoch >> 8);
+	out[2] = (uint8_t)(sample.epoch >> 16);
+	out[3] = (uint8_t)(sample.epoch >> 24);
+	out[4] = (uint8_t)sample.sensornumber;
+	out[5] = (uint8_t)(sample.sensornumber >> 8);
+	out[6] = (uint8_t)bits;
+	out[7] = (uint8_t)(bits >> 8);
+	out[8] = (uint8_t)(bits >> 16);
+	out[9] = (uint8_t)(bits >> 24);
+}
+
+static void unpackSample(const uint8_t *in, struct sensordata &sample)
+{
+uint32_t bits = (uint32_t)in[6] | ((uint32_t)in[7] << 8) | ((uint32_t)in[8] << 16) | ((uint32_t)in[9] << 24);
+
+	sample.epoch = (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+	sample.sensornumber = (uint16_t)in[4] | ((uint16_t)in[5] << 8);
+	memcpy(&sample.sensorvalue, &bits, sizeof(bits));
+}
+
+// the largest allocation that would succeed
+static uint32_t largestFreeBlock(void)
+{
+	#ifdef ESP32
+		return ESP.getMaxAllocHeap();
+	#else
+		return ESP.getMaxFreeBlockSize();
+	#endif
+}
+
 // constructor
 DeviceIO::DeviceIO(void)
 {
+	_DeviceIO_aggregator.begin(aggregateOutput, this);
+	_DeviceIO_scheduler.begin(sensorOutput, this);
+	_DeviceIO_directives.add(DEVICEIO_SERVER_DIRECTIVE_REBOOT, directiveReboot, this);
+	_DeviceIO_directives.add(DEVICEIO_SERVER_DIRECTIVE_BUILD, directiveBuild, this);
+	_DeviceIO_directives.add(DEVICEIO_SERVER_DIRECTIVE_SET, directiveSet, this);
+	_DeviceIO_directives.add(DEVICEIO_SERVER_DIRECTIVE_NEXT, directiveNext, this);
+	
+	#if DEVICEIO_BUILTIN_SENSORS
+		// the built-in sensors are channels like any other
+		#ifdef ESP8266
+			addSensor(DEVICEIO_SENSOR_VCC, DEVICEIO_BUILTIN_PERIOD_S * 1000, readVcc, this);
+		#endif
+		addSensor(DEVICEIO_SENSOR_WIFI, DEVICEIO_BUILTIN_PERIOD_S * 1000, readWifi, this);
+		#ifdef ESP32
+			addSensor(DEVICEIO_SENSOR_TEMPERATURE, DEVICEIO_BUILTIN_PERIOD_S * 1000, readTemperature, this);
+		#endif
+		
+		// and rarely move between check-ins
+		setSensorDeadband(DEVICEIO_SENSOR_VCC, DEVICEIO_VCC_DEADBAND, 0, DEVICEIO_BUILTIN_HEARTBEAT_S);
+		setSensorDeadband(DEVICEIO_SENSOR_WIFI, DEVICEIO_WIFI_DEADBAND, 0, DEVICEIO_BUILTIN_HEARTBEAT_S);
+		setSensorDeadband(DEVICEIO_SENSOR_TEMPERATURE, DEVICEIO_TEMPERATURE_DEADBAND, 0, DEVICEIO_BUILTIN_HEARTBEAT_S);
+	#endif
 }
 
 // destructor
 DeviceIO::~DeviceIO(void)
 {
+	#if DEVICEIO_BACKGROUND
+		// the worker uses this object
+		_DeviceIO_worker.stop();
+	#endif
 }
 
 // main init
@@ -128,8 +290,8 @@ void DeviceIO::initialize(void)
 			{};
 			Serial.println("");
 		}
-		debugMsg(F("Init"));		
 	}
+	DEVICEIO_LOG_I(_DeviceIO_log, "Init");
   
 	#ifdef ESP32
 		if (!SPIFFS.begin(true))
@@ -139,9 +301,10 @@ void DeviceIO::initialize(void)
 		#endif
 	#endif
 	{
+		DEVICEIO_LOG_E(_DeviceIO_log, "Error mounting SPIFFS, formatting...");
 		if (debugSerial == 1)
 		{
-			debugMsg(F("Error mounting SPIFFS, formatting..."));
+			flushLog();
 			delay(2000);
 		}
 		#ifdef ESP32
@@ -150,11 +313,12 @@ void DeviceIO::initialize(void)
 			#ifdef ESP8266
 				if (!LittleFS.format())
 				{
-					debugMsg(F("SPIFFS format failed"));
+					DEVICEIO_LOG_E(_DeviceIO_log, "SPIFFS format failed");
 				} else
 				{
 					// reboot
-					debugMsg(F("SPIFFS format OK"));
+					DEVICEIO_LOG_I(_DeviceIO_log, "SPIFFS format OK");
+					flushLog();
 					delay(2000);
 					ESP.restart();
 				}
@@ -163,111 +327,139 @@ void DeviceIO::initialize(void)
 		unprovisionDevice();
 	}
   
-	// check spiffs filesystem
-	if (!_DeviceIO_fileSystem.checkFlashConfig())
+	// check spiffs filesystem once, from here on the small files are served from RAM
+	if (!_DeviceIO_fileSystem.mount())
 	{
-		if (debugSerial == 1) debugMsg(F("Flash size error"));
+		DEVICEIO_LOG_E(_DeviceIO_log, "Flash size error");
+		flushLog();
 		delay(10000); // delay 10s to prevent the IC from being hammered if we have a flash problem
 		ESP.restart();
 	}
+	
+	// the server's settings, over the built-in channels' and the sketch's from here on
+	if (_DeviceIO_tuning.begin(_DeviceIO_fileSystem))
+	{
+		for (uint8_t i = 0; i < _DeviceIO_tuning.count(); i++)
+			applyTuning(_DeviceIO_tuning.sensor(i).sensornumber);
+		DEVICEIO_LOG_I(_DeviceIO_log, "Server settings loaded");
+	}
   
-	// check if device is provisioned already
-	_DeviceIO_fileSystem.openFromFile(_DeviceIO_provisionKeyFilename, _DeviceIO_deviceProvisioned);
-	if (_DeviceIO_deviceProvisioned == 1)
-		// get existing token from SPIFFS
-		_DeviceIO_fileSystem.openFromFile(_DeviceIO_provisionTokenFilename, _DeviceIO_deviceToken);    
+	// check if device is provisioned already, this reads the store
+	loadProvisioning();
+	// samples and a firmware download left over from before the reset, their
+	// positions are in the store
+	_DeviceIO_spool.begin(_DeviceIO_fileSystem, &_DeviceIO_store);
+	#if DEVICEIO_OTA
+		_DeviceIO_firmware.begin(_DeviceIO_fileSystem, &_DeviceIO_store);
+	#endif
+	#if DEVICEIO_NTP
+		// the clock only syncs during check-ins, until then the samples get no time
+		_DeviceIO_clock.begin(&_DeviceIO_store);
+	#endif
+	
+	// server identity for the shared HTTPS connection
+	#ifdef ESP32
+		_DeviceIO_connection.setCACert(_DeviceIO_OTAserverCertificate);
+		#if DEVICEIO_PUSH
+			_DeviceIO_push.connection().setCACert(_DeviceIO_OTAserverCertificate);
+		#endif
+	#else
+		#ifdef ESP8266
+			_DeviceIO_connection.setFingerprint(_DeviceIO_OTAserverFingerprint);
+			#if DEVICEIO_PUSH
+				_DeviceIO_push.connection().setFingerprint(_DeviceIO_OTAserverFingerprint);
+			#endif
+		#endif
+	#endif
 	
-	// initialize for ntp service
-	configTime(0, 0, "pool.ntp.org", "time.nist.gov");
 	// See https://github.com/nayarsystems/posix_tz_db/blob/master/zones.csv for Timezone codes for your region
 	setenv("TZ", ntpTimeZoneInfo.c_str(), 1);
+	tzset();
 }
 
-void DeviceIO::debugMsg(String msg)
+// prints the log before a restart, it would be lost
+void DeviceIO::flushLog(void)
 {
-char buf[50];
-
-	sprintf_P(buf, PSTR("(DeviceIO b%d) "), DEVICE_IO_BUILD_NUMBER);
-	Serial.print(buf);
-	Serial.println(msg);
+	if (debugSerial == 1)
+		_DeviceIO_log.flush(Serial);
 }
 
-void DeviceIO::debugMsgHttpError(int i)
+#if DEVICEIO_LOG_LEVEL >= DEVICEIO_LOG_ERROR
+// HTTPClient errors by name, for the log
+static PGM_P httpErrorName(int code)
 {
-const __FlashStringHelper *HTTPERR = F("HTTPERR:");
-const __FlashStringHelper *errmsg;
-
-	switch(i)
+	switch (code)
 	{
 		case -1:
-			errmsg = F("CONNECTION_REFUSED");
-			break;
+			return PSTR("CONNECTION_REFUSED");
 		case -2:
-			errmsg = F("SEND_HEADER_FAILED");
-			break;
+			return PSTR("SEND_HEADER_FAILED");
 		case -3:
-			errmsg = F("SEND_PAYLOAD_FAILED");
-			break;
+			return PSTR("SEND_PAYLOAD_FAILED");
 		case -4:
-			errmsg = F("NOT_CONNECTED");
-			break;
+			return PSTR("NOT_CONNECTED");
 		case -5:
-			errmsg = F("CONNECTION_LOST");
-			break;
+			return PSTR("CONNECTION_LOST");
 		case -6:
-			errmsg = F("NO_STREAM");
-			break;
+			return PSTR("NO_STREAM");
 		case -7:
-			errmsg = F("NO_HTTP_SERVER");
-			break;
+			return PSTR("NO_HTTP_SERVER");
 		case -8:
-			errmsg = F("NOT_ENOUGH_RAM");
-			break;
+			return PSTR("NOT_ENOUGH_RAM");
 		case -9:
-			errmsg = F("ENCODING");
-			break;
+			return PSTR("ENCODING");
 		case -10:
-			errmsg = F("STREAM_WRITE");
-			break;
+			return PSTR("STREAM_WRITE");
 		case -11:
-			errmsg = F("READ_TIMEOUT");
-			break;
-		default:
-			debugMsg(String(HTTPERR), String(i));
-			return;
+			return PSTR("READ_TIMEOUT");
 	}
-	debugMsg(String(HTTPERR), String(errmsg));
+	return PSTR("");
 }
+#endif
 
-void DeviceIO::debugMsg(String msg, long appendnumber)
+void DeviceIO::unprovisionDevice(void)
 {
-	debugMsg(msg + String(appendnumber));
+  // clear the provisioning settings, both or neither
+  _DeviceIO_store.setInt(_DeviceIO_provisionedKey, 0);
+  _DeviceIO_store.remove(_DeviceIO_tokenKey);
+  _DeviceIO_store.commit();
+  DEVICEIO_LOG_I(_DeviceIO_log, "Unprovisioned");
 }
 
-void DeviceIO::debugMsg(String msg, String msg2)
+void DeviceIO::loadProvisioning(void)
 {
-	debugMsg(msg + msg2);
-}
+int32_t provisioned = 0;
 
-void DeviceIO::debugMsgError(String msg, String msg2, long appendnumber)
-{
-	debugMsg(msg + msg2 + String(appendnumber));
-}
+	// one read of the store file
+	if (_DeviceIO_store.begin(_DeviceIO_fileSystem) && _DeviceIO_store.getInt(_DeviceIO_provisionedKey, provisioned))
+	{
+		_DeviceIO_deviceProvisioned = (provisioned == 1) ? 1 : 0;
+		if (_DeviceIO_deviceProvisioned == 1)
+			_DeviceIO_store.getString(_DeviceIO_tokenKey, _DeviceIO_deviceToken);
+		return;
+	}
 
-void DeviceIO::unprovisionDevice(void)
-{
-  // delete the provisioning files
-  _DeviceIO_fileSystem.saveToFile(_DeviceIO_provisionKeyFilename, "0");
-  _DeviceIO_fileSystem.saveToFile(_DeviceIO_provisionTokenFilename, "");
-  if (debugSerial == 1) debugMsg(F("Unprovisioned"));
+	// written by an older build, moved to the store with one commit
+	if (!_DeviceIO_fileSystem.openFromFile(_DeviceIO_provisionKeyFilename, _DeviceIO_deviceProvisioned))
+		return;
+	if (_DeviceIO_deviceProvisioned == 1)
+		_DeviceIO_fileSystem.openFromFile(_DeviceIO_provisionTokenFilename, _DeviceIO_deviceToken);
+	_DeviceIO_store.setInt(_DeviceIO_provisionedKey, _DeviceIO_deviceProvisioned);
+	if (_DeviceIO_deviceProvisioned == 1)
+		_DeviceIO_store.setString(_DeviceIO_tokenKey, _DeviceIO_deviceToken.c_str());
+	if (_DeviceIO_store.commit())
+	{
+		_DeviceIO_fileSystem.removeFile(_DeviceIO_provisionKeyFilename);
+		_DeviceIO_fileSystem.removeFile(_DeviceIO_provisionTokenFilename);
+		DEVICEIO_LOG_I(_DeviceIO_log, "Provisioning files moved to the store");
+	}
 }
 
 long DeviceIO::getRemoteVersionNumber(void)
 {
-const char *_DeviceIO_OTAgetversionprefix = "getversion&prodID=";
 long vernum;
 
-  if (debugSerial == 1) debugMsg(F("Fetching latest build number"));
+  DEVICEIO_LOG_D(_DeviceIO_log, "Fetching latest build number");
   
   // example url: https://deviceio.goodprototyping.com/manage-device?cmd=getversion&prodID=radio2prodIDpass=password&token=%token%
   String serverPath = 	String(_DeviceIO_OTAHTTPSprefix) + String(_DeviceIO_OTAhost) + \
@@ -275,27 +467,18 @@ long vernum;
 						String(_DeviceIO_OTAprodIDpass) + productIDpassword + \
 						String(_DeviceIO_OTAtokenprefix) + _DeviceIO_deviceToken;
   
-  //if (debugSerial == 1) debugMsg(serverPath);
-  
   String payload = newSSLGET(serverPath);
   if (_DeviceIO_LastHTTPcode < 1)
   {
-    if (debugSerial == 1)
-	{
-		debugMsgError(String(_DeviceIO_httpsreq), String(_DeviceIO_errmsg_failedwitherror), _DeviceIO_LastHTTPcode);
-		debugMsgHttpError(_DeviceIO_LastHTTPcode);
-		debugMsg(F("Check HTTPS certificate or factory reset"));
-	}
+	DEVICEIO_LOG_E(_DeviceIO_log, "HTTPS request failed with error #%d %s", _DeviceIO_LastHTTPcode, httpErrorName(_DeviceIO_LastHTTPcode));
+	DEVICEIO_LOG_E(_DeviceIO_log, "Check HTTPS certificate or factory reset");
 	return -1;
   }
   
   if (_DeviceIO_LastHTTPcode != 200) 
   {
-	if (debugSerial == 1)
-	{
-		debugMsgError(String(F("Build number fetch")), String(_DeviceIO_errmsg_failedwitherror), _DeviceIO_LastHTTPcode);	
-		debugMsg(F("Check provisioning token or factory reset"));
-	}
+	DEVICEIO_LOG_E(_DeviceIO_log, "Build number fetch failed with error #%d", _DeviceIO_LastHTTPcode);
+	DEVICEIO_LOG_E(_DeviceIO_log, "Check provisioning token or factory reset");
 	return -1;
   }
   
@@ -303,12 +486,7 @@ long vernum;
   if (payload.length() < 5)
   {
     vernum = atoi(payload.c_str());
-    if (debugSerial == 1)
-	{
-		char buf[50];
-		sprintf_P(buf, PSTR("Running build #%ld, newest build is #%ld"), buildNumber, vernum);
-		debugMsg(String(buf));
-	}
+    DEVICEIO_LOG_I(_DeviceIO_log, "Running build #%ld, newest build is #%ld", buildNumber, vernum);
 	
     // return the remote version #
     return vernum;
@@ -318,7 +496,6 @@ long vernum;
 
 uint8_t DeviceIO::getDeviceToken(void)
 {
-const char *_DeviceIO_OTAgetdevicetokenprefix = "gettoken&prodID=";
 String serverPath;
 
   // example url: https://deviceio.goodprototyping.com/manage-device?cmd=gettoken&prodID=radio2&prodIDpass=password
@@ -326,668 +503,1500 @@ String serverPath;
 				String(_DeviceIO_OTAqueryprefix) + String(_DeviceIO_OTAgetdevicetokenprefix) + productIDname + \
 				String(_DeviceIO_OTAprodIDpass) + productIDpassword;
 
-  if (debugSerial == 1)
-  {
-	  debugMsg(F("Getting a device token"));
-	  //debugMsg(F("URL:"), serverPath);
-  }
+  DEVICEIO_LOG_I(_DeviceIO_log, "Getting a device token");
   
   String payload = newSSLGET(serverPath);
   
   if (_DeviceIO_LastHTTPcode < 1)
   {
-	if (debugSerial == 1)
-	{
-		debugMsgError(String(_DeviceIO_httpsreq), String(_DeviceIO_errmsg_failedwitherror), _DeviceIO_LastHTTPcode);
-		debugMsgHttpError(_DeviceIO_LastHTTPcode);
-		debugMsg(String(_DeviceIO_errmsg_CERTfactoryreset));
-	}
+	DEVICEIO_LOG_E(_DeviceIO_log, "HTTPS request failed with error #%d %s", _DeviceIO_LastHTTPcode, httpErrorName(_DeviceIO_LastHTTPcode));
+	DEVICEIO_LOG_E(_DeviceIO_log, "Check SSL CA or factory reset");
 	return 0;
   }
 
   if (_DeviceIO_LastHTTPcode != 200) 
   {
-    if (debugSerial == 1)
-	{
-		debugMsgError(String(F("Token retrieval")), String(_DeviceIO_errmsg_failedwitherror), _DeviceIO_LastHTTPcode);
-	}
+    DEVICEIO_LOG_E(_DeviceIO_log, "Token retrieval failed with error #%d", _DeviceIO_LastHTTPcode);
     return 0;
   }
   
   if (payload.length() < 1)
   {
-	if (debugSerial == 1) debugMsg(F("Got empty token"));
+	DEVICEIO_LOG_E(_DeviceIO_log, "Got empty token");
 	return 0;
   }
   
   // set token
   _DeviceIO_deviceToken = payload;
-  if (debugSerial == 1)
-  {
-	  debugMsg(F("Got token="), _DeviceIO_deviceToken);
-  }
-
-  // save to spiffs
-  _DeviceIO_fileSystem.saveToFile(_DeviceIO_provisionKeyFilename, "1");
-  _DeviceIO_fileSystem.saveToFile(_DeviceIO_provisionTokenFilename, _DeviceIO_deviceToken);
-
-  // reboot
-  delay(2000);
-  ESP.restart();
-  return 1;
-}
-
-uint8_t DeviceIO::getNewFirmware(void)
-{
-const char *_DeviceIO_OTAgetdfirmwareprefix = "getfirmware&prodID=";
-HTTPClient https;
-
-  //debugMsg(F("Getting new firmware"));
-
-  // example url: https://deviceio.goodprototyping.com/manage-device?cmd=getfirmware&prodID=radio2&prodIDpass=password&token=%token%
-  String serverPath = 	String(_DeviceIO_OTAHTTPSprefix) + String(_DeviceIO_OTAhost) + \
-						String(_DeviceIO_OTAqueryprefix) + String(_DeviceIO_OTAgetdfirmwareprefix) + productIDname + \
-						String(_DeviceIO_OTAprodIDpass) + productIDpassword + \
-						String(_DeviceIO_OTAtokenprefix) + _DeviceIO_deviceToken;
-  //debugMsg(F("URL:"), serverPath);
-  
-  #ifdef ESP8266
-	std::unique_ptr <BearSSL::WiFiClientSecure> client (new BearSSL::WiFiClientSecure);
-	client->setFingerprint(_DeviceIO_OTAserverFingerprint);
-	if (!https.begin(*client, serverPath))
-	{
-		_DeviceIO_LastHTTPcode = 0;
-		return 0;
-	}
-  #else
-	#ifdef ESP32
-		https.begin(serverPath, _DeviceIO_OTAserverCertificate);
-	#endif
-  #endif
-  
-  // get the firmware
-  _DeviceIO_LastHTTPcode = https.GET();
-  if (_DeviceIO_LastHTTPcode < 1)
-  {
-	if (debugSerial == 1)
-	{
-		debugMsgError(String(F("getNewFirmware HTTPS request")), _DeviceIO_errmsg_failedwitherror, _DeviceIO_LastHTTPcode);
-		debugMsgHttpError(_DeviceIO_LastHTTPcode);
-		debugMsg(String(_DeviceIO_errmsg_CERTfactoryreset));
-	}
-	https.end();
-	return 0;
-  }
+  // the record would outlive the String
+  DEVICEIO_LOG_I(_DeviceIO_log, "Got a token, %u characters", (unsigned int)_DeviceIO_deviceToken.length());
 
-  if (_DeviceIO_LastHTTPcode != 200)
+  // save to spiffs, a reset can't leave the flag without the token
+  if (!_DeviceIO_store.setString(_DeviceIO_tokenKey, _DeviceIO_deviceToken.c_str()))
   {
-	if (debugSerial == 1)
-	{
-		debugMsgError(String(F("getNewFirmware retrieval")), _DeviceIO_errmsg_failedwitherror, _DeviceIO_LastHTTPcode);
-	}
-	https.end();
+	DEVICEIO_LOG_E(_DeviceIO_log, "Token too long");
 	return 0;
   }
-  
-  unsigned long firmwarecontentLength = https.getSize();
-  if (firmwarecontentLength < 1)
+  _DeviceIO_store.setInt(_DeviceIO_provisionedKey, 1);
+  // not on flash, a reboot would ask for a token again. the check-in retries
+  if (!_DeviceIO_store.commit())
   {
-    if (debugSerial == 1) debugMsg(F("Got empty firmware"));
-		https.end();
+	DEVICEIO_LOG_E(_DeviceIO_log, "Token not saved");
 	return 0;
   }
 
-  if (debugSerial == 1) debugMsg(F("Downloaded bytes = "), firmwarecontentLength);
+  // the check-in reboots the device
+  return 1;
+}
 
-  // check if there is enough to OTA Update
-  bool canBegin = Update.begin(firmwarecontentLength);
-  if (!canBegin)
-  {
-    // not enough partition space to begin OTA
-    if (debugSerial == 1) debugMsg(F("Not enough space to begin"));
-	https.end();
-    return 0;
-  }
-  
-  if (debugSerial == 1) debugMsg(F("Starting OTA, please wait..."));
-  delay(20); // allow serial buffer to empty before we begin update
-  
-  size_t written = Update.writeStream(*https.getStreamPtr());
-  if ((unsigned long)written == firmwarecontentLength)
-  {
-    if (debugSerial == 1) debugMsg(F("Bytes written OK: "), written);
-  } else
-  {
-    if (debugSerial == 1) 
-	{
-		debugMsg(F("Error, only wrote "), written);
-		debugMsg(F("Rebooting..."));
-	}
-	https.end();
-	delay(5000);
-	ESP.restart();
-  }
-  
-  // close the connection
-  https.end();
-  
-  // check to see if update ended properly
-  if (Update.end())
-  {
-    if (debugSerial == 1) debugMsg(F("OTA completed"));
-    if (Update.isFinished())
-    {
-      if (debugSerial == 1) debugMsg(F("Rebooting"));
-		ESP.restart();
-    } else 
-    {
-      if (debugSerial == 1) debugMsg(F("Update failed"));
-		return 0;
-    }
-  } else 
-  {
-	if (debugSerial == 1)
+// the check-in as a state machine //////////////////////////////
+//
+// poll() runs one step after the other until its budget is used up.
+// a step that waits sets _DeviceIO_wakeMS and returns, nothing in here
+// calls delay(). HTTPS requests can't be split with the HTTPClient API
+// so each one is a single step
+
+uint8_t DeviceIO::doCheckIn(void)
+{
+uint8_t state;
+
+	// sleep through the waits of the state machine
+	while ((state = poll(0xFFFFFFFF)) == DEVICEIO_POLL_BUSY)
 	{
-		debugMsg(F("Update Error #"), Update.getError());
+		long wait = (long)(_DeviceIO_wakeMS - millis());
+		delay(wait > 0 ? wait : 0);
 	}
+	
+	if (state == DEVICEIO_POLL_DONE)
+		return 1;
 	return 0;
-  }
+}
 
-  // reboot
-  delay(2000);
-  ESP.restart();
-  // shouldn't get here
-  return 1;
+uint8_t DeviceIO::poll(unsigned long budgetUs)
+{
+	#if DEVICEIO_BACKGROUND
+		// the worker runs the check-ins
+		if (_DeviceIO_worker.running())
+			return DEVICEIO_POLL_IDLE;
+	#endif
+	
+	return pollSteps(budgetUs);
 }
 
-uint8_t DeviceIO::doOTA(void)
-{			
-	if (debugSerial == 1) debugMsg(F("OTA check starting"));
+uint8_t DeviceIO::pollSteps(unsigned long budgetUs)
+{
+unsigned long start = micros();
+uint8_t firstStep = 1;
+uint8_t state;
+
+	// what the last steps logged, as far as the UART takes it without waiting
+	if (debugSerial == 1)
+		_DeviceIO_log.drain(Serial);
+	#if DEVICEIO_NTP
+		// takes an NTP reply stepNTP() is waiting for, sends nothing
+		_DeviceIO_clock.poll(false);
+	#endif
+	_DeviceIO_scheduler.run(millis());
 	
-	if (WiFi.status() != WL_CONNECTED)
+	if (_DeviceIO_phase == DEVICEIO_PHASE_IDLE)
 	{
-		if (debugSerial == 1) debugMsg(F("No network, exiting"));
-		return 0;
+		state = startCheckIn();
+		#if DEVICEIO_PUSH
+			if (state == DEVICEIO_POLL_IDLE)
+				pollPush();
+		#endif
+		if (state != DEVICEIO_POLL_BUSY)
+			return state;
 	}
-	
-	// get device token if we have none
-	if (_DeviceIO_deviceProvisioned == 0)
+
+	do
 	{
-		if (getDeviceToken()==0)
-		{
-			return 0;
-		}
-	}
+		// a step is waiting for the clock
+		if ((long)(millis() - _DeviceIO_wakeMS) < 0)
+			return DEVICEIO_POLL_BUSY;
+		
+		// requests only start with a fresh budget
+		if ((firstStep == 0) && ((_DeviceIO_phase == DEVICEIO_PHASE_TOKEN) || (_DeviceIO_phase == DEVICEIO_PHASE_CHECKIN) || \
+								 (_DeviceIO_phase == DEVICEIO_PHASE_VERSION) || (_DeviceIO_phase == DEVICEIO_PHASE_TELEMETRY) || \
+								 (_DeviceIO_phase == DEVICEIO_PHASE_OTA_BEGIN) || (_DeviceIO_phase == DEVICEIO_PHASE_REPLAY)))
+			return DEVICEIO_POLL_BUSY;
+		
+		state = checkInStep();
+		// the UART empties its FIFO during the HTTPS steps
+		if (debugSerial == 1)
+			_DeviceIO_log.drain(Serial);
+		if (state != DEVICEIO_POLL_BUSY)
+			return state;
+		firstStep = 0;
+	} while ((micros() - start) < budgetUs);
 	
-	// get remote version
-	long remotevernum = getRemoteVersionNumber();
-	if (remotevernum == -1)
-	{
-		if (debugSerial == 1) debugMsg(F("Remote build number query failed"));
-		return 0;
-	} else
-	if (remotevernum <= buildNumber)
-	{
-		if (debugSerial == 1) debugMsg(F("No new build available"));
-		return 1;
-	}
-
-	if (debugSerial == 1) debugMsg(F("Fetching firmware for build #"), remotevernum);
-	if (getNewFirmware() != 1)
-		return 0;
-
-	// everything worked
-	return 1;
+	return DEVICEIO_POLL_BUSY;
 }
 
-uint8_t DeviceIO::doCheckIn(void)
+uint8_t DeviceIO::startCheckIn(void)
 {
 unsigned long now = millis();
-uint8_t wifiSignalStrength = 0;
-int sendSensorDataReturnValue = 0;
-float voltsMcu;
-
-#ifdef ESP32
-	uint8_t esp32temp; // we need to declare this here to allow the goto to compile
-#endif
-
-	// check timer to do a check-in, run when first called
-	// checkinInterval is minimum 5 minutes
-	long ci = checkinInterval < (5*ONE_MINUTE) ? (5*ONE_MINUTE) : checkinInterval;
-	if ( !((now > lastCheckInTimeMS + ci) || (lastCheckInTimeMS == 0)) )
-		return 0;
 
-	if (debugSerial == 1) debugMsg(F("Check-in starting"));
-	
-// WIFI ////////////////////
-	
-	// make sure we're connected
-	if (WiFi.status() != WL_CONNECTED)
+	// the sketch moved the last check-in, the next one goes from there
+	if (lastCheckInTimeMS != _DeviceIO_lastCheckInMS)
 	{
-		if (debugSerial == 1) debugMsg(F("No Network for check-in, exiting"));
-		goto checkinfailed;
+		_DeviceIO_schedule.at((lastCheckInTimeMS == 0) ? now : (unsigned long)(lastCheckInTimeMS + checkInInterval()));
+		_DeviceIO_lastCheckInMS = lastCheckInTimeMS;
+		_DeviceIO_restartCheckIn = 0;
 	}
+	// the first check-in of this boot is within checkinJitterMS
+	if (!_DeviceIO_schedule.started())
+		_DeviceIO_schedule.begin(now, checkinJitterMS);
+	if (!_DeviceIO_schedule.due(now))
+		return DEVICEIO_POLL_IDLE;
+	#if DEVICEIO_PUSH
+		// one TLS connection at a time, the check-in needs the heap
+		_DeviceIO_push.close();
+	#endif
 
-// NTP /////////////////////
-
-	// get the time first	
-	if (getNTPtime() == 0) 
-		goto checkinfailed; // if this happens we lost WiFi
-
-// OTA /////////////////////
-
-	// do the OTA check first
-	if (doOTA() == 0)
-		goto checkinfailed;
+	DEVICEIO_LOG_I(_DeviceIO_log, "Check-in starting");
 	
-// SENSORS /////////////////
-
-	// VCC
-	#ifdef ESP8266	
-		// not applicable on ESP32		
-		voltsMcu = ESP.getVcc() / 1000.0f;
-		/*if (debugSerial == 1) 
-		{
-			Serial.print(F("Adding VCC to provisioner = "));
-			Serial.println(voltsMcu);
-		}*/
-		addSensorValue(255, voltsMcu);
+	_DeviceIO_checkinStartMS = now;
+	_DeviceIO_ntpAttempts = 0;
+	_DeviceIO_remoteBuild = -1;
+	_DeviceIO_sensorResult = 0;
+	_DeviceIO_replyAfterMS = 0;
+	#if DEVICEIO_OTA
+		_DeviceIO_otaStream = nullptr;
+		_DeviceIO_otaAttempts = 0;
 	#endif
 	
-	// built-in wifi sensor
-	wifiSignalStrength = getWifiSignalStrength();
-    /*if (debugSerial == 1) 
-	{
-		Serial.print(F("Adding WiFi sensor to provisioner = "));
-		Serial.println(String(wifiSignalStrength));
-	}*/
-    addSensorValue(256, wifiSignalStrength);
+	memset(&_DeviceIO_checkinStats, 0, sizeof(_DeviceIO_checkinStats));
+	_DeviceIO_checkinStats.freeHeapBefore = ESP.getFreeHeap();
+	_DeviceIO_checkinStats.maxBlockBefore = largestFreeBlock();
+	_DeviceIO_checkinHandshakes = _DeviceIO_connection.handshakes;
 	
-	#ifdef ESP32
-		// built-in temp sensor
-		// convert raw temperature in F to Celsius degrees
-		esp32temp = ((temprature_sens_read() - 32) / 1.8);
-		/*if (debugSerial == 1) 
-		{
-			Serial.print(F("Adding ESP32 temp sensor to provisioner = "));
-			Serial.println(String(esp32temp) + "C");
-		}*/
-		addSensorValue(257, esp32temp);
-	#endif
+	// windows that ended since their sensor's last sample go with this check-in
+	_DeviceIO_aggregator.flush(now);
 	
-	if (_DeviceIO_sensorindex > 0)
+	// make sure we're connected
+	if (WiFi.status() != WL_CONNECTED)
 	{
-		sendSensorDataReturnValue = sendSensorData();
-		if (sendSensorDataReturnValue == 0)
-			goto checkinfailed;
+		DEVICEIO_LOG_W(_DeviceIO_log, "No Network for check-in, exiting");
+		return finishCheckIn(0);
 	}
-
-// ALERTS ///////////////////
 	
-// FINISHED /////////////////
+	#if DEVICEIO_NTP
+		setPhase(DEVICEIO_PHASE_NTP);
+	#else
+		setPhase(DEVICEIO_PHASE_TOKEN);
+	#endif
+	return DEVICEIO_POLL_BUSY;
+}
 
-	if (debugSerial == 1)
+#if DEVICEIO_PUSH
+void DeviceIO::pollPush(void)
+{
+String url;
+bool supported = _DeviceIO_push.supported();
+
+	// after the first check-in, which has the start jitter
+	if ((pushChannel == 0) || (_DeviceIO_deviceProvisioned == 0) || (_DeviceIO_restartCheckIn == 1) || (WiFi.status() != WL_CONNECTED))
 	{
-		debugMsg(F("Check-In finished at "), String(now));
+		_DeviceIO_push.close();
+		return;
 	}
 	
-	// process reboot request if any
-	if (sendSensorDataReturnValue == 2)
+	if (_DeviceIO_push.ready(millis()))
 	{
-		debugMsg(F("Processing reboot request..."));
-		delay(5000);
-		ESP.restart();
+		// example url: /manage-device?cmd=listen&prodID=radio2&prodIDpass=password&token=%token%&build=12&hold=120
+		url = 	String(_DeviceIO_OTAqueryprefix) + String(_DeviceIO_OTAlistenprefix) + productIDname + \
+				String(_DeviceIO_OTAprodIDpass) + productIDpassword + String(_DeviceIO_OTAtokenprefix) + _DeviceIO_deviceToken + \
+				String(_DeviceIO_OTAbuildprefix) + String(buildNumber) + String(_DeviceIO_OTAholdprefix) + String(pushHoldS);
+		// the reply's directives set these as a check-in's do
+		_DeviceIO_replyReboot = 0;
+		_DeviceIO_replyBuild = -1;
+		_DeviceIO_replyAfterMS = 0;
+		if (!_DeviceIO_push.send(_DeviceIO_OTAhost, url, pushHoldS, millis()))
+		{
+			DEVICEIO_LOG_W(_DeviceIO_log, "Push channel connection failed");
+			return;
+		}
 	}
 	
-	// set last check-in time
-	lastCheckInTimeMS = now;
-	return 1;
-
-checkinfailed:
-	if (debugSerial == 1) debugMsg(F("Check-in failed"));
-	// reset the lastCheckInTimeMS so the server doesn't get hammered, but soon enough
-	lastCheckInTimeMS = now - (checkinInterval/8);
-	return 0;
-}
-
-uint8_t DeviceIO::getNTPtime(void)
-{
-uint8_t attempts = 0;
-
-	while(1)
+	if (!_DeviceIO_push.receive(millis()))
 	{
-		if (doNTP(15) == 0) // wait 5 seconds to sync
-		{
-			if (debugSerial == 1)
-				debugMsg(F("NTP Failure, retrying..."));
-			
-			// limit # of retries
-			attempts++;
-			if (attempts > 2) return 0;
-			
-			// wait and try again
-			delay(3000);
-		} else
-			break; // valid NTP call
-		
-		// exit if we don't have a valid WiFi connection
-		if (WiFi.status() != WL_CONNECTED)
-			return 0;
+		if (supported && !_DeviceIO_push.supported())
+			DEVICEIO_LOG_W(_DeviceIO_log, "Server has no push channel, directives come with check-ins");
+		return;
 	}
-  	
-	if (debugSerial == 1)
+	
+	// SETCMD and the sketch's directives have run. REBOOT and a newer build go
+	// through a check-in, it uploads the samples first. NEXT sets the check-in
+	if ((_DeviceIO_replyReboot == 1) || (_DeviceIO_replyBuild > buildNumber))
 	{
-		char buftime[100];
-		sprintf_P(buftime, PSTR("%d/%d/%d %d:%d:%d"), 	_DeviceIO_timeinfo.tm_mon+1, 
-														_DeviceIO_timeinfo.tm_mday, 
-														_DeviceIO_timeinfo.tm_year+1900, 
-														_DeviceIO_timeinfo.tm_hour, 
-														_DeviceIO_timeinfo.tm_min, 
-														_DeviceIO_timeinfo.tm_sec);
-		debugMsg(F("NTP: "), String(buftime));
-	}
-
-	// set clock set
-	_DeviceIO_clockneverset = 0;
-	return 1; // successful NTP
+		DEVICEIO_LOG_I(_DeviceIO_log, "Pushed %s, checking in", (_DeviceIO_replyReboot == 1) ? "reboot" : "build");
+		if (_DeviceIO_replyReboot == 1)
+			_DeviceIO_pushReboot = 1;
+		_DeviceIO_schedule.at(millis());
+	} else if (_DeviceIO_replyAfterMS > 0)
+		_DeviceIO_schedule.at(millis() + _DeviceIO_replyAfterMS);
 }
+#endif
 
-// The time() function only calls the NTP server every hour
-uint8_t DeviceIO::doNTP(int sec)
+void DeviceIO::setPhase(uint8_t phase, unsigned long waitMS)
 {
-time_t timenow;
-		
-	uint32_t start = millis();
-	timenow = time(nullptr);
-    do
-	{
-      time(&timenow);
-	  localtime_r(&timenow, &_DeviceIO_timeinfo);
-      delay(50);
-    } while (((millis() - start) <= (1000 * sec)) && (_DeviceIO_timeinfo.tm_year < (2020 - 1900)));
-    
-	if (_DeviceIO_timeinfo.tm_year <= (2020 - 1900)) 
-		return 0;  // the NTP call was unsuccessful
-	
-	// ok!
-	return 1;
+	_DeviceIO_phase = phase;
+	_DeviceIO_phaseStartMS = millis();
+	_DeviceIO_wakeMS = _DeviceIO_phaseStartMS + waitMS;
 }
 
-void DeviceIO::getTime(struct tm &t)
+// every restart the server asked for, a REBOOT, a new build or a new token
+uint8_t DeviceIO::scheduleReboot(unsigned long waitMS)
 {
-	if (doNTP(15) == 0) // wait 15 seconds to sync
-	{
-		// TODO: we should reset the date/time here
-	} else
-	{	
-		// populate the passed time structure
-		t.tm_sec = _DeviceIO_timeinfo.tm_sec;
-		t.tm_min = _DeviceIO_timeinfo.tm_min;
-		t.tm_hour = _DeviceIO_timeinfo.tm_hour;
-		t.tm_mday = _DeviceIO_timeinfo.tm_mday;
-		t.tm_mon = _DeviceIO_timeinfo.tm_mon+1;
-		t.tm_year = _DeviceIO_timeinfo.tm_year+1900;
-	}
+	_DeviceIO_connection.close();
+	recordCheckIn(1);
+	// the check-in got through, the restarted device waits its interval
+	checkInSucceeded();
+	// the sample buffer doesn't survive the restart
+	spoolSamples();
+	setPhase(DEVICEIO_PHASE_REBOOT, waitMS);
+	return DEVICEIO_POLL_BUSY;
 }
 
-void DeviceIO::addSensorValue(int sensorNumber, float sensorValue)
+// OTA when remotevernum is newer than our build, otherwise on to the next phase
+uint8_t DeviceIO::nextPhaseAfterBuild(long remotevernum, uint8_t next)
 {
-	if (_DeviceIO_sensorindex > 19)
-	{
-		// push the array forward one unit
-		memcpy(&_DeviceIO_sensorsamples[0], &_DeviceIO_sensorsamples[1], sizeof(_DeviceIO_sensorsamples[1])* 19);
-		// set the maximum index to 19
-		_DeviceIO_sensorindex = 19;
-	}
-	
-	if (debugSerial == 1)
+	if (remotevernum <= buildNumber)
 	{
-		char numbuf[18];
-		dtostrf(sensorValue, 8, 8, numbuf);  
-		char msg[100];
-		sprintf_P(msg, PSTR("addSensorValue index=%d, sensorNumber=%d, sensorValue=%s"),	_DeviceIO_sensorindex,
-																							sensorNumber,
-																							numbuf);
-	
-		debugMsg(msg);
+		DEVICEIO_LOG_D(_DeviceIO_log, "No new build available");
+		return next;
 	}
 	
-	// get the local time, sourced from NTP
-	char buftime[50];
-	// sql datetime format is "2020-11-25 01:50:34"
-	sprintf_P(buftime, PSTR("%d-%d-%d %d:%d:%d"), 	_DeviceIO_timeinfo.tm_year+1900, 
-													_DeviceIO_timeinfo.tm_mon+1, 
-													_DeviceIO_timeinfo.tm_mday, 
-													_DeviceIO_timeinfo.tm_hour, 
-													_DeviceIO_timeinfo.tm_min, 
-													_DeviceIO_timeinfo.tm_sec);
-													
-	_DeviceIO_sensorsamples[_DeviceIO_sensorindex].date = String(buftime);
-	_DeviceIO_sensorsamples[_DeviceIO_sensorindex].sensornumber = sensorNumber;
-	_DeviceIO_sensorsamples[_DeviceIO_sensorindex].sensorvalue = sensorValue;
-	_DeviceIO_sensorindex++;
+	#if DEVICEIO_OTA
+		DEVICEIO_LOG_I(_DeviceIO_log, "Fetching firmware for build #%ld", remotevernum);
+		return DEVICEIO_PHASE_OTA_BEGIN;
+	#else
+		DEVICEIO_LOG_I(_DeviceIO_log, "Build #%ld is available, OTA is compiled out", remotevernum);
+		return next;
+	#endif
 }
 
-// return values:
-// 0 = failed or unused
-// 1 = successful
-// 2 = flagged for reboot
-// 3 = other commands
-uint8_t DeviceIO::sendSensorData()
+uint8_t DeviceIO::checkInStep(void)
 {
-String serverPath;
-int i=0;
+uint8_t result;
+// spooled samples go after the fresh ones
+uint8_t last = _DeviceIO_spool.empty() ? DEVICEIO_PHASE_FINISH : DEVICEIO_PHASE_REPLAY;
 
-	if (debugSerial == 1) debugMsg(F("sendSensorData starting"));
-
-	if (_DeviceIO_sensorindex < 1)
-	{
-		if (debugSerial == 1) debugMsg(F("No sensor data, exiting"));
-		return 0;
-	}
-	
-	if (WiFi.status() != WL_CONNECTED)
+	switch (_DeviceIO_phase)
 	{
-		if (debugSerial == 1) debugMsg(F("No network, exiting"));
-		return 0;
-	}
+// NTP /////////////////////
+		#if DEVICEIO_NTP
+			case DEVICEIO_PHASE_NTP:
+				return stepNTP();
+		#endif
 
-	// prepare sensor data payload
-	String httpRequestData = "";
-	for (i=0; i < _DeviceIO_sensorindex; i++)
+// TOKEN ///////////////////
+		case DEVICEIO_PHASE_TOKEN:
+			// get device token if we have none, the device reboots with it
+			if (_DeviceIO_deviceProvisioned == 0)
+			{
+				if (getDeviceToken() == 0)
+					return finishCheckIn(0);
+				return scheduleReboot(2000);
+			}
+			
+			// a restart doesn't bring the next check-in forward, the clock
+			// tells how long ago the last one before it was
+			if (_DeviceIO_restartCheckIn == 1)
+			{
+				uint32_t wait = restartWait();
+				
+				_DeviceIO_restartCheckIn = 0;
+				if (wait > 0)
+				{
+					DEVICEIO_LOG_I(_DeviceIO_log, "Checked in before the restart, next check-in in %lus", (unsigned long)(wait / 1000));
+					_DeviceIO_connection.close();
+					_DeviceIO_phase = DEVICEIO_PHASE_IDLE;
+					_DeviceIO_schedule.at(millis() + wait);
+					return DEVICEIO_POLL_IDLE;
+				}
+			}
+			
+			// one checkin request uploads the samples and returns the newest
+			// build number and the directives. servers that don't know it get
+			// the getversion and sensor requests for the rest of this boot
+			if (_DeviceIO_checkinSupported == 1)
+				setPhase(DEVICEIO_PHASE_SENSORS);
+			else
+				setPhase(DEVICEIO_PHASE_VERSION);
+			return DEVICEIO_POLL_BUSY;
+
+// SENSORS /////////////////
+		case DEVICEIO_PHASE_SENSORS:
+			// the channels due by now go with this upload
+			_DeviceIO_scheduler.run(millis());
+			// the upload takes the newest samples of the server's batch size, the
+			// older ones are spooled and replayed in batches of that size
+			if ((_DeviceIO_tuning.batch() > 0) && (_DeviceIO_sensorsamples.size() > _DeviceIO_tuning.batch()))
+				spoolSamples(_DeviceIO_tuning.batch());
+			if (_DeviceIO_checkinSupported == 1)
+				setPhase(DEVICEIO_PHASE_CHECKIN);
+			else
+				setPhase(DEVICEIO_PHASE_TELEMETRY);
+			return DEVICEIO_POLL_BUSY;
+
+// CHECKIN /////////////////
+		case DEVICEIO_PHASE_CHECKIN:
+			result = sendSensorData(_DeviceIO_OTAcheckinprefix, &_DeviceIO_remoteBuild, _DeviceIO_sensorsamples);
+			if (result == 0)
+			{
+				if (_DeviceIO_checkinSupported == 1)
+					return finishCheckIn(0);
+				setPhase(DEVICEIO_PHASE_VERSION);
+				return DEVICEIO_POLL_BUSY;
+			}
+			_DeviceIO_sensorResult = result;
+			// uploaded as sensor data, the build number is still to get
+			if (_DeviceIO_checkinSupported == 0)
+			{
+				setPhase(DEVICEIO_PHASE_VERSION);
+				return DEVICEIO_POLL_BUSY;
+			}
+			
+			// the samples are uploaded, now the OTA
+			setPhase(nextPhaseAfterBuild(_DeviceIO_remoteBuild, last));
+			return DEVICEIO_POLL_BUSY;
+
+// OTA /////////////////////
+		case DEVICEIO_PHASE_VERSION:
+			#if DEVICEIO_OTA
+				// do the OTA check first
+				_DeviceIO_remoteBuild = getRemoteVersionNumber();
+				if (_DeviceIO_remoteBuild == -1)
+				{
+					DEVICEIO_LOG_E(_DeviceIO_log, "Remote build number query failed");
+					return finishCheckIn(0);
+				}
+				setPhase(nextPhaseAfterBuild(_DeviceIO_remoteBuild, DEVICEIO_PHASE_SENSORS));
+			#else
+				// the build number is only needed for the OTA
+				setPhase(DEVICEIO_PHASE_SENSORS);
+			#endif
+			return DEVICEIO_POLL_BUSY;
+			
+		#if DEVICEIO_OTA
+			case DEVICEIO_PHASE_OTA_BEGIN:
+				return stepOTABegin();
+				
+			case DEVICEIO_PHASE_OTA_WRITE:
+				return stepOTAWrite();
+				
+			case DEVICEIO_PHASE_OTA_END:
+				return stepOTAEnd();
+		#endif
+
+// TELEMETRY ///////////////
+		case DEVICEIO_PHASE_TELEMETRY:
+			if (!_DeviceIO_sensorsamples.empty())
+			{
+				result = sendSensorData(_DeviceIO_OTAsensorprefix, nullptr, _DeviceIO_sensorsamples);
+				if (result == 0)
+					return finishCheckIn(0);
+				// a REBOOT in the reply to the checkin request still goes
+				if (_DeviceIO_sensorResult != 2)
+					_DeviceIO_sensorResult = result;
+			}
+			setPhase(last);
+			return DEVICEIO_POLL_BUSY;
+			
+		case DEVICEIO_PHASE_REPLAY:
+			return stepReplay();
+
+// ALERTS ///////////////////
+	
+// FINISHED /////////////////
+		case DEVICEIO_PHASE_FINISH:
+			DEVICEIO_LOG_I(_DeviceIO_log, "Check-In finished at %lu", millis());
+			
+			#if DEVICEIO_PUSH
+				// a REBOOT that came over the push channel
+				if (_DeviceIO_pushReboot == 1)
+					_DeviceIO_sensorResult = 2;
+			#endif
+			// process reboot request if any
+			if (_DeviceIO_sensorResult == 2)
+			{
+				DEVICEIO_LOG_I(_DeviceIO_log, "Processing reboot request...");
+				return scheduleReboot(5000);
+			}
+			return finishCheckIn(1);
+			
+		case DEVICEIO_PHASE_REBOOT:
+			flushLog();
+			ESP.restart();
+			return DEVICEIO_POLL_BUSY;
+	}
+	
+	return finishCheckIn(0);
+}
+
+uint8_t DeviceIO::finishCheckIn(uint8_t success)
+{
+	_DeviceIO_connection.close();
+	#if DEVICEIO_OTA
+		_DeviceIO_otaStream = nullptr;
+		// an unfinished download keeps its checkpoint, not its buffers
+		_DeviceIO_decoder.end();
+		_DeviceIO_firmware.suspend();
+	#endif
+	_DeviceIO_phase = DEVICEIO_PHASE_IDLE;
+	_DeviceIO_restartCheckIn = 0;
+	recordCheckIn(success);
+	
+	// set last check-in time
+	lastCheckInTimeMS = _DeviceIO_checkinStartMS;
+	_DeviceIO_lastCheckInMS = lastCheckInTimeMS;
+	
+	if (success == 1)
 	{
-		httpRequestData += 	"&sensor[" + String(i) + "][datetime]=" + _DeviceIO_sensorsamples[i].date + 
-							"&sensor[" + String(i) + "][sensornum]=" + String(_DeviceIO_sensorsamples[i].sensornumber) + 
-							"&sensor[" + String(i) + "][sensorval]=" + String(_DeviceIO_sensorsamples[i].sensorvalue);
+		checkInSucceeded();
+		return DEVICEIO_POLL_DONE;
 	}
 	
-	// example url: https://deviceio.goodprototyping.com/manage-device?cmd=sensor&prodID=radio2&prodIDpass=password&token=token
-	serverPath = 	String(_DeviceIO_OTAHTTPSprefix) + String(_DeviceIO_OTAhost) + String(_DeviceIO_OTAqueryprefix) + \
-							"sensor&prodID=" + productIDname + String(_DeviceIO_OTAprodIDpass) + productIDpassword + String(_DeviceIO_OTAtokenprefix) + _DeviceIO_deviceToken;
+	DEVICEIO_LOG_W(_DeviceIO_log, "Check-in failed");
+	// keep the samples on flash until the next check-in gets through
+	spoolSamples();
+	// sooner than the interval, later after each failure in a row, so the server doesn't get hammered
+	_DeviceIO_schedule.failed(millis(), checkInInterval(), _DeviceIO_replyAfterMS);
+	return DEVICEIO_POLL_FAILED;
+}
+
+void DeviceIO::checkInSucceeded(void)
+{
+	_DeviceIO_schedule.succeeded(_DeviceIO_checkinStartMS, millis(), checkInInterval(), _DeviceIO_replyAfterMS);
+	// for restartWait() after the next restart, when the clock is set
+	if (clockEpoch() != 0)
+	{
+		_DeviceIO_store.setInt(_DeviceIO_checkinKey, (int32_t)(clockEpoch() - (millis() - _DeviceIO_checkinStartMS) / 1000));
+		_DeviceIO_store.commit();
+	}
+}
 
-	String payload;
-	payload = newSSLPOST(serverPath, httpRequestData);
+void DeviceIO::recordCheckIn(uint8_t success)
+{
+DeviceIOCheckInStats &checkin = _DeviceIO_checkinStats;
+DeviceIOReading readings[6];
+uint8_t count = 0;
+
+	checkin.success = success;
+	checkin.durationMs = millis() - _DeviceIO_checkinStartMS;
+	// the connection times are those of this check-in's last connect
+	if (_DeviceIO_connection.handshakes != _DeviceIO_checkinHandshakes)
+	{
+		checkin.dnsMs = _DeviceIO_connection.dnsMs;
+		checkin.tlsMs = _DeviceIO_connection.handshakeMs;
+	}
+	// the TLS buffers are gone by now
+	checkin.freeHeapAfter = ESP.getFreeHeap();
+	checkin.maxBlockAfter = largestFreeBlock();
 	
-	//if (debugSerial == 1) debugMsg(F("Sensordata Payload="), httpRequestData);
-	//if (debugSerial == 1) debugMsg(F("Sensordata Payload Len="), httpRequestData.length());
+	_DeviceIO_stats.last = checkin;
+	_DeviceIO_stats.checkins++;
+	if (success == 0)
+		_DeviceIO_stats.failures++;
 	
-	if (_DeviceIO_LastHTTPcode < 1)
+	if (reportStats != 1)
+		return;
+	
+	// stored like the readings of the sensor channels, deadbands apply
+	readings[count++] = {DEVICEIO_SENSOR_CHECKIN_MS, (float)checkin.durationMs};
+	if (checkin.tlsMs > 0)
+		readings[count++] = {DEVICEIO_SENSOR_TLS_MS, (float)checkin.tlsMs};
+	readings[count++] = {DEVICEIO_SENSOR_FREE_HEAP, (float)checkin.freeHeapAfter};
+	readings[count++] = {DEVICEIO_SENSOR_MAX_BLOCK, (float)checkin.maxBlockAfter};
+	readings[count++] = {DEVICEIO_SENSOR_FAILED_REQUESTS, (float)checkin.failedRequests};
+	readings[count++] = {DEVICEIO_SENSOR_DROPPED, (float)getDroppedSampleCount()};
+	sensorOutput(this, readings, count);
+}
+
+#if DEVICEIO_NTP
+
+// syncs the clock when it is due, every 10ms until the reply is in. waits for
+// the first sync of this boot, 3 attempts of 15 seconds 3 seconds apart, a
+// later one that fails leaves the clock running on its drift estimate
+uint8_t DeviceIO::stepNTP(void)
+{
+	_DeviceIO_checkinStats.ntpMs = millis() - _DeviceIO_checkinStartMS;
+	_DeviceIO_clock.poll(WiFi.status() == WL_CONNECTED);
+	if (_DeviceIO_clock.synced() && !_DeviceIO_clock.busy())
 	{
-		if (debugSerial == 1)
+		#if DEVICEIO_LOG_LEVEL >= DEVICEIO_LOG_INFO
+			struct tm timeinfo;
+			if (getTime(timeinfo))
+				DEVICEIO_LOG_I(_DeviceIO_log, "NTP: %d/%d/%d %d:%d:%d", timeinfo.tm_mon, timeinfo.tm_mday, timeinfo.tm_year, \
+							   timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+		#endif
+		
+		setPhase(DEVICEIO_PHASE_TOKEN);
+		return DEVICEIO_POLL_BUSY;
+	}
+	
+	// exit if we don't have a valid WiFi connection
+	if (WiFi.status() != WL_CONNECTED)
+		return finishCheckIn(0);
+	
+	if ((millis() - _DeviceIO_phaseStartMS) <= (15 * 1000))
+	{
+		_DeviceIO_wakeMS = millis() + 10;
+		return DEVICEIO_POLL_BUSY;
+	}
+	
+	DEVICEIO_LOG_W(_DeviceIO_log, "NTP Failure, retrying...");
+	
+	// limit # of retries
+	_DeviceIO_ntpAttempts++;
+	if (_DeviceIO_ntpAttempts > 2)
+		return finishCheckIn(0);
+	
+	// wait and try again
+	setPhase(DEVICEIO_PHASE_NTP, 3000);
+	_DeviceIO_phaseStartMS = _DeviceIO_wakeMS;
+	return DEVICEIO_POLL_BUSY;
+}
+
+#endif
+
+#if DEVICEIO_OTA
+
+uint8_t DeviceIO::stepOTABegin(void)
+{
+const char *headers[] = {"Content-Range", "Content-Encoding", "X-Image-Size", "X-Image-MD5", _DeviceIO_retryAfterHeader};
+HTTPClient *https;
+size_t offset = 0;
+size_t imageSize;
+bool heatshrink;
+
+  //DEVICEIO_LOG_D(_DeviceIO_log, "Getting new firmware");
+
+  // example url: https://deviceio.goodprototyping.com/manage-device?cmd=getfirmware&prodID=radio2&prodIDpass=password&token=%token%
+  String serverPath = 	String(_DeviceIO_OTAHTTPSprefix) + String(_DeviceIO_OTAhost) + \
+						String(_DeviceIO_OTAqueryprefix) + String(_DeviceIO_OTAgetdfirmwareprefix) + productIDname + \
+						String(_DeviceIO_OTAprodIDpass) + productIDpassword + \
+						String(_DeviceIO_OTAtokenprefix) + _DeviceIO_deviceToken;
+  
+  // the rest of a download that stopped, in this boot or before a reset
+  if (_DeviceIO_firmware.resume(_DeviceIO_remoteBuild))
+	offset = _DeviceIO_firmware.progress();
+  
+  // a smaller body when the server has one, a Range request gets the image as it is
+  if (offset == 0)
+  {
+	// e.g. &heatshrink=11.4&patchfrom=12
+	if (DEVICEIO_OTA_HEATSHRINK == 1)
+		serverPath += String(_DeviceIO_OTAheatshrinkprefix) + String(DEVICEIO_HEATSHRINK_WINDOW) + "." + String(DEVICEIO_HEATSHRINK_LOOKAHEAD);
+	if (DEVICEIO_OTA_PATCH == 1)
+		serverPath += String(_DeviceIO_OTApatchprefix) + String(buildNumber);
+  }
+  
+  // reuses the check-in connection
+  https = _DeviceIO_connection.open(_DeviceIO_OTAhost, serverPath);
+  if (https == nullptr)
+  {
+	_DeviceIO_LastHTTPcode = HTTPC_ERROR_CONNECTION_REFUSED;
+	countRequest(0, millis(), 0, 0);
+	return retryOTA();
+  }
+  
+  if (offset > 0)
+  {
+	https->addHeader(F("Range"), String(F("bytes=")) + String((unsigned long)offset) + "-");
+	DEVICEIO_LOG_I(_DeviceIO_log, "Resuming firmware download at %u", (unsigned int)offset);
+  }
+  // replaces the set open() collects, Retry-After included
+  https->collectHeaders(headers, 5);
+  
+  // get the firmware, the body is counted as it is written
+  unsigned long requestMS = millis();
+  _DeviceIO_LastHTTPcode = https->GET();
+  countRequest(0, requestMS, 0, 0);
+  // a busy server during a rollout says when to come back, the check-in fails below
+  retryAfter(https);
+  if (_DeviceIO_LastHTTPcode < 1)
+  {
+	DEVICEIO_LOG_E(_DeviceIO_log, "getNewFirmware HTTPS request failed with error #%d %s", _DeviceIO_LastHTTPcode, httpErrorName(_DeviceIO_LastHTTPcode));
+	return retryOTA();
+  }
+
+  unsigned long firmwarecontentLength = https->getSize();
+  if (_DeviceIO_LastHTTPcode == 206)
+  {
+	// Content-Range: bytes 65536-917503/917504, must continue where we stopped
+	String range = https->header("Content-Range");
+	int slash = range.indexOf('/');
+	if ((slash < 0) || ((size_t)atol(range.c_str() + 6) != offset) || ((size_t)atol(range.c_str() + slash + 1) != _DeviceIO_firmware.size()))
+	{
+		DEVICEIO_LOG_W(_DeviceIO_log, "Firmware changed, starting over");
+		_DeviceIO_firmware.abort();
+		return retryOTA();
+	}
+  } else
+  if ((_DeviceIO_LastHTTPcode == 200) && (offset > 0))
+  {
+	// the server sent the whole image
+	_DeviceIO_firmware.abort();
+	offset = 0;
+  } else
+  if (_DeviceIO_LastHTTPcode == 416)
+  {
+	// the saved progress doesn't fit the image
+	_DeviceIO_firmware.abort();
+	return retryOTA();
+  }
+  
+  if ((_DeviceIO_LastHTTPcode != 200) && (_DeviceIO_LastHTTPcode != 206))
+  {
+	DEVICEIO_LOG_E(_DeviceIO_log, "getNewFirmware retrieval failed with error #%d", _DeviceIO_LastHTTPcode);
+	return finishCheckIn(0);
+  }
+  
+  if (firmwarecontentLength < 1)
+  {
+    DEVICEIO_LOG_E(_DeviceIO_log, "Got empty firmware");
+	return finishCheckIn(0);
+  }
+
+  DEVICEIO_LOG_I(_DeviceIO_log, "Downloaded bytes = %lu", firmwarecontentLength);
+
+  // a compressed image or a patch says how big the image is
+  String encoding = https->header("Content-Encoding");
+  heatshrink = encoding.equals(F("heatshrink"));
+  if ((encoding.length() > 0) && !heatshrink && !encoding.equals(F("identity")))
+  {
+	DEVICEIO_LOG_E(_DeviceIO_log, "Unknown firmware encoding");
+	return finishCheckIn(0);
+  }
+  imageSize = firmwarecontentLength;
+  if (https->hasHeader("X-Image-Size"))
+	imageSize = (size_t)atol(https->header("X-Image-Size").c_str());
+
+  // check if there is enough to OTA Update, the ESP8266 checks the MD5 at the end
+  if ((offset == 0) && !_DeviceIO_firmware.open(imageSize, _DeviceIO_remoteBuild, https->header("X-Image-MD5").c_str()))
+  {
+    // not enough partition space to begin OTA
+    DEVICEIO_LOG_E(_DeviceIO_log, "Not enough space to begin");
+	return finishCheckIn(0);
+  }
+  
+  // only a whole body can be a patch
+  if (!_DeviceIO_decoder.begin(_DeviceIO_firmware, heatshrink, (offset == 0) && (DEVICEIO_OTA_PATCH == 1)))
+  {
+	DEVICEIO_LOG_E(_DeviceIO_log, "Not enough memory to decode");
+	_DeviceIO_firmware.abort();
+	return finishCheckIn(0);
+  }
+  
+  DEVICEIO_LOG_I(_DeviceIO_log, "Starting OTA, please wait...");
+  
+  _DeviceIO_otaStream = https->getStreamPtr();
+  _DeviceIO_otaRemaining = firmwarecontentLength;
+  
+  // allow serial buffer to empty before we begin update
+  setPhase(DEVICEIO_PHASE_OTA_WRITE, 20);
+  _DeviceIO_otaLastDataMS = _DeviceIO_wakeMS;
+  return DEVICEIO_POLL_BUSY;
+}
+
+// the download stopped, what is written stays and the next
+// attempt asks for the rest. the delay doubles every attempt
+uint8_t DeviceIO::retryOTA(void)
+{
+	_DeviceIO_connection.close();
+	_DeviceIO_otaStream = nullptr;
+	_DeviceIO_decoder.end();
+	_DeviceIO_checkinStats.otaBytesPerSecond = _DeviceIO_firmware.receiveBytesPerSecond();
+	
+	_DeviceIO_otaAttempts++;
+	if (_DeviceIO_otaAttempts >= DEVICEIO_OTA_ATTEMPTS)
+	{
+		DEVICEIO_LOG_W(_DeviceIO_log, "Firmware download failed, resuming with the next check-in");
+		return finishCheckIn(0);
+	}
+	
+	DEVICEIO_LOG_W(_DeviceIO_log, "Firmware download interrupted at %u", (unsigned int)_DeviceIO_firmware.progress());
+	setPhase(DEVICEIO_PHASE_OTA_BEGIN, (unsigned long)DEVICEIO_OTA_RETRY_MS << (_DeviceIO_otaAttempts - 1));
+	return DEVICEIO_POLL_BUSY;
+}
+
+// moves up to DEVICEIO_OTA_CHUNK_SIZE bytes from the socket to flash
+uint8_t DeviceIO::stepOTAWrite(void)
+{
+uint8_t buf[DEVICEIO_OTA_CHUNK_SIZE];
+
+	int available = (_DeviceIO_otaStream != nullptr) ? _DeviceIO_otaStream->available() : 0;
+	if (available <= 0)
+	{
+		// wait for data unless the connection is gone or stalled
+		if ((_DeviceIO_otaStream != nullptr) && _DeviceIO_otaStream->connected() && \
+			((millis() - _DeviceIO_otaLastDataMS) < DEVICEIO_HTTPS_TIMEOUT))
 		{
-			debugMsgError(String(F("HTTPS POST request")), String(_DeviceIO_errmsg_failedwitherror), _DeviceIO_LastHTTPcode);
-			debugMsgHttpError(_DeviceIO_LastHTTPcode);
-			debugMsg(String(_DeviceIO_errmsg_CERTfactoryreset));
+			_DeviceIO_wakeMS = millis() + 1;
+			return DEVICEIO_POLL_BUSY;
 		}
-		return 0;
+		return retryOTA();
+	}
+	
+	size_t want = (size_t)available;
+	if (want > sizeof(buf)) want = sizeof(buf);
+	if (want > _DeviceIO_otaRemaining) want = _DeviceIO_otaRemaining;
+	
+	size_t got = _DeviceIO_otaStream->readBytes(buf, want);
+	if (got == 0)
+		return retryOTA();
+	
+	if (!_DeviceIO_decoder.write(buf, got))
+	{
+		DEVICEIO_LOG_E(_DeviceIO_log, "Error, only wrote %u, decoder error #%d, firmware error #%d", (unsigned int)_DeviceIO_firmware.progress(), \
+					   _DeviceIO_decoder.getError(), _DeviceIO_firmware.getError());
+		_DeviceIO_firmware.abort();
+		return finishCheckIn(0);
 	}
+	
+	_DeviceIO_otaRemaining -= got;
+	_DeviceIO_stats.bytesReceived += got;
+	_DeviceIO_otaLastDataMS = millis();
+	if (_DeviceIO_otaRemaining == 0)
+	{
+		DEVICEIO_LOG_I(_DeviceIO_log, "Bytes written OK: %u", (unsigned int)_DeviceIO_firmware.progress());
+		setPhase(DEVICEIO_PHASE_OTA_END);
+	}
+	return DEVICEIO_POLL_BUSY;
+}
 
-	if (_DeviceIO_LastHTTPcode != 200) 
+uint8_t DeviceIO::stepOTAEnd(void)
+{
+	// close the connection
+	_DeviceIO_connection.close();
+	_DeviceIO_otaStream = nullptr;
+	_DeviceIO_decoder.end();
+	
+	// verifies the image and boots it next
+	if (!_DeviceIO_firmware.finish())
 	{
-		if (debugSerial == 1)
+		DEVICEIO_LOG_E(_DeviceIO_log, "Update Error #%d", _DeviceIO_firmware.getError());
+		return finishCheckIn(0);
+	}
+	
+	DEVICEIO_LOG_I(_DeviceIO_log, "Network %lu B/s, flash %lu B/s, waited %lu ms for the flash", \
+				   (unsigned long)_DeviceIO_firmware.receiveBytesPerSecond(), (unsigned long)_DeviceIO_firmware.flashBytesPerSecond(), \
+				   (unsigned long)_DeviceIO_firmware.stallMillis());
+	DEVICEIO_LOG_I(_DeviceIO_log, "OTA completed, rebooting");
+	_DeviceIO_checkinStats.otaBytesPerSecond = _DeviceIO_firmware.receiveBytesPerSecond();
+	
+	// reboot
+	return scheduleReboot(2000);
+}
+
+#endif
+
+// one batch of spooled samples per step, oldest first. the spool keeps
+// them until the server took them, a failed batch waits for the next check-in
+uint8_t DeviceIO::stepReplay(void)
+{
+ReplayBuffer batch;
+uint8_t record[DEVICEIO_SPOOL_RECORD_MAX];
+struct sensordata sample;
+int32_t len = 0;
+uint16_t limit = spoolBatch();
+
+	// whole records, as many as fit the batch
+	while ((batch.size() < limit) && ((len = _DeviceIO_spool.read(record, (limit - batch.size()) * DEVICEIO_SPOOL_SAMPLE_SIZE)) > 0))
+	{
+		for (int32_t i = 0; i + DEVICEIO_SPOOL_SAMPLE_SIZE <= len; i += DEVICEIO_SPOOL_SAMPLE_SIZE)
 		{
-			debugMsgError(String(F("sendSensorData")), String(_DeviceIO_errmsg_failedwitherror), _DeviceIO_LastHTTPcode);
+			unpackSample(record + i, sample);
+			batch.push(sample);
 		}
-		return 0;
 	}
-		  
-	if (payload.length() < 1)
+	// a record spooled by a build with a larger DEVICEIO_SPOOL_BATCH, its oldest samples are dropped
+	if (batch.empty() && (len < 0))
+	{
+		len = _DeviceIO_spool.read(record, sizeof(record));
+		for (int32_t i = 0; i + DEVICEIO_SPOOL_SAMPLE_SIZE <= len; i += DEVICEIO_SPOOL_SAMPLE_SIZE)
+		{
+			unpackSample(record + i, sample);
+			batch.push(sample);
+		}
+	}
+	
+	if (batch.empty())
+	{
+		setPhase(DEVICEIO_PHASE_FINISH);
+		return DEVICEIO_POLL_BUSY;
+	}
+	
+	DEVICEIO_LOG_I(_DeviceIO_log, "Replaying spooled samples: %u", (unsigned int)batch.size());
+	uint8_t result = sendSensorData(_DeviceIO_OTAsensorprefix, nullptr, batch);
+	if (result == 0)
 	{
-		if (debugSerial == 1) debugMsg(F("Got empty sensor return value"));
+		_DeviceIO_spool.rewind();
+		setPhase(DEVICEIO_PHASE_FINISH);
+		return DEVICEIO_POLL_BUSY;
+	}
+	
+	_DeviceIO_spool.commit();
+	if (result == 2)
+		_DeviceIO_sensorResult = 2;
+	return DEVICEIO_POLL_BUSY;
+}
+
+uint32_t DeviceIO::clockEpoch(void)
+{
+	#if DEVICEIO_NTP
+		return _DeviceIO_clock.epoch();
+	#else
 		return 0;
+	#endif
+}
+
+bool DeviceIO::getTime(struct tm &t)
+{
+time_t timenow = (time_t)clockEpoch();
+struct tm timeinfo;
+
+	if (timenow == 0)
+		return false;
+	
+	// populate the passed time structure
+	localtime_r(&timenow, &timeinfo);
+	t.tm_sec = timeinfo.tm_sec;
+	t.tm_min = timeinfo.tm_min;
+	t.tm_hour = timeinfo.tm_hour;
+	t.tm_mday = timeinfo.tm_mday;
+	t.tm_mon = timeinfo.tm_mon+1;
+	t.tm_year = timeinfo.tm_year+1900;
+	return true;
+}
+
+void DeviceIO::addSensorValue(int sensorNumber, float sensorValue)
+{
+struct sensordata sample;
+
+	DEVICEIO_LOG_D(_DeviceIO_log, "addSensorValue sensorNumber=%d, sensorValue=%f", sensorNumber, sensorValue);
+	
+	makeSample(sample, sensorNumber, sensorValue);
+	
+	#if DEVICEIO_BACKGROUND
+		// the worker owns the sample buffer, never wait for it
+		if (_DeviceIO_worker.running())
+		{
+			_DeviceIO_samplequeue.push(sample);
+			return;
+		}
+	#endif
+	
+	storeSample(sample);
+}
+
+// the sample time is sourced from NTP, the datetime string is built at upload.
+// samples taken before the first sync of this boot get 0
+void DeviceIO::makeSample(struct sensordata &sample, int sensorNumber, float sensorValue)
+{
+	sample.epoch = clockEpoch();
+	sample.sensornumber = (uint16_t)sensorNumber;
+	sample.sensorvalue = sensorValue;
+}
+
+void DeviceIO::storeSample(const struct sensordata &sample)
+{
+	if (!_DeviceIO_aggregator.add(sample.sensornumber, sample.sensorvalue, millis()))
+		bufferSample(sample);
+}
+
+// a closed window, one sample per statistic, stamped with the time the
+// window ended rather than the later sample or check-in that closed it
+void DeviceIO::aggregateOutput(void *device, uint16_t sensornumber, float value, unsigned long endMs)
+{
+struct sensordata sample;
+
+	((DeviceIO *)device)->makeSample(sample, sensornumber, value);
+	if (sample.epoch != 0)
+		sample.epoch -= (millis() - endMs) / 1000;
+	((DeviceIO *)device)->bufferSample(sample);
+}
+
+// the channels that were due together, one clock read for all of them
+void DeviceIO::sensorOutput(void *device, const DeviceIOReading *readings, uint8_t count)
+{
+DeviceIO *self = (DeviceIO *)device;
+struct sensordata sample;
+
+	sample.epoch = self->clockEpoch();
+	for (uint8_t i = 0; i < count; i++)
+	{
+		sample.sensornumber = readings[i].sensornumber;
+		sample.sensorvalue = readings[i].value;
+		self->storeSample(sample);
+	}
+}
+
+#if DEVICEIO_BUILTIN_SENSORS
+
+bool DeviceIO::readWifi(void *device, float &value)
+{
+	if (WiFi.status() != WL_CONNECTED)
+		return false;
+	value = ((DeviceIO *)device)->getWifiSignalStrength(WiFi.RSSI());
+	return true;
+}
+
+#ifdef ESP8266
+	// not applicable on ESP32
+	bool DeviceIO::readVcc(void *, float &value)
+	{
+		value = ESP.getVcc() / 1000.0f;
+		return true;
+	}
+#endif
+
+#ifdef ESP32
+	// convert raw temperature in F to Celsius degrees
+	bool DeviceIO::readTemperature(void *, float &value)
+	{
+		uint8_t esp32temp = ((temprature_sens_read() - 32) / 1.8);
+		value = esp32temp;
+		return true;
 	}
+#endif
+
+#endif
+
+void DeviceIO::bufferSample(const struct sensordata &sample)
+{
+	// no slot for a sensor the server turned off, or a value that didn't move
+	if (_DeviceIO_tuning.disabled(sample.sensornumber) || \
+		_DeviceIO_sensorpolicies.suppress(sample.sensornumber, sample.sensorvalue, millis()))
+		return;
 	
-	// check the response
-	if ( (payload.charAt(0) == 'O') && (payload.charAt(1) == 'K'))
+	// the buffer would overwrite its oldest sample
+	if (_DeviceIO_sensorsamples.full())
+		spoolSamples();
+	_DeviceIO_sensorsamples.push(sample);
+}
+
+bool DeviceIO::spoolSamples(uint16_t keep)
+{
+uint8_t record[DEVICEIO_SPOOL_BATCH * DEVICEIO_SPOOL_SAMPLE_SIZE];
+uint16_t count;
+uint16_t limit = spoolBatch();
+
+	if ((_DeviceIO_sensorsamples.size() <= keep) || !_DeviceIO_spool.ready())
+		return false;
+	
+	while (_DeviceIO_sensorsamples.size() > keep)
 	{
-		// POST successful
-		if (debugSerial == 1) debugMsg(F("sendSensorData OK"));
+		count = _DeviceIO_sensorsamples.size() - keep;
+		if (count > limit)
+			count = limit;
+		for (uint16_t i = 0; i < count; i++)
+			packSample(_DeviceIO_sensorsamples[i], record + i * DEVICEIO_SPOOL_SAMPLE_SIZE);
+		
+		if (!_DeviceIO_spool.append(record, count * DEVICEIO_SPOOL_SAMPLE_SIZE))
+		{
+			DEVICEIO_LOG_E(_DeviceIO_log, "Spooling samples failed");
+			return false;
+		}
+		_DeviceIO_sensorsamples.popFront(count);
 	}
-	else
+	
+	DEVICEIO_LOG_I(_DeviceIO_log, "Samples spooled to flash");
+	return true;
+}
+
+// samples per spool record and replay request
+uint16_t DeviceIO::spoolBatch(void)
+{
+	if ((_DeviceIO_tuning.batch() > 0) && (_DeviceIO_tuning.batch() < DEVICEIO_SPOOL_BATCH))
+		return _DeviceIO_tuning.batch();
+	return DEVICEIO_SPOOL_BATCH;
+}
+
+// the server's interval wins over the sketch's, neither goes below DEVICEIO_MIN_CHECKIN_INTERVAL
+long DeviceIO::checkInInterval(void)
+{
+long ci = (_DeviceIO_tuning.checkinIntervalMs() > 0) ? (long)_DeviceIO_tuning.checkinIntervalMs() : checkinInterval;
+
+	return (ci < (long)DEVICEIO_MIN_CHECKIN_INTERVAL) ? (long)DEVICEIO_MIN_CHECKIN_INTERVAL : ci;
+}
+
+// the channels and policies get the server's settings of sensornumber
+void DeviceIO::applyTuning(uint16_t sensornumber)
+{
+const DeviceIOTunedSensor *tuned = _DeviceIO_tuning.find(sensornumber);
+struct sensorpolicy *policy;
+
+	if (tuned == nullptr)
+		return;
+	if ((tuned->flags & DEVICEIO_TUNING_PERIOD) != 0)
+		_DeviceIO_scheduler.setPeriod(sensornumber, tuned->periodMs, millis());
+	if (((tuned->flags & DEVICEIO_TUNING_DEADBAND) != 0) && ((policy = _DeviceIO_sensorpolicies.get(sensornumber)) != nullptr))
 	{
-		// POST FAILED
-		if (debugSerial == 1) debugMsg(F("sendSensorData FAIL"));
+		policy->deadband = 1;
+		policy->absolute = tuned->absolute;
+		policy->relative = tuned->relative;
+		policy->heartbeatMs = tuned->heartbeatMs;
 	}
+}
+
+bool DeviceIO::setSensorPrecision(int sensorNumber, uint8_t decimals)
+{
+	if (decimals > DEVICEIO_PRECISION_RAW)
+		return false;
+	
+	struct sensorpolicy *policy = _DeviceIO_sensorpolicies.get((uint16_t)sensorNumber);
+	if (policy == nullptr)
+		return false;
+	policy->decimals = decimals;
+	return true;
+}
+
+bool DeviceIO::setSensorAggregation(int sensorNumber, uint32_t windowSeconds, uint32_t hopSeconds, uint8_t stats, int firstOutput)
+{
+	if (firstOutput < 0)
+		firstOutput = sensorNumber;
+	return _DeviceIO_aggregator.configure((uint16_t)sensorNumber, windowSeconds * 1000, hopSeconds * 1000, stats, (uint16_t)firstOutput);
+}
+
+bool DeviceIO::setSensorDeadband(int sensorNumber, float absolute, float relative, uint32_t heartbeatSeconds)
+{
+	if ((absolute < 0) || (relative < 0))
+		return false;
+	
+	struct sensorpolicy *policy = _DeviceIO_sensorpolicies.get((uint16_t)sensorNumber);
+	if (policy == nullptr)
+		return false;
+	policy->deadband = 1;
+	policy->absolute = absolute;
+	policy->relative = relative;
+	policy->heartbeatMs = heartbeatSeconds * 1000;
+	// the server's deadband wins
+	applyTuning((uint16_t)sensorNumber);
+	return true;
+}
+
+uint32_t DeviceIO::getSuppressedSampleCount(int sensorNumber)
+{
+	return _DeviceIO_sensorpolicies.suppressed(sensorNumber);
+}
+
+bool DeviceIO::addSensor(int sensorNumber, uint32_t periodMS, DeviceIOSensorRead read, void *context)
+{
+const DeviceIOTunedSensor *tuned = _DeviceIO_tuning.find((uint16_t)sensorNumber);
+
+	// the server's period wins
+	if ((tuned != nullptr) && ((tuned->flags & DEVICEIO_TUNING_PERIOD) != 0))
+		periodMS = tuned->periodMs;
+	return _DeviceIO_scheduler.add((uint16_t)sensorNumber, periodMS, read, context, millis());
+}
+
+bool DeviceIO::removeSensor(int sensorNumber)
+{
+	return _DeviceIO_scheduler.remove((uint16_t)sensorNumber);
+}
+
+void DeviceIO::runSensors(void)
+{
+	#if DEVICEIO_BACKGROUND
+		// the worker owns the sample buffer and reads the channels itself
+		if (_DeviceIO_worker.running())
+			return;
+	#endif
+	
+	_DeviceIO_scheduler.run(millis());
+}
+
+uint32_t DeviceIO::getDroppedSampleCount(void)
+{
+	return _DeviceIO_sensorsamples.dropped() + getDroppedPushCount();
+}
+
+uint32_t DeviceIO::getDroppedPushCount(void)
+{
+	#if DEVICEIO_BACKGROUND
+		return _DeviceIO_samplequeue.dropped();
+	#else
+		return 0;
+	#endif
+}
+
+DeviceIOStats DeviceIO::getStats(void)
+{
+DeviceIOStats stats = _DeviceIO_stats;
+
+	// the parts that keep their own counters
+	stats.tlsHandshakes = _DeviceIO_connection.handshakes;
+	stats.tlsResumptions = _DeviceIO_connection.resumptions;
+	#if DEVICEIO_NTP
+		stats.ntpSyncs = _DeviceIO_clock.syncs;
+		stats.ntpTimeouts = _DeviceIO_clock.timeouts;
+	#endif
+	stats.droppedSamples = getDroppedSampleCount();
+	stats.droppedPushes = getDroppedPushCount();
+	stats.suppressedSamples = getSuppressedSampleCount();
+	return stats;
+}
+
+#if DEVICEIO_BACKGROUND
+
+bool DeviceIO::startBackgroundCheckIn(int8_t core, uint8_t priority)
+{
+	return _DeviceIO_worker.start(backgroundTask, this, DEVICEIO_WORKER_STACK, priority, core);
+}
+
+void DeviceIO::stopBackgroundCheckIn(void)
+{
+	_DeviceIO_worker.stop();
+	// samples that arrived after the last worker pass
+	drainSampleQueue();
+}
+
+void DeviceIO::backgroundTask(void *device)
+{
+	((DeviceIO *)device)->backgroundLoop();
+}
+
+void DeviceIO::backgroundLoop(void)
+{
+uint8_t state;
+unsigned long wait;
+
+	while (!_DeviceIO_worker.stopping())
+	{
+		drainSampleQueue();
+		state = pollSteps(0xFFFFFFFF);
 		
-	// process the return string
-	uint8_t flagreboot = 0;
+		// wake for the next step or to drain the queue, whichever comes first
+		wait = DEVICEIO_WORKER_PERIOD_MS;
+		if (state == DEVICEIO_POLL_BUSY)
+		{
+			long untilWake = (long)(_DeviceIO_wakeMS - millis());
+			if (untilWake < (long)wait)
+				wait = (untilWake > 0) ? (unsigned long)untilWake : 0;
+		}
+		DeviceIOWorker::sleep(wait);
+	}
+}
+
+void DeviceIO::drainSampleQueue(void)
+{
+struct sensordata sample;
+
+	while (_DeviceIO_samplequeue.pop(sample))
+		storeSample(sample);
+}
+
+#endif
+
+// return values:
+// 0 = failed or unused
+// 1 = successful
+// 2 = flagged for reboot
+// 3 = other commands
+// command is the sensor or the checkin prefix. for checkin remotevernum
+// receives the newest build number, an empty upload is allowed and a
+// server without the command clears _DeviceIO_checkinSupported.
+// samples is emptied once the server has them
+template <class Buffer>
+uint8_t DeviceIO::sendSensorData(const char *command, long *remotevernum, Buffer &samples)
+{
+String serverPath;
+char setack[24];
+uint32_t tuningCommits = _DeviceIO_tuning.commits;
+
+	DEVICEIO_LOG_D(_DeviceIO_log, "sendSensorData starting");
+
+	if (samples.empty() && (remotevernum == nullptr))
+	{
+		DEVICEIO_LOG_D(_DeviceIO_log, "No sensor data, exiting");
+		return 0;
+	}
 	
+	if (WiFi.status() != WL_CONNECTED)
+	{
+		DEVICEIO_LOG_W(_DeviceIO_log, "No network, exiting");
+		return 0;
+	}
+
+	// the sensor data payload is encoded while it is sent, as a binary
+	// batch unless the server turned it down. nothing to negotiate when empty
+	uint16_t samplecount = samples.size();
+	uint8_t binary = ((_DeviceIO_binarySupported == 1) && (samplecount > 0)) ? 1 : 0;
+	
+	// example url: https://deviceio.goodprototyping.com/manage-device?cmd=sensor&prodID=radio2&prodIDpass=password&token=token
+	// example url: https://deviceio.goodprototyping.com/manage-device?cmd=checkin&prodID=radio2&prodIDpass=password&token=token&build=12
+	serverPath = 	String(_DeviceIO_OTAHTTPSprefix) + String(_DeviceIO_OTAhost) + String(_DeviceIO_OTAqueryprefix) + \
+							command + productIDname + String(_DeviceIO_OTAprodIDpass) + productIDpassword + String(_DeviceIO_OTAtokenprefix) + _DeviceIO_deviceToken;
+	if (remotevernum != nullptr)
+		serverPath += String(_DeviceIO_OTAbuildprefix) + String(buildNumber);
+	// the last SETCMD's id and settings applied and rejected, until an upload gets through
+	if (_DeviceIO_tuning.acknowledgement(setack, sizeof(setack)))
+		serverPath += String(_DeviceIO_OTAsetackprefix) + setack;
+
 	// example return: [CR] = chr$(13)
 	// deviceio OK[CR]2 sensors updated[CR]REBOOT[CR]SETCMD enable(123),disable(1),ssid(abcdef),ssidpw(abcdef)[CR]
-	//              1                    2         3                                                         4
+	// the checkin command adds the newest build number as a directive:
+	// deviceio OK[CR]2 sensors updated[CR]BUILD 13[CR]REBOOT[CR]
+	// the directives run while the response is read, see DeviceIODirectives.h
+	DeviceIODirectiveParser response(_DeviceIO_directives);
+	_DeviceIO_replyReboot = 0;
+	_DeviceIO_replyBuild = -1;
+	if (binary == 1)
+	{
+		DeviceIOBinaryEncoder<Buffer> httpRequestData(samples, samplecount, _DeviceIO_sensorpolicies);
+		newSSLPOST(serverPath, httpRequestData, httpRequestData.size(), DEVICEIO_BINARY_CONTENT_TYPE, response);
+	} else
+	{
+		DeviceIOSampleEncoder<Buffer> httpRequestData(samples, samplecount);
+		newSSLPOST(serverPath, httpRequestData, httpRequestData.size(), "application/x-www-form-urlencoded", response);
+	}
 	
-	// process the string by line separations that begins at separation 2 as above (after '2 sensors updated[CR]')	
-	// get line count
-	int srLinePos = 0;
-	int chr13count = 0;
-	while (srLinePos < payload.length())
+	// a server that can't read the binary batch answers 415, or says so in the
+	// status line. send the form for the rest of this boot, starting with these
+	// samples. neither reply ran its directives, the form's reply brings them
+	if ((binary == 1) && ((_DeviceIO_LastHTTPcode == 415) || ((_DeviceIO_LastHTTPcode == 200) && response.unsupported())))
 	{
-		int i = payload.indexOf(0x0d, srLinePos); // chr(13)
-		if (i == -1)
-			break;
-		
-		if (chr13count > 1)
+		DEVICEIO_LOG_W(_DeviceIO_log, "Binary upload not supported by server");
+		_DeviceIO_binarySupported = 0;
+		return sendSensorData(command, remotevernum, samples);
+	}
+	
+	if (_DeviceIO_LastHTTPcode < 1)
+	{
+		DEVICEIO_LOG_E(_DeviceIO_log, "HTTPS POST request failed with error #%d %s", _DeviceIO_LastHTTPcode, httpErrorName(_DeviceIO_LastHTTPcode));
+		DEVICEIO_LOG_E(_DeviceIO_log, "Check SSL CA or factory reset");
+		return 0;
+	}
+
+	if (_DeviceIO_LastHTTPcode != 200) 
+	{
+		DEVICEIO_LOG_E(_DeviceIO_log, "sendSensorData failed with error #%d", _DeviceIO_LastHTTPcode);
+		// unknown command or endpoint, fall back to getversion and sensor
+		if ((remotevernum != nullptr) && ((_DeviceIO_LastHTTPcode == 400) || (_DeviceIO_LastHTTPcode == 404)))
+			_DeviceIO_checkinSupported = 0;
+		return 0;
+	}
+		  
+	if (response.bytes() == 0)
+	{
+		DEVICEIO_LOG_W(_DeviceIO_log, "Got empty sensor return value");
+		return 0;
+	}
+	
+	// check the response
+	if (response.ok())
+		DEVICEIO_LOG_D(_DeviceIO_log, "sendSensorData OK");
+	else
+		DEVICEIO_LOG_W(_DeviceIO_log, "sendSensorData FAIL");
+	
+	// a 200 without a build number is a sensor reply from a server without
+	// checkin. it has the samples, the build number comes from getversion
+	if (remotevernum != nullptr)
+	{
+		*remotevernum = _DeviceIO_replyBuild;
+		if (*remotevernum == -1)
 		{
-			// dump this one
-			String commandToProcess = payload.substring(srLinePos, i);
-			//if (debugSerial == 1) debugMsg(commandToProcess);
-			
-			// process reboot request
-			if (strncmp(commandToProcess.c_str(), DEVICEIO_SERVER_DIRECTIVE_REBOOT, 6) == 0)
-			{
-				// flag this device for reboot. the device will reset the database flag when it checks the version #
-				flagreboot = 1;
-				//if (debugSerial == 1) debugMsg(F("REBOOT REQUEST"));
-			}
-			
-			// process set command
-			if (strncmp(commandToProcess.c_str(), DEVICEIO_SERVER_DIRECTIVE_SET, 6) == 0)
-			{
-				//if (debugSerial == 1) debugMsg(F("SETCMD REQUEST"));
-				// process commands here
-			}
-		}
-		
-		chr13count++;
-		srLinePos = i+1;
+			DEVICEIO_LOG_W(_DeviceIO_log, "checkin not supported by server");
+			_DeviceIO_checkinSupported = 0;
+		} else
+			DEVICEIO_LOG_I(_DeviceIO_log, "Running build #%ld, newest build is #%ld", buildNumber, *remotevernum);
 	}
 	
-	// sensor data was sent, reset the sensor index
-	_DeviceIO_sensorindex = 0;
+	// sensor data was sent, empty the buffer
+	samples.clear();
+	_DeviceIO_tuning.acknowledged(tuningCommits);
 	
-	if (debugSerial == 1) debugMsg(F("sendSensorData finished at "), String(millis()));
+	DEVICEIO_LOG_D(_DeviceIO_log, "sendSensorData finished at %lu", millis());
 
-	if (flagreboot == 1)
+	if (_DeviceIO_replyReboot == 1)
 		return 2; // reboot requested
 		
 	return 1; // successful
 }
 
-uint8_t DeviceIO::getWifiSignalStrength()
+// convert dBm to quality percentage
+uint8_t DeviceIO::getWifiSignalStrength(long dBm)
 {
-const int EVALPOINTS = 3;
-long rssi = 0;
-long dBm = 0;
-    
-  for (int i=0; i < EVALPOINTS; i++)
-  {
-      rssi += WiFi.RSSI();
-      delay(2);
-  }
-
-  dBm = rssi / EVALPOINTS;
-
-  // convert dBm to quality percentage
   if (dBm <= -100) return 0;
   if (dBm >= -50) return 100;
   return 2 * (dBm + 100);
 }
 
+void DeviceIO::countRequest(uint8_t post, unsigned long startMS, size_t sent, size_t received)
+{
+uint32_t ms = millis() - startMS;
+int code = _DeviceIO_LastHTTPcode;
+
+	_DeviceIO_stats.requests++;
+	_DeviceIO_stats.bytesSent += sent;
+	_DeviceIO_stats.bytesReceived += received;
+	if (code < 1)
+		_DeviceIO_stats.httpErrors[(-code < DEVICEIO_STATS_HTTP_ERRORS) ? -code : 0]++;
+	else
+		_DeviceIO_stats.httpStatus[(code < 600) ? code / 100 : 0]++;
+	
+	_DeviceIO_checkinStats.requests++;
+	if ((code != 200) && (code != 206))
+		_DeviceIO_checkinStats.failedRequests++;
+	if ((post == 1) && (ms > _DeviceIO_checkinStats.postMs))
+		_DeviceIO_checkinStats.postMs = ms;
+	if ((post == 0) && (ms > _DeviceIO_checkinStats.getMs))
+		_DeviceIO_checkinStats.getMs = ms;
+}
+
 // this function should only be called for small payloads
 String DeviceIO::newSSLGET(String url)
 {
-HTTPClient https;
+HTTPClient *https;
 String payload = ""; // empty string
+unsigned long start;
 
-	//if (debugSerial == 1) debugMsg(F("newSSLGET:"), url);	
-	
-	#ifdef ESP8266
-		std::unique_ptr <BearSSL::WiFiClientSecure> client (new BearSSL::WiFiClientSecure);
-		client->setFingerprint(_DeviceIO_OTAserverFingerprint);
-		https.setTimeout(5000); // added in 0.8
-		if (!https.begin(*client, url))
-		{
-			_DeviceIO_LastHTTPcode = 0;
-			return payload;
-		}		
-	#else
-		#ifdef ESP32
-			https.setConnectTimeout(5000); // added in 0.8
-			https.begin(url, _DeviceIO_OTAserverCertificate); // specify the URL and certificate
-		#endif
-	#endif
+	// reuses the check-in connection
+	https = _DeviceIO_connection.open(_DeviceIO_OTAhost, url);
+	if (https == nullptr)
+	{
+		_DeviceIO_LastHTTPcode = HTTPC_ERROR_CONNECTION_REFUSED;
+		countRequest(0, millis(), 0, 0);
+		return payload;
+	}
 	
-	_DeviceIO_LastHTTPcode = https.GET();
+	start = millis();
+	_DeviceIO_LastHTTPcode = https->GET();
+	retryAfter(https);
 	if (_DeviceIO_LastHTTPcode > 0)
 	{
 		// check for the returning code
-		payload = https.getString();
+		payload = https->getString();
 	}
+	countRequest(0, start, 0, payload.length());
 
-	https.end();
+	_DeviceIO_connection.finish();
 	return payload;
 }
 
-// this function should only be called for small payloads
-String DeviceIO::newSSLPOST(String url, String httpRequestData)
+// the request body is streamed from httpRequestData, the response through the parser
+void DeviceIO::newSSLPOST(String url, Stream &httpRequestData, size_t httpRequestLength, const char *contentType, DeviceIODirectiveParser &response)
 {
-HTTPClient https;
-String payload = ""; // empty string
-
-	//if (debugSerial == 1) debugMsg(F("newSSLPOST:"), url);
+HTTPClient *https;
+unsigned long start;
 
-	#ifdef ESP8266
-		std::unique_ptr <BearSSL::WiFiClientSecure> client (new BearSSL::WiFiClientSecure);
-		client->setFingerprint(_DeviceIO_OTAserverFingerprint);
-		if (!https.begin(*client, url))
-		{
-			_DeviceIO_LastHTTPcode = 0;
-			return payload;
-		}
-	#else
-		#ifdef ESP32
-			https.begin(url, _DeviceIO_OTAserverCertificate); //Specify the URL and certificate
-		#endif
-	#endif
+	// reuses the check-in connection
+	https = _DeviceIO_connection.open(_DeviceIO_OTAhost, url);
+	if (https == nullptr)
+	{
+		_DeviceIO_LastHTTPcode = HTTPC_ERROR_CONNECTION_REFUSED;
+		countRequest(1, millis(), 0, 0);
+		return;
+	}
 	
-	https.addHeader("Content-Type", "application/x-www-form-urlencoded");
-	_DeviceIO_LastHTTPcode = https.POST(httpRequestData);				
+	start = millis();
+	https->addHeader("Content-Type", contentType);
+	// the cores treat a zero stream size as unknown length, an empty body goes without the stream
+	if (httpRequestLength == 0)
+		_DeviceIO_LastHTTPcode = https->sendRequest("POST", (uint8_t *)NULL, 0);
+	else
+		_DeviceIO_LastHTTPcode = https->sendRequest("POST", &httpRequestData, httpRequestLength);
+	retryAfter(https);
 	if (_DeviceIO_LastHTTPcode > 0)
 	{
-		// check for the returning code
-		payload = https.getString();
+		// in the core's TCP sized chunks, plain or chunked
+		response.begin(_DeviceIO_LastHTTPcode);
+		https->writeToStream(&response);
+		response.end();
 	}
-	https.end(); //Free the resources
-	return payload;
+	countRequest(1, start, (_DeviceIO_LastHTTPcode > 0) ? httpRequestLength : 0, response.bytes());
+	_DeviceIO_connection.finish();
 }
+
+void DeviceIO::directiveReboot(void *device, char *)
+{
+	// flag this device for reboot. the device will reset the database flag when it checks the version #
+	((DeviceIO *)device)->_DeviceIO_replyReboot = 1;
+}
+
+// newest build number, checkin only
+void DeviceIO::directiveBuild(void *device, char *args)
+{
+	((DeviceIO *)device)->_DeviceIO_replyBuild = atol(args);
+}
+
+// NEXT 600: the next check-in not before 600 seconds from now
+void DeviceIO::directiveNext(void *device, char *args)
+{
+	((DeviceIO *)device)->_DeviceIO_replyAfterMS = DeviceIOCheckInSchedule::hintMs(args);
+}
+
+// Retry-After: 120, mostly with a 503. the HTTP date form isn't used by the server
+void DeviceIO::retryAfter(HTTPClient *https)
+{
+uint32_t ms;
+
+	if ((_DeviceIO_LastHTTPcode <= 0) || !https->hasHeader(_DeviceIO_retryAfterHeader))
+		return;
+	ms = DeviceIOCheckInSchedule::hintMs(https->header(_DeviceIO_retryAfterHeader).c_str());
+	if (ms > _DeviceIO_replyAfterMS)
+		_DeviceIO_replyAfterMS = ms;
+}
+
+uint32_t DeviceIO::restartWait(void)
+{
+uint32_t now = clockEpoch();
+int32_t last;
+uint32_t elapsedMs;
+
+	if ((now == 0) || !_DeviceIO_store.getInt(_DeviceIO_checkinKey, last) || (last <= 0) || ((uint32_t)last > now))
+		return 0;
+	// the interval ran out while the device was off
+	if (now - (uint32_t)last >= (uint32_t)checkInInterval() / 1000)
+		return 0;
+	elapsedMs = (now - (uint32_t)last) * 1000;
+	return (uint32_t)checkInInterval() - elapsedMs;
+}
+
+// SETCMD interval(3600),disable(5),ssid(abc): a setting the library doesn't know
+// goes to the sketch's directive of that name, "ssid" gets "abc"
+void DeviceIO::directiveSet(void *device, char *args)
+{
+DeviceIO *self = (DeviceIO *)device;
+char *name, *value;
+int32_t sensor;
+uint8_t applied = 0, rejected = 0;
+
+	while (DeviceIODirectives::nextArgument(args, name, value))
+	{
+		if (self->_DeviceIO_tuning.set(name, value, sensor))
+		{
+			if (sensor >= 0)
+				self->applyTuning((uint16_t)sensor);
+			if (strcmp(name, "id") != 0)
+				applied++;
+		} else if (!reservedDirective(name) && self->_DeviceIO_directives.dispatch(name, value))
+			applied++;
+		else
+			rejected++;
+	}
+	
+	if (!self->_DeviceIO_tuning.commit(applied, rejected))
+		DEVICEIO_LOG_E(self->_DeviceIO_log, "Saving server settings failed");
+	DEVICEIO_LOG_I(self->_DeviceIO_log, "Server settings: %u applied, %u rejected", (unsigned int)applied, (unsigned int)rejected);
+}
+
+bool DeviceIO::addDirective(const char *name, DeviceIODirectiveHandler handler, void *context)
+{
+	if (reservedDirective(name))
+		return false;
+	return _DeviceIO_directives.add(name, handler, context);
+}
+
+bool DeviceIO::removeDirective(const char *name)
+{
+	if (reservedDirective(name))
+		return false;
+	return _DeviceIO_directives.remove(name);
+}
+
 // end of DeviceIO.cpp
\ No newline at end of file
@@ -25,9 +25,36 @@
 
 #include <Arduino.h>
 #include "Effortless_SPIFFS.h"
-#include <WiFiUdp.h>
 #include <time.h>
-#include <NTPClient.h>
+#include "DeviceIOFeatures.h"
+#include "DeviceIORingBuffer.h"
+#include "DeviceIOSampleEncoder.h"
+#include "DeviceIOBinaryEncoder.h"
+#include "DeviceIOSensorPolicy.h"
+#include "DeviceIOAggregator.h"
+#include "DeviceIOScheduler.h"
+#include "DeviceIOConnection.h"
+#include "DeviceIODirectives.h"
+#include "DeviceIOTuning.h"
+#include "DeviceIOCheckInSchedule.h"
+#include "DeviceIOSpool.h"
+#include "DeviceIOStore.h"
+#if DEVICEIO_NTP
+	#include "DeviceIOClock.h"
+#endif
+#include "DeviceIOStats.h"
+#include "DeviceIOLog.h"
+#if DEVICEIO_OTA
+	#include "DeviceIOFirmware.h"
+	#include "DeviceIOImageDecoder.h"
+#endif
+#include "DeviceIOWorker.h"
+#if DEVICEIO_PUSH
+	#include "DeviceIOPush.h"
+#endif
+#if DEVICEIO_BACKGROUND
+	#include "DeviceIOSampleQueue.h"
+#endif
 
 // version control
 #define DEVICE_IO_BUILD_NUMBER		12
@@ -35,10 +62,98 @@
 #define ONE_HOUR					ONE_MINUTE * 60	// interval in ms
 #define FOUR_HOURS					ONE_HOUR * 4	// OTA check-in interval is every 4 hours
 
+// number of buffered sensor samples, 12 bytes each
+#ifndef DEVICEIO_SAMPLE_CAPACITY
+	#define DEVICEIO_SAMPLE_CAPACITY	20
+#endif
+
+// built-in sensors are read every DEVICEIO_BUILTIN_PERIOD_S and stored when
+// they changed by this much, or once a day
+#define DEVICEIO_SENSOR_VCC				255
+#define DEVICEIO_SENSOR_WIFI			256
+#define DEVICEIO_SENSOR_TEMPERATURE		257
+#ifndef DEVICEIO_BUILTIN_PERIOD_S
+	#define DEVICEIO_BUILTIN_PERIOD_S	300
+#endif
+#ifndef DEVICEIO_BUILTIN_HEARTBEAT_S
+	#define DEVICEIO_BUILTIN_HEARTBEAT_S	(24UL * 3600)
+#endif
+#define DEVICEIO_VCC_DEADBAND			0.05	// V
+#define DEVICEIO_WIFI_DEADBAND			5		// %
+#define DEVICEIO_TEMPERATURE_DEADBAND	1		// deg C
+
+// check-in stats stored after each check-in when reportStats is 1, see getStats()
+#define DEVICEIO_SENSOR_CHECKIN_MS		258		// duration
+#define DEVICEIO_SENSOR_TLS_MS			259		// TLS handshake, when there was one
+#define DEVICEIO_SENSOR_FREE_HEAP		260		// bytes, after the check-in
+#define DEVICEIO_SENSOR_MAX_BLOCK		261		// largest free block, same
+#define DEVICEIO_SENSOR_FAILED_REQUESTS	262
+#define DEVICEIO_SENSOR_DROPPED			263		// samples dropped since boot
+
+// poll() results
+#define DEVICEIO_POLL_IDLE			0	// no check-in is due
+#define DEVICEIO_POLL_BUSY			1	// a check-in is in progress, call again
+#define DEVICEIO_POLL_DONE			2	// the check-in just finished
+#define DEVICEIO_POLL_FAILED		3	// the check-in just failed, it is retried with back-off
+
+// check-in phases, see getCheckInPhase()
+#define DEVICEIO_PHASE_IDLE			0
+#define DEVICEIO_PHASE_NTP			1	// waiting for the SNTP sync
+#define DEVICEIO_PHASE_TOKEN		2	// provisioning, HTTPS
+#define DEVICEIO_PHASE_SENSORS		3	// reading the sensor channels that are due
+#define DEVICEIO_PHASE_CHECKIN		4	// combined checkin request, HTTPS
+#define DEVICEIO_PHASE_VERSION		5	// getversion request, HTTPS
+#define DEVICEIO_PHASE_TELEMETRY	6	// sensor request, HTTPS
+#define DEVICEIO_PHASE_OTA_BEGIN	7	// getfirmware request, HTTPS
+#define DEVICEIO_PHASE_OTA_WRITE	8	// firmware download, one chunk per step
+#define DEVICEIO_PHASE_OTA_END		9
+#define DEVICEIO_PHASE_FINISH		10
+#define DEVICEIO_PHASE_REBOOT		11	// waiting to restart
+#define DEVICEIO_PHASE_REPLAY		12	// spooled samples, one batch per step, HTTPS
+
+// firmware bytes moved to flash per poll() step
+#ifndef DEVICEIO_OTA_CHUNK_SIZE
+	#define DEVICEIO_OTA_CHUNK_SIZE	512
+#endif
+
+// a dropped firmware download is resumed this often per check-in,
+// the first retry waits DEVICEIO_OTA_RETRY_MS and every next one twice as long
+#ifndef DEVICEIO_OTA_ATTEMPTS
+	#define DEVICEIO_OTA_ATTEMPTS		5
+#endif
+#ifndef DEVICEIO_OTA_RETRY_MS
+	#define DEVICEIO_OTA_RETRY_MS		1000
+#endif
+
+// background check-ins, see startBackgroundCheckIn()
+#ifndef DEVICEIO_QUEUE_RATE_HZ
+	#define DEVICEIO_QUEUE_RATE_HZ		25		// samples per second, all tasks together, that are never dropped
+#endif
+#ifndef DEVICEIO_QUEUE_CAPACITY
+	// an HTTPS request blocks the worker up to DEVICEIO_HTTPS_TIMEOUT, the queue holds
+	// the samples of that long at DEVICEIO_QUEUE_RATE_HZ. power of two
+	#define DEVICEIO_QUEUE_CAPACITY		DeviceIOSampleQueueCapacity(DEVICEIO_QUEUE_RATE_HZ * DEVICEIO_HTTPS_TIMEOUT / 1000)
+#endif
+#ifndef DEVICEIO_WORKER_PERIOD_MS
+	#define DEVICEIO_WORKER_PERIOD_MS	10		// the worker drains the queue this often
+#endif
+#ifndef DEVICEIO_WORKER_STACK
+	#define DEVICEIO_WORKER_STACK		12288	// TLS needs most of it
+#endif
+
+// spooled samples are packed into 10 bytes, at most one sample buffer per record
+#define DEVICEIO_SPOOL_SAMPLE_SIZE		10
+#if (DEVICEIO_SAMPLE_CAPACITY * DEVICEIO_SPOOL_SAMPLE_SIZE) <= DEVICEIO_SPOOL_RECORD_MAX
+	#define DEVICEIO_SPOOL_BATCH		DEVICEIO_SAMPLE_CAPACITY
+#else
+	#define DEVICEIO_SPOOL_BATCH		(DEVICEIO_SPOOL_RECORD_MAX / DEVICEIO_SPOOL_SAMPLE_SIZE)
+#endif
+
+
 struct sensordata
 {
-	String 		date;
-	int 		sensornumber;
+	uint32_t 	epoch;			// seconds since 1970, 0 if the clock was never set
+	uint16_t 	sensornumber;
 	float 		sensorvalue;
 };
 
@@ -50,108 +165,287 @@ public:
 
 	uint8_t 			debugSerial 		= 1;
 	long 				buildNumber 		= 1;
+	// millis() when the last check-in started. setting it moves the next
+	// check-in to checkinInterval after it, 0 checks in on the next call
 	long 				lastCheckInTimeMS 	= 0;
 	long 				checkinInterval 	= FOUR_HOURS;
+	// the first check-in after a restart waits a random part of this, so a
+	// fleet that restarts together doesn't check in together. 0 checks in at once
+	uint32_t 			checkinJitterMS 	= DEVICEIO_STARTUP_JITTER_MS;
 	String 				productIDname 		= "na";
 	String				productIDpassword 	= "";
+	// 1 stores the DEVICEIO_SENSOR_CHECKIN_MS.. stats after each check-in, they go up with the next one
+	uint8_t 			reportStats 		= 0;
+	#if DEVICEIO_PUSH
+		// 1 keeps a long-poll open to the server between check-ins, its
+		// directives arrive within seconds. see DeviceIOPush.h
+		uint8_t 		pushChannel 		= 0;
+		// how long the server may hold it, below the idle timeout of the NAT
+		uint16_t 		pushHoldS 			= DEVICEIO_PUSH_HOLD_S;
+	#endif
 	
 	
     void 				initialize(void);
+	// blocks until the check-in is done, returns 1 when it succeeded
 	uint8_t 			doCheckIn(void);
+	// runs check-in steps for about budgetUs microseconds and returns one
+	// of DEVICEIO_POLL_*, call it from loop(). waits never block, but an
+	// HTTPS request is a single step and only starts at the beginning of
+	// a call, so a call may overrun its budget by one request
+	uint8_t 			poll(unsigned long budgetUs);
+	uint8_t 			getCheckInPhase(void) 		{ return _DeviceIO_phase; }
+	// safe from any task once startBackgroundCheckIn() ran
 	void 				addSensorValue(int sensorNumber, float sensorValue);
+	// samples lost to a full buffer or queue since boot
+	uint32_t 			getDroppedSampleCount(void);
+	// of those, the ones addSensorValue() found the queue full for, 0 without startBackgroundCheckIn()
+	uint32_t 			getDroppedPushCount(void);
+	// decimals the binary upload keeps for a sensor, 0..6 or DEVICEIO_PRECISION_RAW
+	bool 				setSensorPrecision(int sensorNumber, uint8_t decimals);
+	// folds the samples of sensorNumber into windows of windowSeconds, a new one every
+	// hopSeconds (windowSeconds for tumbling windows). the DEVICEIO_AGGREGATE_* stats
+	// are uploaded in that order as sensors firstOutput, firstOutput + 1 ... (-1 for
+	// sensorNumber). stats 0 uploads every sample again. call before startBackgroundCheckIn()
+	bool 				setSensorAggregation(int sensorNumber, uint32_t windowSeconds, uint32_t hopSeconds, uint8_t stats, int firstOutput = -1);
+	// stores a value of sensorNumber only when it moved by more than absolute and by more
+	// than relative (a fraction of the last stored value), or every heartbeatSeconds.
+	// applies to the uploaded sensor numbers, after aggregation. call before startBackgroundCheckIn()
+	bool 				setSensorDeadband(int sensorNumber, float absolute, float relative = 0, uint32_t heartbeatSeconds = 0);
+	// values dropped by a deadband since boot, sensorNumber -1 for all sensors
+	uint32_t 			getSuppressedSampleCount(int sensorNumber = -1);
+	// reads sensorNumber through read every periodMS and stores the value as
+	// addSensorValue() would. a sensorNumber with a channel gets the new period.
+	// the built-in sensors have one each. call before startBackgroundCheckIn()
+	bool 				addSensor(int sensorNumber, uint32_t periodMS, DeviceIOSensorRead read, void *context = nullptr);
+	bool 				removeSensor(int sensorNumber);
+	// reads the channels that are due, poll() and doCheckIn() call it. call it from
+	// loop() when they run less often than the fastest channel. in background mode
+	// the check-in task reads them and this does nothing
+	void 				runSensors(void);
+	// runs handler with the arguments of every name directive in a sensor or checkin
+	// response, e.g. "LED" for the line "LED on", and of every name setting of a
+	// SETCMD the library doesn't know. REBOOT, BUILD and SETCMD are the library's.
+	// false when the sketch's DEVICEIO_DIRECTIVES_USER are taken
+	bool 				addDirective(const char *name, DeviceIODirectiveHandler handler, void *context = nullptr);
+	bool 				removeDirective(const char *name);
+	
+	#if DEVICEIO_BACKGROUND
+		// check-ins run on their own task, doCheckIn() and poll() then
+		// return DEVICEIO_POLL_IDLE. samples go through a lock-free queue
+		// the task drains every DEVICEIO_WORKER_PERIOD_MS
+		bool 			startBackgroundCheckIn(int8_t core = 0, uint8_t priority = 1);
+		void 			stopBackgroundCheckIn(void);
+	#endif
 	void 				unprovisionDevice(void);
 	
-	void 				getTime(struct tm &t);	
+	// local time in ntpTimeZoneInfo, tm_mon 1..12 and tm_year the full year. never
+	// waits for NTP, false and t unchanged until the clock is set
+	bool 				getTime(struct tm &t);	
 	String 				ntpTimeZoneInfo 	= "MST7MDT";
+	// how fast the local clock runs against NTP, 0 until measured
+	#if DEVICEIO_NTP
+		float 			getClockDrift(void) 		{ return _DeviceIO_clock.driftPpm(); }
+	#else
+		float 			getClockDrift(void) 		{ return 0; }
+	#endif
+	
+	// TLS statistics since boot
+	uint32_t 			getTLSHandshakeCount(void) 	{ return _DeviceIO_connection.handshakes; }
+	uint32_t 			getTLSResumeCount(void) 	{ return _DeviceIO_connection.resumptions; }
+	#if DEVICEIO_PUSH
+		// the push channel is waiting for the server's directives
+		bool 			isPushListening(void) 		{ return _DeviceIO_push.listening(); }
+	#endif
+	// the last check-in and the counters since boot. in background mode the
+	// fields may come from either side of a check-in that is just ending
+	DeviceIOStats 		getStats(void);
+	// the oldest log line, false when there is none. for sketches that set
+	// debugSerial to 0 and want the log somewhere else than Serial
+	bool 				readLog(char *line, size_t size) 	{ return _DeviceIO_log.read(line, size); }
 
 protected:
 
 private:
-	void 				debugMsg(String);
-	void 				debugMsg(String, long);
-	void 				debugMsg(String, String);
-	void				debugMsgError(String, String, long);
-	void				debugMsgHttpError(int);
-	
-	uint8_t 			sendSensorData(void);
-    uint8_t 			doOTA(void);
-	uint8_t 			getNewFirmware(void);
+	typedef DeviceIORingBuffer<sensordata, DEVICEIO_SAMPLE_CAPACITY> SampleBuffer;
+	// one spool record or more, replayed with one request
+	typedef DeviceIORingBuffer<sensordata, DEVICEIO_SPOOL_BATCH> ReplayBuffer;
+	
+	// prints what is left of the log, blocking, before a restart
+	void 				flushLog(void);
+	
+	template <class Buffer>
+	uint8_t 			sendSensorData(const char *command, long *remotevernum, Buffer &samples);
 	uint8_t 			getDeviceToken(void);
+	// from the store, or from the files of older builds
+	void 				loadProvisioning(void);
 	long 				getRemoteVersionNumber(void);
-	uint8_t 			getWifiSignalStrength(void);
+	uint8_t 			getWifiSignalStrength(long dBm);
 
-	uint8_t    			getNTPtime(void);
-	uint8_t 			doNTP(int);
+	// check-in steps, each returns one of DEVICEIO_POLL_*
+	uint8_t 			pollSteps(unsigned long budgetUs);
+	uint8_t 			startCheckIn(void);
+	uint8_t 			checkInStep(void);
+	#if DEVICEIO_PUSH
+		// between check-ins, a directive that needs one brings it forward
+		void 			pollPush(void);
+	#endif
+	#if DEVICEIO_NTP
+		uint8_t 		stepNTP(void);
+	#endif
+	#if DEVICEIO_OTA
+		uint8_t 		stepOTABegin(void);
+		uint8_t 		stepOTAWrite(void);
+		uint8_t 		stepOTAEnd(void);
+		uint8_t 		retryOTA(void);
+	#endif
+	uint8_t 			stepReplay(void);
+	uint8_t 			finishCheckIn(uint8_t success);
+	// ends the check-in stats, and stores them when reportStats is set
+	void 				recordCheckIn(uint8_t success);
+	// schedules the next check-in after a good one and keeps its time for restartWait()
+	void 				checkInSucceeded(void);
+	// one HTTPS request, _DeviceIO_LastHTTPcode has its result
+	void 				countRequest(uint8_t post, unsigned long startMS, size_t sent, size_t received);
+	void 				setPhase(uint8_t phase, unsigned long waitMS = 0);
+	uint8_t 			scheduleReboot(unsigned long waitMS);
+	uint8_t 			nextPhaseAfterBuild(long remotevernum, uint8_t next);
+	// seconds since 1970, 0 until the clock is set
+	uint32_t 			clockEpoch(void);
+	void 				makeSample(struct sensordata &sample, int sensorNumber, float sensorValue);
+	// into the sample buffer, or into its window when the sensor is aggregated
+	void 				storeSample(const struct sensordata &sample);
+	// into the sample buffer, a full buffer goes to the spool first
+	void 				bufferSample(const struct sensordata &sample);
+	static void 		aggregateOutput(void *device, uint16_t sensornumber, float value, unsigned long endMs);
+	static void 		sensorOutput(void *device, const DeviceIOReading *readings, uint8_t count);
+	#if DEVICEIO_BUILTIN_SENSORS
+		static bool 	readWifi(void *device, float &value);
+		#ifdef ESP8266
+			static bool readVcc(void *device, float &value);
+		#endif
+		#ifdef ESP32
+			static bool readTemperature(void *device, float &value);
+		#endif
+	#endif
+	// moves the oldest samples to the spool until keep are left, false when they stay
+	bool 				spoolSamples(uint16_t keep = 0);
+	uint16_t 			spoolBatch(void);
+	// checkinInterval, or the server's
+	long 				checkInInterval(void);
+	void 				applyTuning(uint16_t sensornumber);
+	
+	#if DEVICEIO_BACKGROUND
+		static void 	backgroundTask(void *device);
+		void 			backgroundLoop(void);
+		void 			drainSampleQueue(void);
+	#endif
 	
 	String 				newSSLGET(String);
-	String 				newSSLPOST(String, String);
+	// the response goes through the parser, its directives run as it arrives
+	void 				newSSLPOST(String, Stream &, size_t, const char *, DeviceIODirectiveParser &);
+	static void 		directiveReboot(void *device, char *args);
+	static void 		directiveBuild(void *device, char *args);
+	static void 		directiveSet(void *device, char *args);
+	static void 		directiveNext(void *device, char *args);
+	// a Retry-After header is a hint like NEXT
+	void 				retryAfter(HTTPClient *https);
+	// ms until checkInInterval() after the last check-in before the restart, 0 when it is due or unknown
+	uint32_t 			restartWait(void);
 	String 				getStringFromReturnValue(String data, char separator, uint8_t index);
 	
 	// last HTTP return code
 	int					_DeviceIO_LastHTTPcode = 0;
 	
-	// 20 rotating sensor samples
-	int    				_DeviceIO_sensorindex = 0;
-	struct sensordata	_DeviceIO_sensorsamples[20];
+	// rotating sensor samples, spooled to flash or overwritten when full
+	SampleBuffer 		_DeviceIO_sensorsamples;
+	
+	#if DEVICEIO_BACKGROUND
+		// other tasks push here, the worker moves the samples to _DeviceIO_sensorsamples
+		DeviceIOSampleQueue<sensordata, DEVICEIO_QUEUE_CAPACITY> _DeviceIO_samplequeue;
+		DeviceIOWorker 	_DeviceIO_worker;
+	#endif
+	
+	// one keep-alive HTTPS connection per check-in, the TLS session outlives it
+	DeviceIOConnection 	_DeviceIO_connection;
+	
+	// the combined checkin command is used until the server turns it down
+	uint8_t 			_DeviceIO_checkinSupported = 1;
+	// same for binary sample uploads
+	uint8_t 			_DeviceIO_binarySupported = 1;
+	
+	// server directives by name, and what the built-in ones said in the last response
+	DeviceIODirectives 	_DeviceIO_directives;
+	uint8_t 			_DeviceIO_replyReboot 		= 0;
+	long 				_DeviceIO_replyBuild 		= -1;
+	// what SETCMD set, over the sketch's settings
+	DeviceIOTuning 		_DeviceIO_tuning;
+	
+	// per-sensor settings
+	DeviceIOSensorPolicies _DeviceIO_sensorpolicies;
+	DeviceIOAggregator 	_DeviceIO_aggregator;
+	DeviceIOScheduler 	_DeviceIO_scheduler;
+	
+	// when the next check-in is due, see DeviceIOCheckInSchedule.h
+	DeviceIOCheckInSchedule _DeviceIO_schedule;
+	long 				_DeviceIO_lastCheckInMS 	= 0;	// lastCheckInTimeMS as the library set it
+	uint8_t 			_DeviceIO_restartCheckIn 	= 1;	// the first check-in of this boot is still ahead
+	uint32_t 			_DeviceIO_replyAfterMS 		= 0;	// the server's hint for this check-in
+	#if DEVICEIO_PUSH
+		// its own TLS connection, closed while a check-in runs
+		DeviceIOPush 	_DeviceIO_push{_DeviceIO_directives};
+		uint8_t 		_DeviceIO_pushReboot 		= 0;	// a pushed REBOOT, after the check-in it brought forward
+	#endif
+	
+	// check-in state, see poll()
+	uint8_t 			_DeviceIO_phase 			= DEVICEIO_PHASE_IDLE;
+	unsigned long 		_DeviceIO_checkinStartMS 	= 0;
+	unsigned long 		_DeviceIO_phaseStartMS 		= 0;
+	unsigned long 		_DeviceIO_wakeMS 			= 0;	// the next step runs no earlier
+	uint8_t 			_DeviceIO_ntpAttempts 		= 0;
+	long 				_DeviceIO_remoteBuild 		= -1;
+	uint8_t 			_DeviceIO_sensorResult 		= 0;	// sendSensorData() return value, 2 = reboot
+	#if DEVICEIO_OTA
+		WiFiClient *	_DeviceIO_otaStream 		= nullptr;
+		size_t 			_DeviceIO_otaRemaining 		= 0;
+		unsigned long 	_DeviceIO_otaLastDataMS 	= 0;
+		uint8_t 		_DeviceIO_otaAttempts 		= 0;
+	#endif
+	
+	// the check-in in progress is copied to _DeviceIO_stats.last when it ends
+	DeviceIOStats 		_DeviceIO_stats 			= {};
+	DeviceIOCheckInStats _DeviceIO_checkinStats 	= {};
+	uint32_t 			_DeviceIO_checkinHandshakes = 0;	// handshakes before this check-in
+	
+	// records waiting for Serial or readLog()
+	DeviceIOLog 		_DeviceIO_log;
+	
+	#if DEVICEIO_OTA
+		// the image being downloaded, resumable
+		DeviceIOFirmware _DeviceIO_firmware;
+		DeviceIOImageDecoder _DeviceIO_decoder;
+	#endif
 	
 	// effortless filesystem
 	eSPIFFS 			_DeviceIO_fileSystem;	
 	
-	// clock and ntp
-	uint8_t 			_DeviceIO_clockneverset = 1;
-	struct tm 			_DeviceIO_timeinfo;
+	// samples that could not be sent yet, replayed after the next good check-in
+	DeviceIOSpool 		_DeviceIO_spool;
+	
+	// persistent settings, committed together
+	DeviceIOStore 		_DeviceIO_store;
+	
+	#if DEVICEIO_NTP
+		// wall clock, synced over NTP while check-ins run
+		DeviceIOClock 	_DeviceIO_clock;
+	#endif
 		
 	// provisioning settings
 	uint8_t 			_DeviceIO_deviceProvisioned = 0;
 	String 				_DeviceIO_deviceToken = "";
-	const char *		_DeviceIO_provisionKeyFilename 		= "/deviceProvisioned.txt";
-	const char *		_DeviceIO_provisionTokenFilename 	= "/deviceToken.txt";
-	
-	// host connection strings
-	const char *  		_DeviceIO_OTAhost   				= "deviceio-devices.goodprototyping.com";
-	const char * 		_DeviceIO_OTAHTTPSprefix 			= "https://";
-	const char *		_DeviceIO_OTAprodIDpass 			= "&prodIDpass=";
-	const char * 		_DeviceIO_OTAqueryprefix 			= "/manage-device?cmd=";
-	const char * 		_DeviceIO_OTAgetversionprefix 		= "getversion&prodID=";
-	const char *		_DeviceIO_OTAtokenprefix			= "&token=";
-	const char * 		_DeviceIO_httpsreq 					= "HTTPS request";
-
-	
-	// error strings
-	const char *		_DeviceIO_errmsg_failedwitherror 	= " failed with error #";
-	const char *		_DeviceIO_errmsg_CERTfactoryreset 	= "Check SSL CA or factory reset";
-	
-	const char *		DEVICEIO_SERVER_DIRECTIVE_REBOOT	= "REBOOT";
-	const char *		DEVICEIO_SERVER_DIRECTIVE_SET		= "SETCMD";
-	
-	// SSL/TLS for https://deviceio-devices.goodprototyping.com
-	#ifdef ESP32
-		// cert for ESP32 HTTPClient
-		const char* 	_DeviceIO_OTAserverCertificate		=	\
-"-----BEGIN CERTIFICATE-----\n" \
-"MIIDBzCCAnCgAwIBAgIJALaHl013FkeYMA0GCSqGSIb3DQEBCwUAMIGZMQswCQYD\n" \
-"VQQGEwJDQTEPMA0GA1UECAwGUXVlYmVjMREwDwYDVQQHDAhNb250cmVhbDEdMBsG\n" \
-"A1UECgwUR29vZFByb3RvdHlwaW5nIFtST10xGDAWBgNVBAsMD0dvb2RQcm90b3R5\n" \
-"cGluZzEtMCsGA1UEAwwkZGV2aWNlaW8tZGV2aWNlcy5nb29kcHJvdG90eXBpbmcu\n" \
-"Y29tMCAXDTIxMDEwOTIyMjcxOVoYDzIwODAxMjI1MjIyNzE5WjCBmTELMAkGA1UE\n" \
-"BhMCQ0ExDzANBgNVBAgMBlF1ZWJlYzERMA8GA1UEBwwITW9udHJlYWwxHTAbBgNV\n" \
-"BAoMFEdvb2RQcm90b3R5cGluZyBbUk9dMRgwFgYDVQQLDA9Hb29kUHJvdG90eXBp\n" \
-"bmcxLTArBgNVBAMMJGRldmljZWlvLWRldmljZXMuZ29vZHByb3RvdHlwaW5nLmNv\n" \
-"bTCBnzANBgkqhkiG9w0BAQEFAAOBjQAwgYkCgYEA4kAT5YbaRpPg/Tz7+gyeAVoH\n" \
-"hDA/Qtii/9FUE8LZszCapmdANNdLUDuTvWtCc8VgWymdA0OoF43RmWU+p2IuN20Y\n" \
-"XXf3CQMeBjgeCdG3jOVOUjYyFvrJPA5OK1eqx1WlorVf86rhlGGTDNTiWR+FArew\n" \
-"NL/vq9pUSbDjxp0MdFECAwEAAaNTMFEwHQYDVR0OBBYEFDQP7UEOfif5RGF8n2vr\n" \
-"hv5JYE4PMB8GA1UdIwQYMBaAFDQP7UEOfif5RGF8n2vrhv5JYE4PMA8GA1UdEwEB\n" \
-"/wQFMAMBAf8wDQYJKoZIhvcNAQELBQADgYEAPKvd34ZkD77B8E/37oS3K+Ju9uWh\n" \
-"fuODJTg+9OqgLwjaW8ueaq+kG5nPSIwCP2K69I1bXwwbaFXW2plL8VqPT/Pvv2S3\n" \
-"nctPTAfI5t8RFCWSSE4VzQyW5Dc76gb3OWUPc+1TCllC9cv5lgoVUjOMAeHG8ubr\n" \
-"/aHW8ixdgc1fRUs=\n" \
-"-----END CERTIFICATE-----\n";
-	#else
-		#ifdef ESP8266
-			// SHA-1 fingerprint for BEARSSL
-			const uint8_t _DeviceIO_OTAserverFingerprint[20] = {0x93, 0x1C, 0x03, 0x1E, 0x5E, 0x3C, 0x34, 0x16, 0xE3, 0x1D, 0xD5, 0xD1, 0xE6, 0xA1, 0x60, 0xDB, 0x22, 0x48, 0xB3, 0x30};
-		#endif
+	
+	#ifdef DEVICEIO_NATIVE
+		// host build benchmarks reach into the check-in internals
+		friend class DeviceIONativeBench;
 	#endif
 };
 
@@ -0,0 +1,153 @@
+// DeviceIOAggregator.cpp
+// Per-sensor windowed aggregation for DeviceIO samples
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOAggregator.h"
+
+bool DeviceIOAggregator::configure(uint16_t sensornumber, uint32_t windowMs, uint32_t hopMs, uint8_t stats, uint16_t firstOutput)
+{
+Aggregate *aggregate = nullptr;
+uint8_t i;
+
+	for (i = 0; i < _count; i++)
+	{
+		if (_aggregates[i].sensornumber == sensornumber)
+		{
+			aggregate = &_aggregates[i];
+			break;
+		}
+	}
+
+	if (stats == 0)
+	{
+		// the last entry takes its place
+		if (aggregate != nullptr)
+			*aggregate = _aggregates[--_count];
+		return true;
+	}
+
+	if ((hopMs == 0) || (windowMs < hopMs) || ((windowMs % hopMs) != 0) || (windowMs / hopMs > DEVICEIO_AGGREGATE_PANES))
+		return false;
+	if (aggregate == nullptr)
+	{
+		if (_count == DEVICEIO_AGGREGATE_SENSORS)
+			return false;
+		aggregate = &_aggregates[_count++];
+	}
+
+	// a new configuration starts with empty windows
+	memset(aggregate, 0, sizeof(Aggregate));
+	aggregate->sensornumber = sensornumber;
+	aggregate->firstOutput = firstOutput;
+	aggregate->stats = stats & DEVICEIO_AGGREGATE_ALL;
+	aggregate->panes = (uint8_t)(windowMs / hopMs);
+	aggregate->hopMs = hopMs;
+	return true;
+}
+
+bool DeviceIOAggregator::add(uint16_t sensornumber, float value, unsigned long nowMs)
+{
+Pane *pane;
+float delta;
+
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		Aggregate &aggregate = _aggregates[i];
+		if (aggregate.sensornumber != sensornumber)
+			continue;
+
+		advance(aggregate, nowMs);
+
+		// Welford, no sum of squares to lose precision in
+		pane = &aggregate.window[aggregate.pane];
+		pane->count++;
+		delta = value - pane->mean;
+		pane->mean += delta / pane->count;
+		pane->m2 += delta * (value - pane->mean);
+		if ((pane->count == 1) || (value < pane->min))
+			pane->min = value;
+		if ((pane->count == 1) || (value > pane->max))
+			pane->max = value;
+		aggregate.last = value;
+		folded++;
+		return true;
+	}
+	return false;
+}
+
+void DeviceIOAggregator::flush(unsigned long nowMs)
+{
+	for (uint8_t i = 0; i < _count; i++)
+		advance(_aggregates[i], nowMs);
+}
+
+void DeviceIOAggregator::advance(Aggregate &aggregate, unsigned long nowMs)
+{
+uint8_t closed = 0;
+
+	if (!aggregate.started)
+	{
+		aggregate.started = true;
+		aggregate.paneStart = nowMs;
+		return;
+	}
+
+	// after a long gap every pane is empty, the rest of the hops output nothing
+	while (nowMs - aggregate.paneStart >= aggregate.hopMs)
+	{
+		if (closed++ == aggregate.panes)
+		{
+			aggregate.paneStart += (nowMs - aggregate.paneStart) / aggregate.hopMs * aggregate.hopMs;
+			break;
+		}
+		close(aggregate);
+		aggregate.paneStart += aggregate.hopMs;
+	}
+}
+
+// outputs the window ending with the current pane, then starts the next pane
+void DeviceIOAggregator::close(Aggregate &aggregate)
+{
+uint32_t count = 0;
+float mean = 0, m2 = 0, min = 0, max = 0;
+float delta;
+uint16_t output = aggregate.firstOutput;
+unsigned long endMs = aggregate.paneStart + aggregate.hopMs;
+
+	// Chan et al., pane by pane
+	for (uint8_t i = 0; i < aggregate.panes; i++)
+	{
+		const Pane &pane = aggregate.window[i];
+		if (pane.count == 0)
+			continue;
+		if ((count == 0) || (pane.min < min))
+			min = pane.min;
+		if ((count == 0) || (pane.max > max))
+			max = pane.max;
+		delta = pane.mean - mean;
+		count += pane.count;
+		mean += delta * pane.count / count;
+		m2 += pane.m2 + delta * delta * (float)(count - pane.count) * pane.count / count;
+	}
+
+	if ((count > 0) && (_output != nullptr))
+	{
+		if (aggregate.stats & DEVICEIO_AGGREGATE_MEAN)
+			_output(_context, output++, mean, endMs);
+		if (aggregate.stats & DEVICEIO_AGGREGATE_MIN)
+			_output(_context, output++, min, endMs);
+		if (aggregate.stats & DEVICEIO_AGGREGATE_MAX)
+			_output(_context, output++, max, endMs);
+		if (aggregate.stats & DEVICEIO_AGGREGATE_COUNT)
+			_output(_context, output++, (float)count, endMs);
+		if (aggregate.stats & DEVICEIO_AGGREGATE_LAST)
+			_output(_context, output++, aggregate.last, endMs);
+		if (aggregate.stats & DEVICEIO_AGGREGATE_VARIANCE)
+			_output(_context, output++, m2 / count, endMs);
+		windows++;
+	}
+
+	aggregate.pane = (aggregate.pane + 1) % aggregate.panes;
+	memset(&aggregate.window[aggregate.pane], 0, sizeof(Pane));
+}
@@ -0,0 +1,102 @@
+// DeviceIOAggregator.h
+// Per-sensor windowed aggregation for DeviceIO samples
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// A sensor with an aggregation folds its samples into windows instead of
+// storing each one. A window is split into panes of hop milliseconds,
+// every pane keeps count, mean, sum of squared deviations (Welford),
+// min and max. When a pane ends the window made of the last panes is
+// handed to the output as one value per statistic, then the oldest pane
+// is cleared for the next hop:
+//
+//   tumbling    window == hop, one pane, every sample is in one window
+//   sliding     window == panes * hop, a window every hop, overlapping
+//
+// Adding a sample costs the same whatever the window length, nothing is
+// allocated. Windows without samples are not output. A window is closed
+// by the first sample or flush() after it ended, possibly several hops
+// later, the output gets the time it ended to stamp it with.
+
+#ifndef DeviceIOAggregator_h
+#define DeviceIOAggregator_h
+
+#include <Arduino.h>
+
+// sensors with an aggregation
+#ifndef DEVICEIO_AGGREGATE_SENSORS
+	#define DEVICEIO_AGGREGATE_SENSORS	4
+#endif
+// panes per window, the most a sliding window overlaps
+#ifndef DEVICEIO_AGGREGATE_PANES
+	#define DEVICEIO_AGGREGATE_PANES	4
+#endif
+
+// statistics, output in this order to consecutive sensor numbers
+#define DEVICEIO_AGGREGATE_MEAN			0x01
+#define DEVICEIO_AGGREGATE_MIN			0x02
+#define DEVICEIO_AGGREGATE_MAX			0x04
+#define DEVICEIO_AGGREGATE_COUNT		0x08
+#define DEVICEIO_AGGREGATE_LAST			0x10
+#define DEVICEIO_AGGREGATE_VARIANCE		0x20	// population variance
+#define DEVICEIO_AGGREGATE_ALL			0x3F
+
+// receives one statistic of a closed window, endMs is when the window ended
+typedef void (*DeviceIOAggregateOutput)(void *context, uint16_t sensornumber, float value, unsigned long endMs);
+
+class DeviceIOAggregator
+{
+public:
+	DeviceIOAggregator() {}
+
+	void 				begin(DeviceIOAggregateOutput output, void *context) 	{ _output = output; _context = context; }
+
+	// windows of windowMs starting every hopMs, windowMs a multiple of hopMs
+	// of at most DEVICEIO_AGGREGATE_PANES. stats 0 removes the aggregation.
+	// false when the table is full or the window doesn't fit
+	bool 				configure(uint16_t sensornumber, uint32_t windowMs, uint32_t hopMs, uint8_t stats, uint16_t firstOutput);
+
+	// folds value in when sensornumber has an aggregation, false otherwise
+	bool 				add(uint16_t sensornumber, float value, unsigned long nowMs);
+	// outputs the windows that ended by nowMs
+	void 				flush(unsigned long nowMs);
+
+	// since boot
+	uint32_t 			folded 			= 0;	// samples added to a window
+	uint32_t 			windows 		= 0;	// windows output
+
+private:
+	struct Pane
+	{
+		uint32_t 		count;
+		float 			mean;
+		float 			m2;			// sum of squared deviations from mean
+		float 			min;
+		float 			max;
+	};
+
+	struct Aggregate
+	{
+		uint16_t 		sensornumber;
+		uint16_t 		firstOutput;
+		uint8_t 		stats;		// 0 when unused
+		uint8_t 		panes;
+		uint8_t 		pane;		// the one samples go to
+		bool 			started;
+		uint32_t 		hopMs;
+		unsigned long 	paneStart;
+		float 			last;
+		Pane 			window[DEVICEIO_AGGREGATE_PANES];
+	};
+
+	// closes the panes that ended by nowMs
+	void 				advance(Aggregate &aggregate, unsigned long nowMs);
+	void 				close(Aggregate &aggregate);
+
+	DeviceIOAggregateOutput _output 	= nullptr;
+	void *				_context 		= nullptr;
+	Aggregate 			_aggregates[DEVICEIO_AGGREGATE_SENSORS] = {};
+	uint8_t 			_count 			= 0;	// entries in use are at the front
+};
+
+#endif
@@ -0,0 +1,199 @@
+// DeviceIOBinaryEncoder.h
+// Streaming binary encoder for DeviceIO sensor uploads
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// Sent with Content-Type DEVICEIO_BINARY_CONTENT_TYPE, version 1:
+//
+//   "DIO" 0x01          magic and format version
+//   varint  count       number of samples
+//   uint32  base        epoch of the first sample, little endian
+//   count times:
+//     varint  delta     zigzag, epoch minus the previous sample's epoch (base for the first)
+//     varint  key       sensornumber << 3 | mode
+//     value             mode 0..6: zigzag varint of round(value * 10^mode)
+//                       mode 7:    float, 4 bytes little endian
+//   uint32  crc         CRC-32 of everything before it, little endian
+//
+// varints are unsigned LEB128, 7 bits per byte with the low bits
+// first. A typical sample takes 4 to 6 bytes instead of about 90 in
+// the form encoding. An epoch of 0 means the clock was not set.
+//
+// Like DeviceIOSampleEncoder it encodes one piece at a time through a
+// small scratch buffer, the length comes from a dry pass and the CRC
+// is accumulated while the body is read.
+
+#ifndef DeviceIOBinaryEncoder_h
+#define DeviceIOBinaryEncoder_h
+
+#include <Arduino.h>
+#include <math.h>
+#include "DeviceIOCRC32.h"
+#include "DeviceIOSensorPolicy.h"
+
+#define DEVICEIO_BINARY_CONTENT_TYPE	"application/x-deviceio-samples"
+#define DEVICEIO_BINARY_VERSION			1
+
+template <class Buffer>
+class DeviceIOBinaryEncoder : public Stream
+{
+public:
+	// encodes the first count samples of the buffer, the buffer must not change meanwhile
+	DeviceIOBinaryEncoder(const Buffer &samples, uint16_t count, const DeviceIOSensorPolicies &policies)
+		: _samples(samples), _policies(policies), _count(count), _next(0), _len(0), _pos(0), _size(0), _sent(0), _crc(0)
+	{
+		_base = (_count > 0) ? _samples[0].epoch : 0;
+		_previous = _base;
+		for (int32_t i = -1; i <= (int32_t)_count; i++)
+			_size += encode(i, _scratch);
+		_previous = _base;
+	}
+
+	// total body length in bytes
+	size_t 			size(void) const { return _size; }
+
+	int available(void) override
+	{
+		size_t remaining = _size - _sent;
+		return remaining > 0x7fff ? 0x7fff : (int)remaining;
+	}
+
+	int read(void) override
+	{
+		if (!fill()) return -1;
+		_sent++;
+		return _scratch[_pos++];
+	}
+
+	int peek(void) override
+	{
+		if (!fill()) return -1;
+		return _scratch[_pos];
+	}
+
+	size_t readBytes(char *buffer, size_t length) override
+	{
+		size_t copied = 0;
+		while (copied < length && fill())
+		{
+			size_t n = _len - _pos;
+			if (n > length - copied) n = length - copied;
+			memcpy(buffer + copied, _scratch + _pos, n);
+			_pos += n;
+			copied += n;
+		}
+		_sent += copied;
+		return copied;
+	}
+
+	// read only
+	size_t write(uint8_t) override { return 0; }
+
+private:
+	// make sure the scratch buffer has unread bytes
+	bool fill(void)
+	{
+		if (_pos < _len) return true;
+		if (_next > (int32_t)_count + 1) return false;
+		_len = encode(_next - 1, _scratch);
+		// the crc covers everything but itself
+		if (_next <= (int32_t)_count)
+			_crc = DeviceIOCRC32::update(_crc, _scratch, _len);
+		_next++;
+		_pos = 0;
+		return _len > 0;
+	}
+
+	// piece -1 is the header, 0..count-1 the samples, count the crc. returns its length
+	uint8_t encode(int32_t piece, uint8_t *out)
+	{
+		uint8_t n = 0;
+
+		if (piece < 0)
+		{
+			out[n++] = 'D';
+			out[n++] = 'I';
+			out[n++] = 'O';
+			out[n++] = DEVICEIO_BINARY_VERSION;
+			n += varint(_count, out + n);
+			n += uint32le(_base, out + n);
+			return n;
+		}
+
+		if (piece == (int32_t)_count)
+			return uint32le(_crc, out);
+
+		const typename Buffer::value_type &sample = _samples[(uint16_t)piece];
+		n += varint(zigzag((int32_t)(sample.epoch - _previous)), out + n);
+		_previous = sample.epoch;
+
+		uint8_t mode = _policies.decimals(sample.sensornumber);
+		int32_t quantized = 0;
+		if (mode <= DEVICEIO_PRECISION_MAX)
+		{
+			float scaled = sample.sensorvalue * scale(mode);
+			if (isfinite(scaled) && (fabsf(scaled) < 2147483520.0f))
+				quantized = (int32_t)lroundf(scaled);
+			else
+				mode = DEVICEIO_PRECISION_RAW;
+		} else
+			mode = DEVICEIO_PRECISION_RAW;
+
+		n += varint(((uint32_t)sample.sensornumber << 3) | mode, out + n);
+		if (mode == DEVICEIO_PRECISION_RAW)
+		{
+			uint32_t bits;
+			memcpy(&bits, &sample.sensorvalue, sizeof(bits));
+			n += uint32le(bits, out + n);
+		} else
+			n += varint(zigzag(quantized), out + n);
+		return n;
+	}
+
+	static float scale(uint8_t decimals)
+	{
+		static const float powers[DEVICEIO_PRECISION_MAX + 1] = {1.0f, 10.0f, 100.0f, 1000.0f, 10000.0f, 100000.0f, 1000000.0f};
+		return powers[decimals];
+	}
+
+	static uint32_t zigzag(int32_t v)
+	{
+		return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+	}
+
+	static uint8_t varint(uint32_t v, uint8_t *out)
+	{
+		uint8_t n = 0;
+		while (v >= 0x80)
+		{
+			out[n++] = (uint8_t)(v | 0x80);
+			v >>= 7;
+		}
+		out[n++] = (uint8_t)v;
+		return n;
+	}
+
+	static uint8_t uint32le(uint32_t v, uint8_t *out)
+	{
+		out[0] = (uint8_t)v;
+		out[1] = (uint8_t)(v >> 8);
+		out[2] = (uint8_t)(v >> 16);
+		out[3] = (uint8_t)(v >> 24);
+		return 4;
+	}
+
+	const Buffer &	_samples;
+	const DeviceIOSensorPolicies &_policies;
+	uint16_t 		_count;
+	int32_t 		_next;			// piece to encode next, plus one
+	uint8_t 		_len;
+	uint8_t 		_pos;
+	size_t 			_size;
+	size_t 			_sent;
+	uint32_t 		_crc;
+	uint32_t 		_base;
+	uint32_t 		_previous;
+	uint8_t 		_scratch[16];
+};
+
+#endif
@@ -0,0 +1,33 @@
+// DeviceIOCRC32.h
+// CRC-32 for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// The zlib/Ethernet CRC-32 (reflected polynomial 0xEDB88320), computed
+// bit by bit to keep the 1 KB lookup table out of flash. Chain calls by
+// passing the previous result, start with 0.
+
+#ifndef DeviceIOCRC32_h
+#define DeviceIOCRC32_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+class DeviceIOCRC32
+{
+public:
+	static uint32_t update(uint32_t crc, const void *data, size_t length)
+	{
+		const uint8_t *p = (const uint8_t *)data;
+		crc = ~crc;
+		while (length--)
+		{
+			crc ^= *p++;
+			for (uint8_t bit = 0; bit < 8; bit++)
+				crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+		}
+		return ~crc;
+	}
+};
+
+#endif
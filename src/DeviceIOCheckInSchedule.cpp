@@ -0,0 +1,68 @@
+// DeviceIOCheckInSchedule.cpp
+// When DeviceIO checks in next: start jitter, exponential back-off and the server's hint
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOCheckInSchedule.h"
+
+void DeviceIOCheckInSchedule::begin(unsigned long nowMs, uint32_t jitterMs)
+{
+	_dueMs = nowMs + jitter(jitterMs);
+	_failures = 0;
+	_started = true;
+}
+
+void DeviceIOCheckInSchedule::succeeded(unsigned long startMs, unsigned long nowMs, uint32_t intervalMs, uint32_t hintMs)
+{
+	_dueMs = startMs + intervalMs + jitter(intervalMs / 100 * DEVICEIO_CHECKIN_JITTER_PERCENT);
+	_failures = 0;
+	hint(nowMs, hintMs);
+}
+
+void DeviceIOCheckInSchedule::failed(unsigned long nowMs, uint32_t intervalMs, uint32_t hintMs)
+{
+uint32_t longest = (intervalMs > DEVICEIO_BACKOFF_MAX_MS) ? intervalMs : DEVICEIO_BACKOFF_MAX_MS;
+uint32_t wait = intervalMs / 8;
+
+	if (_failures < 0xFF)
+		_failures++;
+	for (uint8_t i = 1; (i < _failures) && (wait < longest); i++)
+		wait = (wait > longest / 2) ? longest : wait * 2;
+	if (wait > longest)
+		wait = longest;
+
+	_dueMs = nowMs + wait / 2 + jitter(wait - wait / 2);
+	hint(nowMs, hintMs);
+}
+
+void DeviceIOCheckInSchedule::at(unsigned long dueMs)
+{
+	_dueMs = dueMs;
+	_started = true;
+}
+
+uint32_t DeviceIOCheckInSchedule::hintMs(const char *seconds)
+{
+unsigned long s = strtoul(seconds, nullptr, 10);
+
+	// seconds * 1000 wraps above 4.29M s, and past 2^31 ms a hint reads as due
+	if (s > DEVICEIO_HINT_MAX_S)
+		s = DEVICEIO_HINT_MAX_S;
+	return (uint32_t)s * 1000;
+}
+
+void DeviceIOCheckInSchedule::hint(unsigned long nowMs, uint32_t hintMs)
+{
+	if ((hintMs > 0) && ((long)(nowMs + hintMs - _dueMs) > 0))
+		_dueMs = nowMs + hintMs;
+}
+
+uint32_t DeviceIOCheckInSchedule::jitter(uint32_t range)
+{
+	if (range == 0)
+		return 0;
+	// random() takes a long
+	if (range > 0x7FFFFFFEUL)
+		range = 0x7FFFFFFEUL;
+	return (uint32_t)random((long)range + 1);
+}
@@ -0,0 +1,77 @@
+// DeviceIOCheckInSchedule.h
+// When DeviceIO checks in next: start jitter, exponential back-off and the server's hint
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// Devices that restart together, after a power cut or a fleet OTA,
+// would all check in within the same second and then stay in step.
+// The first check-in of a boot is due at a random time within the
+// start jitter. After a good check-in the next one is due an interval
+// later plus up to DEVICEIO_CHECKIN_JITTER_PERCENT of it, so the fleet
+// drifts apart rather than together and no device checks in more often
+// than its interval.
+//
+// A failed check-in is retried after an eighth of the interval, twice
+// as long after each failure in a row, up to the interval or
+// DEVICEIO_BACKOFF_MAX_MS, whichever is longer. Each wait is a random
+// time between half of it and all of it, so devices that failed
+// together don't retry together. A hint from the server, the NEXT
+// directive or a Retry-After header, makes the next check-in wait at
+// least that long, up to DEVICEIO_HINT_MAX_S.
+//
+// Times are millis() and compared as differences, they work across
+// its 49-day wrap.
+
+#ifndef DeviceIOCheckInSchedule_h
+#define DeviceIOCheckInSchedule_h
+
+#include <Arduino.h>
+
+// the first check-in after a restart, sketches can change checkinJitterMS
+#ifndef DEVICEIO_STARTUP_JITTER_MS
+	#define DEVICEIO_STARTUP_JITTER_MS 			(60UL * 1000)
+#endif
+#ifndef DEVICEIO_CHECKIN_JITTER_PERCENT
+	#define DEVICEIO_CHECKIN_JITTER_PERCENT 	5
+#endif
+#ifndef DEVICEIO_BACKOFF_MAX_MS
+	#define DEVICEIO_BACKOFF_MAX_MS 			(60UL * 60 * 1000)
+#endif
+// the longest wait a server hint asks for, in ms it stays well below 2^31
+#ifndef DEVICEIO_HINT_MAX_S
+	#define DEVICEIO_HINT_MAX_S 				(7UL * 24 * 3600)
+#endif
+
+class DeviceIOCheckInSchedule
+{
+public:
+	DeviceIOCheckInSchedule() {}
+
+	// the first check-in of this boot, within jitterMs from now
+	void 				begin(unsigned long nowMs, uint32_t jitterMs);
+	bool 				started(void) const 		{ return _started; }
+	// a check-in that started at startMs went through, hintMs is the server's or 0
+	void 				succeeded(unsigned long startMs, unsigned long nowMs, uint32_t intervalMs, uint32_t hintMs);
+	void 				failed(unsigned long nowMs, uint32_t intervalMs, uint32_t hintMs);
+	// the next check-in at dueMs, whatever was planned
+	void 				at(unsigned long dueMs);
+	// a hint in seconds as the server sends it, in ms and at most DEVICEIO_HINT_MAX_S
+	static uint32_t 	hintMs(const char *seconds);
+
+	bool 				due(unsigned long nowMs) const 	{ return (long)(nowMs - _dueMs) >= 0; }
+	unsigned long 		dueMs(void) const 			{ return _dueMs; }
+	// failed check-ins in a row
+	uint8_t 			failures(void) const 		{ return _failures; }
+
+private:
+	// not before nowMs + hintMs
+	void 				hint(unsigned long nowMs, uint32_t hintMs);
+	// 0..range, from the hardware RNG unless the sketch called randomSeed()
+	static uint32_t 	jitter(uint32_t range);
+
+	unsigned long 		_dueMs 			= 0;
+	uint8_t 			_failures 		= 0;
+	bool 				_started 		= false;
+};
+
+#endif
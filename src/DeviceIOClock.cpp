@@ -0,0 +1,239 @@
+// DeviceIOClock.cpp
+// NTP-disciplined wall clock for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOClock.h"
+#include <math.h>
+#include <sys/time.h>
+
+#define DEVICEIO_CLOCK_EPOCH_KEY 	"epoch"
+// 1900 to 1970
+#define DEVICEIO_NTP_UNIX_OFFSET 	2208988800ULL
+
+static uint32_t readBigEndian32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// an NTP timestamp in milliseconds since 1970, seconds with the top bit
+// clear are in the era that starts in 2036
+static uint64_t ntpToEpochMs(const uint8_t *p)
+{
+uint64_t seconds = readBigEndian32(p);
+
+	if ((seconds & 0x80000000UL) == 0)
+		seconds += 0x100000000ULL;
+	return (seconds - DEVICEIO_NTP_UNIX_OFFSET) * 1000 + (((uint64_t)readBigEndian32(p + 4) * 1000) >> 32);
+}
+
+void DeviceIOClock::begin(DeviceIOStore *store, const char *server)
+{
+int32_t saved;
+
+	_store = store;
+	_server = server;
+	if ((_store != nullptr) && _store->getInt(DEVICEIO_CLOCK_EPOCH_KEY, saved))
+		_lastEpoch = (uint32_t)saved;
+}
+
+uint64_t DeviceIOClock::epochMs(void) const
+{
+Anchor anchor = _anchors[_current.load()];
+unsigned long elapsed;
+
+	if (anchor.epochMs == 0)
+		return 0;
+	elapsed = millis() - anchor.ms;
+	return anchor.epochMs + elapsed + (int64_t)(elapsed * anchor.drift);
+}
+
+void DeviceIOClock::poll(bool online)
+{
+unsigned long now = millis();
+uint8_t packet[DEVICEIO_NTP_PACKET_SIZE];
+const Anchor &anchor = _anchors[_current.load()];
+
+	if (_pending)
+	{
+		// packets that aren't the reply are dropped
+		while (_udp.parsePacket() >= DEVICEIO_NTP_PACKET_SIZE)
+		{
+			_udp.read(packet, sizeof(packet));
+			if (receive(packet, now))
+				return;
+		}
+		if (now - _sentMs >= DEVICEIO_CLOCK_TIMEOUT_MS)
+		{
+			timeouts++;
+			finish(true, now);
+		}
+		return;
+	}
+
+	if ((anchor.epochMs != 0) && (now - anchor.ms >= DEVICEIO_CLOCK_REANCHOR_MS))
+		setAnchor(epochMs(), now, anchor.drift);
+
+	if (!online || !due())
+		return;
+	if (_failed && (now - _failedMs < (synced() ? DEVICEIO_CLOCK_RESYNC_RETRY_MS : DEVICEIO_CLOCK_RETRY_MS)))
+		return;
+	send(now);
+}
+
+// when the error the drift may have built up reaches the tolerance
+bool DeviceIOClock::due(void) const
+{
+unsigned long age = millis() - _syncMs;
+float ppm = DEVICEIO_CLOCK_UNDISCIPLINED_PPM;
+
+	if (!synced() || (age >= DEVICEIO_CLOCK_MAX_AGE_S * 1000))
+		return true;
+	if (_measured)
+		ppm = (_residualPpm > DEVICEIO_CLOCK_FLOOR_PPM) ? _residualPpm : DEVICEIO_CLOCK_FLOOR_PPM;
+	return (float)age * ppm >= DEVICEIO_CLOCK_TOLERANCE_MS * 1e6f;
+}
+
+void DeviceIOClock::send(unsigned long now)
+{
+uint8_t packet[DEVICEIO_NTP_PACKET_SIZE];
+uint32_t id = ++requests;
+
+	// the transmit timestamp is only a cookie, servers copy it into the reply
+	memset(packet, 0, sizeof(packet));
+	packet[0] = 0x23;		// no leap warning, version 4, client
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		_cookie[i] = (uint8_t)(now >> (24 - 8 * i));
+		_cookie[4 + i] = (uint8_t)(id >> (24 - 8 * i));
+	}
+	memcpy(packet + 40, _cookie, sizeof(_cookie));
+
+	if (!_udp.begin(DEVICEIO_CLOCK_LOCAL_PORT) || !_udp.beginPacket(_server, 123) || \
+		(_udp.write(packet, sizeof(packet)) != sizeof(packet)) || !_udp.endPacket())
+	{
+		finish(true, now);
+		return;
+	}
+	_pending = true;
+	_sentMs = now;
+}
+
+bool DeviceIOClock::receive(const uint8_t *packet, unsigned long now)
+{
+uint64_t received, transmitted, serverMs;
+long rtt;
+
+	if (memcmp(packet + 24, _cookie, sizeof(_cookie)) != 0)
+		return false;
+
+	// a server, synchronized, not a kiss-o'-death
+	if (((packet[0] & 0x07) != 4) || ((packet[0] >> 6) == 3) || (packet[1] == 0) || (packet[1] > 15))
+	{
+		rejected++;
+		finish(true, now);
+		return true;
+	}
+
+	received = ntpToEpochMs(packet + 32);
+	transmitted = ntpToEpochMs(packet + 40);
+	rtt = (long)(now - _sentMs) - (long)(transmitted - received);
+	if (rtt < 0)
+		rtt = 0;
+	serverMs = transmitted + rtt / 2;
+
+	// half the round trip is the error, a reply picked up late looks like a long one
+	if ((rtt > DEVICEIO_CLOCK_MAX_RTT_MS) || (serverMs / 1000 < DEVICEIO_EPOCH_VALID))
+	{
+		rejected++;
+		finish(true, now);
+		return true;
+	}
+
+	// not before the last good time of this or an earlier boot, unless
+	// the previous reply said so too: then the last good time was wrong
+	if ((serverMs / 1000 < _lastEpoch) && ((_earlierMs == 0) || !agree(_earlierMs, serverMs, now - _earlierAt)))
+	{
+		_earlierMs = serverMs;
+		_earlierAt = now;
+		rejected++;
+		finish(true, now);
+		return true;
+	}
+
+	lastRttMs = (unsigned long)rtt;
+	sync(serverMs, now);
+	finish(false, now);
+	return true;
+}
+
+bool DeviceIOClock::agree(uint64_t a, uint64_t b, unsigned long elapsed)
+{
+int64_t error = (int64_t)(b - a) - (int64_t)elapsed;
+
+	if (error < 0)
+		error = -error;
+	return error <= DEVICEIO_CLOCK_AGREE_MS + (int64_t)elapsed * DEVICEIO_CLOCK_MAX_PPM / 1000000;
+}
+
+void DeviceIOClock::sync(uint64_t serverMs, unsigned long now)
+{
+float drift = _anchors[_current.load()].drift;
+unsigned long interval = now - _syncMs;
+// a reply before the last good time got here confirmed by the one before it
+bool back = serverMs / 1000 < _lastEpoch;
+bool confirmed = back || (synced() && agree(_syncEpochMs, serverMs, interval));
+struct timeval tv;
+
+	_earlierMs = 0;
+
+	// shorter intervals measure the round trip more than the oscillator,
+	// a step is not drift
+	if (back || !confirmed)
+		_measured = false;
+	else if (interval >= DEVICEIO_CLOCK_MIN_INTERVAL_S * 1000)
+	{
+		_residualPpm = fabsf((float)(int64_t)(serverMs - epochMs())) * 1e6f / interval;
+		drift = (float)((int64_t)(serverMs - _syncEpochMs) - (int64_t)interval) / interval;
+		if (drift > DEVICEIO_CLOCK_MAX_PPM * 1e-6f)
+			drift = DEVICEIO_CLOCK_MAX_PPM * 1e-6f;
+		if (drift < -DEVICEIO_CLOCK_MAX_PPM * 1e-6f)
+			drift = -DEVICEIO_CLOCK_MAX_PPM * 1e-6f;
+		_measured = true;
+	}
+
+	setAnchor(serverMs, now, drift);
+	_syncMs = now;
+	_syncEpochMs = serverMs;
+	_lastEpoch = (uint32_t)(serverMs / 1000);
+	syncs++;
+
+	// time() and the TLS certificate checks run on the system time
+	tv.tv_sec = (time_t)(serverMs / 1000);
+	tv.tv_usec = (suseconds_t)(serverMs % 1000) * 1000;
+	settimeofday(&tv, nullptr);
+
+	if (confirmed && (_store != nullptr))
+	{
+		_store->setInt(DEVICEIO_CLOCK_EPOCH_KEY, (int32_t)_lastEpoch);
+		_store->commit();
+	}
+}
+
+void DeviceIOClock::setAnchor(uint64_t epochMs, unsigned long ms, float drift)
+{
+uint8_t next = _current.load() ^ 1;
+
+	_anchors[next].epochMs = epochMs;
+	_anchors[next].ms = ms;
+	_anchors[next].drift = drift;
+	_current.store(next);
+}
+
+void DeviceIOClock::finish(bool failed, unsigned long now)
+{
+	_udp.stop();
+	_pending = false;
+	_failed = failed;
+	_failedMs = now;
+}
@@ -0,0 +1,152 @@
+// DeviceIOClock.h
+// NTP-disciplined wall clock for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// A small SNTP client over WiFiUDP that never waits for the network.
+// poll() sends one 48 byte request and later picks up the reply, the
+// round trip is taken out of the server time (t3 + rtt / 2). A reply
+// with a round trip over DEVICEIO_CLOCK_MAX_RTT_MS is not trusted. A
+// good reply anchors the wall clock to millis():
+//
+//   now = anchor epoch + elapsed * (1 + drift)
+//
+// so epochMs() is a subtraction and a multiply, from any task. drift
+// is how fast the local oscillator runs against the server, measured
+// between two syncs at least DEVICEIO_CLOCK_MIN_INTERVAL_S apart. The
+// next sync is due when the error the drift estimate may have built up
+// since the last one reaches DEVICEIO_CLOCK_TOLERANCE_MS: at first the
+// drift is unknown and DEVICEIO_CLOCK_UNDISCIPLINED_PPM is assumed, a
+// few hours; once it is measured the error left over at the last sync
+// decides, usually DEVICEIO_CLOCK_MAX_AGE_S. Offline the clock keeps
+// running on the drift estimate.
+//
+// Every sync also sets the system time for time() and TLS. A sync that
+// agrees with the clock the previous one set up saves the epoch in the
+// store, one bad reply is never saved. Replies earlier than the last
+// good epoch, of this boot or a saved one, are rejected, unless the next
+// reply agrees with the rejected one: two servers in a row outvote a
+// bogus future epoch, it can't hold the clock back for good.
+
+#ifndef DeviceIOClock_h
+#define DeviceIOClock_h
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include <atomic>
+#include "DeviceIOStore.h"
+
+#ifndef DEVICEIO_CLOCK_SERVER
+	#define DEVICEIO_CLOCK_SERVER 				"pool.ntp.org"
+#endif
+// the largest error the clock may build up before it syncs again
+#ifndef DEVICEIO_CLOCK_TOLERANCE_MS
+	#define DEVICEIO_CLOCK_TOLERANCE_MS 		1000
+#endif
+// syncs at least this often while the network is up
+#ifndef DEVICEIO_CLOCK_MAX_AGE_S
+	#define DEVICEIO_CLOCK_MAX_AGE_S 			86400UL
+#endif
+// drift assumed until it is measured, a plain crystal is within 100 ppm
+#ifndef DEVICEIO_CLOCK_UNDISCIPLINED_PPM
+	#define DEVICEIO_CLOCK_UNDISCIPLINED_PPM 	100
+#endif
+// a measured drift is trusted to no better than this
+#ifndef DEVICEIO_CLOCK_FLOOR_PPM
+	#define DEVICEIO_CLOCK_FLOOR_PPM 			5
+#endif
+// drift larger than this is a bad measurement
+#define DEVICEIO_CLOCK_MAX_PPM 					500
+// shortest interval drift is measured over
+#define DEVICEIO_CLOCK_MIN_INTERVAL_S 			600UL
+#define DEVICEIO_CLOCK_TIMEOUT_MS 				2000
+// replies that took longer are rejected
+#define DEVICEIO_CLOCK_MAX_RTT_MS 				500
+// wait after a lost or bad reply, before and after the first sync
+#define DEVICEIO_CLOCK_RETRY_MS 				3000
+#define DEVICEIO_CLOCK_RESYNC_RETRY_MS 			60000UL
+// the anchor moves up offline as well, long before millis() wraps
+#define DEVICEIO_CLOCK_REANCHOR_MS 				0x40000000UL
+#define DEVICEIO_CLOCK_LOCAL_PORT 				2390
+#define DEVICEIO_NTP_PACKET_SIZE 				48
+
+// two times agree within this, plus DEVICEIO_CLOCK_MAX_PPM of the time between them
+#define DEVICEIO_CLOCK_AGREE_MS 				2000
+
+// epochs below this are not a date (2021-01-01)
+#define DEVICEIO_EPOCH_VALID					1609459200UL
+
+class DeviceIOClock
+{
+public:
+	DeviceIOClock() {}
+
+	// the saved epoch, when there is one. store may be nullptr
+	void 				begin(DeviceIOStore *store, const char *server = DEVICEIO_CLOCK_SERVER);
+
+	// sends a request when a sync is due and online, takes the reply on a
+	// later call. it never waits, but the reply should be taken within
+	// DEVICEIO_CLOCK_MAX_RTT_MS: call it every few ms while busy()
+	void 				poll(bool online);
+	bool 				busy(void) const 		{ return _pending; }
+	bool 				due(void) const;
+
+	bool 				synced(void) const 		{ return _anchors[_current.load()].epochMs != 0; }
+	// milliseconds and seconds since 1970 (UTC), 0 until the first sync. any task
+	uint64_t 			epochMs(void) const;
+	uint32_t 			epoch(void) const 		{ return (uint32_t)(epochMs() / 1000); }
+	// the local clock runs this much fast against the server, 0 until measured
+	float 				driftPpm(void) const 	{ return -_anchors[_current.load()].drift * 1e6f; }
+	// the last good epoch of this or an earlier boot, 0 when there is none
+	uint32_t 			lastEpoch(void) const 	{ return _lastEpoch; }
+
+	// since boot
+	uint32_t 			requests 		= 0;
+	uint32_t 			syncs 			= 0;
+	uint32_t 			timeouts 		= 0;
+	uint32_t 			rejected 		= 0;	// replies that were not sane
+	unsigned long 		lastRttMs 		= 0;
+
+private:
+	struct Anchor
+	{
+		uint64_t 		epochMs;		// 0 when not set
+		unsigned long 	ms;				// millis() at epochMs
+		float 			drift;			// the server's time runs 1 + drift as fast as millis()
+	};
+
+	void 				send(unsigned long now);
+	// true when the request is done with, a good reply or not
+	bool 				receive(const uint8_t *packet, unsigned long now);
+	void 				sync(uint64_t serverMs, unsigned long now);
+	// b, elapsed ms after a, is consistent with it
+	static bool 		agree(uint64_t a, uint64_t b, unsigned long elapsed);
+	void 				setAnchor(uint64_t epochMs, unsigned long ms, float drift);
+	void 				finish(bool failed, unsigned long now);
+
+	WiFiUDP 			_udp;
+	DeviceIOStore *		_store 			= nullptr;
+	const char *		_server 		= DEVICEIO_CLOCK_SERVER;
+
+	// readers take the current one, a sync writes the other and flips
+	Anchor 				_anchors[2] 	= {};
+	std::atomic<uint8_t> _current{0};
+
+	uint32_t 			_lastEpoch 		= 0;
+	// the last reply before _lastEpoch, the next one may confirm it
+	uint64_t 			_earlierMs 		= 0;
+	unsigned long 		_earlierAt 		= 0;
+	unsigned long 		_syncMs 		= 0;	// millis() at the last sync
+	uint64_t 			_syncEpochMs 	= 0;	// the server's time then
+	bool 				_measured 		= false;	// drift measured
+	float 				_residualPpm 	= 0;	// the previous drift's error at the last sync
+
+	// the request in flight
+	bool 				_pending 		= false;
+	bool 				_failed 		= false;
+	unsigned long 		_sentMs 		= 0;
+	unsigned long 		_failedMs 		= 0;
+	uint8_t 			_cookie[8] 		= {};	// our transmit timestamp, the reply echoes it
+};
+
+#endif
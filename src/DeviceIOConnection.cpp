@@ -0,0 +1,135 @@
+// DeviceIOConnection.cpp
+// Shared HTTPS connection for one DeviceIO check-in
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOConnection.h"
+
+#define DEVICEIO_HTTPS_PORT 		443
+
+DeviceIOConnection::DeviceIOConnection()
+{
+}
+
+DeviceIOConnection::~DeviceIOConnection()
+{
+	close();
+}
+
+bool DeviceIOConnection::connected(void)
+{
+	return (_client != nullptr) && _client->connected();
+}
+
+bool DeviceIOConnection::connect(const char *host)
+{
+IPAddress address;
+unsigned long start;
+
+	if (connected())
+		return true;
+
+	// TLS buffers only live for the duration of a check-in
+	if (_client == nullptr)
+	{
+		_client = new DeviceIOTLSClient;
+		#ifdef ESP8266
+			if (_fingerprint != nullptr)
+				_client->setFingerprint(_fingerprint);
+		#else
+			if (_caCert != nullptr)
+				_client->setCACert(_caCert);
+		#endif
+	}
+
+	#if DEVICEIO_TLS_SESSIONS
+		// BearSSL keeps the session id in _session. it is unchanged after an
+		// abbreviated handshake and replaced after a full one
+		uint8_t offered[sizeof(_session)];
+		const uint8_t *session = (const uint8_t *)&_session;
+		bool hadSession = false;
+		memcpy(offered, session, sizeof(offered));
+		for (size_t i = 0; i < sizeof(offered); i++)
+		{
+			if (offered[i] != 0)
+			{
+				hadSession = true;
+				break;
+			}
+		}
+		_client->setSession(&_session);
+	#endif
+
+	// resolved apart to time it, the connect finds the address in the DNS cache
+	start = millis();
+	if (!WiFi.hostByName(host, address))
+		return false;
+	dnsMs = millis() - start;
+	
+	start = millis();
+	if (!_client->connect(host, DEVICEIO_HTTPS_PORT))
+		return false;
+	handshakeMs = millis() - start;
+
+	handshakes++;
+	#if DEVICEIO_TLS_SESSIONS
+		if (hadSession && memcmp(offered, session, sizeof(offered)) == 0)
+			resumptions++;
+	#endif
+	return true;
+}
+
+HTTPClient *DeviceIOConnection::open(const char *host, const String &url)
+{
+	if (!connect(host))
+		return nullptr;
+
+	if (_https == nullptr)
+	{
+		// the server's hint when it is busy, the other response headers aren't kept
+		static const char *headers[] = { "Retry-After" };
+		
+		_https = new HTTPClient;
+		_https->setReuse(true);
+		_https->setTimeout(DEVICEIO_HTTPS_TIMEOUT);
+		_https->collectHeaders(headers, 1);
+	}
+
+	// HTTPClient sees the connected client and reuses it
+	if (!_https->begin(*_client, url))
+		return nullptr;
+
+	requests++;
+	return _https;
+}
+
+DeviceIOTLSClient *DeviceIOConnection::stream(const char *host)
+{
+	if (!connect(host))
+		return nullptr;
+	requests++;
+	return _client;
+}
+
+void DeviceIOConnection::finish(void)
+{
+	if (_https != nullptr)
+		_https->end();
+}
+
+void DeviceIOConnection::close(void)
+{
+	// HTTPClient stops the client when destroyed, so it goes first
+	if (_https != nullptr)
+	{
+		_https->end();
+		delete _https;
+		_https = nullptr;
+	}
+	if (_client != nullptr)
+	{
+		_client->stop();
+		delete _client;
+		_client = nullptr;
+	}
+}
@@ -0,0 +1,93 @@
+// DeviceIOConnection.h
+// Shared HTTPS connection for one DeviceIO check-in
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// All requests of a check-in go through one TLS client and one
+// HTTPClient with HTTP/1.1 keep-alive, so a check-in pays for one
+// handshake instead of one per request. close() frees the TLS
+// buffers between check-ins but keeps the TLS session, so where the
+// TLS stack supports it (BearSSL on ESP8266) the next check-in does an
+// abbreviated handshake. The ESP32 mbedTLS client has no session
+// API, there only keep-alive applies.
+
+#ifndef DeviceIOConnection_h
+#define DeviceIOConnection_h
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+
+#ifdef ESP32
+	#include <HTTPClient.h>
+	#include <WiFi.h>
+#else
+	#ifdef ESP8266
+		#include <WiFiClientSecureBearSSL.h>
+		#include <ESP8266HTTPClient.h>
+		#include <ESP8266WiFi.h>
+	#endif
+#endif
+
+// request timeout, also the longest stall of a firmware download
+#define DEVICEIO_HTTPS_TIMEOUT 		5000
+
+// follows the target, the host build models the ESP32 and has them only
+// when built with -DDEVICEIO_TLS_SESSIONS=1 to model BearSSL
+#ifndef DEVICEIO_TLS_SESSIONS
+	#if defined(ESP8266)
+		#define DEVICEIO_TLS_SESSIONS 	1
+	#else
+		#define DEVICEIO_TLS_SESSIONS 	0
+	#endif
+#endif
+
+#if defined(ESP8266)
+	typedef BearSSL::WiFiClientSecure 	DeviceIOTLSClient;
+#else
+	typedef WiFiClientSecure 			DeviceIOTLSClient;
+#endif
+
+class DeviceIOConnection
+{
+public:
+	DeviceIOConnection();
+	~DeviceIOConnection();
+
+	// server identity, the ESP32 uses a CA certificate and the ESP8266 a SHA-1 fingerprint
+	void 				setCACert(const char *caCert) { _caCert = caCert; }
+	void 				setFingerprint(const uint8_t *fingerprint) { _fingerprint = fingerprint; }
+
+	// connects if needed and prepares the shared HTTPClient for url,
+	// returns nullptr when the TLS connection could not be made
+	HTTPClient *		open(const char *host, const String &url);
+	// connects if needed and returns the TLS client for a request written
+	// without HTTPClient, nullptr when the connection could not be made
+	DeviceIOTLSClient *	stream(const char *host);
+	// ends the current request, the socket stays open when the server allows it
+	void 				finish(void);
+	// closes the socket and frees the TLS client, the TLS session is kept
+	void 				close(void);
+	bool 				connected(void);
+
+	// statistics since boot
+	uint32_t 			handshakes 		= 0;	// TLS handshakes, full or abbreviated
+	uint32_t 			resumptions 	= 0;	// abbreviated handshakes
+	uint32_t 			requests 		= 0;	// requests served by open()
+	// the last connection, ms
+	unsigned long 		dnsMs 			= 0;
+	unsigned long 		handshakeMs 	= 0;	// TCP connect and TLS handshake
+
+private:
+	bool 				connect(const char *host);
+
+	DeviceIOTLSClient *	_client 		= nullptr;
+	HTTPClient *		_https 			= nullptr;
+	const char *		_caCert 		= nullptr;
+	const uint8_t *		_fingerprint 	= nullptr;
+
+	#if DEVICEIO_TLS_SESSIONS
+		BearSSL::Session 	_session;
+	#endif
+};
+
+#endif
@@ -0,0 +1,181 @@
+// DeviceIODirectives.cpp
+// Server directives for DeviceIO, parsed while the response streams in
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIODirectives.h"
+
+DeviceIODirectives::DeviceIODirectives()
+{
+	for (uint8_t i = 0; i < DEVICEIO_DIRECTIVES; i++)
+		_entries[i].name = nullptr;
+}
+
+DeviceIODirectives::Entry *DeviceIODirectives::find(const char *name)
+{
+	for (uint8_t i = 0; i < DEVICEIO_DIRECTIVES; i++)
+		if ((_entries[i].name != nullptr) && (strcmp(_entries[i].name, name) == 0))
+			return &_entries[i];
+	return nullptr;
+}
+
+bool DeviceIODirectives::add(const char *name, DeviceIODirectiveHandler handler, void *context)
+{
+Entry *entry;
+
+	if ((name == nullptr) || (handler == nullptr))
+		return false;
+
+	entry = find(name);
+	for (uint8_t i = 0; (entry == nullptr) && (i < DEVICEIO_DIRECTIVES); i++)
+		if (_entries[i].name == nullptr)
+			entry = &_entries[i];
+	if (entry == nullptr)
+		return false;
+
+	entry->name = name;
+	entry->handler = handler;
+	entry->context = context;
+	return true;
+}
+
+bool DeviceIODirectives::remove(const char *name)
+{
+Entry *entry = find(name);
+
+	if (entry == nullptr)
+		return false;
+	entry->name = nullptr;
+	return true;
+}
+
+bool DeviceIODirectives::dispatch(const char *name, char *args)
+{
+Entry *entry = find(name);
+
+	if (entry == nullptr)
+	{
+		unknown++;
+		return false;
+	}
+	dispatched++;
+	entry->handler(entry->context, args);
+	return true;
+}
+
+bool DeviceIODirectives::nextArgument(char *&cursor, char *&name, char *&value)
+{
+char *p = cursor;
+
+	while ((*p == ',') || (*p == ' '))
+		p++;
+	if (*p == 0)
+		return false;
+
+	name = p;
+	while ((*p != 0) && (*p != '(') && (*p != ','))
+		p++;
+	if (*p == '(')
+	{
+		// the value may hold commas, it ends at the parenthesis
+		*p++ = 0;
+		value = p;
+		while ((*p != 0) && (*p != ')'))
+			p++;
+		if (*p == ')')
+			*p++ = 0;
+	} else
+	{
+		// no value, it is the terminator the name gets next
+		value = p;
+	}
+	if (*p == ',')
+		*p++ = 0;
+
+	cursor = p;
+	return true;
+}
+
+DeviceIODirectiveParser::DeviceIODirectiveParser(DeviceIODirectives &directives)
+	: _directives(directives)
+{
+}
+
+void DeviceIODirectiveParser::begin(int httpCode)
+{
+	// the push channel reads one response after another with the same parser
+	_dispatch = (httpCode == 200);
+	_length = 0;
+	_overflow = false;
+	_ok = false;
+	_unsupported = false;
+	_updated = 0;
+	_bytes = 0;
+	_lines = 0;
+}
+
+size_t DeviceIODirectiveParser::write(const uint8_t *buffer, size_t size)
+{
+	_bytes += size;
+	for (size_t i = 0; i < size; i++)
+	{
+		char c = (char)buffer[i];
+
+		if ((c == '\r') || (c == '\n'))
+		{
+			// CR LF is one line end
+			if ((c == '\n') && (_length == 0) && !_overflow)
+				continue;
+			endLine();
+			continue;
+		}
+
+		if (_length < DEVICEIO_DIRECTIVE_LINE)
+			_line[_length++] = c;
+		else
+			_overflow = true;
+	}
+	return size;
+}
+
+void DeviceIODirectiveParser::end(void)
+{
+	if ((_length > 0) || _overflow)
+		endLine();
+}
+
+void DeviceIODirectiveParser::endLine(void)
+{
+char *args;
+
+	_line[_length] = 0;
+
+	if (_overflow)
+	{
+		_directives.dropped++;
+	} else if (_lines == 0)
+	{
+		// "deviceio OK", or "deviceio UNSUPPORTED binary" and the upload goes again
+		_ok = (strstr(_line, "OK") != nullptr);
+		_unsupported = (strstr(_line, "UNSUPPORTED") != nullptr);
+		if (_unsupported)
+			_dispatch = false;
+	} else if (_lines == 1)
+	{
+		// "2 sensors updated"
+		_updated = atol(_line);
+	} else if (_dispatch && (_length > 0))
+	{
+		// the name ends at the first space, the arguments follow it
+		args = strchr(_line, ' ');
+		if (args != nullptr)
+			*args++ = 0;
+		else
+			args = _line + _length;
+		_directives.dispatch(_line, args);
+	}
+
+	_lines++;
+	_length = 0;
+	_overflow = false;
+}
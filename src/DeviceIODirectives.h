@@ -0,0 +1,126 @@
+// DeviceIODirectives.h
+// Server directives for DeviceIO, parsed while the response streams in
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// A sensor or checkin response is lines that end in CR:
+//
+//   deviceio OK[CR]2 sensors updated[CR]BUILD 13[CR]REBOOT[CR]SETCMD enable(123),ssid(abcdef)[CR]
+//
+// a status line, a count line, then one directive per line: a name and,
+// after the first space, its arguments. DeviceIODirectiveParser is the
+// Stream HTTPClient::writeToStream() writes the response into. It keeps
+// one line of DEVICEIO_DIRECTIVE_LINE bytes, whatever the size of the
+// response, and hands each directive to the handler registered for its
+// name in a DeviceIODirectives table as soon as its CR arrives. The name
+// and the arguments are NUL-terminated in the line buffer, nothing is
+// copied. A line longer than the buffer is dropped, not cut. A server
+// that can't read the upload may say so in the status line:
+//
+//   deviceio UNSUPPORTED binary[CR]0 sensors updated[CR]...
+//
+// the directives of such a reply don't run, they come again with the
+// reply to the upload that is sent instead.
+
+#ifndef DeviceIODirectives_h
+#define DeviceIODirectives_h
+
+#include <Arduino.h>
+
+// REBOOT, BUILD, SETCMD and NEXT, DeviceIO registers them itself
+#define DEVICEIO_DIRECTIVES_BUILTIN 	4
+// handlers a sketch can add on top of those
+#ifndef DEVICEIO_DIRECTIVES_USER
+	#define DEVICEIO_DIRECTIVES_USER 	8
+#endif
+#ifndef DEVICEIO_DIRECTIVES
+	#define DEVICEIO_DIRECTIVES 		(DEVICEIO_DIRECTIVES_BUILTIN + DEVICEIO_DIRECTIVES_USER)
+#endif
+#ifndef DEVICEIO_DIRECTIVE_LINE
+	#define DEVICEIO_DIRECTIVE_LINE 	128
+#endif
+// the status and count lines before the directives
+#define DEVICEIO_DIRECTIVE_HEADER_LINES	2
+
+// args is what follows the name and a space, "" when nothing does. it
+// lives in the parser's line buffer until the handler returns and the
+// handler may write to it, e.g. with DeviceIODirectives::nextArgument()
+typedef void (*DeviceIODirectiveHandler)(void *context, char *args);
+
+class DeviceIODirectives
+{
+public:
+	DeviceIODirectives();
+
+	// name must outlive the table, a string constant. a name that has a handler
+	// gets the new one. false when all DEVICEIO_DIRECTIVES are taken
+	bool 				add(const char *name, DeviceIODirectiveHandler handler, void *context);
+	bool 				remove(const char *name);
+	// runs the handler of name, false when there is none
+	bool 				dispatch(const char *name, char *args);
+
+	// splits "enable(123),disable(1),reset" in place, one pair per call: name
+	// "enable" and value "123", then "disable" and "1", then "reset" and "".
+	// cursor starts at the arguments and moves on, false when they are used up
+	static bool 		nextArgument(char *&cursor, char *&name, char *&value);
+
+	// since boot
+	uint32_t 			dispatched 		= 0;
+	uint32_t 			unknown 		= 0;	// directives without a handler
+	uint32_t 			dropped 		= 0;	// lines longer than DEVICEIO_DIRECTIVE_LINE
+
+private:
+	struct Entry
+	{
+		const char *	name;			// nullptr when unused
+		DeviceIODirectiveHandler handler;
+		void *			context;
+	};
+
+	Entry *				find(const char *name);
+
+	Entry 				_entries[DEVICEIO_DIRECTIVES];
+};
+
+class DeviceIODirectiveParser : public Stream
+{
+public:
+	DeviceIODirectiveParser(DeviceIODirectives &directives);
+
+	// before each body, the directives of a response that isn't a 200 don't run
+	void 				begin(int httpCode);
+
+	// HTTPClient writes the response body here
+	size_t 				write(uint8_t c) override 	{ return write(&c, 1); }
+	size_t 				write(const uint8_t *buffer, size_t size) override;
+	int 				available(void) override 	{ return 0; }
+	int 				read(void) override 		{ return -1; }
+	int 				peek(void) override 		{ return -1; }
+	// takes a last line that came without its CR
+	void 				end(void);
+
+	// the status line says OK
+	bool 				ok(void) const 				{ return _ok; }
+	// the status line says UNSUPPORTED, the server couldn't read the upload
+	bool 				unsupported(void) const 	{ return _unsupported; }
+	// samples the server stored, from the count line, 0 without one
+	long 				updated(void) const 		{ return _updated; }
+	size_t 				bytes(void) const 			{ return _bytes; }
+	uint16_t 			lines(void) const 			{ return _lines; }
+
+private:
+	void 				endLine(void);
+
+	DeviceIODirectives &_directives;
+	bool 				_dispatch 		= false;
+	char 				_line[DEVICEIO_DIRECTIVE_LINE + 1];
+	size_t 				_length 		= 0;
+	bool 				_overflow 		= false;
+	bool 				_ok 			= false;
+	bool 				_unsupported 	= false;
+	long 				_updated 		= 0;
+	size_t 				_bytes 			= 0;
+	uint16_t 			_lines 			= 0;
+};
+
+#endif
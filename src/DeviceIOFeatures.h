@@ -0,0 +1,49 @@
+// DeviceIOFeatures.h
+// Compile-time feature selection for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// Each feature is on unless a build flag turns it off, e.g. in
+// platformio.ini:
+//
+//   build_flags = -D DEVICEIO_OTA=0 -D DEVICEIO_LOG_LEVEL=0
+//
+// A feature that is off has no members in DeviceIO and no code that
+// calls it, the linker drops the rest (both cores link with
+// --gc-sections). The flags must be the same for every file of the
+// build, so set them for the project, not with a #define in the sketch.
+// Logging has its own DEVICEIO_LOG_LEVEL, see DeviceIOLog.h.
+
+#ifndef DeviceIOFeatures_h
+#define DeviceIOFeatures_h
+
+// SNTP clock. without it getTime() returns false and samples go up with
+// epoch 0, as those taken before the first sync do
+#ifndef DEVICEIO_NTP
+	#define DEVICEIO_NTP 				1
+#endif
+
+// firmware updates. without them a newer build on the server is only logged
+#ifndef DEVICEIO_OTA
+	#define DEVICEIO_OTA 				1
+#endif
+
+// the DEVICEIO_SENSOR_VCC, _WIFI and _TEMPERATURE channels. without them the
+// ESP8266 ADC is left to analogRead(A0) instead of measuring VCC
+#ifndef DEVICEIO_BUILTIN_SENSORS
+	#define DEVICEIO_BUILTIN_SENSORS 	1
+#endif
+
+// the long-poll push channel, sketches turn it on with pushChannel. without
+// it directives only arrive with check-ins
+#ifndef DEVICEIO_PUSH
+	#define DEVICEIO_PUSH 				1
+#endif
+
+// shortest check-in interval in ms, checkinInterval is raised to it. it keeps
+// the server load down, don't go below 5 minutes without asking us first
+#ifndef DEVICEIO_MIN_CHECKIN_INTERVAL
+	#define DEVICEIO_MIN_CHECKIN_INTERVAL 	(5UL * 60 * 1000)
+#endif
+
+#endif
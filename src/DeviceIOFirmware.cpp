@@ -0,0 +1,415 @@
+// DeviceIOFirmware.cpp
+// Resumable firmware image writer for DeviceIO OTA updates
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOFirmware.h"
+
+#if !DEVICEIO_OTA_RESUME
+	#include <Updater.h>
+#endif
+#ifdef DEVICEIO_NATIVE
+	// the flash task's time runs on the other core's timeline
+	#include "DeviceIONative.h"
+#endif
+
+// build, size and offset
+#define DEVICEIO_OTA_PROGRESS_KEY 	"ota"
+// "build size offset", written by builds before the store
+#define DEVICEIO_OTA_PROGRESS_FILE 	"/otaProgress.txt"
+
+void DeviceIOFirmware::begin(eSPIFFS &fileSystem, DeviceIOStore *store)
+{
+	_store = store;
+	// a download the older build left is for another image than this one's next
+	fileSystem.removeFile(DEVICEIO_OTA_PROGRESS_FILE);
+}
+
+bool DeviceIOFirmware::open(size_t size, long build, const char *md5)
+{
+	abort();
+	if (!start(size, build))
+		return false;
+	#if !DEVICEIO_OTA_RESUME
+		// Update.end() then refuses an image with another MD5
+		if ((md5 != nullptr) && (md5[0] != 0) && !Update.setMD5(md5))
+		{
+			abort();
+			_error = DEVICEIO_FIRMWARE_VERIFY;
+			return false;
+		}
+	#else
+		// esp_ota_set_boot_partition() verifies the image's own hash
+		(void)md5;
+	#endif
+	return true;
+}
+
+void DeviceIOFirmware::abort(void)
+{
+	forget();
+	release();
+}
+
+void DeviceIOFirmware::resetStages(void)
+{
+	_stageBytes = 0;
+	_receiveMicros = 0;
+	_flashMicros = 0;
+	_stallMicros = 0;
+	_lastWrite = 0;
+}
+
+uint32_t DeviceIOFirmware::rate(uint32_t micros) const
+{
+	if (micros == 0)
+		return 0;
+	return (uint32_t)((uint64_t)_stageBytes * 1000000 / micros);
+}
+
+#if DEVICEIO_OTA_RESUME
+
+bool DeviceIOFirmware::start(size_t size, long build)
+{
+	_error = DEVICEIO_FIRMWARE_OK;
+	_partition = esp_ota_get_next_update_partition(NULL);
+	if ((_partition == nullptr) || (size == 0) || (size > _partition->size))
+	{
+		_error = DEVICEIO_FIRMWARE_SPACE;
+		return false;
+	}
+	_buffers = (uint8_t *)malloc(2 * DEVICEIO_FLASH_SECTOR);
+	_busy.store(false);
+	_flashFailed.store(false);
+	if ((_buffers == nullptr) || \
+		!_flasher.start(flashTask, this, DEVICEIO_FLASH_TASK_STACK, DEVICEIO_FLASH_TASK_PRIORITY, DeviceIOWorker::otherCore()))
+	{
+		free(_buffers);
+		_buffers = nullptr;
+		_error = DEVICEIO_FIRMWARE_SPACE;
+		return false;
+	}
+
+	_build = build;
+	_size = size;
+	_progress = 0;
+	_fill = 0;
+	_queued = 0;
+	_flashed = 0;
+	_checkpointed = 0;
+	_running = true;
+	resetStages();
+	return true;
+}
+
+bool DeviceIOFirmware::resume(long build)
+{
+uint32_t saved[3];
+size_t size, offset;
+
+	if (_running)
+	{
+		if (_build == build)
+		{
+			// the time spent reconnecting is not receive time
+			_lastWrite = 0;
+			return true;
+		}
+		abort();
+	}
+
+	if ((_store == nullptr) || !_store->getBytes(DEVICEIO_OTA_PROGRESS_KEY, saved, sizeof(saved)))
+		return false;
+	size = saved[1];
+	offset = saved[2];
+	if (((long)(int32_t)saved[0] != build) || (offset == 0) || (offset >= size) || ((offset % DEVICEIO_FLASH_SECTOR) != 0))
+	{
+		// another build or garbage
+		forget();
+		return false;
+	}
+
+	// the sectors before offset are on flash already
+	if (!start(size, build))
+	{
+		forget();
+		return false;
+	}
+	_progress = offset;
+	_queued = offset;
+	_flashed = offset;
+	_checkpointed = offset;
+	return true;
+}
+
+size_t DeviceIOFirmware::write(const uint8_t *data, size_t len)
+{
+unsigned long now = micros();
+size_t done = 0;
+size_t n, filled;
+
+	if (!_running || (_error != DEVICEIO_FIRMWARE_OK))
+		return 0;
+	if (len > _size - _progress)
+	{
+		_error = DEVICEIO_FIRMWARE_SIZE;
+		return 0;
+	}
+	if (_lastWrite != 0)
+		_receiveMicros += now - _lastWrite;
+
+	while (done < len)
+	{
+		filled = _progress - _queued;
+		n = DEVICEIO_FLASH_SECTOR - filled;
+		if (n > len - done)
+			n = len - done;
+		memcpy(_buffers + _fill * DEVICEIO_FLASH_SECTOR + filled, data + done, n);
+		_progress += n;
+		done += n;
+
+		// a full sector, or the last one
+		if (((_progress - _queued) == DEVICEIO_FLASH_SECTOR) || (_progress == _size))
+		{
+			if (!submit())
+				return 0;
+		}
+	}
+	_stageBytes += len;
+	_lastWrite = micros();
+	return len;
+}
+
+// hands the filled buffer to the flash task and switches to the other one
+bool DeviceIOFirmware::submit(void)
+{
+uint8_t *sector = _buffers + _fill * DEVICEIO_FLASH_SECTOR;
+size_t len = _progress - _queued;
+
+	if (len == 0)
+		return true;
+
+	if (_queued == 0)
+	{
+		if (sector[0] != DEVICEIO_IMAGE_MAGIC)
+		{
+			_error = DEVICEIO_FIRMWARE_MAGIC;
+			return false;
+		}
+		// written by finish(), until then the image can't boot
+		sector[0] = 0xFF;
+	}
+
+	// the task is done with the other buffer once it is idle
+	if (!wait())
+		return false;
+	_job = sector;
+	_jobOffset = _queued;
+	_jobLen = len;
+	_busy.store(true);
+	_queued += len;
+	_fill ^= 1;
+	return true;
+}
+
+// until the flash task wrote everything it was given
+bool DeviceIOFirmware::wait(void)
+{
+unsigned long start = micros();
+
+	while (_busy.load())
+		DeviceIOWorker::sleep(1);
+	#ifdef DEVICEIO_NATIVE
+		DeviceIONative::syncOtherCore();
+	#endif
+	_stallMicros += micros() - start;
+	_flashMicros += _jobMicros;
+	_jobMicros = 0;
+
+	if (_flashFailed.load())
+	{
+		_error = DEVICEIO_FIRMWARE_FLASH;
+		return false;
+	}
+	_flashed = _queued;
+	if ((_flashed - _checkpointed) >= DEVICEIO_OTA_CHECKPOINT)
+		checkpoint();
+	return true;
+}
+
+void DeviceIOFirmware::flashTask(void *firmware)
+{
+DeviceIOFirmware *self = (DeviceIOFirmware *)firmware;
+unsigned long start;
+
+	#ifdef DEVICEIO_NATIVE
+		DeviceIONative::enterOtherCore();
+	#endif
+	while (!self->_flasher.stopping())
+	{
+		if (!self->_busy.load())
+		{
+			DeviceIOWorker::sleep(1);
+			continue;
+		}
+		start = micros();
+		if ((esp_partition_erase_range(self->_partition, self->_jobOffset, DEVICEIO_FLASH_SECTOR) != ESP_OK) || \
+			(esp_partition_write(self->_partition, self->_jobOffset, self->_job, self->_jobLen) != ESP_OK))
+			self->_flashFailed.store(true);
+		self->_jobMicros = micros() - start;
+		self->_busy.store(false);
+	}
+}
+
+bool DeviceIOFirmware::finish(void)
+{
+uint8_t magic = DEVICEIO_IMAGE_MAGIC;
+
+	if (!_running || (_error != DEVICEIO_FIRMWARE_OK))
+		return false;
+
+	if (_progress != _size)
+		_error = DEVICEIO_FIRMWARE_SIZE;
+	else
+	if (!wait())
+		_error = DEVICEIO_FIRMWARE_FLASH;
+	else
+	if (esp_partition_write(_partition, 0, &magic, 1) != ESP_OK)
+		_error = DEVICEIO_FIRMWARE_FLASH;
+	else
+	if (esp_ota_set_boot_partition(_partition) != ESP_OK)
+		_error = DEVICEIO_FIRMWARE_VERIFY;
+
+	abort();
+	return _error == DEVICEIO_FIRMWARE_OK;
+}
+
+void DeviceIOFirmware::suspend(void)
+{
+	if (!_running)
+		return;
+	// the bytes still in the buffers are downloaded again
+	if (wait())
+		checkpoint();
+	release();
+}
+
+void DeviceIOFirmware::checkpoint(void)
+{
+uint32_t saved[3];
+
+	if (!_running || (_store == nullptr) || (_flashed == _checkpointed))
+		return;
+	saved[0] = (uint32_t)_build;
+	saved[1] = _size;
+	saved[2] = _flashed;
+	_store->setBytes(DEVICEIO_OTA_PROGRESS_KEY, saved, sizeof(saved));
+	if (_store->commit())
+		_checkpointed = _flashed;
+}
+
+void DeviceIOFirmware::forget(void)
+{
+	if (_store != nullptr)
+	{
+		_store->remove(DEVICEIO_OTA_PROGRESS_KEY);
+		_store->commit();
+	}
+	_checkpointed = 0;
+}
+
+void DeviceIOFirmware::release(void)
+{
+	// a sector being written is finished first
+	_flasher.stop();
+	_busy.store(false);
+	free(_buffers);
+	_buffers = nullptr;
+	_running = false;
+}
+
+#else
+
+bool DeviceIOFirmware::start(size_t size, long build)
+{
+	_error = DEVICEIO_FIRMWARE_OK;
+	if (!Update.begin(size))
+	{
+		_error = DEVICEIO_FIRMWARE_SPACE;
+		return false;
+	}
+	_build = build;
+	_size = size;
+	_progress = 0;
+	_running = true;
+	resetStages();
+	return true;
+}
+
+// only within this boot, Update keeps the image open meanwhile
+bool DeviceIOFirmware::resume(long build)
+{
+	if (_running && (_build == build))
+	{
+		_lastWrite = 0;
+		return true;
+	}
+	abort();
+	return false;
+}
+
+size_t DeviceIOFirmware::write(const uint8_t *data, size_t len)
+{
+unsigned long now = micros();
+
+	if (!_running || (_error != DEVICEIO_FIRMWARE_OK))
+		return 0;
+	if (_lastWrite != 0)
+		_receiveMicros += now - _lastWrite;
+	// one core, write() is the flash stage
+	if (Update.write((uint8_t *)data, len) != len)
+	{
+		_error = DEVICEIO_FIRMWARE_FLASH;
+		return 0;
+	}
+	_progress += len;
+	_stageBytes += len;
+	_lastWrite = micros();
+	_flashMicros += _lastWrite - now;
+	return len;
+}
+
+bool DeviceIOFirmware::finish(void)
+{
+	if (!_running || (_error != DEVICEIO_FIRMWARE_OK))
+		return false;
+	_running = false;
+	if (!Update.end() || !Update.isFinished())
+	{
+		_error = DEVICEIO_FIRMWARE_VERIFY;
+		return false;
+	}
+	return true;
+}
+
+void DeviceIOFirmware::suspend(void)
+{
+}
+
+void DeviceIOFirmware::checkpoint(void)
+{
+}
+
+void DeviceIOFirmware::forget(void)
+{
+}
+
+void DeviceIOFirmware::release(void)
+{
+	// ending an incomplete image drops it
+	if (_running)
+		Update.end();
+	_running = false;
+}
+
+#endif
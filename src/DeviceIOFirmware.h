@@ -0,0 +1,140 @@
+// DeviceIOFirmware.h
+// Resumable firmware image writer for DeviceIO OTA updates
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// On the ESP32 the image goes straight to the next OTA partition, one
+// 4 KB sector at a time, the way the core's Update class writes it:
+// the first byte is held back until the image is complete so a partial
+// image never boots, and esp_ota_set_boot_partition() verifies it at
+// the end. Unlike Update a download can continue at any sector offset.
+// There are two sector buffers: while a task on the other core erases
+// and writes one, write() fills the other from the network, and only
+// waits when the flash falls behind.
+// Every DEVICEIO_OTA_CHECKPOINT bytes, and whenever the download is
+// suspended, the build number, size and offset are committed to the
+// DeviceIOStore as one value, so the download resumes after a reset as
+// well and a reset during the commit leaves the previous checkpoint.
+//
+// The ESP8266 writes through Update, which can't start at an offset.
+// There a download continues within the same boot only. Update.end()
+// checks nothing but the size, so the server's MD5 of the image is
+// handed to Update.setMD5() and a different image is not booted.
+
+#ifndef DeviceIOFirmware_h
+#define DeviceIOFirmware_h
+
+#include <Arduino.h>
+#include "Effortless_SPIFFS.h"
+#include "DeviceIOStore.h"
+
+#if defined(ESP32)
+	#define DEVICEIO_OTA_RESUME 		1
+	#include <atomic>
+	#include <esp_partition.h>
+	#include <esp_ota_ops.h>
+	#include "DeviceIOWorker.h"
+#else
+	#define DEVICEIO_OTA_RESUME 		0
+#endif
+
+#define DEVICEIO_FLASH_SECTOR			4096
+#define DEVICEIO_IMAGE_MAGIC			0xE9	// first byte of an ESP image
+
+#define DEVICEIO_FLASH_TASK_STACK		3072
+#define DEVICEIO_FLASH_TASK_PRIORITY	2
+
+// progress saved to flash this often while downloading
+#ifndef DEVICEIO_OTA_CHECKPOINT
+	#define DEVICEIO_OTA_CHECKPOINT		(64 * 1024)
+#endif
+
+// getError() values
+#define DEVICEIO_FIRMWARE_OK			0
+#define DEVICEIO_FIRMWARE_SPACE			1	// no partition, too small or no memory
+#define DEVICEIO_FIRMWARE_MAGIC			2	// not an ESP image
+#define DEVICEIO_FIRMWARE_FLASH			3	// erase or write failed
+#define DEVICEIO_FIRMWARE_SIZE			4	// more or fewer bytes than announced
+#define DEVICEIO_FIRMWARE_VERIFY		5	// the image was not accepted
+
+class DeviceIOFirmware
+{
+public:
+	DeviceIOFirmware() {}
+	~DeviceIOFirmware() { release(); }
+
+	// checkpoints are kept in store, which begin() has read
+	void 				begin(eSPIFFS &fileSystem, DeviceIOStore *store);
+
+	// a new image of size bytes for build, md5 its 32 hex digits when the
+	// server sent them, the ESP8266 checks the image against it
+	bool 				open(size_t size, long build, const char *md5 = nullptr);
+	// continues the image of build where this boot or the last checkpoint
+	// left it, false when there is none. progress() tells where
+	bool 				resume(long build);
+	size_t 				write(const uint8_t *data, size_t len);
+	// all bytes are written, makes the image the one to boot
+	bool 				finish(void);
+	// drops the image and its checkpoint
+	void 				abort(void);
+	// saves the progress and frees the buffer, resume() picks it up
+	void 				suspend(void);
+
+	bool 				running(void) const 		{ return _running; }
+	size_t 				size(void) const 			{ return _size; }
+	// bytes accepted by write()
+	size_t 				progress(void) const 		{ return _progress; }
+	uint8_t 			getError(void) const 		{ return _error; }
+
+	// the stages of the download since open() or resume(): getting the bytes to
+	// write(), writing them to flash, and write() waiting for the flash
+	uint32_t 			receiveBytesPerSecond(void) const 	{ return rate(_receiveMicros); }
+	uint32_t 			flashBytesPerSecond(void) const 	{ return rate(_flashMicros); }
+	uint32_t 			stallMillis(void) const 			{ return _stallMicros / 1000; }
+
+private:
+	bool 				start(size_t size, long build);
+	void 				checkpoint(void);
+	void 				forget(void);
+	void 				release(void);
+	void 				resetStages(void);
+	uint32_t 			rate(uint32_t micros) const;
+	#if DEVICEIO_OTA_RESUME
+		bool 			submit(void);
+		bool 			wait(void);
+		static void 	flashTask(void *firmware);
+	#endif
+
+	DeviceIOStore *		_store 			= nullptr;
+	bool 				_running 		= false;
+	long 				_build 			= -1;
+	size_t 				_size 			= 0;
+	size_t 				_progress 		= 0;
+	uint8_t 			_error 			= DEVICEIO_FIRMWARE_OK;
+
+	size_t 				_stageBytes 	= 0;
+	uint32_t 			_receiveMicros 	= 0;
+	uint32_t 			_flashMicros 	= 0;
+	uint32_t 			_stallMicros 	= 0;
+	unsigned long 		_lastWrite 		= 0;		// micros() when write() returned, 0 before the first
+
+	#if DEVICEIO_OTA_RESUME
+		const esp_partition_t *_partition = nullptr;
+		uint8_t *		_buffers 		= nullptr;	// two sectors, only while running
+		uint8_t 		_fill 			= 0;		// the one write() fills
+		size_t 			_queued 		= 0;		// bytes handed to the flash task, a multiple of the sector size
+		size_t 			_flashed 		= 0;		// bytes on flash
+		size_t 			_checkpointed 	= 0;
+
+		// the flash task takes one sector at a time, _busy until it is written
+		DeviceIOWorker 	_flasher;
+		std::atomic<bool> _busy{false};
+		std::atomic<bool> _flashFailed{false};
+		const uint8_t *	_job 			= nullptr;
+		size_t 			_jobOffset 		= 0;
+		size_t 			_jobLen 		= 0;
+		uint32_t 		_jobMicros 		= 0;
+	#endif
+};
+
+#endif
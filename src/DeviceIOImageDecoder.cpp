@@ -0,0 +1,344 @@
+// DeviceIOImageDecoder.cpp
+// Streaming decoder between a firmware download and DeviceIOFirmware
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOImageDecoder.h"
+#include "DeviceIOCRC32.h"
+
+#define DEVICEIO_HEATSHRINK_BACKREF 	(1 + DEVICEIO_HEATSHRINK_WINDOW + DEVICEIO_HEATSHRINK_LOOKAHEAD)
+
+bool DeviceIOImageDecoder::begin(DeviceIOFirmware &firmware, bool heatshrink, bool patch)
+{
+size_t size = 2 * DEVICEIO_DECODER_BUFFER;
+
+	end();
+	_firmware = &firmware;
+	_error = DEVICEIO_DECODER_OK;
+	_stage = patch ? STAGE_DETECT : STAGE_IMAGE;
+	_heatshrink = heatshrink;
+	_state = PATCH_MAGIC;
+	_field = 0;
+	_varint = 0;
+	_shift = 0;
+	_remaining = 0;
+	_sourceLen = 0;
+
+	// a raw image goes straight through
+	if (!heatshrink && !patch)
+		return true;
+
+	if (heatshrink)
+		size += (size_t)1 << DEVICEIO_HEATSHRINK_WINDOW;
+	_memory = (uint8_t *)malloc(size);
+	if (_memory == nullptr)
+		return fail(DEVICEIO_DECODER_MEMORY);
+
+	// source first, ESP.flashRead() wants it word aligned
+	_source = _memory;
+	_out = _memory + DEVICEIO_DECODER_BUFFER;
+	_outLen = 0;
+	_window = heatshrink ? _memory + 2 * DEVICEIO_DECODER_BUFFER : nullptr;
+	_windowPos = 0;
+	_bits = 0;
+	_bitCount = 0;
+	if (heatshrink)
+		memset(_window, 0, (size_t)1 << DEVICEIO_HEATSHRINK_WINDOW);
+	return true;
+}
+
+void DeviceIOImageDecoder::end(void)
+{
+	free(_memory);
+	_memory = nullptr;
+	_source = nullptr;
+	_out = nullptr;
+	_window = nullptr;
+}
+
+bool DeviceIOImageDecoder::write(const uint8_t *data, size_t len)
+{
+	if (_error != DEVICEIO_DECODER_OK)
+		return false;
+	if (_heatshrink)
+		return inflate(data, len);
+	return decoded(data, len);
+}
+
+bool DeviceIOImageDecoder::fail(uint8_t error)
+{
+	_error = error;
+	return false;
+}
+
+// heatshrink //////////////////
+
+bool DeviceIOImageDecoder::inflate(const uint8_t *data, size_t len)
+{
+const uint32_t mask = ((uint32_t)1 << DEVICEIO_HEATSHRINK_WINDOW) - 1;
+size_t used = 0;
+uint32_t symbol, distance, count;
+uint8_t need;
+
+	for (;;)
+	{
+		// the next symbol needs 9 bits for a literal, more for a back reference
+		while ((_bitCount < DEVICEIO_HEATSHRINK_BACKREF) && (used < len))
+		{
+			_bits = (_bits << 8) | data[used++];
+			_bitCount += 8;
+		}
+		if (_bitCount == 0)
+			break;
+		need = ((_bits >> (_bitCount - 1)) & 1) ? 9 : DEVICEIO_HEATSHRINK_BACKREF;
+		if (_bitCount < need)
+			break;
+
+		_bitCount -= need;
+		symbol = (_bits >> _bitCount) & (((uint32_t)1 << (need - 1)) - 1);
+		_bits &= ((uint32_t)1 << _bitCount) - 1;
+
+		if (need == 9)
+		{
+			_window[_windowPos++ & mask] = (uint8_t)symbol;
+			_out[_outLen++] = (uint8_t)symbol;
+			if ((_outLen == DEVICEIO_DECODER_BUFFER) && !decoded(_out, _outLen))
+				return false;
+			continue;
+		}
+
+		distance = (symbol >> DEVICEIO_HEATSHRINK_LOOKAHEAD) + 1;
+		count = (symbol & (((uint32_t)1 << DEVICEIO_HEATSHRINK_LOOKAHEAD) - 1)) + 1;
+		while (count-- > 0)
+		{
+			uint8_t c = _window[(_windowPos - distance) & mask];
+			_window[_windowPos++ & mask] = c;
+			_out[_outLen++] = c;
+			if ((_outLen == DEVICEIO_DECODER_BUFFER) && !decoded(_out, _outLen))
+				return false;
+		}
+	}
+
+	// the bits left are part of the next symbol or padding
+	if ((_outLen > 0) && !decoded(_out, _outLen))
+		return false;
+	return true;
+}
+
+// image or patch //////////////
+
+bool DeviceIOImageDecoder::decoded(const uint8_t *data, size_t len)
+{
+	_outLen = 0;
+	if (len == 0)
+		return true;
+
+	if (_stage == STAGE_DETECT)
+		_stage = (data[0] == DEVICEIO_PATCH_MAGIC[0]) ? STAGE_PATCH : STAGE_IMAGE;
+	if (_stage == STAGE_PATCH)
+		return patch(data, len);
+
+	if (_firmware->write(data, len) != len)
+		return fail(DEVICEIO_DECODER_WRITE);
+	return true;
+}
+
+bool DeviceIOImageDecoder::patch(const uint8_t *data, size_t len)
+{
+size_t used = 0;
+size_t n;
+
+	while (used < len)
+	{
+		switch (_state)
+		{
+			case PATCH_MAGIC:
+				if (data[used++] != (uint8_t)DEVICEIO_PATCH_MAGIC[_field])
+					return fail(DEVICEIO_DECODER_FORMAT);
+				if (++_field == 4)
+				{
+					_field = 0;
+					_state = PATCH_HEADER;
+				}
+				break;
+
+			case PATCH_HEADER:
+			case PATCH_CONTROL:
+				// LEB128, at most 5 bytes for 32 bits
+				_varint |= (uint32_t)(data[used] & 0x7F) << _shift;
+				_shift += 7;
+				if ((data[used++] & 0x80) != 0)
+				{
+					if (_shift >= 35)
+						return fail(DEVICEIO_DECODER_FORMAT);
+					break;
+				}
+				_fields[_field++] = _varint;
+				_varint = 0;
+				_shift = 0;
+				if (!control())
+					return false;
+				break;
+
+			case PATCH_DIFF:
+				n = len - used;
+				if (n > _remaining)
+					n = _remaining;
+				if (!diff(data + used, n))
+					return false;
+				used += n;
+				_remaining -= n;
+				if (_remaining == 0)
+				{
+					_remaining = _extra;
+					_state = PATCH_EXTRA;
+				}
+				break;
+
+			case PATCH_EXTRA:
+				n = len - used;
+				if (n > _remaining)
+					n = _remaining;
+				if ((n > 0) && (_firmware->write(data + used, n) != n))
+					return fail(DEVICEIO_DECODER_WRITE);
+				used += n;
+				_remaining -= n;
+				break;
+		}
+
+		// the next control once the extra bytes are through
+		if ((_state == PATCH_EXTRA) && (_remaining == 0))
+		{
+			if ((_seek < 0) ? ((uint32_t)-_seek > _sourcePos) : ((uint32_t)_seek > _sourceSize - _sourcePos))
+				return fail(DEVICEIO_DECODER_FORMAT);
+			_sourcePos += _seek;
+			_state = PATCH_CONTROL;
+		}
+	}
+	return true;
+}
+
+// a header or control is complete once all its fields are
+bool DeviceIOImageDecoder::control(void)
+{
+uint32_t available;
+
+	if (_state == PATCH_HEADER)
+	{
+		if (_field < 3)
+			return true;
+		#if DEVICEIO_OTA_RESUME
+			const esp_partition_t *running = esp_ota_get_running_partition();
+			available = (running != nullptr) ? running->size : 0;
+		#else
+			available = ESP.getSketchSize();
+		#endif
+		if (_fields[0] > available)
+			return fail(DEVICEIO_DECODER_SOURCE);
+		if (_fields[1] != _firmware->size())
+			return fail(DEVICEIO_DECODER_FORMAT);
+		if (!checkSource(_fields[0], _fields[2]))
+			return false;
+		_sourceSize = _fields[0];
+		_sourcePos = 0;
+		_field = 0;
+		_state = PATCH_CONTROL;
+		return true;
+	}
+
+	if (_field < 3)
+		return true;
+	_field = 0;
+	if (_fields[0] > _sourceSize - _sourcePos)
+		return fail(DEVICEIO_DECODER_FORMAT);
+	_remaining = _fields[0];
+	_extra = _fields[1];
+	_seek = (int32_t)(_fields[2] >> 1) ^ -(int32_t)(_fields[2] & 1);
+	_state = PATCH_DIFF;
+
+	// an empty diff goes straight to the extra bytes
+	if (_remaining == 0)
+	{
+		_remaining = _extra;
+		_state = PATCH_EXTRA;
+	}
+	return true;
+}
+
+// running image bytes plus the patch bytes
+bool DeviceIOImageDecoder::diff(const uint8_t *data, size_t len)
+{
+uint8_t image[DEVICEIO_DECODER_BUFFER];
+size_t done = 0;
+size_t n, i, at;
+
+	while (done < len)
+	{
+		if ((_sourcePos < _sourceStart) || (_sourcePos >= _sourceStart + _sourceLen))
+		{
+			if (!readSource(_sourcePos))
+				return false;
+		}
+		at = _sourcePos - _sourceStart;
+		n = _sourceLen - at;
+		if (n > len - done)
+			n = len - done;
+		for (i = 0; i < n; i++)
+			image[i] = _source[at + i] + data[done + i];
+		if (_firmware->write(image, n) != n)
+			return fail(DEVICEIO_DECODER_WRITE);
+		_sourcePos += n;
+		done += n;
+	}
+	return true;
+}
+
+// the running image is the one the patch was made from
+bool DeviceIOImageDecoder::checkSource(uint32_t size, uint32_t crc)
+{
+uint32_t offset = 0;
+uint32_t sum = 0;
+uint32_t n;
+
+	while (offset < size)
+	{
+		if (!readSource(offset))
+			return false;
+		n = _sourceLen;
+		if (n > size - offset)
+			n = size - offset;
+		sum = DeviceIOCRC32::update(sum, _source, n);
+		offset += n;
+	}
+	// diff() reads from the start again
+	_sourceLen = 0;
+	if (sum != crc)
+		return fail(DEVICEIO_DECODER_SOURCE);
+	return true;
+}
+
+bool DeviceIOImageDecoder::readSource(uint32_t offset)
+{
+	// whole words, the bytes past the source are never used
+	_sourceStart = offset & ~(uint32_t)3;
+	_sourceLen = DEVICEIO_DECODER_BUFFER;
+
+	#if DEVICEIO_OTA_RESUME
+		const esp_partition_t *running = esp_ota_get_running_partition();
+		if (_sourceStart + _sourceLen > running->size)
+			_sourceLen = running->size - _sourceStart;
+		if (esp_partition_read(running, _sourceStart, _source, _sourceLen) != ESP_OK)
+		{
+			_sourceLen = 0;
+			return fail(DEVICEIO_DECODER_SOURCE);
+		}
+	#else
+		// the sketch starts at flash address 0
+		if (!ESP.flashRead(_sourceStart, (uint32_t *)_source, _sourceLen))
+		{
+			_sourceLen = 0;
+			return fail(DEVICEIO_DECODER_SOURCE);
+		}
+	#endif
+	return true;
+}
@@ -0,0 +1,133 @@
+// DeviceIOImageDecoder.h
+// Streaming decoder between a firmware download and DeviceIOFirmware
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// A firmware response is the raw image, or smaller: compressed with
+// heatshrink (Content-Encoding: heatshrink), a patch against the image
+// that is running now, or a compressed patch. write() takes the body as
+// it arrives and hands the image bytes to DeviceIOFirmware, nothing
+// bigger than the heatshrink window and two small buffers is held.
+//
+// heatshrink is LZSS over a bit stream, most significant bit first:
+//
+//   1 <8 bits>                          a literal byte
+//   0 <window bits> <lookahead bits>    distance - 1 and count - 1, copies
+//                                       count bytes from distance back
+//
+// with window and lookahead sizes DEVICEIO_HEATSHRINK_WINDOW and
+// DEVICEIO_HEATSHRINK_LOOKAHEAD (heatshrink -w 11 -l 4). The window
+// holds the last 2^window bytes of output.
+//
+// A patch is an interleaved bsdiff stream, varints as in
+// DeviceIOBinaryEncoder:
+//
+//   "DIOP"              magic
+//   varint  source      bytes of the running image the patch reads
+//   varint  target      bytes of the new image
+//   varint  crc         CRC-32 of the source bytes (DeviceIOCRC32)
+//   until target bytes are written:
+//     varint  diff      bytes made from the running image
+//     varint  extra     bytes sent as they are
+//     varint  seek      zigzag, moves the read position in the running image
+//     diff bytes        added to the running image byte by byte
+//     extra bytes
+//
+// Most of a new build is the old one with moved addresses, the diff
+// bytes are then mostly zero and compress well. A body that doesn't
+// start with the magic is the image itself. Before the first byte is
+// written the running image is read once to check the crc, a build of
+// the same size that isn't the one the patch was made from is refused.
+
+#ifndef DeviceIOImageDecoder_h
+#define DeviceIOImageDecoder_h
+
+#include <Arduino.h>
+#include "DeviceIOFirmware.h"
+
+// both are offered to the server unless defined as 0
+#ifndef DEVICEIO_OTA_HEATSHRINK
+	#define DEVICEIO_OTA_HEATSHRINK 		1
+#endif
+#ifndef DEVICEIO_OTA_PATCH
+	#define DEVICEIO_OTA_PATCH 				1
+#endif
+
+// 2^11 = 2 KB window, matches of up to 2^4 = 16 bytes
+#ifndef DEVICEIO_HEATSHRINK_WINDOW
+	#define DEVICEIO_HEATSHRINK_WINDOW 		11
+#endif
+#ifndef DEVICEIO_HEATSHRINK_LOOKAHEAD
+	#define DEVICEIO_HEATSHRINK_LOOKAHEAD 	4
+#endif
+
+#define DEVICEIO_PATCH_MAGIC 				"DIOP"
+#define DEVICEIO_DECODER_BUFFER 			256		// decoded bytes and running image bytes
+
+// getError() values
+#define DEVICEIO_DECODER_OK 				0
+#define DEVICEIO_DECODER_MEMORY 			1
+#define DEVICEIO_DECODER_FORMAT 			2	// not a patch or a damaged one
+#define DEVICEIO_DECODER_SOURCE 			3	// the patch is for another image
+#define DEVICEIO_DECODER_WRITE 				4	// DeviceIOFirmware refused the bytes
+
+class DeviceIOImageDecoder
+{
+public:
+	DeviceIOImageDecoder() {}
+	~DeviceIOImageDecoder() { end(); }
+
+	// a new body for firmware, patch false when it can only be the image,
+	// e.g. the rest of one after a Range request
+	bool 				begin(DeviceIOFirmware &firmware, bool heatshrink, bool patch);
+	bool 				write(const uint8_t *data, size_t len);
+	// frees the buffers
+	void 				end(void);
+
+	bool 				patching(void) const 		{ return _stage == STAGE_PATCH; }
+	uint8_t 			getError(void) const 		{ return _error; }
+
+private:
+	enum Stage 			{ STAGE_DETECT, STAGE_IMAGE, STAGE_PATCH };
+	enum PatchState 	{ PATCH_MAGIC, PATCH_HEADER, PATCH_CONTROL, PATCH_DIFF, PATCH_EXTRA };
+
+	bool 				inflate(const uint8_t *data, size_t len);
+	bool 				decoded(const uint8_t *data, size_t len);
+	bool 				patch(const uint8_t *data, size_t len);
+	bool 				control(void);
+	bool 				diff(const uint8_t *data, size_t len);
+	bool 				readSource(uint32_t offset);
+	bool 				checkSource(uint32_t size, uint32_t crc);
+	bool 				fail(uint8_t error);
+
+	DeviceIOFirmware *	_firmware 		= nullptr;
+	uint8_t *			_memory 		= nullptr;	// window, output and source buffers, while running
+	uint8_t 			_error 			= DEVICEIO_DECODER_OK;
+	Stage 				_stage 			= STAGE_IMAGE;
+
+	// heatshrink
+	bool 				_heatshrink 	= false;
+	uint8_t *			_window 		= nullptr;
+	uint32_t 			_windowPos 		= 0;
+	uint32_t 			_bits 			= 0;		// not yet decoded, low _bitCount bits
+	uint8_t 			_bitCount 		= 0;
+	uint8_t *			_out 			= nullptr;
+	size_t 				_outLen 		= 0;
+
+	// patch
+	PatchState 			_state 			= PATCH_MAGIC;
+	uint32_t 			_fields[3];
+	uint8_t 			_field 			= 0;
+	uint32_t 			_varint 		= 0;
+	uint8_t 			_shift 			= 0;
+	uint32_t 			_sourceSize 	= 0;
+	uint32_t 			_sourcePos 		= 0;
+	uint32_t 			_remaining 		= 0;		// of the current diff or extra
+	uint32_t 			_extra 			= 0;
+	int32_t 			_seek 			= 0;
+	uint8_t *			_source 		= nullptr;	// running image bytes from _sourceStart
+	uint32_t 			_sourceStart 	= 0;
+	uint32_t 			_sourceLen 		= 0;
+};
+
+#endif
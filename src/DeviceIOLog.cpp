@@ -0,0 +1,184 @@
+// DeviceIOLog.cpp
+// Deferred binary log for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOLog.h"
+// DEVICE_IO_BUILD_NUMBER
+#include "DeviceIO.h"
+
+#if DEVICEIO_LOG_LEVEL > DEVICEIO_LOG_NONE
+
+static const char _DeviceIO_logLevels[] = "?EWID";
+
+uintptr_t DeviceIOLog::pack(float value)
+{
+uint32_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	return (uintptr_t)bits;
+}
+
+void DeviceIOLog::push(const DeviceIOLogRecord &record)
+{
+	_records.push(record);
+}
+
+bool DeviceIOLog::pop(DeviceIOLogRecord &record)
+{
+	#if DEVICEIO_BACKGROUND
+		return _records.pop(record);
+	#else
+		if (_records.empty())
+			return false;
+		record = _records[0];
+		_records.popFront(1);
+		return true;
+	#endif
+}
+
+bool DeviceIOLog::read(char *line, size_t size)
+{
+DeviceIOLogRecord record;
+
+	if (!pop(record))
+		return false;
+	format(record, line, size);
+	return true;
+}
+
+void DeviceIOLog::drain(HardwareSerial &out)
+{
+int room;
+
+	for (;;)
+	{
+		if (_linePrinted == _lineLength)
+		{
+			if (!read(_line, DEVICEIO_LOG_LINE))
+				return;
+			_lineLength = strlen(_line);
+			_line[_lineLength++] = '\r';
+			_line[_lineLength++] = '\n';
+			_linePrinted = 0;
+		}
+
+		// a line may take several calls
+		room = out.availableForWrite();
+		if (room <= 0)
+			return;
+		if ((size_t)room > _lineLength - _linePrinted)
+			room = (int)(_lineLength - _linePrinted);
+		_linePrinted += out.write((const uint8_t *)_line + _linePrinted, room);
+	}
+}
+
+void DeviceIOLog::flush(HardwareSerial &out)
+{
+	// the rest of a line drain() started
+	if (_linePrinted < _lineLength)
+		out.write((const uint8_t *)_line + _linePrinted, _lineLength - _linePrinted);
+	_lineLength = _linePrinted = 0;
+
+	while (read(_line, DEVICEIO_LOG_LINE))
+		out.println(_line);
+	out.flush();
+}
+
+// "(DeviceIO b12 I 123456) " and the format with the arguments in
+size_t DeviceIOLog::format(const DeviceIOLogRecord &record, char *line, size_t size)
+{
+char format[DEVICEIO_LOG_LINE];
+char spec[12];
+char text[DEVICEIO_LOG_LINE];
+size_t length, specLength;
+uint8_t arg = 0;
+uintptr_t value;
+uint32_t bits;
+float real;
+bool isLong;
+int n;
+const char *p;
+
+	if (size == 0)
+		return 0;
+	n = snprintf_P(line, size, PSTR("(DeviceIO b%d %c %lu) "), DEVICE_IO_BUILD_NUMBER, \
+		_DeviceIO_logLevels[(record.level <= DEVICEIO_LOG_DEBUG) ? record.level : 0], record.ms);
+	length = ((n > 0) && ((size_t)n < size)) ? (size_t)n : size - 1;
+
+	strncpy_P(format, record.format, sizeof(format) - 1);
+	format[sizeof(format) - 1] = 0;
+
+	for (p = format; (*p != 0) && (length + 1 < size); p++)
+	{
+		if (*p != '%')
+		{
+			line[length++] = *p;
+			continue;
+		}
+
+		// flags, width, precision and length up to the conversion
+		specLength = 0;
+		isLong = false;
+		spec[specLength++] = *p++;
+		while ((*p != 0) && (strchr("-+ #0123456789.lh", *p) != nullptr) && (specLength < sizeof(spec) - 2))
+		{
+			if (*p == 'l')
+				isLong = true;
+			spec[specLength++] = *p++;
+		}
+		if (*p == 0)
+			break;
+		spec[specLength++] = *p;
+		spec[specLength] = 0;
+
+		if (*p == '%')
+		{
+			line[length++] = '%';
+			continue;
+		}
+		value = (arg < record.argc) ? record.args[arg] : 0;
+		arg++;
+
+		switch (*p)
+		{
+			case 'd':
+			case 'i':
+			case 'c':
+				n = isLong ? snprintf(line + length, size - length, spec, (long)(intptr_t)value) : \
+							 snprintf(line + length, size - length, spec, (int)(intptr_t)value);
+				break;
+			case 'u':
+			case 'x':
+			case 'X':
+				n = isLong ? snprintf(line + length, size - length, spec, (unsigned long)value) : \
+							 snprintf(line + length, size - length, spec, (unsigned int)value);
+				break;
+			case 'f':
+				bits = (uint32_t)value;
+				memcpy(&real, &bits, sizeof(real));
+				n = snprintf(line + length, size - length, spec, (double)real);
+				break;
+			case 's':
+				// in flash on the ESP8266
+				text[0] = 0;
+				if (value != 0)
+				{
+					strncpy_P(text, (PGM_P)value, sizeof(text) - 1);
+					text[sizeof(text) - 1] = 0;
+				}
+				n = snprintf(line + length, size - length, spec, text);
+				break;
+			default:
+				n = snprintf(line + length, size - length, "%s", spec);
+				break;
+		}
+		if (n > 0)
+			length += ((size_t)n < size - length) ? (size_t)n : size - length - 1;
+	}
+
+	line[length] = 0;
+	return length;
+}
+
+#endif
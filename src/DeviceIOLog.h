@@ -0,0 +1,154 @@
+// DeviceIOLog.h
+// Deferred binary log for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// A log call stores a record of the format string's address, its
+// arguments and millis() in a fixed ring; nothing is formatted and
+// nothing is printed at that point, so logging never allocates and
+// never waits for the UART. The line is built when the record is read:
+// read() fetches it on demand, drain() prints the records that fit in
+// the serial transmit FIFO and leaves the rest for the next call.
+//
+// The DEVICEIO_LOG_E/W/I/D macros compile to nothing above
+// DEVICEIO_LOG_LEVEL, format strings included. Formats are printf
+// style with %d %i %u %x %X %c %f %s and the l modifier, at most
+// DEVICEIO_LOG_ARGS arguments. A %s argument must outlive the record,
+// a PSTR() or a string constant, never a String's c_str().
+//
+// With DEVICEIO_BACKGROUND any task can log and a full log drops the
+// new record; without it a full log overwrites the oldest. dropped()
+// counts both. At DEVICEIO_LOG_NONE the log keeps no records and
+// takes no RAM.
+
+#ifndef DeviceIOLog_h
+#define DeviceIOLog_h
+
+#include <Arduino.h>
+#include "DeviceIORingBuffer.h"
+#include "DeviceIOWorker.h"
+#if DEVICEIO_BACKGROUND
+	#include "DeviceIOSampleQueue.h"
+#endif
+
+#define DEVICEIO_LOG_NONE 		0
+#define DEVICEIO_LOG_ERROR 		1
+#define DEVICEIO_LOG_WARN 		2
+#define DEVICEIO_LOG_INFO 		3
+#define DEVICEIO_LOG_DEBUG 		4
+
+// records below this level are compiled out
+#ifndef DEVICEIO_LOG_LEVEL
+	#define DEVICEIO_LOG_LEVEL 		DEVICEIO_LOG_INFO
+#endif
+// records, a power of two
+#ifndef DEVICEIO_LOG_CAPACITY
+	#define DEVICEIO_LOG_CAPACITY 	32
+#endif
+#define DEVICEIO_LOG_ARGS 		6
+// a formatted line, longer ones are cut
+#define DEVICEIO_LOG_LINE 		128
+
+#if DEVICEIO_LOG_LEVEL >= DEVICEIO_LOG_ERROR
+	#define DEVICEIO_LOG_E(log, format, ...) 	(log).write(DEVICEIO_LOG_ERROR, PSTR(format), ##__VA_ARGS__)
+#else
+	#define DEVICEIO_LOG_E(log, format, ...) 	do {} while (0)
+#endif
+#if DEVICEIO_LOG_LEVEL >= DEVICEIO_LOG_WARN
+	#define DEVICEIO_LOG_W(log, format, ...) 	(log).write(DEVICEIO_LOG_WARN, PSTR(format), ##__VA_ARGS__)
+#else
+	#define DEVICEIO_LOG_W(log, format, ...) 	do {} while (0)
+#endif
+#if DEVICEIO_LOG_LEVEL >= DEVICEIO_LOG_INFO
+	#define DEVICEIO_LOG_I(log, format, ...) 	(log).write(DEVICEIO_LOG_INFO, PSTR(format), ##__VA_ARGS__)
+#else
+	#define DEVICEIO_LOG_I(log, format, ...) 	do {} while (0)
+#endif
+#if DEVICEIO_LOG_LEVEL >= DEVICEIO_LOG_DEBUG
+	#define DEVICEIO_LOG_D(log, format, ...) 	(log).write(DEVICEIO_LOG_DEBUG, PSTR(format), ##__VA_ARGS__)
+#else
+	#define DEVICEIO_LOG_D(log, format, ...) 	do {} while (0)
+#endif
+
+struct DeviceIOLogRecord
+{
+	unsigned long 	ms;
+	PGM_P 			format;
+	uint8_t 		level;
+	uint8_t 		argc;
+	uintptr_t 		args[DEVICEIO_LOG_ARGS];	// integers, float bits or string addresses
+};
+
+#if DEVICEIO_LOG_LEVEL > DEVICEIO_LOG_NONE
+
+class DeviceIOLog
+{
+public:
+	DeviceIOLog() {}
+
+	// use the DEVICEIO_LOG_* macros, format must be a PSTR()
+	template <typename... Args>
+	void write(uint8_t level, PGM_P format, Args... args)
+	{
+		static_assert(sizeof...(Args) <= DEVICEIO_LOG_ARGS, "too many DeviceIOLog arguments");
+		// the leading 0 keeps the array from being empty
+		uintptr_t packed[] = { 0, pack(args)... };
+		DeviceIOLogRecord record;
+
+		record.ms = millis();
+		record.format = format;
+		record.level = level;
+		record.argc = (uint8_t)sizeof...(Args);
+		for (uint8_t i = 0; i < record.argc; i++)
+			record.args[i] = packed[i + 1];
+		push(record);
+	}
+
+	// the oldest record as a line without the line end, false when there is none.
+	// a single reader: drain() or read(), not both
+	bool 				read(char *line, size_t size);
+	// prints whole lines while out has room for them, never waits
+	void 				drain(HardwareSerial &out);
+	// prints every record, waits for the UART. before a restart
+	void 				flush(HardwareSerial &out);
+
+	uint32_t 			dropped(void) const 	{ return _records.dropped(); }
+
+private:
+	template <typename T>
+	static uintptr_t 	pack(T value) 			{ return (uintptr_t)(intptr_t)value; }
+	static uintptr_t 	pack(double value) 		{ return pack((float)value); }
+	static uintptr_t 	pack(float value);
+	static uintptr_t 	pack(const char *value) { return (uintptr_t)value; }
+	static uintptr_t 	pack(const __FlashStringHelper *value) 	{ return (uintptr_t)value; }
+
+	void 				push(const DeviceIOLogRecord &record);
+	bool 				pop(DeviceIOLogRecord &record);
+	static size_t 		format(const DeviceIOLogRecord &record, char *line, size_t size);
+
+	#if DEVICEIO_BACKGROUND
+		DeviceIOSampleQueue<DeviceIOLogRecord, DEVICEIO_LOG_CAPACITY> _records;
+	#else
+		DeviceIORingBuffer<DeviceIOLogRecord, DEVICEIO_LOG_CAPACITY> _records;
+	#endif
+
+	// the line drain() is printing
+	char 				_line[DEVICEIO_LOG_LINE + 2];
+	size_t 				_lineLength 	= 0;
+	size_t 				_linePrinted 	= 0;
+};
+
+#else
+
+class DeviceIOLog
+{
+public:
+	bool 				read(char *, size_t) 		{ return false; }
+	void 				drain(HardwareSerial &) 	{}
+	void 				flush(HardwareSerial &) 	{}
+	uint32_t 			dropped(void) const 		{ return 0; }
+};
+
+#endif
+
+#endif
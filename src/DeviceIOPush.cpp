@@ -0,0 +1,211 @@
+// DeviceIOPush.cpp
+// Long-poll push channel for server directives between check-ins
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOPush.h"
+
+DeviceIOPush::DeviceIOPush(DeviceIODirectives &directives)
+	: _parser(directives)
+{
+}
+
+bool DeviceIOPush::ready(unsigned long nowMs)
+{
+	if ((_state == STATE_RETRY) && _retry.due(nowMs))
+		_state = STATE_IDLE;
+	return _state == STATE_IDLE;
+}
+
+bool DeviceIOPush::send(const char *host, const String &url, uint16_t holdS, unsigned long nowMs)
+{
+String request;
+
+	_client = _connection.stream(host);
+	if (_client == nullptr)
+	{
+		fail(nowMs, 0);
+		return false;
+	}
+
+	request = "GET " + url + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: keep-alive\r\n\r\n";
+	if (_client->print(request) != request.length())
+	{
+		fail(nowMs, 0);
+		return false;
+	}
+
+	requests++;
+	_state = STATE_HEAD;
+	_sentMs = nowMs;
+	_holdMs = (uint32_t)holdS * 1000;
+	_code = 0;
+	_remaining = -1;
+	_closeAfter = false;
+	_retryAfterMs = 0;
+	_length = 0;
+	return true;
+}
+
+bool DeviceIOPush::receive(unsigned long nowMs)
+{
+uint8_t buffer[64];
+size_t i, n, body;
+int available, got;
+
+	if (!listening())
+		return false;
+
+	while (listening() && ((available = _client->available()) > 0))
+	{
+		n = ((size_t)available < sizeof(buffer)) ? (size_t)available : sizeof(buffer);
+		if ((_state == STATE_BODY) && (_remaining >= 0) && ((size_t)_remaining < n))
+			n = (size_t)_remaining;
+		// -1 when the TLS client failed, the connection is gone
+		got = _client->read(buffer, n);
+		if (got < 0)
+		{
+			fail(nowMs, 0);
+			return false;
+		}
+		if (got == 0)
+			break;
+		n = (size_t)got;
+
+		for (i = 0; (i < n) && (_state == STATE_HEAD); i++)
+		{
+			if (buffer[i] == '\r')
+				continue;
+			if (buffer[i] != '\n')
+			{
+				if (_length < DEVICEIO_PUSH_LINE)
+					_line[_length++] = (char)buffer[i];
+				continue;
+			}
+			if (!headerLine(nowMs))
+				return false;
+		}
+
+		// the rest of the buffer is body
+		if ((_state != STATE_BODY) || (i == n))
+		{
+			if ((_state == STATE_BODY) && (_remaining == 0))
+				return endReply(nowMs);
+			continue;
+		}
+		body = n - i;
+		if ((_remaining >= 0) && ((size_t)_remaining < body))
+			body = (size_t)_remaining;
+		_parser.write(buffer + i, body);
+		if (_remaining >= 0)
+		{
+			_remaining -= body;
+			if (_remaining == 0)
+				return endReply(nowMs);
+		}
+	}
+
+	if (!_connection.connected())
+	{
+		// a body without a length ends with the connection
+		if ((_state == STATE_BODY) && (_remaining < 0))
+		{
+			_closeAfter = true;
+			return endReply(nowMs);
+		}
+		fail(nowMs, 0);
+		return false;
+	}
+	if ((uint32_t)(nowMs - _sentMs) > _holdMs + DEVICEIO_PUSH_GRACE_MS)
+		fail(nowMs, 0);
+	return false;
+}
+
+bool DeviceIOPush::headerLine(unsigned long nowMs)
+{
+char *value;
+
+	_line[_length] = 0;
+	_length = 0;
+
+	// "HTTP/1.1 200 OK"
+	if (_code == 0)
+	{
+		value = strchr(_line, ' ');
+		_code = (value != nullptr) ? atoi(value + 1) : 0;
+		if (_code > 0)
+			return true;
+		fail(nowMs, 0);
+		return false;
+	}
+
+	if (_line[0] != 0)
+	{
+		value = strchr(_line, ':');
+		if (value == nullptr)
+			return true;
+		*value++ = 0;
+		while (*value == ' ')
+			value++;
+		if (strcasecmp(_line, "Content-Length") == 0)
+			_remaining = atol(value);
+		else if (strcasecmp(_line, "Connection") == 0)
+			_closeAfter = (strcasecmp(value, "close") == 0);
+		else if (strcasecmp(_line, "Retry-After") == 0)
+			_retryAfterMs = DeviceIOCheckInSchedule::hintMs(value);
+		else if ((strcasecmp(_line, "Transfer-Encoding") == 0) && (strcasecmp(value, "chunked") == 0))
+		{
+			// the server sends listen replies with a length
+			fail(nowMs, 0);
+			return false;
+		}
+		return true;
+	}
+
+	// the blank line after the headers
+	if ((_code == 400) || (_code == 404))
+	{
+		// no cmd=listen on this server, the check-ins carry the directives
+		close();
+		_state = STATE_OFF;
+		return false;
+	}
+	if (_code != 200)
+	{
+		fail(nowMs, _retryAfterMs);
+		return false;
+	}
+	_state = STATE_BODY;
+	_parser.begin(_code);
+	return true;
+}
+
+bool DeviceIOPush::endReply(unsigned long nowMs)
+{
+	_parser.end();
+	replies++;
+	lastReplyMs = nowMs;
+	// the back-off starts over
+	_retry.begin(nowMs, 0);
+	_state = STATE_IDLE;
+	if (_closeAfter)
+		close();
+	return true;
+}
+
+void DeviceIOPush::fail(unsigned long nowMs, uint32_t hintMs)
+{
+	close();
+	failures++;
+	_state = STATE_RETRY;
+	// failed() waits an eighth of the interval, doubling with each failure
+	_retry.failed(nowMs, DEVICEIO_PUSH_RETRY_MS * 8, hintMs);
+}
+
+void DeviceIOPush::close(void)
+{
+	_connection.close();
+	_client = nullptr;
+	if (listening())
+		_state = STATE_IDLE;
+}
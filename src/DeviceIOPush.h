@@ -0,0 +1,104 @@
+// DeviceIOPush.h
+// Long-poll push channel for server directives between check-ins
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// Without it a directive the server queues for a device, a REBOOT or a
+// new BUILD, waits for the next check-in, up to checkinInterval later.
+// With it the device keeps its own TLS connection to the DeviceIO host
+// between check-ins, with one listen request outstanding:
+//
+//   GET /manage-device?cmd=listen&prodID=..&prodIDpass=..&token=..&build=12&hold=120
+//
+// The server holds the request until it has directives for the device,
+// or for hold seconds, and answers like a checkin: the status and count
+// lines, then the directives. The next listen request goes out on the
+// same connection right away, so a directive arrives within a round
+// trip, and an idle device costs one small request every hold seconds
+// and no handshake. hold is the keepalive: keep it below the idle
+// timeout of the NATs and proxies on the way. A connection that hasn't
+// answered within hold plus DEVICEIO_PUSH_GRACE_MS is dropped.
+//
+// receive() only reads what has arrived, only connecting blocks. A lost
+// connection is made again after a random wait that doubles with each
+// failure in a row, as check-ins back off (DeviceIOCheckInSchedule), and
+// a 503's Retry-After is honoured. A server without cmd=listen answers
+// 400 or 404, then the channel stays off until the next restart. The
+// check-ins go on at their interval either way, without the channel
+// directives arrive with them as before.
+
+#ifndef DeviceIOPush_h
+#define DeviceIOPush_h
+
+#include <Arduino.h>
+#include "DeviceIOConnection.h"
+#include "DeviceIODirectives.h"
+#include "DeviceIOCheckInSchedule.h"
+
+// seconds the server holds a listen request, sketches can change pushHoldS
+#ifndef DEVICEIO_PUSH_HOLD_S
+	#define DEVICEIO_PUSH_HOLD_S 		120
+#endif
+// on top of hold, for the reply to arrive
+#ifndef DEVICEIO_PUSH_GRACE_MS
+	#define DEVICEIO_PUSH_GRACE_MS 		(15UL * 1000)
+#endif
+// longest wait before the first reconnect, it doubles with each failure
+#ifndef DEVICEIO_PUSH_RETRY_MS
+	#define DEVICEIO_PUSH_RETRY_MS 		(30UL * 1000)
+#endif
+// the status line and the headers are read a line at a time, longer ones are cut
+#define DEVICEIO_PUSH_LINE 				48
+
+class DeviceIOPush
+{
+public:
+	DeviceIOPush(DeviceIODirectives &directives);
+
+	DeviceIOConnection &connection(void) 		{ return _connection; }
+
+	// the next listen request can go out, false while one is outstanding,
+	// while waiting to reconnect and on a server without cmd=listen
+	bool 				ready(unsigned long nowMs);
+	// connects if needed and sends the listen request for url, false when it failed
+	bool 				send(const char *host, const String &url, uint16_t holdS, unsigned long nowMs);
+	// reads what has arrived, true when a reply has been read and its directives dispatched
+	bool 				receive(unsigned long nowMs);
+	// closes the connection, the next request reconnects at once
+	void 				close(void);
+
+	// a listen request is outstanding
+	bool 				listening(void) const 		{ return (_state == STATE_HEAD) || (_state == STATE_BODY); }
+	bool 				supported(void) const 		{ return _state != STATE_OFF; }
+
+	// statistics since boot
+	uint32_t 			requests 		= 0;
+	uint32_t 			replies 		= 0;	// 200s, with or without directives
+	uint32_t 			failures 		= 0;	// connections that failed or were lost
+	unsigned long 		lastReplyMs 	= 0;	// millis() of the last reply
+
+private:
+	enum State 			{ STATE_IDLE, STATE_RETRY, STATE_HEAD, STATE_BODY, STATE_OFF };
+
+	void 				fail(unsigned long nowMs, uint32_t hintMs);
+	// a line of the status and headers, false when the reply can't be used
+	bool 				headerLine(unsigned long nowMs);
+	bool 				endReply(unsigned long nowMs);
+
+	DeviceIOConnection 	_connection;
+	DeviceIOTLSClient *	_client 		= nullptr;	// _connection's, while it is open
+	DeviceIODirectiveParser _parser;
+	// when to reconnect
+	DeviceIOCheckInSchedule _retry;
+	State 				_state 			= STATE_IDLE;
+	unsigned long 		_sentMs 		= 0;
+	uint32_t 			_holdMs 		= 0;
+	int 				_code 			= 0;
+	long 				_remaining 		= -1;	// body bytes, -1 until the connection closes
+	bool 				_closeAfter 	= false;
+	uint32_t 			_retryAfterMs 	= 0;
+	char 				_line[DEVICEIO_PUSH_LINE + 1];
+	uint8_t 			_length 		= 0;
+};
+
+#endif
@@ -0,0 +1,78 @@
+// DeviceIORingBuffer.h
+// Fixed capacity ring buffer for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// Holds plain-old-data elements in a static array. When full, a push
+// overwrites the oldest element in O(1) and counts it as dropped.
+// Element 0 is always the oldest element.
+
+#ifndef DeviceIORingBuffer_h
+#define DeviceIORingBuffer_h
+
+#include <stdint.h>
+
+template <typename T, uint16_t N>
+class DeviceIORingBuffer
+{
+public:
+	static_assert(N > 0, "DeviceIORingBuffer capacity must be at least 1");
+	typedef T value_type;
+
+	DeviceIORingBuffer() : _head(0), _count(0), _dropped(0) {}
+
+	uint16_t 		capacity(void) const { return N; }
+	uint16_t 		size(void) const { return _count; }
+	bool 			empty(void) const { return _count == 0; }
+	bool 			full(void) const { return _count == N; }
+	// elements overwritten since construction
+	uint32_t 		dropped(void) const { return _dropped; }
+
+	// returns false when the oldest element had to be overwritten
+	bool push(const T &item)
+	{
+		if (_count == N)
+		{
+			_items[_head] = item;
+			_head = next(_head);
+			_dropped++;
+			return false;
+		}
+		_items[wrap(_head + _count)] = item;
+		_count++;
+		return true;
+	}
+
+	// index 0 is the oldest element, no bounds check
+	T &operator[](uint16_t i) { return _items[wrap(_head + i)]; }
+	const T &operator[](uint16_t i) const { return _items[wrap(_head + i)]; }
+
+	// drop the oldest count elements
+	void popFront(uint16_t count)
+	{
+		if (count >= _count)
+		{
+			clear();
+			return;
+		}
+		_head = wrap(_head + count);
+		_count -= count;
+	}
+
+	void clear(void)
+	{
+		_head = 0;
+		_count = 0;
+	}
+
+private:
+	static uint16_t wrap(uint32_t i) { return (uint16_t)(i >= N ? i - N : i); }
+	static uint16_t next(uint16_t i) { return wrap((uint32_t)i + 1); }
+
+	T 				_items[N];
+	uint16_t 		_head;
+	uint16_t 		_count;
+	uint32_t 		_dropped;
+};
+
+#endif
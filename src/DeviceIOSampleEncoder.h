@@ -0,0 +1,135 @@
+// DeviceIOSampleEncoder.h
+// Streaming form encoder for DeviceIO sensor uploads
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// Produces the cmd=sensor POST body
+//   &sensor[i][datetime]=...&sensor[i][sensornum]=...&sensor[i][sensorval]=...
+// one sample at a time through a fixed scratch buffer, so HTTPClient
+// can stream it straight into the TLS client. Nothing is allocated
+// and the extra RAM does not depend on the batch size.
+//
+// HTTPClient cannot send a chunked request body, so the body length
+// is computed up front with a dry encoding pass (see size()).
+
+#ifndef DeviceIOSampleEncoder_h
+#define DeviceIOSampleEncoder_h
+
+#include <Arduino.h>
+#include <time.h>
+
+template <class Buffer>
+class DeviceIOSampleEncoder : public Stream
+{
+public:
+	// encodes the first count samples of the buffer, the buffer must not change meanwhile
+	DeviceIOSampleEncoder(const Buffer &samples, uint16_t count)
+		: _samples(samples), _count(count), _next(0), _len(0), _pos(0), _size(0), _sent(0)
+	{
+		for (uint16_t i = 0; i < _count; i++)
+			_size += encode(i, _scratch);
+	}
+
+	// total body length in bytes
+	size_t 			size(void) const { return _size; }
+
+	int available(void) override
+	{
+		size_t remaining = _size - _sent;
+		return remaining > 0x7fff ? 0x7fff : (int)remaining;
+	}
+
+	int read(void) override
+	{
+		if (!fill()) return -1;
+		_sent++;
+		return (uint8_t)_scratch[_pos++];
+	}
+
+	int peek(void) override
+	{
+		if (!fill()) return -1;
+		return (uint8_t)_scratch[_pos];
+	}
+
+	size_t readBytes(char *buffer, size_t length) override
+	{
+		size_t copied = 0;
+		while (copied < length && fill())
+		{
+			size_t n = _len - _pos;
+			if (n > length - copied) n = length - copied;
+			memcpy(buffer + copied, _scratch + _pos, n);
+			_pos += n;
+			copied += n;
+		}
+		_sent += copied;
+		return copied;
+	}
+
+	// read only
+	size_t write(uint8_t) override { return 0; }
+
+private:
+	// make sure the scratch buffer has unread bytes
+	bool fill(void)
+	{
+		if (_pos < _len) return true;
+		if (_next >= _count) return false;
+		_len = encode(_next++, _scratch);
+		_pos = 0;
+		return _len > 0;
+	}
+
+	// one sample, returns its length
+	uint8_t encode(uint16_t i, char *out)
+	{
+		const typename Buffer::value_type &sample = _samples[i];
+		const struct tm &sampletime = localTime(sample.epoch);
+		char numbuf[48];
+
+		// same rendering as String(float)
+		dtostrf(sample.sensorvalue, 4, 2, numbuf);
+
+		int n = snprintf_P(out, sizeof(_scratch), PSTR("&sensor[%u][datetime]=%d-%d-%d %d:%d:%d&sensor[%u][sensornum]=%u&sensor[%u][sensorval]=%s"),
+							i, sampletime.tm_year+1900, sampletime.tm_mon+1, sampletime.tm_mday,
+							sampletime.tm_hour, sampletime.tm_min, sampletime.tm_sec,
+							i, (unsigned int)sample.sensornumber,
+							i, numbuf);
+		if (n < 0) return 0;
+		return n >= (int)sizeof(_scratch) ? sizeof(_scratch) - 1 : (uint8_t)n;
+	}
+
+	// sql datetime format is "2020-11-25 01:50:34", local time. a sample
+	// taken before the clock was set keeps the historic all-zero date.
+	// consecutive samples often share a second, so the last one is cached
+	const struct tm &localTime(uint32_t epoch)
+	{
+		if (epoch != _lastEpoch || !_lastValid)
+		{
+			memset(&_lastTime, 0, sizeof(_lastTime));
+			if (epoch != 0)
+			{
+				time_t t = epoch;
+				localtime_r(&t, &_lastTime);
+			}
+			_lastEpoch = epoch;
+			_lastValid = true;
+		}
+		return _lastTime;
+	}
+
+	const Buffer &	_samples;
+	uint16_t 		_count;
+	uint16_t 		_next;
+	uint8_t 		_len;
+	uint8_t 		_pos;
+	size_t 			_size;
+	size_t 			_sent;
+	char 			_scratch[192];
+	uint32_t 		_lastEpoch = 0;
+	bool 			_lastValid = false;
+	struct tm 		_lastTime;
+};
+
+#endif
@@ -0,0 +1,99 @@
+// DeviceIOSampleQueue.h
+// Bounded lock-free sample queue for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// Multi-producer, single-consumer queue after Dmitry Vyukov's bounded
+// queue. Every cell carries a sequence number, so a producer claims a
+// cell with one compare-and-swap and never waits for another thread.
+// A push never blocks: with one producer it is wait-free, with several
+// a producer only retries when another one claimed the same cell first.
+// When the queue is full the new element is dropped and counted.
+//
+// Needs std::atomic with compare-and-swap, see DEVICEIO_BACKGROUND.
+
+#ifndef DeviceIOSampleQueue_h
+#define DeviceIOSampleQueue_h
+
+#include <stdint.h>
+#include <atomic>
+
+// the smallest power of two that holds n elements
+constexpr uint16_t DeviceIOSampleQueueCapacity(uint32_t n, uint32_t capacity = 2)
+{
+	return (capacity >= n) ? (uint16_t)capacity : DeviceIOSampleQueueCapacity(n, capacity * 2);
+}
+
+template <typename T, uint16_t N>
+class DeviceIOSampleQueue
+{
+public:
+	static_assert(N >= 2 && (N & (N - 1)) == 0, "DeviceIOSampleQueue capacity must be a power of two");
+	typedef T value_type;
+
+	DeviceIOSampleQueue() : _enqueuePos(0), _dropped(0), _dequeuePos(0)
+	{
+		for (uint32_t i = 0; i < N; i++)
+			_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	uint16_t 		capacity(void) const { return N; }
+	// elements refused because the queue was full
+	uint32_t 		dropped(void) const { return _dropped.load(std::memory_order_relaxed); }
+
+	// any thread, returns false when the queue is full
+	bool push(const T &item)
+	{
+		Cell *cell;
+		uint32_t pos = _enqueuePos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			cell = &_cells[pos & (N - 1)];
+			uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+			int32_t dif = (int32_t)(seq - pos);
+			if (dif == 0)
+			{
+				// the cell is free, claim it
+				if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else
+			if (dif < 0)
+			{
+				// the consumer has not emptied this cell yet
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			} else
+				pos = _enqueuePos.load(std::memory_order_relaxed);
+		}
+		cell->item = item;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer thread only, returns false when the queue is empty
+	bool pop(T &item)
+	{
+		Cell *cell = &_cells[_dequeuePos & (N - 1)];
+		uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+		if ((int32_t)(seq - (_dequeuePos + 1)) < 0)
+			return false;
+		item = cell->item;
+		cell->sequence.store(_dequeuePos + N, std::memory_order_release);
+		_dequeuePos++;
+		return true;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<uint32_t> sequence;
+		T 				item;
+	};
+
+	Cell 			_cells[N];
+	std::atomic<uint32_t> _enqueuePos;
+	std::atomic<uint32_t> _dropped;
+	uint32_t 		_dequeuePos;		// consumer only
+};
+
+#endif
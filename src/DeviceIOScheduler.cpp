@@ -0,0 +1,177 @@
+// DeviceIOScheduler.cpp
+// Periodic sensor channels for DeviceIO on a timer wheel
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOScheduler.h"
+
+DeviceIOScheduler::DeviceIOScheduler()
+{
+	memset(_channels, 0, sizeof(_channels));
+	memset(_slots, DEVICEIO_SCHEDULER_NONE, sizeof(_slots));
+	memset(_slotOf, DEVICEIO_SCHEDULER_NONE, sizeof(_slotOf));
+}
+
+bool DeviceIOScheduler::add(uint16_t sensornumber, uint32_t periodMs, DeviceIOSensorRead read, void *context, unsigned long nowMs)
+{
+uint8_t channel = DEVICEIO_SCHEDULER_NONE;
+
+	if ((read == nullptr) || (periodMs == 0))
+		return false;
+
+	// the sensor's channel, else a free one
+	for (uint8_t i = 0; i < DEVICEIO_SENSOR_CHANNELS; i++)
+	{
+		if ((_channels[i].read != nullptr) && (_channels[i].sensornumber == sensornumber))
+		{
+			channel = i;
+			unlink(i);
+			break;
+		}
+		if ((channel == DEVICEIO_SCHEDULER_NONE) && (_channels[i].read == nullptr))
+			channel = i;
+	}
+	if (channel == DEVICEIO_SCHEDULER_NONE)
+		return false;
+
+	if (!_started)
+	{
+		_tick = nowMs / DEVICEIO_SCHEDULER_TICK_MS;
+		_started = true;
+	}
+	_channels[channel].read = read;
+	_channels[channel].context = context;
+	_channels[channel].periodMs = periodMs;
+	_channels[channel].due = nowMs;
+	_channels[channel].sensornumber = sensornumber;
+	insert(channel, nowMs);
+	return true;
+}
+
+bool DeviceIOScheduler::remove(uint16_t sensornumber)
+{
+	for (uint8_t i = 0; i < DEVICEIO_SENSOR_CHANNELS; i++)
+	{
+		if ((_channels[i].read != nullptr) && (_channels[i].sensornumber == sensornumber))
+		{
+			unlink(i);
+			_channels[i].read = nullptr;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DeviceIOScheduler::setPeriod(uint16_t sensornumber, uint32_t periodMs, unsigned long nowMs)
+{
+unsigned long due;
+
+	if (periodMs == 0)
+		return false;
+
+	for (uint8_t i = 0; i < DEVICEIO_SENSOR_CHANNELS; i++)
+	{
+		if ((_channels[i].read != nullptr) && (_channels[i].sensornumber == sensornumber))
+		{
+			Channel &c = _channels[i];
+			due = c.due - c.periodMs + periodMs;
+			unlink(i);
+			c.periodMs = periodMs;
+			c.due = ((long)(due - nowMs) < 0) ? nowMs : due;
+			insert(i, nowMs);
+			return true;
+		}
+	}
+	return false;
+}
+
+uint8_t DeviceIOScheduler::run(unsigned long nowMs)
+{
+DeviceIOReading batch[DEVICEIO_SCHEDULER_BATCH];
+uint8_t count = 0;
+uint8_t total = 0;
+unsigned long target = nowMs / DEVICEIO_SCHEDULER_TICK_MS;
+// a millis() wrap or a long pause walks every slot once
+unsigned long ticks = target - _tick + 1;
+uint8_t channel, next;
+unsigned long late, missed;
+float value;
+
+	if (!_started)
+		return 0;
+	if (ticks > DEVICEIO_SCHEDULER_SLOTS)
+		ticks = DEVICEIO_SCHEDULER_SLOTS;
+	// the current tick is walked again next time, its later channels aren't due yet
+	_tick = target;
+
+	for (unsigned long t = target + 1 - ticks; t != target + 1; t++)
+	{
+		channel = _slots[t & (DEVICEIO_SCHEDULER_SLOTS - 1)];
+		while (channel != DEVICEIO_SCHEDULER_NONE)
+		{
+			Channel &c = _channels[channel];
+			next = c.next;
+			late = nowMs - c.due;
+			if ((long)late >= 0)
+			{
+				if (c.read(c.context, value))
+				{
+					batch[count].sensornumber = c.sensornumber;
+					batch[count].value = value;
+					if (++count == DEVICEIO_SCHEDULER_BATCH)
+					{
+						_output(_context, batch, count);
+						count = 0;
+					}
+					reads++;
+					total++;
+				}
+				if (late > maxLateMs)
+					maxLateMs = late;
+
+				// on the channel's own grid
+				missed = late / c.periodMs;
+				skipped += missed;
+				c.due += (missed + 1) * c.periodMs;
+				unlink(channel);
+				insert(channel, nowMs);
+			}
+			channel = next;
+		}
+	}
+	if (count > 0)
+		_output(_context, batch, count);
+	return total;
+}
+
+void DeviceIOScheduler::insert(uint8_t channel, unsigned long nowMs)
+{
+Channel &c = _channels[channel];
+unsigned long tick = _tick;
+uint8_t slot;
+
+	// due in a later tick, counted from the one run() walks next
+	if ((long)(c.due - nowMs) > 0)
+		tick = nowMs / DEVICEIO_SCHEDULER_TICK_MS + ((nowMs % DEVICEIO_SCHEDULER_TICK_MS) + (c.due - nowMs)) / DEVICEIO_SCHEDULER_TICK_MS;
+	if ((long)(tick - _tick) < 0)
+		tick = _tick;
+
+	slot = (uint8_t)(tick & (DEVICEIO_SCHEDULER_SLOTS - 1));
+	c.next = _slots[slot];
+	_slots[slot] = channel;
+	_slotOf[channel] = slot;
+}
+
+void DeviceIOScheduler::unlink(uint8_t channel)
+{
+uint8_t slot = _slotOf[channel];
+uint8_t *link;
+
+	if (slot == DEVICEIO_SCHEDULER_NONE)
+		return;
+	link = &_slots[slot];
+	while (*link != channel)
+		link = &_channels[*link].next;
+	*link = _channels[channel].next;
+	_slotOf[channel] = DEVICEIO_SCHEDULER_NONE;
+}
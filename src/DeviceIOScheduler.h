@@ -0,0 +1,93 @@
+// DeviceIOScheduler.h
+// Periodic sensor channels for DeviceIO on a timer wheel
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// A channel is a read callback, a sensor number and a period. Channels
+// hang in a wheel of DEVICEIO_SCHEDULER_SLOTS slots, one per tick of
+// DEVICEIO_SCHEDULER_TICK_MS, by the tick they are due in. run() only
+// walks the slots of the ticks that passed since the last call, so a
+// call costs about the same with 2 channels or 40, and a channel due
+// in a later turn of the wheel is skipped with one compare.
+//
+// The readings of one run() go to the output in batches of up to
+// DEVICEIO_SCHEDULER_BATCH. A channel's next reading is due one period
+// after the last due time, not after the call that read it, so the
+// rate doesn't drift with how often run() is called. Periods missed
+// while run() wasn't called are skipped, not read in a burst.
+
+#ifndef DeviceIOScheduler_h
+#define DeviceIOScheduler_h
+
+#include <Arduino.h>
+
+#ifndef DEVICEIO_SENSOR_CHANNELS
+	#define DEVICEIO_SENSOR_CHANNELS 	32
+#endif
+#ifndef DEVICEIO_SCHEDULER_TICK_MS
+	#define DEVICEIO_SCHEDULER_TICK_MS 	10
+#endif
+#define DEVICEIO_SCHEDULER_SLOTS 		64		// a power of two
+#define DEVICEIO_SCHEDULER_BATCH 		16
+#define DEVICEIO_SCHEDULER_NONE 		0xFF
+
+// false when there is no reading this time
+typedef bool (*DeviceIOSensorRead)(void *context, float &value);
+
+struct DeviceIOReading
+{
+	uint16_t 			sensornumber;
+	float 				value;
+};
+
+// receives the readings of the channels that were due together
+typedef void (*DeviceIOSchedulerOutput)(void *context, const DeviceIOReading *readings, uint8_t count);
+
+class DeviceIOScheduler
+{
+public:
+	DeviceIOScheduler();
+
+	void 				begin(DeviceIOSchedulerOutput output, void *context) 	{ _output = output; _context = context; }
+
+	// the first reading is due at once. a sensor number that has a channel
+	// gets the new period and read. false when all DEVICEIO_SENSOR_CHANNELS are taken
+	bool 				add(uint16_t sensornumber, uint32_t periodMs, DeviceIOSensorRead read, void *context, unsigned long nowMs);
+	bool 				remove(uint16_t sensornumber);
+	// the next reading is due one new period after the last one, or at once
+	// when that has passed. false when sensornumber has no channel
+	bool 				setPeriod(uint16_t sensornumber, uint32_t periodMs, unsigned long nowMs);
+
+	// reads the channels due by nowMs, returns how many were read
+	uint8_t 			run(unsigned long nowMs);
+
+	// since boot
+	uint32_t 			reads 			= 0;	// readings output
+	uint32_t 			skipped 		= 0;	// periods missed while run() wasn't called
+	unsigned long 		maxLateMs 		= 0;	// the latest a channel was read after it was due
+
+private:
+	struct Channel
+	{
+		DeviceIOSensorRead read;		// nullptr when unused
+		void *			context;
+		uint32_t 		periodMs;
+		unsigned long 	due;
+		uint16_t 		sensornumber;
+		uint8_t 		next;			// in the same slot
+	};
+
+	// into the slot of its due tick, never one run() is done with
+	void 				insert(uint8_t channel, unsigned long nowMs);
+	void 				unlink(uint8_t channel);
+
+	DeviceIOSchedulerOutput _output 	= nullptr;
+	void *				_context 		= nullptr;
+	Channel 			_channels[DEVICEIO_SENSOR_CHANNELS];
+	uint8_t 			_slots[DEVICEIO_SCHEDULER_SLOTS];	// first channel of each slot
+	uint8_t 			_slotOf[DEVICEIO_SENSOR_CHANNELS];
+	unsigned long 		_tick 			= 0;	// the oldest tick run() walks next
+	bool 				_started 		= false;
+};
+
+#endif
@@ -0,0 +1,123 @@
+// DeviceIOSensorPolicy.h
+// Per-sensor settings for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// A small fixed table keyed by sensor number. Sensors without an entry
+// use the defaults.
+//
+// A sensor with a deadband only stores a value that moved by more than
+// the absolute deadband and by more than the relative one (a fraction
+// of the last stored value) since the last stored value, or when the
+// last one is heartbeat milliseconds old. Zero turns each off, with all
+// three zero only repeats of the same value are dropped.
+
+#ifndef DeviceIOSensorPolicy_h
+#define DeviceIOSensorPolicy_h
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// number of sensors with their own settings
+#ifndef DEVICEIO_SENSOR_POLICY_COUNT
+	#define DEVICEIO_SENSOR_POLICY_COUNT	12
+#endif
+
+// decimals kept by the binary upload, the form upload always sent 2
+#define DEVICEIO_PRECISION_DEFAULT		2
+#define DEVICEIO_PRECISION_MAX			6
+#define DEVICEIO_PRECISION_RAW			7	// send the float as is
+
+struct sensorpolicy
+{
+	uint16_t 	sensornumber;
+	uint8_t 	decimals;
+	uint8_t 	deadband;		// 1 when the values below apply
+	float 		absolute;
+	float 		relative;
+	uint32_t 	heartbeatMs;
+	uint8_t 	stored;			// last and lastMs are set
+	float 		last;			// last value stored
+	uint32_t 	lastMs;
+	uint32_t 	suppressed;		// values dropped since boot
+};
+
+class DeviceIOSensorPolicies
+{
+public:
+	DeviceIOSensorPolicies() : _count(0) {}
+
+	// returns the entry for sensornumber, adding it with the defaults when
+	// missing. nullptr when the table is full
+	struct sensorpolicy *get(uint16_t sensornumber)
+	{
+		struct sensorpolicy *policy = (struct sensorpolicy *)find(sensornumber);
+		if (policy != nullptr)
+			return policy;
+		if (_count == DEVICEIO_SENSOR_POLICY_COUNT)
+			return nullptr;
+		policy = &_items[_count++];
+		memset(policy, 0, sizeof(struct sensorpolicy));
+		policy->sensornumber = sensornumber;
+		policy->decimals = DEVICEIO_PRECISION_DEFAULT;
+		return policy;
+	}
+
+	const struct sensorpolicy *find(uint16_t sensornumber) const
+	{
+		for (uint8_t i = 0; i < _count; i++)
+		{
+			if (_items[i].sensornumber == sensornumber)
+				return &_items[i];
+		}
+		return nullptr;
+	}
+
+	uint8_t decimals(uint16_t sensornumber) const
+	{
+		const struct sensorpolicy *policy = find(sensornumber);
+		return (policy != nullptr) ? policy->decimals : DEVICEIO_PRECISION_DEFAULT;
+	}
+
+	// true when value is inside sensornumber's deadband, it is counted and
+	// not stored. otherwise it becomes the value the next ones are compared to
+	bool suppress(uint16_t sensornumber, float value, uint32_t nowMs)
+	{
+		struct sensorpolicy *policy = (struct sensorpolicy *)find(sensornumber);
+		if ((policy == nullptr) || (policy->deadband == 0))
+			return false;
+
+		if ((policy->stored == 1) && ((policy->heartbeatMs == 0) || (nowMs - policy->lastMs < policy->heartbeatMs)))
+		{
+			float change = fabsf(value - policy->last);
+			if ((change <= policy->absolute) || (change <= policy->relative * fabsf(policy->last)))
+			{
+				policy->suppressed++;
+				return true;
+			}
+		}
+		policy->stored = 1;
+		policy->last = value;
+		policy->lastMs = nowMs;
+		return false;
+	}
+
+	// for one sensor, or all with sensornumber -1
+	uint32_t suppressed(int32_t sensornumber) const
+	{
+		uint32_t total = 0;
+		for (uint8_t i = 0; i < _count; i++)
+		{
+			if ((sensornumber < 0) || (_items[i].sensornumber == sensornumber))
+				total += _items[i].suppressed;
+		}
+		return total;
+	}
+
+private:
+	struct sensorpolicy _items[DEVICEIO_SENSOR_POLICY_COUNT];
+	uint8_t 		_count;
+};
+
+#endif
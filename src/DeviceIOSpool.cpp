@@ -0,0 +1,258 @@
+// DeviceIOSpool.cpp
+// Flash-backed record log for DeviceIO telemetry
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOSpool.h"
+
+// first, last and start segment
+#define DEVICEIO_SPOOL_INDEX_KEY 	"spool"
+// "first last start", written by builds before the store
+#define DEVICEIO_SPOOL_INDEX 		"/spool.idx"
+#define DEVICEIO_SPOOL_NAME_SIZE 	24
+
+bool DeviceIOSpool::begin(eSPIFFS &fileSystem, DeviceIOStore *store)
+{
+uint32_t index[3];
+
+	_fs = nullptr;
+	if (DEVICEIO_SPOOL_SEGMENTS == 0)
+		return false;
+
+	_fs = &fileSystem;
+	_store = store;
+	_first = 0;
+	_last = 0;
+	_start = 0;
+
+	if (_store->getBytes(DEVICEIO_SPOOL_INDEX_KEY, index, sizeof(index)))
+	{
+		if ((index[1] >= index[0]) && (index[1] - index[0] < DEVICEIO_SPOOL_SEGMENTS))
+		{
+			_first = index[0];
+			_last = index[1];
+			_start = index[2];
+		}
+	} else
+	{
+		// the index file of an older build, moved to the store
+		String saved;
+		if (_fs->openFromFile(DEVICEIO_SPOOL_INDEX, saved))
+		{
+			unsigned long first, last, start;
+			if ((sscanf(saved.c_str(), "%lu %lu %lu", &first, &last, &start) == 3) && (last >= first) && \
+				(last - first < DEVICEIO_SPOOL_SEGMENTS))
+			{
+				_first = first;
+				_last = last;
+				_start = start;
+			}
+			if (saveIndex())
+				_fs->removeFile(DEVICEIO_SPOOL_INDEX);
+		}
+	}
+
+	// appends continue after the last good record, unless a reset left
+	// part of one behind
+	char name[DEVICEIO_SPOOL_NAME_SIZE];
+	segmentName(_last, name);
+	_headSize = scanSegment(_last);
+	if ((int)_headSize < _fs->getFileSize(name))
+	{
+		corrupt++;
+		startSegment();
+	}
+
+	if ((_first == _last) && (_start > _headSize))
+		_start = _headSize;
+	rewind();
+	return true;
+}
+
+bool DeviceIOSpool::append(const uint8_t *data, uint16_t len)
+{
+uint8_t record[DEVICEIO_SPOOL_HEADER_SIZE + DEVICEIO_SPOOL_RECORD_MAX];
+char name[DEVICEIO_SPOOL_NAME_SIZE];
+
+	if ((_fs == nullptr) || (len == 0) || (len > DEVICEIO_SPOOL_RECORD_MAX))
+		return false;
+
+	if (_headSize + DEVICEIO_SPOOL_HEADER_SIZE + len > DEVICEIO_SPOOL_SEGMENT_SIZE)
+		startSegment();
+
+	record[0] = (uint8_t)len;
+	record[1] = (uint8_t)(len >> 8);
+	memcpy(record + DEVICEIO_SPOOL_HEADER_SIZE, data, len);
+	uint32_t crc = DeviceIOCRC32::update(DeviceIOCRC32::update(0, record, 2), data, len);
+	record[2] = (uint8_t)crc;
+	record[3] = (uint8_t)(crc >> 8);
+	record[4] = (uint8_t)(crc >> 16);
+	record[5] = (uint8_t)(crc >> 24);
+
+	segmentName(_last, name);
+	if (!_fs->appendFile(name, record, DEVICEIO_SPOOL_HEADER_SIZE + len))
+	{
+		// part of the record may be on flash, the next one goes to a new segment
+		_headSize = DEVICEIO_SPOOL_SEGMENT_SIZE;
+		return false;
+	}
+
+	_headSize += DEVICEIO_SPOOL_HEADER_SIZE + len;
+	appends++;
+	return true;
+}
+
+int32_t DeviceIOSpool::read(uint8_t *data, uint16_t max)
+{
+int32_t len;
+
+	if (_fs == nullptr)
+		return 0;
+
+	for (;;)
+	{
+		if ((_readSegment == _last) && (_readOffset >= _headSize))
+			return 0;
+
+		len = readRecord(_readSegment, _readOffset, data, max);
+		if (len == -2)
+			return -1;
+		if (len > 0)
+		{
+			_readOffset += DEVICEIO_SPOOL_HEADER_SIZE + len;
+			return len;
+		}
+
+		// the rest of a damaged segment is lost
+		if (len < 0)
+			corrupt++;
+		if (_readSegment == _last)
+		{
+			_readOffset = _headSize;
+			return 0;
+		}
+		_readSegment++;
+		_readOffset = 0;
+	}
+}
+
+void DeviceIOSpool::commit(void)
+{
+char name[DEVICEIO_SPOOL_NAME_SIZE];
+
+	if ((_fs == nullptr) || ((_readSegment == _first) && (_readOffset == _start)))
+		return;
+
+	// segments go before the index is saved, a reset in between can
+	// only send the records read from the last segment again
+	for (uint32_t segment = _first; segment < _readSegment; segment++)
+	{
+		segmentName(segment, name);
+		_fs->removeFile(name);
+	}
+	_first = _readSegment;
+	_start = _readOffset;
+
+	// everything was read, the newest segment starts over
+	if ((_first == _last) && (_start >= _headSize))
+	{
+		segmentName(_last, name);
+		_fs->removeFile(name);
+		_headSize = 0;
+		_start = 0;
+		_readOffset = 0;
+	}
+	saveIndex();
+}
+
+void DeviceIOSpool::rewind(void)
+{
+	_readSegment = _first;
+	_readOffset = _start;
+}
+
+void DeviceIOSpool::segmentName(uint32_t segment, char *name)
+{
+	sprintf(name, "/spool%lu.seg", (unsigned long)segment);
+}
+
+bool DeviceIOSpool::saveIndex(void)
+{
+uint32_t index[3] = {_first, _last, _start};
+
+	_store->setBytes(DEVICEIO_SPOOL_INDEX_KEY, index, sizeof(index));
+	return _store->commit();
+}
+
+// closes the newest segment, the oldest one goes when there are too many
+void DeviceIOSpool::startSegment(void)
+{
+char name[DEVICEIO_SPOOL_NAME_SIZE];
+uint32_t evictFrom = _first;
+
+	// an empty segment is reused, there may be a torn record in it
+	if (_headSize == 0)
+	{
+		segmentName(_last, name);
+		_fs->removeFile(name);
+		return;
+	}
+
+	_last++;
+	_headSize = 0;
+	if (_last - _first >= DEVICEIO_SPOOL_SEGMENTS)
+	{
+		_first = _last - DEVICEIO_SPOOL_SEGMENTS + 1;
+		_start = 0;
+		if (_readSegment < _first)
+			rewind();
+	}
+	saveIndex();
+
+	for (uint32_t segment = evictFrom; segment < _first; segment++)
+	{
+		segmentName(segment, name);
+		_fs->removeFile(name);
+		evictions++;
+	}
+	// left over when the index was lost
+	segmentName(_last, name);
+	_fs->removeFile(name);
+}
+
+uint32_t DeviceIOSpool::scanSegment(uint32_t segment)
+{
+uint8_t data[DEVICEIO_SPOOL_RECORD_MAX];
+uint32_t offset = 0;
+int32_t len;
+
+	while ((len = readRecord(segment, offset, data, sizeof(data))) > 0)
+		offset += DEVICEIO_SPOOL_HEADER_SIZE + len;
+	return offset;
+}
+
+int32_t DeviceIOSpool::readRecord(uint32_t segment, uint32_t offset, uint8_t *data, uint16_t max)
+{
+char name[DEVICEIO_SPOOL_NAME_SIZE];
+uint8_t header[DEVICEIO_SPOOL_HEADER_SIZE];
+
+	segmentName(segment, name);
+	size_t n = _fs->readFile(name, offset, header, sizeof(header));
+	if (n == 0)
+		return 0;
+	if (n < sizeof(header))
+		return -1;
+
+	uint16_t len = (uint16_t)header[0] | ((uint16_t)header[1] << 8);
+	uint32_t crc = (uint32_t)header[2] | ((uint32_t)header[3] << 8) | ((uint32_t)header[4] << 16) | ((uint32_t)header[5] << 24);
+	if ((len == 0) || (len > DEVICEIO_SPOOL_RECORD_MAX))
+		return -1;
+	if (len > max)
+		return -2;
+
+	if (_fs->readFile(name, offset + DEVICEIO_SPOOL_HEADER_SIZE, data, len) != len)
+		return -1;
+	if (DeviceIOCRC32::update(DeviceIOCRC32::update(0, header, 2), data, len) != crc)
+		return -1;
+	return len;
+}
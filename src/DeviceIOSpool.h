@@ -0,0 +1,96 @@
+// DeviceIOSpool.h
+// Flash-backed record log for DeviceIO telemetry
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// Records are appended to numbered segment files through eSPIFFS:
+//
+//   uint16  len         payload length, little endian
+//   uint32  crc         CRC-32 of len and the payload, little endian
+//   len bytes           payload
+//
+// An append opens the newest segment in append mode and writes the one
+// record, nothing already on flash is rewritten. A full segment starts
+// the next one, and when there are more than DEVICEIO_SPOOL_SEGMENTS
+// the oldest segment is deleted with everything it holds.
+//
+// Records are read back in order. read() moves a pending position,
+// commit() makes it the new start and deletes the segments behind it,
+// rewind() goes back to the start. The first and last segment number
+// and the start offset are one value of the DeviceIOStore, committed
+// on commit and when a segment is started or evicted, never per
+// append. A reset while it is written leaves the previous index.
+//
+// A record torn by a reset fails its CRC. begin() finds the end of the
+// last good record of the newest segment and starts a fresh segment
+// when there is garbage behind it, read() skips to the next segment.
+
+#ifndef DeviceIOSpool_h
+#define DeviceIOSpool_h
+
+#include <Arduino.h>
+#include "Effortless_SPIFFS.h"
+#include "DeviceIOCRC32.h"
+#include "DeviceIOStore.h"
+
+// segments kept on flash, 0 disables the spool
+#ifndef DEVICEIO_SPOOL_SEGMENTS
+	#define DEVICEIO_SPOOL_SEGMENTS		8
+#endif
+// a segment is closed when the next record would not fit
+#ifndef DEVICEIO_SPOOL_SEGMENT_SIZE
+	#define DEVICEIO_SPOOL_SEGMENT_SIZE	4096
+#endif
+#define DEVICEIO_SPOOL_RECORD_MAX		256		// payload bytes
+#define DEVICEIO_SPOOL_HEADER_SIZE		6
+
+class DeviceIOSpool
+{
+public:
+	DeviceIOSpool() {}
+
+	// loads the index from store, which begin() has read, and checks the
+	// newest segment, false when disabled
+	bool 				begin(eSPIFFS &fileSystem, DeviceIOStore *store);
+	bool 				ready(void) const 		{ return _fs != nullptr; }
+	// no records after the committed position
+	bool 				empty(void) const 		{ return (_first == _last) && (_start >= _headSize); }
+
+	// one record, at most DEVICEIO_SPOOL_RECORD_MAX bytes
+	bool 				append(const uint8_t *data, uint16_t len);
+
+	// the next record after the pending position, returns its length, 0 when
+	// there are no more and -1 when it is longer than max, nothing is read then
+	int32_t 			read(uint8_t *data, uint16_t max);
+	// the records read so far were delivered
+	void 				commit(void);
+	// read again from the committed position
+	void 				rewind(void);
+
+	// since boot
+	uint32_t 			appends 		= 0;
+	uint32_t 			evictions 		= 0;	// segments deleted unread
+	uint32_t 			corrupt 		= 0;	// bad records found, the rest of their segment is skipped
+
+private:
+	void 				segmentName(uint32_t segment, char *name);
+	// false when the store couldn't commit it
+	bool 				saveIndex(void);
+	void 				startSegment(void);
+	// length of the good records at the start of segment
+	uint32_t 			scanSegment(uint32_t segment);
+	// the record at offset into data, returns its length, 0 at the end of the
+	// segment, -1 when it is damaged and -2 when it is longer than max
+	int32_t 			readRecord(uint32_t segment, uint32_t offset, uint8_t *data, uint16_t max);
+
+	eSPIFFS *			_fs 			= nullptr;
+	DeviceIOStore *		_store 			= nullptr;
+	uint32_t 			_first 			= 0;	// oldest segment
+	uint32_t 			_last 			= 0;	// newest segment, appends go here
+	uint32_t 			_start 			= 0;	// committed read offset in _first
+	uint32_t 			_headSize 		= 0;	// bytes in _last
+	uint32_t 			_readSegment 	= 0;	// pending read position
+	uint32_t 			_readOffset 	= 0;
+};
+
+#endif
@@ -0,0 +1,61 @@
+// DeviceIOStats.h
+// Check-in performance counters for DeviceIO
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// DeviceIO::getStats() returns a copy of these. The check-in fields
+// describe the last check-in that ended, the others count since boot.
+// Times are in milliseconds, GET and POST latency runs from sending the
+// request to the last byte of the response, so it includes the server.
+// The free heap and the largest free block are taken when a check-in
+// starts and after it closed its connection; a largest block well below
+// the free heap means the heap is fragmented.
+
+#ifndef DeviceIOStats_h
+#define DeviceIOStats_h
+
+#include <stdint.h>
+
+// HTTPClient errors (HTTPC_ERROR_*) are -1 to -11
+#define DEVICEIO_STATS_HTTP_ERRORS 	12
+
+struct DeviceIOCheckInStats
+{
+	uint8_t 	success;
+	uint32_t 	durationMs;
+	uint32_t 	ntpMs;				// waiting for the clock, 0 when it needed no sync
+	uint32_t 	dnsMs;				// resolving the server, 0 without a new connection
+	uint32_t 	tlsMs;				// TCP connect and TLS handshake, same
+	uint32_t 	getMs;				// the slowest GET
+	uint32_t 	postMs;				// the slowest POST
+	uint16_t 	requests;
+	uint16_t 	failedRequests;		// no response, or not 200/206
+	uint32_t 	otaBytesPerSecond;	// firmware download, 0 without one
+	uint32_t 	freeHeapBefore;
+	uint32_t 	freeHeapAfter;
+	uint32_t 	maxBlockBefore;
+	uint32_t 	maxBlockAfter;
+};
+
+struct DeviceIOStats
+{
+	DeviceIOCheckInStats last;
+
+	// since boot
+	uint32_t 	checkins;
+	uint32_t 	failures;
+	uint32_t 	requests;
+	uint32_t 	bytesSent;			// request and response bodies, firmware included
+	uint32_t 	bytesReceived;
+	uint32_t 	httpStatus[6];		// responses by code / 100, [0] for codes outside 100..599
+	uint32_t 	httpErrors[DEVICEIO_STATS_HTTP_ERRORS];	// no response, by -HTTPC_ERROR_*, [0] for others
+	uint32_t 	tlsHandshakes;
+	uint32_t 	tlsResumptions;
+	uint32_t 	ntpSyncs;
+	uint32_t 	ntpTimeouts;
+	uint32_t 	droppedSamples;		// getDroppedSampleCount()
+	uint32_t 	droppedPushes;		// getDroppedPushCount(), counted in droppedSamples too
+	uint32_t 	suppressedSamples;	// getSuppressedSampleCount()
+};
+
+#endif
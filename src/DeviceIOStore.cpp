@@ -0,0 +1,302 @@
+// DeviceIOStore.cpp
+// Log-structured key/value store for DeviceIO persistent state
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOStore.h"
+
+#define DEVICEIO_STORE_FILE 		"/deviceio.kv"
+#define DEVICEIO_STORE_COMPACTED 	"/deviceio.kv.new"
+
+bool DeviceIOStore::begin(eSPIFFS &fileSystem)
+{
+uint8_t *data;
+size_t n;
+
+	_fs = &fileSystem;
+	memset(_entries, 0, sizeof(_entries));
+	_size = 0;
+	_rewrite = false;
+
+	data = (uint8_t *)malloc(DEVICEIO_STORE_FILE_SIZE);
+	if (data == nullptr)
+		return false;
+
+	n = _fs->readFile(DEVICEIO_STORE_FILE, 0, data, DEVICEIO_STORE_FILE_SIZE);
+	if (n == 0)
+	{
+		// a reset during compact() after the old file was removed
+		n = _fs->readFile(DEVICEIO_STORE_COMPACTED, 0, data, DEVICEIO_STORE_FILE_SIZE);
+		if ((n > 0) && !_fs->renameFile(DEVICEIO_STORE_COMPACTED, DEVICEIO_STORE_FILE))
+			_rewrite = true;
+	}
+
+	_size = replay(data, n);
+	if (_size < n)
+	{
+		corrupt++;
+		_rewrite = true;
+	}
+	free(data);
+	return _size > 0;
+}
+
+bool DeviceIOStore::getInt(const char *key, int32_t &value) const
+{
+const Entry *entry = find(key);
+
+	if ((entry == nullptr) || (entry->type != DEVICEIO_STORE_INT))
+		return false;
+	value = (int32_t)((uint32_t)entry->value[0] | ((uint32_t)entry->value[1] << 8) | \
+					  ((uint32_t)entry->value[2] << 16) | ((uint32_t)entry->value[3] << 24));
+	return true;
+}
+
+bool DeviceIOStore::getString(const char *key, String &value) const
+{
+const Entry *entry = find(key);
+char text[DEVICEIO_STORE_VALUE_SIZE + 1];
+
+	if ((entry == nullptr) || (entry->type != DEVICEIO_STORE_STRING))
+		return false;
+	memcpy(text, entry->value, entry->len);
+	text[entry->len] = 0;
+	value = text;
+	return true;
+}
+
+bool DeviceIOStore::getBytes(const char *key, void *value, uint8_t len) const
+{
+const Entry *entry = find(key);
+
+	if ((entry == nullptr) || (entry->type != DEVICEIO_STORE_BYTES) || (entry->len != len))
+		return false;
+	memcpy(value, entry->value, len);
+	return true;
+}
+
+bool DeviceIOStore::setInt(const char *key, int32_t value)
+{
+uint8_t bytes[4];
+
+	bytes[0] = (uint8_t)value;
+	bytes[1] = (uint8_t)((uint32_t)value >> 8);
+	bytes[2] = (uint8_t)((uint32_t)value >> 16);
+	bytes[3] = (uint8_t)((uint32_t)value >> 24);
+	return set(key, DEVICEIO_STORE_INT, bytes, sizeof(bytes));
+}
+
+bool DeviceIOStore::setString(const char *key, const char *value)
+{
+size_t len = strlen(value);
+
+	if (len > DEVICEIO_STORE_VALUE_SIZE)
+		return false;
+	return set(key, DEVICEIO_STORE_STRING, (const uint8_t *)value, (uint8_t)len);
+}
+
+bool DeviceIOStore::setBytes(const char *key, const void *value, uint8_t len)
+{
+	if (len > DEVICEIO_STORE_VALUE_SIZE)
+		return false;
+	return set(key, DEVICEIO_STORE_BYTES, (const uint8_t *)value, len);
+}
+
+bool DeviceIOStore::remove(const char *key)
+{
+	if (find(key) == nullptr)
+		return true;
+	return set(key, DEVICEIO_STORE_DELETED, nullptr, 0);
+}
+
+bool DeviceIOStore::commit(void)
+{
+uint8_t record[DEVICEIO_STORE_RECORD_MAX];
+size_t len;
+
+	if (_fs == nullptr)
+		return false;
+
+	len = frame(record, false);
+	if (len == 0)
+		return true;
+
+	if (_rewrite || (_size + len > DEVICEIO_STORE_FILE_SIZE))
+		return compact(record);
+
+	if (!_fs->appendFile(DEVICEIO_STORE_FILE, record, len))
+	{
+		// part of the record may be on flash, the values stay dirty
+		_rewrite = true;
+		return false;
+	}
+	_size += len;
+	commits++;
+	committed();
+	return true;
+}
+
+const DeviceIOStore::Entry *DeviceIOStore::find(const char *key) const
+{
+	for (uint8_t i = 0; i < DEVICEIO_STORE_KEYS; i++)
+	{
+		if ((_entries[i].key[0] != 0) && (_entries[i].type != DEVICEIO_STORE_DELETED) && (strcmp(_entries[i].key, key) == 0))
+			return &_entries[i];
+	}
+	return nullptr;
+}
+
+bool DeviceIOStore::set(const char *key, uint8_t type, const uint8_t *value, uint8_t len)
+{
+Entry *entry = nullptr;
+size_t keyLen = strlen(key);
+
+	if ((keyLen == 0) || (keyLen >= DEVICEIO_STORE_KEY_SIZE))
+		return false;
+
+	// the key's entry, deleted or not, else a free one
+	for (uint8_t i = 0; i < DEVICEIO_STORE_KEYS; i++)
+	{
+		if (strcmp(_entries[i].key, key) == 0)
+		{
+			entry = &_entries[i];
+			break;
+		}
+		if ((entry == nullptr) && (_entries[i].key[0] == 0))
+			entry = &_entries[i];
+	}
+	if (entry == nullptr)
+		return false;
+
+	// unchanged values cost no flash
+	if ((entry->key[0] != 0) && (entry->type == type) && (entry->len == len) && \
+		((len == 0) || (memcmp(entry->value, value, len) == 0)))
+		return true;
+
+	strcpy(entry->key, key);
+	entry->type = type;
+	entry->len = len;
+	if (len > 0)
+		memcpy(entry->value, value, len);
+	entry->dirty = true;
+	return true;
+}
+
+size_t DeviceIOStore::replay(const uint8_t *data, size_t len)
+{
+size_t offset = 0;
+uint16_t payload;
+uint32_t crc;
+
+	while (offset + DEVICEIO_STORE_HEADER_SIZE <= len)
+	{
+		payload = (uint16_t)data[offset] | ((uint16_t)data[offset + 1] << 8);
+		crc = (uint32_t)data[offset + 2] | ((uint32_t)data[offset + 3] << 8) | \
+			  ((uint32_t)data[offset + 4] << 16) | ((uint32_t)data[offset + 5] << 24);
+		if ((payload == 0) || (offset + DEVICEIO_STORE_HEADER_SIZE + payload > len))
+			break;
+		if (DeviceIOCRC32::update(DeviceIOCRC32::update(0, data + offset, 2), data + offset + DEVICEIO_STORE_HEADER_SIZE, payload) != crc)
+			break;
+		apply(data + offset + DEVICEIO_STORE_HEADER_SIZE, payload);
+		offset += DEVICEIO_STORE_HEADER_SIZE + payload;
+	}
+	return offset;
+}
+
+void DeviceIOStore::apply(const uint8_t *payload, size_t len)
+{
+size_t offset = 0;
+char key[DEVICEIO_STORE_KEY_SIZE];
+uint8_t keyLen, type, valueLen;
+
+	while (offset < len)
+	{
+		keyLen = payload[offset++];
+		if ((keyLen == 0) || (keyLen >= DEVICEIO_STORE_KEY_SIZE) || (offset + keyLen + 2 > len))
+			break;
+		memcpy(key, payload + offset, keyLen);
+		key[keyLen] = 0;
+		offset += keyLen;
+		type = payload[offset++];
+		valueLen = payload[offset++];
+		if ((valueLen > DEVICEIO_STORE_VALUE_SIZE) || (offset + valueLen > len))
+			break;
+		set(key, type, payload + offset, valueLen);
+		offset += valueLen;
+	}
+	// values read back are on flash already
+	committed();
+}
+
+size_t DeviceIOStore::frame(uint8_t *record, bool all)
+{
+size_t len = DEVICEIO_STORE_HEADER_SIZE;
+size_t keyLen;
+uint16_t payload;
+uint32_t crc;
+
+	for (uint8_t i = 0; i < DEVICEIO_STORE_KEYS; i++)
+	{
+		const Entry &entry = _entries[i];
+		if ((entry.key[0] == 0) || !(all ? (entry.type != DEVICEIO_STORE_DELETED) : entry.dirty))
+			continue;
+		keyLen = strlen(entry.key);
+		record[len++] = (uint8_t)keyLen;
+		memcpy(record + len, entry.key, keyLen);
+		len += keyLen;
+		record[len++] = entry.type;
+		record[len++] = entry.len;
+		memcpy(record + len, entry.value, entry.len);
+		len += entry.len;
+	}
+	if (len == DEVICEIO_STORE_HEADER_SIZE)
+		return 0;
+
+	payload = (uint16_t)(len - DEVICEIO_STORE_HEADER_SIZE);
+	record[0] = (uint8_t)payload;
+	record[1] = (uint8_t)(payload >> 8);
+	crc = DeviceIOCRC32::update(DeviceIOCRC32::update(0, record, 2), record + DEVICEIO_STORE_HEADER_SIZE, payload);
+	record[2] = (uint8_t)crc;
+	record[3] = (uint8_t)(crc >> 8);
+	record[4] = (uint8_t)(crc >> 16);
+	record[5] = (uint8_t)(crc >> 24);
+	return len;
+}
+
+// all values to a new file as one record, then it replaces the log
+bool DeviceIOStore::compact(uint8_t *record)
+{
+size_t len = frame(record, true);
+
+	_fs->removeFile(DEVICEIO_STORE_COMPACTED);
+	if ((len > 0) && !_fs->appendFile(DEVICEIO_STORE_COMPACTED, record, len))
+	{
+		_fs->removeFile(DEVICEIO_STORE_COMPACTED);
+		return false;
+	}
+	// SPIFFS can't rename over a file, from here until the rename begin() reads the new one
+	_fs->removeFile(DEVICEIO_STORE_FILE);
+	if ((len > 0) && !_fs->renameFile(DEVICEIO_STORE_COMPACTED, DEVICEIO_STORE_FILE))
+	{
+		_rewrite = true;
+		return false;
+	}
+
+	_size = len;
+	_rewrite = false;
+	commits++;
+	compactions++;
+	committed();
+	return true;
+}
+
+// dirty values are on flash now, deleted ones free their entry
+void DeviceIOStore::committed(void)
+{
+	for (uint8_t i = 0; i < DEVICEIO_STORE_KEYS; i++)
+	{
+		_entries[i].dirty = false;
+		if (_entries[i].type == DEVICEIO_STORE_DELETED)
+			_entries[i].key[0] = 0;
+	}
+}
@@ -0,0 +1,115 @@
+// DeviceIOStore.h
+// Log-structured key/value store for DeviceIO persistent state
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// All values live in one file of CRC-framed records, framed as in
+// DeviceIOSpool:
+//
+//   uint16  len         payload length, little endian
+//   uint32  crc         CRC-32 of len and the payload, little endian
+//   len bytes           payload, one or more values:
+//     uint8   keyLen
+//     keyLen bytes      key
+//     uint8   type      DEVICEIO_STORE_INT, _STRING, _BYTES or _DELETED
+//     uint8   valueLen
+//     valueLen bytes    int32 little endian, the characters, or a small
+//                       struct as it is in RAM
+//
+// set*() and remove() change the values in RAM, commit() appends every
+// change since the last commit as one record. A record torn by a reset
+// fails its CRC and none of its values apply, so a commit is all or
+// nothing. Later records override earlier ones.
+//
+// begin() reads the whole file with one read and replays it. When the
+// next record doesn't fit in DEVICEIO_STORE_FILE_SIZE, or a torn record
+// is behind the last good one, commit() compacts instead: all values go
+// to a new file as one record, which replaces the old file. A reset in
+// between leaves either file complete, begin() finishes the swap.
+
+#ifndef DeviceIOStore_h
+#define DeviceIOStore_h
+
+#include <Arduino.h>
+#include "Effortless_SPIFFS.h"
+#include "DeviceIOCRC32.h"
+
+#ifndef DEVICEIO_STORE_KEYS
+	#define DEVICEIO_STORE_KEYS 		8
+#endif
+#ifndef DEVICEIO_STORE_VALUE_SIZE
+	#define DEVICEIO_STORE_VALUE_SIZE 	64		// longest string
+#endif
+// compacted when the log would grow past this
+#ifndef DEVICEIO_STORE_FILE_SIZE
+	#define DEVICEIO_STORE_FILE_SIZE 	1024
+#endif
+#define DEVICEIO_STORE_KEY_SIZE 		16		// with the terminating 0
+#define DEVICEIO_STORE_HEADER_SIZE 		6
+
+// value types
+#define DEVICEIO_STORE_DELETED 			0
+#define DEVICEIO_STORE_INT 				1
+#define DEVICEIO_STORE_STRING 			2
+#define DEVICEIO_STORE_BYTES 			3
+
+// a record with every value fits a compacted file
+#define DEVICEIO_STORE_RECORD_MAX 		(DEVICEIO_STORE_HEADER_SIZE + DEVICEIO_STORE_KEYS * (DEVICEIO_STORE_KEY_SIZE + 2 + DEVICEIO_STORE_VALUE_SIZE))
+
+class DeviceIOStore
+{
+public:
+	DeviceIOStore() {}
+
+	// loads the values, false when there were none
+	bool 				begin(eSPIFFS &fileSystem);
+
+	// false when key has no value of that type
+	bool 				getInt(const char *key, int32_t &value) const;
+	bool 				getString(const char *key, String &value) const;
+	// false as well when the value isn't len bytes
+	bool 				getBytes(const char *key, void *value, uint8_t len) const;
+
+	// kept until commit(), false when the key or value is too long or all
+	// DEVICEIO_STORE_KEYS keys are taken
+	bool 				setInt(const char *key, int32_t value);
+	bool 				setString(const char *key, const char *value);
+	bool 				setBytes(const char *key, const void *value, uint8_t len);
+	bool 				remove(const char *key);
+
+	// writes the changes as one record
+	bool 				commit(void);
+
+	// since boot
+	uint32_t 			commits 		= 0;
+	uint32_t 			compactions 	= 0;
+	uint32_t 			corrupt 		= 0;	// torn or damaged records found by begin()
+
+private:
+	struct Entry
+	{
+		char 			key[DEVICEIO_STORE_KEY_SIZE];	// empty when unused
+		uint8_t 		type;
+		uint8_t 		len;
+		bool 			dirty;		// changed since the last commit
+		uint8_t 		value[DEVICEIO_STORE_VALUE_SIZE];
+	};
+
+	const Entry *		find(const char *key) const;
+	bool 				set(const char *key, uint8_t type, const uint8_t *value, uint8_t len);
+	// replays the records in data, returns the length of the good ones
+	size_t 				replay(const uint8_t *data, size_t len);
+	void 				apply(const uint8_t *payload, size_t len);
+	// frames the dirty entries, or all of them, into record
+	size_t 				frame(uint8_t *record, bool all);
+	// record holds DEVICEIO_STORE_RECORD_MAX bytes
+	bool 				compact(uint8_t *record);
+	void 				committed(void);
+
+	eSPIFFS *			_fs 			= nullptr;
+	Entry 				_entries[DEVICEIO_STORE_KEYS] = {};
+	size_t 				_size 			= 0;		// bytes of good records in the file
+	bool 				_rewrite 		= false;	// garbage behind them, compact on the next commit
+};
+
+#endif
@@ -0,0 +1,227 @@
+// DeviceIOTuning.cpp
+// Settings the server sets with SETCMD, kept on flash
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOTuning.h"
+
+#define DEVICEIO_TUNING_FILE 		"/deviceio.tune"
+#define DEVICEIO_TUNING_NEW 		"/deviceio.tune.new"
+#define DEVICEIO_TUNING_HEADER_SIZE 6
+
+// the next number of a value, the comma after it is skipped
+static bool nextUnsigned(char *&p, uint32_t max, uint32_t &value)
+{
+char *end;
+unsigned long n;
+
+	if ((*p < '0') || (*p > '9'))
+		return false;
+	n = strtoul(p, &end, 10);
+	if (n > max)
+		return false;
+	value = (uint32_t)n;
+	p = end;
+	if (*p == ',')
+		p++;
+	return true;
+}
+
+static bool nextFloat(char *&p, float &value)
+{
+char *end;
+
+	// strtod takes nan and inf too, neither is a deadband
+	value = (float)strtod(p, &end);
+	if ((end == p) || !(value >= 0) || isinf(value))
+		return false;
+	p = end;
+	if (*p == ',')
+		p++;
+	return true;
+}
+
+bool DeviceIOTuning::begin(eSPIFFS &fileSystem)
+{
+uint8_t record[DEVICEIO_TUNING_HEADER_SIZE + sizeof(Settings)];
+size_t n;
+uint16_t len;
+uint32_t crc;
+
+	_fs = &fileSystem;
+	memset(&_settings, 0, sizeof(_settings));
+
+	n = _fs->readFile(DEVICEIO_TUNING_FILE, 0, record, sizeof(record));
+	if (n == 0)
+	{
+		// a reset in save() after the old file was removed
+		n = _fs->readFile(DEVICEIO_TUNING_NEW, 0, record, sizeof(record));
+		if (n > 0)
+			_fs->renameFile(DEVICEIO_TUNING_NEW, DEVICEIO_TUNING_FILE);
+	}
+	if (n != sizeof(record))
+		return false;
+
+	len = (uint16_t)(record[0] | (record[1] << 8));
+	crc = (uint32_t)record[2] | ((uint32_t)record[3] << 8) | ((uint32_t)record[4] << 16) | ((uint32_t)record[5] << 24);
+	if ((len != sizeof(Settings)) || (crc != DeviceIOCRC32::update(DeviceIOCRC32::update(0, record, 2), record + DEVICEIO_TUNING_HEADER_SIZE, len)))
+		return false;
+
+	memcpy(&_settings, record + DEVICEIO_TUNING_HEADER_SIZE, sizeof(Settings));
+	if (_settings.count > DEVICEIO_TUNING_SENSORS)
+	{
+		memset(&_settings, 0, sizeof(_settings));
+		return false;
+	}
+	return true;
+}
+
+const DeviceIOTunedSensor *DeviceIOTuning::find(uint16_t sensornumber) const
+{
+	for (uint8_t i = 0; i < _settings.count; i++)
+		if (_settings.sensors[i].sensornumber == sensornumber)
+			return &_settings.sensors[i];
+	return nullptr;
+}
+
+bool DeviceIOTuning::disabled(uint16_t sensornumber) const
+{
+const DeviceIOTunedSensor *tuned = find(sensornumber);
+
+	return (tuned != nullptr) && ((tuned->flags & DEVICEIO_TUNING_DISABLED) != 0);
+}
+
+DeviceIOTunedSensor *DeviceIOTuning::get(uint16_t sensornumber)
+{
+DeviceIOTunedSensor *tuned = (DeviceIOTunedSensor *)find(sensornumber);
+
+	if ((tuned != nullptr) || (_settings.count == DEVICEIO_TUNING_SENSORS))
+		return tuned;
+	tuned = &_settings.sensors[_settings.count++];
+	memset(tuned, 0, sizeof(DeviceIOTunedSensor));
+	tuned->sensornumber = sensornumber;
+	return tuned;
+}
+
+bool DeviceIOTuning::set(const char *name, char *value, int32_t &sensor)
+{
+char *p = value;
+uint32_t number, periodMs, heartbeat = 0;
+float absolute, relative = 0;
+DeviceIOTunedSensor *tuned;
+
+	sensor = -1;
+
+	if (strcmp(name, "reset") == 0)
+	{
+		if (*p != 0)
+			return false;
+		_settings.checkinMs = 0;
+		_settings.batch = 0;
+		_settings.count = 0;
+		return true;
+	}
+	if ((strcmp(name, "id") == 0) || (strcmp(name, "batch") == 0))
+	{
+		if (!nextUnsigned(p, 0xFFFF, number) || (*p != 0))
+			return false;
+		if (name[0] == 'i')
+			_settings.id = (uint16_t)number;
+		else
+			_settings.batch = (uint16_t)number;
+		return true;
+	}
+	if (strcmp(name, "interval") == 0)
+	{
+		if (!nextUnsigned(p, 0x7FFFFFFFUL / 1000, number) || (*p != 0))
+			return false;
+		_settings.checkinMs = number * 1000;
+		return true;
+	}
+
+	// the others are per sensor, the sensor number first
+	if (!nextUnsigned(p, 0xFFFF, number))
+		return false;
+	if (strcmp(name, "period") == 0)
+	{
+		if (!nextUnsigned(p, 0xFFFFFFFFUL, periodMs) || (periodMs == 0) || (*p != 0) || ((tuned = get(number)) == nullptr))
+			return false;
+		tuned->flags |= DEVICEIO_TUNING_PERIOD;
+		tuned->periodMs = periodMs;
+	} else if (strcmp(name, "deadband") == 0)
+	{
+		if (!nextFloat(p, absolute) || ((*p != 0) && !nextFloat(p, relative)) || ((*p != 0) && !nextUnsigned(p, 0xFFFFFFFFUL / 1000, heartbeat)) || \
+			(*p != 0) || ((tuned = get(number)) == nullptr))
+			return false;
+		tuned->flags |= DEVICEIO_TUNING_DEADBAND;
+		tuned->absolute = absolute;
+		tuned->relative = relative;
+		tuned->heartbeatMs = heartbeat * 1000;
+	} else if ((strcmp(name, "disable") == 0) || (strcmp(name, "enable") == 0))
+	{
+		if ((*p != 0) || ((tuned = get(number)) == nullptr))
+			return false;
+		if (name[0] == 'd')
+			tuned->flags |= DEVICEIO_TUNING_DISABLED;
+		else
+			tuned->flags &= ~DEVICEIO_TUNING_DISABLED;
+	} else
+		return false;
+
+	sensor = (int32_t)number;
+	return true;
+}
+
+bool DeviceIOTuning::commit(uint8_t applied, uint8_t rejected)
+{
+	_settings.applied = applied;
+	_settings.rejected = rejected;
+	_settings.pending = 1;
+	commits++;
+	return save();
+}
+
+bool DeviceIOTuning::acknowledgement(char *text, size_t size) const
+{
+	if (_settings.pending == 0)
+		return false;
+	snprintf(text, size, "%u,%u,%u", (unsigned int)_settings.id, (unsigned int)_settings.applied, (unsigned int)_settings.rejected);
+	return true;
+}
+
+void DeviceIOTuning::acknowledged(uint32_t commit)
+{
+	// a SETCMD in the same reply needs its own acknowledgement
+	if ((_settings.pending == 0) || (commit != commits))
+		return;
+	_settings.pending = 0;
+	save();
+}
+
+bool DeviceIOTuning::save(void)
+{
+uint8_t record[DEVICEIO_TUNING_HEADER_SIZE + sizeof(Settings)];
+uint32_t crc;
+
+	if (_fs == nullptr)
+		return false;
+
+	record[0] = (uint8_t)(sizeof(Settings) & 0xFF);
+	record[1] = (uint8_t)(sizeof(Settings) >> 8);
+	memcpy(record + DEVICEIO_TUNING_HEADER_SIZE, &_settings, sizeof(Settings));
+	crc = DeviceIOCRC32::update(DeviceIOCRC32::update(0, record, 2), record + DEVICEIO_TUNING_HEADER_SIZE, sizeof(Settings));
+	record[2] = (uint8_t)crc;
+	record[3] = (uint8_t)(crc >> 8);
+	record[4] = (uint8_t)(crc >> 16);
+	record[5] = (uint8_t)(crc >> 24);
+
+	_fs->removeFile(DEVICEIO_TUNING_NEW);
+	if (!_fs->appendFile(DEVICEIO_TUNING_NEW, record, sizeof(record)))
+	{
+		_fs->removeFile(DEVICEIO_TUNING_NEW);
+		return false;
+	}
+	// SPIFFS can't rename over a file, from here until the rename begin() reads the new one
+	_fs->removeFile(DEVICEIO_TUNING_FILE);
+	return _fs->renameFile(DEVICEIO_TUNING_NEW, DEVICEIO_TUNING_FILE);
+}
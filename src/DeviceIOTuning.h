@@ -0,0 +1,108 @@
+// DeviceIOTuning.h
+// Settings the server sets with SETCMD, kept on flash
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// The arguments of a SETCMD directive are settings, a name and a value
+// in parentheses, several numbers separated by commas:
+//
+//   SETCMD id(17),interval(3600),batch(20),period(263,60000),disable(5)
+//
+//   id(n)                       the server's number for this SETCMD
+//   interval(seconds)           check-in interval, 0 for the sketch's
+//   batch(samples)              most samples per upload request, 0 for no limit
+//   period(sensor,ms)           reading period of the sensor's channel
+//   deadband(sensor,absolute,relative,heartbeat seconds)
+//                               as setSensorDeadband(), the last two may be left out
+//   disable(sensor)             the sensor's samples are dropped
+//   enable(sensor)              and stored again
+//   reset                       forgets every setting
+//
+// The settings override what the sketch set. Each SETCMD is written to
+// flash as one CRC-checked record in a new file that then replaces the
+// old one, so a reset leaves the old settings or the new ones. The
+// number of settings that applied and that didn't go back to the server
+// with the id on the next upload. A build with another
+// DEVICEIO_TUNING_SENSORS starts without settings.
+
+#ifndef DeviceIOTuning_h
+#define DeviceIOTuning_h
+
+#include <Arduino.h>
+#include "Effortless_SPIFFS.h"
+#include "DeviceIOCRC32.h"
+
+// sensors with their own settings
+#ifndef DEVICEIO_TUNING_SENSORS
+	#define DEVICEIO_TUNING_SENSORS 	8
+#endif
+
+// DeviceIOTunedSensor flags, the settings it has
+#define DEVICEIO_TUNING_PERIOD 			0x01
+#define DEVICEIO_TUNING_DEADBAND 		0x02
+#define DEVICEIO_TUNING_DISABLED 		0x04
+
+struct DeviceIOTunedSensor
+{
+	uint16_t 	sensornumber;
+	uint8_t 	flags;
+	uint8_t 	unused;
+	uint32_t 	periodMs;
+	float 		absolute;
+	float 		relative;
+	uint32_t 	heartbeatMs;
+};
+
+class DeviceIOTuning
+{
+public:
+	DeviceIOTuning() {}
+
+	// loads the settings, false when there were none
+	bool 				begin(eSPIFFS &fileSystem);
+
+	// one setting of a SETCMD, false when the name is unknown or the value is bad.
+	// sensor is the sensor number a per-sensor setting changed, -1 for the others
+	bool 				set(const char *name, char *value, int32_t &sensor);
+	// after the settings of one SETCMD, writes them and the counts for the acknowledgement
+	bool 				commit(uint8_t applied, uint8_t rejected);
+
+	// "id,applied,rejected" of the last SETCMD, false when it went up already
+	bool 				acknowledgement(char *text, size_t size) const;
+	// the upload with the acknowledgement of commit number commits went through
+	void 				acknowledged(uint32_t commit);
+
+	// 0 when the server didn't set them
+	uint32_t 			checkinIntervalMs(void) const 	{ return _settings.checkinMs; }
+	uint16_t 			batch(void) const 				{ return _settings.batch; }
+	const DeviceIOTunedSensor *find(uint16_t sensornumber) const;
+	bool 				disabled(uint16_t sensornumber) const;
+	uint8_t 			count(void) const 				{ return _settings.count; }
+	const DeviceIOTunedSensor &sensor(uint8_t index) const 	{ return _settings.sensors[index]; }
+
+	// since boot
+	uint32_t 			commits 		= 0;
+
+private:
+	// the file's record, after its length and CRC
+	struct Settings
+	{
+		uint32_t 		checkinMs;
+		uint16_t 		batch;
+		uint16_t 		id;
+		uint8_t 		applied;
+		uint8_t 		rejected;
+		uint8_t 		pending;		// not acknowledged yet
+		uint8_t 		count;
+		DeviceIOTunedSensor sensors[DEVICEIO_TUNING_SENSORS];
+	};
+
+	// the sensor's entry, added when missing. nullptr when the table is full
+	DeviceIOTunedSensor *get(uint16_t sensornumber);
+	bool 				save(void);
+
+	eSPIFFS *			_fs 			= nullptr;
+	Settings 			_settings 		= {};
+};
+
+#endif
@@ -0,0 +1,115 @@
+// DeviceIOWorker.cpp
+// Background thread for DeviceIO check-ins
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+
+#include "DeviceIOWorker.h"
+
+#if defined(ESP32)
+
+bool DeviceIOWorker::start(Entry entry, void *arg, uint32_t stackSize, uint8_t priority, int8_t core)
+{
+	if (_running.load())
+		return false;
+
+	_entry = entry;
+	_arg = arg;
+	_stopping.store(false);
+	_running.store(true);
+
+	#ifdef DEVICEIO_NATIVE
+		// the host scheduler picks the core and the stack
+		(void)stackSize;
+		(void)priority;
+		(void)core;
+		if (_thread.joinable())
+			_thread.join();
+		_thread = std::thread(run, this);
+	#else
+		BaseType_t created;
+		if (core < 0)
+			created = xTaskCreate(run, "DeviceIO", stackSize, this, priority, &_task);
+		else
+			created = xTaskCreatePinnedToCore(run, "DeviceIO", stackSize, this, priority, &_task, core);
+		if (created != pdPASS)
+		{
+			_task = nullptr;
+			_running.store(false);
+			return false;
+		}
+	#endif
+	return true;
+}
+
+void DeviceIOWorker::stop(void)
+{
+	#ifdef DEVICEIO_NATIVE
+		_stopping.store(true);
+		if (_thread.joinable())
+			_thread.join();
+	#else
+		if (!_running.load())
+			return;
+		_stopping.store(true);
+		// the task deletes itself once entry returned
+		while (_running.load())
+			delay(1);
+		_task = nullptr;
+	#endif
+}
+
+bool DeviceIOWorker::isCurrent(void) const
+{
+	#ifdef DEVICEIO_NATIVE
+		return _running.load() && (std::this_thread::get_id() == _thread.get_id());
+	#else
+		return _running.load() && (xTaskGetCurrentTaskHandle() == _task);
+	#endif
+}
+
+void DeviceIOWorker::sleep(unsigned long ms)
+{
+	#ifdef DEVICEIO_NATIVE
+		// real time, the virtual clock keeps running with it
+		if (ms == 0)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	#else
+		if (ms == 0)
+			taskYIELD();
+		else
+			vTaskDelay(pdMS_TO_TICKS(ms));
+	#endif
+}
+
+int8_t DeviceIOWorker::otherCore(void)
+{
+	#ifdef DEVICEIO_NATIVE
+		return 0;
+	#else
+		return (int8_t)(xPortGetCoreID() ^ 1);
+	#endif
+}
+
+void DeviceIOWorker::run(void *worker)
+{
+	DeviceIOWorker *self = (DeviceIOWorker *)worker;
+
+	#ifdef DEVICEIO_NATIVE
+		// ESP.restart() throws on the host, a restart ends the thread
+		try
+		{
+			self->_entry(self->_arg);
+		} catch (...)
+		{
+		}
+		self->_running.store(false);
+	#else
+		self->_entry(self->_arg);
+		self->_running.store(false);
+		vTaskDelete(NULL);
+	#endif
+}
+
+#endif
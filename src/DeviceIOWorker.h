@@ -0,0 +1,77 @@
+// DeviceIOWorker.h
+// Background thread for DeviceIO check-ins
+//
+// (c) GoodPrototyping 2020-21, All Rights Reserved
+//
+// A FreeRTOS task on the ESP32 and a std::thread in the host build.
+// The ESP8266 has no second core and runs sketches in a single task,
+// there DEVICEIO_BACKGROUND is 0 and check-ins stay in loop(). An ESP32
+// build can leave the task out with -D DEVICEIO_BACKGROUND=0.
+
+#ifndef DeviceIOWorker_h
+#define DeviceIOWorker_h
+
+#include <Arduino.h>
+
+#ifndef DEVICEIO_BACKGROUND
+	#if defined(ESP32)
+		#define DEVICEIO_BACKGROUND 1
+	#else
+		#define DEVICEIO_BACKGROUND 0
+	#endif
+#endif
+
+// the ESP32 firmware download flashes on a task of its own either way
+#if defined(ESP32)
+
+#include <atomic>
+
+#ifdef DEVICEIO_NATIVE
+	#include <thread>
+#else
+	#include <freertos/FreeRTOS.h>
+	#include <freertos/task.h>
+#endif
+
+class DeviceIOWorker
+{
+public:
+	typedef void (*Entry)(void *arg);
+
+	DeviceIOWorker() : _running(false), _stopping(false) {}
+	~DeviceIOWorker() { stop(); }
+
+	// runs entry(arg) on a new thread, core -1 lets the scheduler choose
+	bool 				start(Entry entry, void *arg, uint32_t stackSize, uint8_t priority, int8_t core);
+	// asks entry to return and waits for it
+	void 				stop(void);
+
+	bool 				running(void) const { return _running.load(); }
+	// entry should return when this turns true
+	bool 				stopping(void) const { return _stopping.load(); }
+	// true on the worker thread itself
+	bool 				isCurrent(void) const;
+
+	// gives the CPU away for ms, 0 just yields
+	static void 		sleep(unsigned long ms);
+	// the core the caller doesn't run on
+	static int8_t 		otherCore(void);
+
+private:
+	static void 		run(void *worker);
+
+	Entry 				_entry 	= nullptr;
+	void *				_arg 	= nullptr;
+	std::atomic<bool> 	_running;
+	std::atomic<bool> 	_stopping;
+
+	#ifdef DEVICEIO_NATIVE
+		std::thread 	_thread;
+	#else
+		TaskHandle_t 	_task 	= nullptr;
+	#endif
+};
+
+#endif
+
+#endif
@@ -37,6 +37,17 @@
 #define Effortless_SPIFFS_PRECISION 15
 #endif
 
+// Read cache of small files, used while mounted, 0 entries disables it
+#ifndef Effortless_SPIFFS_CACHE_ENTRIES
+#define Effortless_SPIFFS_CACHE_ENTRIES 4
+#endif
+
+#ifndef Effortless_SPIFFS_CACHE_FILE_SIZE
+#define Effortless_SPIFFS_CACHE_FILE_SIZE 64
+#endif
+
+#define Effortless_SPIFFS_CACHE_NAME_SIZE 32  // SPIFFS names are at most 31 characters
+
 // Effortless SPIFFS Debug Macros
 #define ESPIFFS_DEBUG(x) \
   if (printer) printer->print(x)
@@ -67,6 +78,36 @@ class eSPIFFS {
   eSPIFFS(Print* _debug = nullptr) : printer(_debug) {}
   ~eSPIFFS() {}
 
+ public:  // mounted-handle mode
+  // Checks the flash config and starts the file system once, after that the
+  // access methods skip both and keep small files in a RAM cache. The cache
+  // assumes this instance is the only one writing the files it has cached
+  virtual inline bool mount() {
+    clearCache();
+    mounted = checkFlashConfig();
+    return mounted;
+  }
+  virtual inline void unmount() {
+    mounted = false;
+    clearCache();
+  }
+  bool isMounted() const {
+    return mounted;
+  }
+  void clearCache() {
+    for (int i = 0; i < Effortless_SPIFFS_CACHE_ENTRIES; i++) {
+      cache[i].name[0] = 0;
+    }
+    cacheNext = 0;
+  }
+  // Calls answered from the cache and calls that went to the file system
+  unsigned long getCacheHits() const {
+    return cacheHits;
+  }
+  unsigned long getCacheMisses() const {
+    return cacheMisses;
+  }
+
  public:  // spiffs access methods
   virtual inline bool checkFlashConfig() {
 #if defined(ESP8266)
@@ -112,22 +153,36 @@ class eSPIFFS {
     return flashSizeCorrect;
   }
   virtual inline int getFileSize(const char* _filename) {
+    // A cached file costs no file system calls
+    CacheEntry* entry = findCached(_filename);
+    if (entry) {
+      return (entry->size > 0) ? entry->size : 0;
+    }
     // Check if the flash config is set correctly
-    if (checkFlashConfig()) {
+    if (mounted || checkFlashConfig()) {
       // Check if the spiffs starts correctly
-      if (EFFORTLESS_SPIFFS_TYPE.begin()) {
+      if (mounted || EFFORTLESS_SPIFFS_TYPE.begin()) {
         // Check if the file exists
         if (EFFORTLESS_SPIFFS_TYPE.exists(_filename)) {
           // Open the dir and check if it is a file
           File currentFile = EFFORTLESS_SPIFFS_TYPE.open(_filename, "r");
           if (currentFile) {
+            // A small file is read now, openFile() then doesn't open it again
+            size_t fileSize = currentFile.size();
+            if (mounted && fileSize <= Effortless_SPIFFS_CACHE_FILE_SIZE) {
+              char contents[Effortless_SPIFFS_CACHE_FILE_SIZE];
+              if (currentFile.readBytes(contents, fileSize) == fileSize) {
+                storeCached(_filename, contents, fileSize);
+              }
+            }
             // Return the file size
-            return currentFile.size();
+            return fileSize;
           } else {
             ESPIFFS_DEBUG("[getFileSize] - File did not open correctly: ");
             ESPIFFS_DEBUGLN(_filename);
           }
         } else {
+          storeCached(_filename, nullptr, -1);
           ESPIFFS_DEBUG("[getFileSize] - File does not exist: ");
           ESPIFFS_DEBUGLN(_filename);
         }
@@ -138,18 +193,28 @@ class eSPIFFS {
     return 0;
   }
   virtual bool openFile(const char* _filename, char* _output, size_t _len = 0) {
+    // A cached file costs no file system calls
+    CacheEntry* entry = findCached(_filename);
+    if (entry) {
+      size_t numBytesToRead = (entry->size > 0) ? entry->size : 0;
+      if (_len > 0 && _len <= numBytesToRead) numBytesToRead = _len;
+      memcpy(_output, entry->contents, numBytesToRead);
+      return numBytesToRead > 0;
+    }
     // Check if the flash config is set correctly
-    if (checkFlashConfig()) {  // 5us
+    if (mounted || checkFlashConfig()) {  // 5us
       // Check if the spiffs starts correctly
-      if (EFFORTLESS_SPIFFS_TYPE.begin()) {  // 5us
+      if (mounted || EFFORTLESS_SPIFFS_TYPE.begin()) {  // 5us
         // Check if the file exists
         if (EFFORTLESS_SPIFFS_TYPE.exists(_filename)) {  // 49us
           // Open it in read mode and check if its ok
           File currentFile = EFFORTLESS_SPIFFS_TYPE.open(_filename, "r");  // 115us
           if (currentFile) {
             // Read the desired number of bytes from the array to the output buffer
-            size_t numBytesToRead = (_len > 0 && _len <= currentFile.size()) ? _len : currentFile.size();
+            size_t fileSize = currentFile.size();
+            size_t numBytesToRead = (_len > 0 && _len <= fileSize) ? _len : fileSize;
             if (currentFile.readBytes(_output, numBytesToRead)) {  // readBytes - 300us, readBytesUntil - 465us - goes up with larger strings
+              if (numBytesToRead == fileSize) storeCached(_filename, _output, fileSize);
               return true;
             } else {
               ESPIFFS_DEBUG("[openFile] - Failed to read any bytes from file: ");
@@ -160,6 +225,7 @@ class eSPIFFS {
             ESPIFFS_DEBUGLN(_filename);
           }
         } else {
+          storeCached(_filename, nullptr, -1);
           ESPIFFS_DEBUG("[openFile] - File does not exist: ");
           ESPIFFS_DEBUGLN(_filename);
         }
@@ -171,15 +237,19 @@ class eSPIFFS {
   }
   virtual bool saveFile(const char* _filename, const char* _input) {  // Total time is about 6000us for small strings
     // Check if the flash config is set correctly
-    if (checkFlashConfig()) {  // 5us
+    if (mounted || checkFlashConfig()) {  // 5us
+      // The file changes whether or not the write works
+      dropCached(_filename);
       // Check if the spiffs starts correctly
-      if (EFFORTLESS_SPIFFS_TYPE.begin()) {  // 10us
+      if (mounted || EFFORTLESS_SPIFFS_TYPE.begin()) {  // 10us
         // Open the file in write mode and check if open
         File currentFile = EFFORTLESS_SPIFFS_TYPE.open(_filename, "w");
         if (currentFile) {
           // Print the input string to the file
           if (currentFile.print(_input)) {
             currentFile.close();
+            // Write through, the next read needs no file system calls
+            storeCached(_filename, _input, strlen(_input));
             return true;
           } else {
             ESPIFFS_DEBUG("[saveFile] - Failed to write any bytes to file: ");
@@ -195,6 +265,107 @@ class eSPIFFS {
     }
     return false;
   }
+  virtual bool appendFile(const char* _filename, const uint8_t* _input, size_t _len) {  // Only writes _len bytes, the file is never rewritten
+    // Check if the flash config is set correctly
+    if (mounted || checkFlashConfig()) {
+      dropCached(_filename);
+      // Check if the spiffs starts correctly
+      if (mounted || EFFORTLESS_SPIFFS_TYPE.begin()) {
+        // Open the file in append mode, it is created if missing
+        File currentFile = EFFORTLESS_SPIFFS_TYPE.open(_filename, "a");
+        if (currentFile) {
+          size_t written = currentFile.write(_input, _len);
+          currentFile.close();
+          if (written == _len) {
+            return true;
+          } else {
+            ESPIFFS_DEBUG("[appendFile] - Failed to write all bytes to file: ");
+            ESPIFFS_DEBUGLN(_filename);
+          }
+        } else {
+          ESPIFFS_DEBUG("[appendFile] - Failed to open file for appending");
+          ESPIFFS_DEBUGLN(_filename);
+        }
+      } else {
+        ESPIFFS_DEBUGLN("[appendFile] - Failed to start LittleFS");
+      }
+    }
+    return false;
+  }
+  virtual size_t readFile(const char* _filename, size_t _offset, uint8_t* _output, size_t _len) {  // Returns the number of bytes read
+    // A cached file costs no file system calls
+    CacheEntry* entry = findCached(_filename);
+    if (entry) {
+      if (entry->size <= 0 || _offset >= (size_t)entry->size) return 0;
+      if (_len > (size_t)entry->size - _offset) _len = (size_t)entry->size - _offset;
+      memcpy(_output, entry->contents + _offset, _len);
+      return _len;
+    }
+    // Check if the flash config is set correctly
+    if (mounted || checkFlashConfig()) {
+      // Check if the spiffs starts correctly
+      if (mounted || EFFORTLESS_SPIFFS_TYPE.begin()) {
+        // Open the file and move to the offset
+        File currentFile = EFFORTLESS_SPIFFS_TYPE.open(_filename, "r");
+        if (currentFile) {
+          if (currentFile.seek(_offset, SeekSet)) {
+            return currentFile.read(_output, _len);
+          } else {
+            ESPIFFS_DEBUG("[readFile] - Offset is past the end of file: ");
+            ESPIFFS_DEBUGLN(_filename);
+          }
+        } else {
+          ESPIFFS_DEBUG("[readFile] - File does not exist: ");
+          ESPIFFS_DEBUGLN(_filename);
+        }
+      } else {
+        ESPIFFS_DEBUGLN("[readFile] - Failed to start LittleFS");
+      }
+    }
+    return 0;
+  }
+  virtual bool removeFile(const char* _filename) {
+    // Nothing to do for a file known to be missing
+    CacheEntry* entry = findCached(_filename);
+    if (entry && entry->size < 0) {
+      return true;
+    }
+    // Check if the flash config is set correctly
+    if (mounted || checkFlashConfig()) {
+      dropCached(_filename);
+      // Check if the spiffs starts correctly
+      if (mounted || EFFORTLESS_SPIFFS_TYPE.begin()) {
+        if (EFFORTLESS_SPIFFS_TYPE.exists(_filename)) {
+          return EFFORTLESS_SPIFFS_TYPE.remove(_filename);
+        }
+        storeCached(_filename, nullptr, -1);
+        return true;
+      } else {
+        ESPIFFS_DEBUGLN("[removeFile] - Failed to start LittleFS");
+      }
+    }
+    return false;
+  }
+  virtual bool renameFile(const char* _from, const char* _to) {  // Replaces _to on LittleFS, fails when it exists on SPIFFS
+    // Check if the flash config is set correctly
+    if (mounted || checkFlashConfig()) {
+      dropCached(_from);
+      dropCached(_to);
+      // Check if the spiffs starts correctly
+      if (mounted || EFFORTLESS_SPIFFS_TYPE.begin()) {
+        if (EFFORTLESS_SPIFFS_TYPE.rename(_from, _to)) {
+          storeCached(_from, nullptr, -1);
+          return true;
+        } else {
+          ESPIFFS_DEBUG("[renameFile] - Failed to rename file: ");
+          ESPIFFS_DEBUGLN(_from);
+        }
+      } else {
+        ESPIFFS_DEBUGLN("[renameFile] - Failed to start LittleFS");
+      }
+    }
+    return false;
+  }
 
  public:
   void setDebugOutput(Print* _debug) {
@@ -419,9 +590,60 @@ class eSPIFFS {
   }
 #endif
 
+ private:  // read cache
+  struct CacheEntry {
+    char name[Effortless_SPIFFS_CACHE_NAME_SIZE];  // empty when unused
+    char contents[Effortless_SPIFFS_CACHE_FILE_SIZE];
+    int  size;  // -1 for a file that doesn't exist
+  };
+
+  CacheEntry* findCached(const char* _filename) {
+    if (mounted) {
+      for (int i = 0; i < Effortless_SPIFFS_CACHE_ENTRIES; i++) {
+        if (cache[i].name[0] && strcmp(cache[i].name, _filename) == 0) {
+          cacheHits++;
+          return &cache[i];
+        }
+      }
+      cacheMisses++;
+    }
+    return nullptr;
+  }
+  void storeCached(const char* _filename, const char* _contents, int _size) {
+    if (!mounted || Effortless_SPIFFS_CACHE_ENTRIES == 0 || _size > Effortless_SPIFFS_CACHE_FILE_SIZE ||
+        strlen(_filename) >= Effortless_SPIFFS_CACHE_NAME_SIZE) {
+      return;
+    }
+    // Replaces the entries in turn
+    CacheEntry* entry = &cache[cacheNext];
+    for (int i = 0; i < Effortless_SPIFFS_CACHE_ENTRIES; i++) {
+      if (strcmp(cache[i].name, _filename) == 0) {
+        entry = &cache[i];
+        break;
+      }
+    }
+    if (entry == &cache[cacheNext] && ++cacheNext == Effortless_SPIFFS_CACHE_ENTRIES) {
+      cacheNext = 0;
+    }
+    strcpy(entry->name, _filename);
+    entry->size = _size;
+    if (_size > 0) memcpy(entry->contents, _contents, _size);
+  }
+  void dropCached(const char* _filename) {
+    for (int i = 0; i < Effortless_SPIFFS_CACHE_ENTRIES; i++) {
+      if (strcmp(cache[i].name, _filename) == 0) cache[i].name[0] = 0;
+    }
+  }
+
  private:  // storage
   bool   flashSizeCorrect = false;
   Print* printer = nullptr;
+  bool   mounted = false;
+
+  CacheEntry    cache[Effortless_SPIFFS_CACHE_ENTRIES > 0 ? Effortless_SPIFFS_CACHE_ENTRIES : 1] = {};
+  int           cacheNext = 0;
+  unsigned long cacheHits = 0;
+  unsigned long cacheMisses = 0;
 };
 
 #endif